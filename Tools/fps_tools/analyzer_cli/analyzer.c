@@ -7,6 +7,7 @@
 #include "fps.h"
 #include "fps_register.h"
 #include "fps_control.h"
+#include "fps_cal_cache.h"
 #include "cli.h"
 #include "sleep.h"
 
@@ -49,7 +50,13 @@ open_sensor()
         printf("\n");
         printf("    Opening sensor...\n");
 
-        device_handle = fps_open_sensor(device_path);
+        if (strcmp(device_path, FPS_SIM_DEVICE_PATH) == 0) {
+            device_handle = fps_open_simulator(NULL);
+        } else if (strncmp(device_path, FPS_REPLAY_DEVICE_PREFIX, strlen(FPS_REPLAY_DEVICE_PREFIX)) == 0) {
+            device_handle = fps_open_replay(device_path + strlen(FPS_REPLAY_DEVICE_PREFIX), FPS_REPLAY_REALTIME);
+        } else {
+            device_handle = fps_open_sensor(device_path);
+        }
 
         if (device_handle == NULL) {
             printf("    Failed!\n");
@@ -380,6 +387,9 @@ access_registers_again :
             if (status < 0) {
                 return status;
             }
+
+            // The writes may have changed the mode
+            (void) fps_invalidate_sensor_mode(device_handle);
         }
 
         if (cmd_key == 'g') {
@@ -436,6 +446,136 @@ access_registers_again :
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Calibration Cache
+//
+
+int
+access_cal_cache()
+{
+    // The defaults of image and detect calibration
+    const int DEFAULT_FRAMES_TO_AVERAGE = 1;
+    const int DEFAULT_DETECT_WIDTH      = 8;
+    const int DEFAULT_DETECT_HEIGHT     = 8;
+    const int DEFAULT_FRAMES_TO_SUSPEND = 4;
+
+    int    status = 0;
+    char   cmd_line[MAX_STRING_LENGTH];
+    char   cmd_key;
+    char   *cmd_opt;
+    int    valid;
+    int    warm;
+    double cpu_us;
+    double sensor_us;
+
+    while (1) {
+
+        clear_console();
+
+        printf("\n");
+        printf("===================\n");
+        printf(" Calibration Cache \n");
+        printf("===================\n");
+        printf("\n");
+        printf("    's' <file> - Save the current calibration into <file>.               \n");
+        printf("                                                                         \n");
+        printf("    'l' <file> - Load the calibration from <file>.                       \n");
+        printf("                                                                         \n");
+        printf("    'v'        - Validate the current calibration by a quick capture.    \n");
+        printf("                                                                         \n");
+        printf("    'w' <file> - Warm start: load and validate <file>, or calibrate in   \n");
+        printf("                 full and save the result into <file>. Full calibration  \n");
+        printf("                 uses the image and detect calibration defaults.         \n");
+        printf("                                                                         \n");
+        printf("    'q'        - Back to main menu.                                      \n");
+        printf("\n");
+        printf("Pleae enter: ");
+
+        cmd_key = get_command(cmd_line, sizeof(cmd_line));
+
+        if (strchr("slvwq\n", cmd_key) == NULL) {
+            printf("    ERROR: Invalid command!\n");
+            sleep_ms(1000);
+            continue;
+        }
+
+        if (cmd_key == 'q') {
+            break;
+        }
+
+        cmd_opt = strtok(cmd_line, " ");
+        cmd_opt = strtok(NULL, " ");
+
+        if ((strchr("slw", cmd_key) != NULL) && (cmd_opt == NULL)) {
+            printf("    ERROR: No file specified!\n");
+            sleep_ms(1000);
+            continue;
+        }
+
+        printf("\n");
+        printf("Result:\n");
+        printf("\n");
+
+        if (cmd_key == 's') {
+            status = fps_save_calibration(device_handle, cmd_opt);
+            printf("    %s\n", ((status < 0) ? "Failed!" : "Saved."));
+        }
+
+        if (cmd_key == 'l') {
+            status = fps_load_calibration(device_handle, cmd_opt);
+            printf("    %s\n", ((status < 0) ? "Failed!" : "Loaded."));
+        }
+
+        if (cmd_key == 'v') {
+            status = fps_validate_calibration(device_handle, FPS_CAL_CACHE_VALIDATE_FRAMES, &valid);
+            if (status < 0) {
+                printf("    Failed!\n");
+            } else {
+                printf("    Calibration is %s.\n", ((valid == TRUE) ? "valid" : "NOT valid"));
+            }
+        }
+
+        if (cmd_key == 'w') {
+            printf("    Starting...\n");
+
+            cpu_us    = fps_get_cpu_time_us();
+            sensor_us = fps_get_clock_time_us(device_handle);
+
+            status = fps_warm_start_calibration(device_handle,
+                                                cmd_opt,
+                                                fps_get_sensor_width(device_handle),
+                                                fps_get_sensor_height(device_handle),
+                                                DEFAULT_FRAMES_TO_AVERAGE,
+                                                DEFAULT_DETECT_WIDTH,
+                                                DEFAULT_DETECT_HEIGHT,
+                                                DEFAULT_FRAMES_TO_SUSPEND,
+                                                &warm);
+
+            cpu_us    = fps_get_cpu_time_us() - cpu_us;
+            sensor_us = fps_get_clock_time_us(device_handle) - sensor_us;
+
+            if (status < 0) {
+                printf("    Failed!\n");
+            } else {
+                printf("    Successful!\n");
+                printf("\n");
+                printf("    Warm Start   = %s\n", ((warm == TRUE) ? "Yes, cache valid" : "No, calibrated in full"));
+                printf("\n");
+                printf("    CPU Time     = %0.3f ms\n", cpu_us / 1000);
+                printf("    Sensor Time  = %0.3f ms (%s clock)\n", sensor_us / 1000, device_handle->clock->name);
+            }
+        }
+
+        printf("\n");
+        printf("Press ENTER key to continue... ");
+        (void) getchar();
+    }
+
+    return status;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Power Down Mode Test
@@ -637,7 +777,8 @@ access_device_path()
         printf("=====================\n");
         printf("\n");
         printf("    's' <path> - Set device path.                                        \n");
-        printf("                   <path> = Device path.                                 \n");
+        printf("                   <path> = Device path, or \"%s\" for the simulator.     \n", FPS_SIM_DEVICE_PATH);
+        printf("                            \"%s<file>\" replays a recorded I/O trace.  \n", FPS_REPLAY_DEVICE_PREFIX);
         printf("                                                                         \n");
         printf("    'g'        - Get current specified device path.                      \n");
         printf("                                                                         \n");
@@ -686,6 +827,288 @@ access_device_path_show_options :
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Record I/O Trace
+//
+
+int
+record_io_trace()
+{
+    int  status = 0;
+    char cmd_line[MAX_STRING_LENGTH];
+    char cmd_key;
+    char *cmd_opt;
+
+    while (1) {
+
+        clear_console();
+
+        printf("\n");
+        printf("==================\n");
+        printf(" Record I/O Trace \n");
+        printf("==================\n");
+        printf("\n");
+        printf("    's' <file> - Start recording the sensor I/O into <file>.             \n");
+        printf("                                                                         \n");
+        printf("    'e'        - End recording.                                          \n");
+        printf("                                                                         \n");
+        printf("    'q'        - Back to main menu.                                      \n");
+        printf("\n");
+        printf("Pleae enter: ");
+
+        cmd_key = get_command(cmd_line, sizeof(cmd_line));
+
+        if (strchr("seq\n", cmd_key) == NULL) {
+            printf("    ERROR: Invalid command!\n");
+            sleep_ms(1000);
+            continue;
+        }
+
+        if (cmd_key == 'q') {
+            break;
+        }
+
+        printf("\n");
+        printf("Result:\n");
+        printf("\n");
+
+        if (cmd_key == 's') {
+            cmd_opt = strtok(cmd_line, " ");
+            cmd_opt = strtok(NULL, " ");
+
+            if (cmd_opt == NULL) {
+                printf("    ERROR: No file given!\n");
+            } else {
+                status = fps_start_recording(device_handle, cmd_opt);
+                printf("    %s\n", ((status < 0) ? "Failed!" : "Recording..."));
+            }
+        }
+
+        if (cmd_key == 'e') {
+            status = fps_stop_recording(device_handle);
+            printf("    %s\n", ((status < 0) ? "Failed!" : "Stopped."));
+        }
+
+        printf("\n");
+        printf("Press ENTER key to continue... ");
+        (void) getchar();
+    }
+
+    return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Performance Counters
+//
+
+static void
+show_performance_counters()
+{
+    static const char *api_names[FPS_API_COUNT] = {
+        "Register Read", "Register Write", "Raw Image", "Averaged Image",
+        "Mode Switch", "Scan Detect", "Wait Event"
+    };
+    static const char *mode_names[FPS_SENSOR_MODES] = {
+        "Image", "Detect", "Power-Down"
+    };
+
+    fps_stats_t     stats;
+    fps_api_stats_t *api;
+    int             i;
+    int             j;
+
+    (void) fps_get_stats(device_handle, &stats);
+
+    printf("    %-16s %8s %6s %12s %10s %10s %10s %12s\n",
+           "Call", "Count", "Errors", "Total ms", "Mean us", "p99 us", "Max us", "Bytes");
+
+    for (i = 0; i < FPS_API_COUNT; i++) {
+        api = &stats.api[i];
+        printf("    %-16s %8u %6u %12.3f %10.1f %10.1f %10.1f %12.0f\n",
+               api_names[i], api->calls, api->errors, api->total_us / 1000.0,
+               (api->calls > 0) ? (api->total_us / api->calls) : 0.0,
+               fps_get_stats_percentile(api, 99.0), api->max_us, api->bytes);
+    }
+
+    printf("\n");
+    printf("    Waits: %0u by event, %0u by timeout, %0u without timeout\n",
+           stats.waits_event, stats.waits_timeout, stats.waits_forever);
+
+    printf("\n");
+    printf("    Mode Transitions = %0u\n", stats.mode_transitions);
+
+    for (i = 0; i < FPS_SENSOR_MODES; i++) {
+    for (j = 0; j < FPS_SENSOR_MODES; j++) {
+        if (stats.mode_matrix[i][j] > 0) {
+            printf("        %s -> %s = %0u\n", mode_names[i], mode_names[j], stats.mode_matrix[i][j]);
+        }
+    }}
+}
+
+int
+access_perf_counters()
+{
+    int  status = 0;
+    char cmd_line[MAX_STRING_LENGTH];
+    char cmd_key;
+
+    while (1) {
+
+        clear_console();
+
+        printf("\n");
+        printf("======================\n");
+        printf(" Performance Counters \n");
+        printf("======================\n");
+        printf("\n");
+        printf("    'g'        - Get the counters since the last clear.                  \n");
+        printf("                                                                         \n");
+        printf("    'c'        - Clear the counters.                                     \n");
+        printf("                                                                         \n");
+        printf("    'q'        - Back to main menu.                                      \n");
+        printf("\n");
+        printf("Pleae enter: ");
+
+        cmd_key = get_command(cmd_line, sizeof(cmd_line));
+
+        if (strchr("gcq\n", cmd_key) == NULL) {
+            printf("    ERROR: Invalid command!\n");
+            sleep_ms(1000);
+            continue;
+        }
+
+        if (cmd_key == 'q') {
+            break;
+        }
+
+        printf("\n");
+        printf("Result:\n");
+        printf("\n");
+
+        if (cmd_key == 'g') {
+            show_performance_counters();
+        }
+
+        if (cmd_key == 'c') {
+            status = fps_reset_stats(device_handle);
+            printf("    %s\n", ((status < 0) ? "Failed!" : "Cleared."));
+        }
+
+        printf("\n");
+        printf("Press ENTER key to continue... ");
+        (void) getchar();
+    }
+
+    return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Event Log
+//
+
+#define EVENT_LOG_DRAIN_MS (100)
+
+int
+access_event_log()
+{
+    int          status = 0;
+    char         cmd_line[MAX_STRING_LENGTH];
+    char         cmd_key;
+    char         *cmd_opt;
+    int          records;
+    unsigned int logged;
+    unsigned int lost;
+
+    while (1) {
+
+        clear_console();
+
+        printf("\n");
+        printf("===========\n");
+        printf(" Event Log \n");
+        printf("===========\n");
+        printf("\n");
+        printf("    's' <records> [file] - Start logging detail events into a ring.      \n");
+        printf("                             <records> = ring size, e.g. 65536.          \n");
+        printf("                             [file]    = drained into every %0d ms.     \n", EVENT_LOG_DRAIN_MS);
+        printf("                                                                         \n");
+        printf("    'd' [file]           - Drain the ring into [file], or the console.   \n");
+        printf("                                                                         \n");
+        printf("    'g'                  - Get the logged and lost record counts.        \n");
+        printf("                                                                         \n");
+        printf("    'e'                  - End logging.                                  \n");
+        printf("                                                                         \n");
+        printf("    'q'                  - Back to main menu.                            \n");
+        printf("\n");
+        printf("Pleae enter: ");
+
+        cmd_key = get_command(cmd_line, sizeof(cmd_line));
+
+        if (strchr("sdgeq\n", cmd_key) == NULL) {
+            printf("    ERROR: Invalid command!\n");
+            sleep_ms(1000);
+            continue;
+        }
+
+        if (cmd_key == 'q') {
+            break;
+        }
+
+        printf("\n");
+        printf("Result:\n");
+        printf("\n");
+
+        cmd_opt = strtok(cmd_line, " ");
+        cmd_opt = strtok(NULL, " ");
+
+        if (cmd_key == 's') {
+            records = (cmd_opt != NULL) ? atoi(cmd_opt) : 0;
+            cmd_opt = strtok(NULL, " ");
+
+            status = fps_start_event_log(device_handle, records);
+            if ((status >= 0) && (cmd_opt != NULL)) {
+                status = fps_start_event_log_drain(device_handle, cmd_opt, EVENT_LOG_DRAIN_MS);
+                if (status < 0) {
+                    (void) fps_stop_event_log(device_handle);
+                }
+            }
+            printf("    %s\n", ((status < 0) ? "Failed!" : "Logging..."));
+        }
+
+        if (cmd_key == 'd') {
+            status = fps_drain_event_log(device_handle, cmd_opt);
+            printf("\n");
+            printf("    %s\n", ((status < 0) ? "Failed!" : "Drained."));
+        }
+
+        if (cmd_key == 'g') {
+            status = fps_get_event_log_counters(device_handle, &logged, &lost);
+            if (status < 0) {
+                printf("    Not logging.\n");
+            } else {
+                printf("    Logged = %0u, Lost = %0u\n", logged, lost);
+            }
+        }
+
+        if (cmd_key == 'e') {
+            status = fps_stop_event_log(device_handle);
+            printf("    %s\n", ((status < 0) ? "Failed!" : "Ended."));
+        }
+
+        printf("\n");
+        printf("Press ENTER key to continue... ");
+        (void) getchar();
+    }
+
+    return status;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Get Program Version
@@ -756,11 +1179,15 @@ menu[] = {
     {    'R',      "Access Registers",        access_registers,       1            },
     {    'k',      "Image Calibration",       image_calibration,      1            },
     {    'K',      "Detect Calibration",      detect_calibration,     1            },
+    {    'w',      "Calibration Cache",       access_cal_cache,       1            },
     {    't',      "Image Mode Test",         image_mode_test,        1            },
     {    'T',      "Detect Mode Test",        detect_mode_test,       1            },
     {    'p',      "Power-Down Mode Test",    power_down_mode_test,   1            },
     {    'l',      "Set Debug Level",         access_debug_level,     0            },
     {    'P',      "Set Device Path",         access_device_path,     0            },
+    {    'x',      "Record I/O Trace",        record_io_trace,        1            },
+    {    's',      "Performance Counters",    access_perf_counters,   1            },
+    {    'e',      "Event Log",               access_event_log,       1            },
     {    'v',      "Get Program Version",     get_program_version,    0            },
     {    'q',      "Quit",                    quit_program,           0            },
     // TODO: adding mordescription e functions here...
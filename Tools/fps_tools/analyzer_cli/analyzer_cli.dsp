@@ -131,23 +131,23 @@ SOURCE=.\inttypes.h
 # End Source File
 # Begin Source File
 
-SOURCE=.\sleep.c
+SOURCE=.\profile.c
 # End Source File
 # Begin Source File
 
-SOURCE=.\sleep.h
+SOURCE=.\profile.h
 # End Source File
 # Begin Source File
 
-SOURCE=.\stdint.h
+SOURCE=.\sleep.c
 # End Source File
 # Begin Source File
 
-SOURCE=.\stopwatch.c
+SOURCE=.\sleep.h
 # End Source File
 # Begin Source File
 
-SOURCE=.\stopwatch.h
+SOURCE=.\stdint.h
 # End Source File
 # End Group
 # End Target
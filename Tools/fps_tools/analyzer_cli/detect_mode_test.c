@@ -9,7 +9,7 @@
 #include "cli.h"
 #include "image.h"
 #include "sleep.h"
-#include "stopwatch.h"
+#include "profile.h"
 
 
 extern fps_handle_t *device_handle;
@@ -34,7 +34,9 @@ detect_calibration_callback(fps_handle_t   *handle,
         char       file_name[MAX_STRING_LENGTH];
         if (info->img_buf != NULL) {
             sprintf(file_name, "%s/detect_calibration_progress_%0d.bmp", image_folder, cnt++);
+            fps_begin_region("file_io");
             save_bmp(file_name, info->img_buf, FPS_SENSOR_SIZE);
+            fps_end_region("file_io");
         }
     }
 #endif
@@ -71,8 +73,8 @@ detect_calibration()
     int         det_row_begin;
     int         det_row_end;
     int         mode_old;
-    stopwatch_t stopwatch;
-    double      elapsed;
+    double      cpu_us;
+    double      sensor_us;
 
     sensor_width  = fps_get_sensor_width(device_handle);
     sensor_height = fps_get_sensor_height(device_handle);
@@ -178,7 +180,7 @@ detect_calibration()
 
 detect_calibration_show_options :
 
-            sleep_us = fps_calculate_suspend_time(det_size, frms_to_susp);
+            sleep_us = fps_get_suspend_time(device_handle, det_size, frms_to_susp, 1.0);
 
             printf("    Detect Window Size = %0d (%0dx%0d)\n", det_size, det_width, det_height);
             printf("    Suspend Interval   = %0d frames (%0.3f us)\n", frms_to_susp, sleep_us);
@@ -196,10 +198,13 @@ detect_calibration_show_options :
                 return status;
             }
 
-            stopwatch_start(&stopwatch);
+            (void) start_profile("detect_calibration");
+            cpu_us    = fps_get_cpu_time_us();
+            sensor_us = fps_get_clock_time_us(device_handle);
 
             status = fps_switch_sensor_mode(device_handle, FPS_DETECT_MODE, &mode_old);
             if (status < 0) {
+                (void) stop_profile("detect_calibration");
                 return status;
             }
 
@@ -208,8 +213,9 @@ detect_calibration_show_options :
                                             det_height,
                                             frms_to_susp);
 
-            stopwatch_stop(&stopwatch);
-            elapsed = stopwatch_get_elapsed(&stopwatch);
+            (void) stop_profile("detect_calibration");
+            cpu_us    = fps_get_cpu_time_us() - cpu_us;
+            sensor_us = fps_get_clock_time_us(device_handle) - sensor_us;
 
             stop_ctrl_c_monitor();
 
@@ -238,7 +244,10 @@ detect_calibration_show_options :
                 printf("    Detect Threshold       = 0x%02X\n", detect_th);
                 printf("    CDS Offset 1           = 0x%03X\n", cds_offset);
                 printf("\n");
-                printf("    Time Elapsed           = %0.3f ms\n", elapsed);
+                printf("    CPU Time               = %0.3f ms\n", cpu_us / 1000);
+                printf("    Sensor Time            = %0.3f ms (%s clock)\n", sensor_us / 1000, device_handle->clock->name);
+                printf("\n");
+                print_profile();
             }
 
             status = fps_switch_sensor_mode(device_handle, mode_old, NULL);
@@ -619,7 +628,7 @@ detect_mode_test_adjust_again :
 
 detect_mode_test_show_options :
 
-            sleep_us = fps_calculate_suspend_time(det_size, frms_to_susp);
+            sleep_us = fps_get_suspend_time(device_handle, det_size, frms_to_susp, 1.0);
 
             printf("    Row Begin            = %0d\n", row_begin);
             printf("    Row End              = %0d\n", row_end);
@@ -648,7 +657,7 @@ detect_mode_test_show_options :
                 return status;
             }
 
-            sleep_us = fps_calculate_suspend_time(det_size, frms_to_susp);
+            sleep_us = fps_get_suspend_time(device_handle, det_size, frms_to_susp, 1.0);
 
             detect_cnt = 0;
 
@@ -659,9 +668,12 @@ detect_mode_test_show_options :
                 return status;
             }
 
+            (void) fps_arm_detect_event(device_handle);
+
             while (is_ctrl_c_hit() == FALSE) {
                 status = fps_scan_detect_event(device_handle, sleep_us);
                 if (status < 0) {
+                    (void) fps_disarm_detect_event(device_handle);
                     return status;
                 }
 
@@ -682,6 +694,8 @@ detect_mode_test_show_options :
                 // If no finger-on detected...
             }
 
+            (void) fps_disarm_detect_event(device_handle);
+
             stop_ctrl_c_monitor();
 
             printf("    Done!\n");
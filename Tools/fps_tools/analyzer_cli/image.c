@@ -84,3 +84,28 @@ save_bmp(char    *path,
     return 0;
 #endif
 }
+
+int
+get_image_stats(uint8_t *img,
+                size_t  size,
+                double  *img_avg,
+                double  *img_var)
+{
+    double sum     = 0.0;
+    double sqr_sum = 0.0;
+    size_t i;
+
+    if (size == 0) {
+        return -1;
+    }
+
+    for (i = 0; i < size; i++) {
+        sum     += (double) img[i];
+        sqr_sum += (double) SQUARE(img[i]);
+    }
+
+    *img_avg = sum / size;
+    *img_var = sqr_sum / size - SQUARE(*img_avg);
+
+    return 0;
+}
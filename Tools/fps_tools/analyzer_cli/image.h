@@ -19,6 +19,11 @@ int save_bmp(char    *path,
              uint8_t *img,
              size_t  size);
 
+int get_image_stats(uint8_t *img,
+                    size_t  size,
+                    double  *img_avg,
+                    double  *img_var);
+
 
 #if defined(__cplusplus)
 }
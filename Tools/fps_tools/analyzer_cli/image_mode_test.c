@@ -6,16 +6,22 @@
 #include "fps.h"
 #include "fps_register.h"
 #include "fps_control.h"
+#include "fps_stream.h"
 #include "cli.h"
 #include "image.h"
 #include "sleep.h"
-#include "stopwatch.h"
+#include "profile.h"
 
 
 extern fps_handle_t *device_handle;
 extern char         image_folder[MAX_STRING_LENGTH];
 
 
+// Image file formats of the image mode test
+#define IMAGE_FORMAT_DATASET (0)
+#define IMAGE_FORMAT_BMP     (1)
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Image Calibration
@@ -34,7 +40,9 @@ image_calibration_callback(fps_handle_t   *handle,
         char       file_name[MAX_STRING_LENGTH];
         if (info->img_buf != NULL) {
             sprintf(file_name, "%s/image_calibration_progress_%0d.bmp", image_folder, cnt++);
+            fps_begin_region("file_io");
             save_bmp(file_name, info->img_buf, FPS_SENSOR_SIZE);
+            fps_end_region("file_io");
         }
     }
 #endif
@@ -63,8 +71,8 @@ image_calibration()
     int         mode_old;
     int         cds_offset;
     int         pga_gain;
-    stopwatch_t stopwatch;
-    double      elapsed;
+    double      cpu_us;
+    double      sensor_us;
 
     sensor_width  = fps_get_sensor_width(device_handle);
     sensor_height = fps_get_sensor_height(device_handle);
@@ -182,10 +190,13 @@ image_calibration_show_options :
                 return status;
             }
 
-            stopwatch_start(&stopwatch);
+            (void) start_profile("image_calibration");
+            cpu_us    = fps_get_cpu_time_us();
+            sensor_us = fps_get_clock_time_us(device_handle);
 
             status = fps_switch_sensor_mode(device_handle, FPS_IMAGE_MODE, &mode_old);
             if (status < 0) {
+                (void) stop_profile("image_calibration");
                 return status;
             }
 
@@ -194,8 +205,9 @@ image_calibration_show_options :
                                            img_height,
                                            frms_to_avg);
 
-            stopwatch_stop(&stopwatch);
-            elapsed = stopwatch_get_elapsed(&stopwatch);
+            (void) stop_profile("image_calibration");
+            cpu_us    = fps_get_cpu_time_us() - cpu_us;
+            sensor_us = fps_get_clock_time_us(device_handle) - sensor_us;
 
             stop_ctrl_c_monitor();
 
@@ -217,7 +229,10 @@ image_calibration_show_options :
                 printf("    CDS Offset 1 = 0x%03X  \n", cds_offset);
                 printf("    PGA Gain 1   = 0x%02X  \n", pga_gain);
                 printf("\n");
-                printf("    Time Elapsed = %0.3f ms\n", elapsed);
+                printf("    CPU Time     = %0.3f ms\n", cpu_us / 1000);
+                printf("    Sensor Time  = %0.3f ms (%s clock)\n", sensor_us / 1000, device_handle->clock->name);
+                printf("\n");
+                print_profile();
             }
 
             status = fps_switch_sensor_mode(device_handle, mode_old, NULL);
@@ -240,12 +255,43 @@ image_calibration_show_options :
 // Image Mode Test
 //
 
+// Append an image to the dataset, or save it as a BMP file without one
+static int
+save_image(fps_dataset_t *dataset,
+           int           n,
+           char          *suffix,
+           uint8_t       *img,
+           int           img_size,
+           double        img_avg,
+           double        img_var,
+           double        img_noise,
+           double        img_dr)
+{
+    int  status;
+    char file_name[MAX_FNAME_LENGTH];
+
+    fps_begin_region("file_io");
+
+    if (dataset != NULL) {
+        status = fps_append_dataset(dataset, (unsigned int) n, img,
+                                    img_avg, img_var, img_noise, img_dr);
+    } else {
+        sprintf(file_name, "%s/%03d_%s.bmp", image_folder, n, suffix);
+        status = save_bmp(file_name, img, img_size);
+    }
+
+    fps_end_region("file_io");
+
+    return status;
+}
+
 int
 image_mode_test()
 {
     const int DEFAULT_FRAMES_TO_AVERAGE   = 1;
     const int DEFAULT_NUMBER_OF_IMAGES    = 100;
     const int DEFAULT_ACQUIRED_IMAGE_TYPE = 1;    // Finger-only image
+    const int DEFAULT_IMAGE_FORMAT        = IMAGE_FORMAT_DATASET;
 
     int         status = 0;
     char        cmd_line[MAX_STRING_LENGTH];
@@ -262,6 +308,7 @@ image_mode_test()
     int         frms_to_avg;
     int         num_of_imgs;
     int         img_type;
+    int         img_format;
     char        adj_type[MAX_STRING_LENGTH];
     int         adj_step;
     int         cds_offset_0;
@@ -273,19 +320,27 @@ image_mode_test()
     FILE        *fptr;
     uint8_t     addr[5];
     uint8_t     data[5];
-    uint8_t     *bkgnd_img;
+    uint8_t     *bkgnd_img  = NULL;
     double      bkgnd_avg;
-    uint8_t     *frgnd_img;
+    uint8_t     *frgnd_img  = NULL;
     double      frgnd_avg;
-    uint8_t     *finger_img;
+    uint8_t     *finger_img = NULL;
     double      finger_dr;
-    stopwatch_t stopwatch;
-    double      elapsed;
+    double      img_avg;
+    double      img_var;
+    double      img_noise;
+    fps_stream_t *stream = NULL;
+    fps_dataset_t *dataset = NULL;
+    unsigned int dropped;
+    unsigned int pool_allocated;
+    unsigned int pool_high_water;
+    unsigned int pool_misses;
     int         n;
 
     frms_to_avg = DEFAULT_FRAMES_TO_AVERAGE;
     num_of_imgs = DEFAULT_NUMBER_OF_IMAGES;
     img_type    = DEFAULT_ACQUIRED_IMAGE_TYPE;
+    img_format  = DEFAULT_IMAGE_FORMAT;
 
     // Get image window first
     status = fps_get_sensing_area(device_handle, FPS_IMAGE_MODE,
@@ -355,6 +410,11 @@ image_mode_test()
         printf("                             1: Finger-only images.                      \n");
         printf("                             2: Enhanced images.                         \n");
         printf("                                                                         \n");
+        printf("    'f' <format>       - Specify how the acquired images are saved.      \n");
+        printf("                           <format> = Image format identifiers.          \n");
+        printf("                             0: One dataset file, images.fpsd.           \n");
+        printf("                             1: One BMP file per image.                  \n");
+        printf("                                                                         \n");
         printf("    '+' <type> <steps> - Increment current CDS/PGA settings.             \n");
         printf("    '-' <type> <steps> - Decrement current CDS/PGA settings.             \n");
         printf("                           <type> = CDS or PGA types.                    \n");
@@ -379,7 +439,7 @@ image_mode_test()
 
         cmd_key = get_command(cmd_line, sizeof(cmd_line));
 
-        if (strchr("ant+-rgbq\n", cmd_key) == NULL) {
+        if (strchr("antf+-rgbq\n", cmd_key) == NULL) {
             printf("    ERROR: Invalid command!\n");
             sleep_ms(1000);
             continue;
@@ -455,6 +515,26 @@ image_mode_test_adjust_again :
             goto image_mode_test_show_options;
         }
 
+        // Set Image File Format
+        // ---------------------------------------------------------------------
+
+        if (cmd_key == 'f') {
+            cmd_opt    = strtok(cmd_line, " ");
+            cmd_opt    = strtok(NULL, " ");
+            img_format = strtol(cmd_opt, NULL, 10);
+
+            if ((img_format != IMAGE_FORMAT_DATASET) && (img_format != IMAGE_FORMAT_BMP)) {
+                printf("    ERROR: Image format identifier must be 0 or 1!\n");
+
+                img_format = DEFAULT_IMAGE_FORMAT;
+
+                sleep_ms(1000);
+                continue;
+            }
+
+            goto image_mode_test_show_options;
+        }
+
         // Adjust CDS or PGA
         // ---------------------------------------------------------------------
 
@@ -613,6 +693,7 @@ image_mode_test_show_options :
             printf("    Number of Frames to Average = %0d frames\n", frms_to_avg);
             printf("    Number of Images to Acquire = %0d images\n", num_of_imgs);
             printf("    Acquired Image Type         = %0d\n", img_type);
+            printf("    Image File Format           = %0d\n", img_format);
             printf("\n");
             printf("    CDS Offset 0 = 0x%02X\n", cds_offset_0);
             printf("    CDS Offset 1 = 0x%03X\n", cds_offset_1);
@@ -627,7 +708,7 @@ image_mode_test_show_options :
 
             printf("    Getting Background Image...\n");
 
-            bkgnd_img = (uint8_t *) malloc(img_size);
+            bkgnd_img = (uint8_t *) fps_acquire_buffer(device_handle, FPS_POOL_FRAME);
             if (bkgnd_img == NULL) {
                 status = -1;
                 goto image_mode_test_error;
@@ -661,7 +742,8 @@ image_mode_test_show_options :
                 goto image_mode_test_error;
             }
 
-            free(bkgnd_img);
+            fps_release_buffer(device_handle, bkgnd_img);
+            bkgnd_img = NULL;
 
             printf("    Done!\n");
         }
@@ -674,19 +756,19 @@ image_mode_test_show_options :
             printf("    Getting Images...\n");
 
             // Create image buffers to store backgournd, foreground and finger-only images
-            bkgnd_img = (uint8_t *) malloc(img_size);
+            bkgnd_img = (uint8_t *) fps_acquire_buffer(device_handle, FPS_POOL_FRAME);
             if (bkgnd_img == NULL) {
                 status = -1;
                 goto image_mode_test_error;
             }
 
-            frgnd_img = (uint8_t *) malloc(img_size);
+            frgnd_img = (uint8_t *) fps_acquire_buffer(device_handle, FPS_POOL_FRAME);
             if (frgnd_img == NULL) {
                 status = -1;
                 goto image_mode_test_error;
             }
 
-            finger_img = (uint8_t *) malloc(img_size);
+            finger_img = (uint8_t *) fps_acquire_buffer(device_handle, FPS_POOL_FRAME);
             if (finger_img == NULL) {
                 status = -1;
                 goto image_mode_test_error;
@@ -750,7 +832,7 @@ image_mode_test_show_options :
             fprintf(fptr, "\n");
             fclose(fptr);
 
-            stopwatch_start(&stopwatch);
+            (void) start_profile("image_mode_test");
 
             start_ctrl_c_monitor();
 
@@ -759,18 +841,42 @@ image_mode_test_show_options :
                 goto image_mode_test_error;
             }
 
+            // Create the dataset while the handle is still free for the register reads
+            if (img_format == IMAGE_FORMAT_DATASET) {
+                sprintf(file_name, "%s/images.fpsd", image_folder);
+                fps_begin_region("file_io");
+                dataset = fps_create_dataset(device_handle, file_name,
+                                             img_width, img_height, frms_to_avg, img_type);
+                fps_end_region("file_io");
+                if (dataset == NULL) {
+                    status = -1;
+                    goto image_mode_test_error;
+                }
+            }
+
+            // Capture the next frames while the current image is processed and saved
+            stream = fps_stream_open(device_handle, img_width, img_height,
+                                     frms_to_avg + 1, FPS_STREAM_BLOCK);
+            if (stream == NULL) {
+                status = -1;
+                goto image_mode_test_error;
+            }
+
             // Repeat to acquire images
             for (n = 0; ((n < num_of_imgs) && (is_ctrl_c_hit() == FALSE)); n++) {
 
                 // Get foreground image
                 if (img_type == 0) {
-                    status = fps_get_averaged_image(device_handle,
-                                                    img_width,
-                                                    img_height,
-                                                    frms_to_avg,
-                                                    frgnd_img,
-                                                    &frgnd_avg,
-                                                    NULL, NULL);
+                    status = fps_get_averaged_image_from(device_handle,
+                                                         fps_stream_frame_source,
+                                                         stream,
+                                                         img_width,
+                                                         img_height,
+                                                         frms_to_avg,
+                                                         frgnd_img,
+                                                         &frgnd_avg,
+                                                         &img_var,
+                                                         &img_noise);
                     if (status < 0) {
                         goto image_mode_test_error;
                     }
@@ -780,8 +886,8 @@ image_mode_test_show_options :
                     printf("    Image %03d DR = %0.3f\n", n, finger_dr);
 
                     // Save this image
-                    sprintf(file_name, "%s/%03d_average.bmp", image_folder, n);
-                    status = save_bmp(file_name, frgnd_img, img_size);
+                    status = save_image(dataset, n, "average", frgnd_img, img_size,
+                                        frgnd_avg, img_var, img_noise, finger_dr);
                     if (status < 0) {
                         goto image_mode_test_error;
                     }
@@ -791,22 +897,28 @@ image_mode_test_show_options :
                 // Get finger-only image
                 else
                 if (img_type == 1) {
-                    status = fps_get_finger_image(device_handle,
-                                                  img_width,
-                                                  img_height,
-                                                  frms_to_avg,
-                                                  finger_img,
-                                                  &finger_dr,
-                                                  NULL, NULL);
+                    status = fps_get_finger_image_from(device_handle,
+                                                       fps_stream_frame_source,
+                                                       stream,
+                                                       img_width,
+                                                       img_height,
+                                                       frms_to_avg,
+                                                       finger_img,
+                                                       &finger_dr,
+                                                       &img_var,
+                                                       &img_noise);
                     if (status < 0) {
                         goto image_mode_test_error;
                     }
 
                     printf("    Image %03d DR = %0.3f\n", n, finger_dr);
 
+                    // The record describes the inverted pixels it stores
+                    (void) get_image_stats(finger_img, img_size, &img_avg, &img_var);
+
                     // Save this image
-                    sprintf(file_name, "%s/%03d_finger.bmp", image_folder, n);
-                    status = save_bmp(file_name, finger_img, img_size);
+                    status = save_image(dataset, n, "finger", finger_img, img_size,
+                                        img_avg, img_var, img_noise, finger_dr);
                     if (status < 0) {
                         goto image_mode_test_error;
                     }
@@ -815,27 +927,59 @@ image_mode_test_show_options :
 
             stop_ctrl_c_monitor();
 
-            stopwatch_stop(&stopwatch);
-            elapsed = stopwatch_get_elapsed(&stopwatch);
+            (void) fps_get_stream_counters(stream, NULL, NULL, &dropped);
+
+            if (dataset != NULL) {
+                fps_begin_region("file_io");
+                status = fps_close_dataset(&dataset);
+                fps_end_region("file_io");
+                if (status < 0) {
+                    goto image_mode_test_error;
+                }
+            }
+
+            (void) stop_profile("image_mode_test");
 
             printf("    Done!\n");
             printf("\n");
-            printf("    Time Elapsed = %0.3f ms\n", elapsed);
+            if (img_format == IMAGE_FORMAT_DATASET) {
+                printf("    Dataset        = %s/images.fpsd\n", image_folder);
+            }
+            printf("    Frames Dropped = %0u\n", dropped);
+
+            (void) fps_get_pool_counters(device_handle, FPS_POOL_FRAME, &pool_allocated, &pool_high_water, &pool_misses);
+            printf("    Frame Pool     = %0u allocated, %0u high-water, %0u misses\n",
+                   pool_allocated, pool_high_water, pool_misses);
+
+            (void) fps_get_pool_counters(device_handle, FPS_POOL_MAP, &pool_allocated, &pool_high_water, &pool_misses);
+            printf("    Map Pool       = %0u allocated, %0u high-water, %0u misses\n",
+                   pool_allocated, pool_high_water, pool_misses);
+
+            printf("\n");
+            print_profile();
 
 image_mode_test_error :
 
-            // Free allocated buffers
-            if (finger_img != NULL) {
-                free(finger_img);
-            }
+            // Drops the regions an error left open
+            (void) fps_enable_profile(FALSE);
 
-            if (frgnd_img != NULL) {
-                free(frgnd_img);
+            if (stream != NULL) {
+                (void) fps_stream_close(&stream);
             }
 
-            if (bkgnd_img != NULL) {
-                free(bkgnd_img);
+            // Closed with what was appended until the error
+            if (dataset != NULL) {
+                (void) fps_close_dataset(&dataset);
             }
+
+            // Return buffers to the pool
+            fps_release_buffer(device_handle, finger_img);
+            fps_release_buffer(device_handle, frgnd_img);
+            fps_release_buffer(device_handle, bkgnd_img);
+
+            finger_img = NULL;
+            frgnd_img  = NULL;
+            bkgnd_img  = NULL;
         }
 
         printf("\n");
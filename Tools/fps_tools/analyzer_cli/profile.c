@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "common.h"
+#include "fps.h"
+#include "profile.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Profiling
+// -----------------------------------------------------------------------------
+// NOTE: A test runs as one top-level region, so that the library regions
+//       within it, capture, process and scan, and those of the test itself,
+//       e.g. file I/O, add up to it. The time of a region outside of its
+//       children is shown as "(self)".
+//
+
+int
+start_profile(const char *name)
+{
+    int status;
+
+    // Drops the regions a failed test left open
+    (void) fps_enable_profile(FALSE);
+
+    status = fps_reset_profile();
+    if (status < 0) {
+        return status;
+    }
+
+    (void) fps_enable_profile(TRUE);
+
+    return fps_begin_region(name);
+}
+
+int
+stop_profile(const char *name)
+{
+    int status;
+
+    status = fps_end_region(name);
+
+    (void) fps_enable_profile(FALSE);
+
+    return status;
+}
+
+static void
+print_profile_region(fps_profile_t *profile,
+                     int           index,
+                     double        parent_ns)
+{
+    fps_profile_region_t *region = &profile->region[index];
+    char                 label[MAX_STRING_LENGTH];
+    double               child_ns = 0.0;
+    int                  children = 0;
+    int                  i;
+
+    sprintf(label, "%*s%.*s", region->depth * 2, "", 24, region->name);
+
+    printf("    %-26s %8u %11.3f %6.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+           label, region->count, region->total_ns / 1000000.0,
+           (parent_ns > 0.0) ? (region->total_ns * 100.0 / parent_ns) : 100.0,
+           (region->count > 0) ? (region->total_ns / region->count / 1000.0) : 0.0,
+           region->min_ns / 1000.0,
+           fps_get_profile_percentile(region, 50.0) / 1000.0,
+           fps_get_profile_percentile(region, 99.0) / 1000.0,
+           region->max_ns / 1000.0);
+
+    for (i = index + 1; i < profile->regions; i++) {
+        if (profile->region[i].parent == index) {
+            print_profile_region(profile, i, region->total_ns);
+            child_ns += profile->region[i].total_ns;
+            children++;
+        }
+    }
+
+    if (children > 0) {
+        sprintf(label, "%*s(self)", (region->depth + 1) * 2, "");
+
+        printf("    %-26s %8s %11.3f %6.1f\n",
+               label, "", (region->total_ns - child_ns) / 1000000.0,
+               (region->total_ns > 0.0) ? ((region->total_ns - child_ns) * 100.0 / region->total_ns) : 0.0);
+    }
+}
+
+void
+print_profile(void)
+{
+    fps_profile_t *profile;
+    double        total_ns = 0.0;
+    int           i;
+
+    // Too big for the stack of some platforms
+    profile = (fps_profile_t *) malloc(sizeof(fps_profile_t));
+    if (profile == NULL) {
+        return;
+    }
+
+    (void) fps_get_profile(profile);
+
+    for (i = 0; i < profile->regions; i++) {
+        if (profile->region[i].parent < 0) {
+            total_ns += profile->region[i].total_ns;
+        }
+    }
+
+    printf("    %-26s %8s %11s %6s %10s %10s %10s %10s %10s\n",
+           "Region", "Count", "Total ms", "%", "Mean us", "Min us", "p50 us", "p99 us", "Max us");
+
+    for (i = 0; i < profile->regions; i++) {
+        if (profile->region[i].parent < 0) {
+            print_profile_region(profile, i, total_ns);
+        }
+    }
+
+    if (profile->dropped > 0) {
+        printf("    (%0u regions beyond the profile limits not shown)\n", profile->dropped);
+    }
+
+    free(profile);
+}
@@ -0,0 +1,27 @@
+#ifndef __profile_h__
+#define __profile_h__
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Profiling
+//
+
+int start_profile(const char *name);
+
+int stop_profile(const char *name);
+
+void print_profile(void);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+
+#endif // __profile_h__
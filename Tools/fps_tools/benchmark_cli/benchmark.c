@@ -0,0 +1,955 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// libfps Benchmark
+// -----------------------------------------------------------------------------
+// NOTE: Times the image and calibration kernels of the library, call by call,
+//       on the simulated F747B and its virtual clock, so that no call waits
+//       for a sensor. Per kernel it reports the time per call and per frame,
+//       frames per second, heap allocations per call and the latency
+//       percentiles. "-c" prints the same as CSV, for tracking over time.
+//
+//       Image kernels get their frames from a cache of synthetic 144x64
+//       frames, taken from the simulator once at the calibrated settings, so
+//       that only the library is timed and not the noise synthesis.
+//       Calibration kernels need a sensor that answers to its settings and
+//       run on the simulator itself.
+//
+//       Allocations are counted by wrapping malloc(), calloc() and realloc()
+//       at link time (-Wl,--wrap=...), which needs the GNU linker.
+//
+//       "-s" checks the fixed-point statistics against the double path
+//       instead, on randomized 144x64 frame sets of 1 to 32 frames, and fails
+//       when a result is off by more than FPS_FIXED_TOLERANCE. It needs no
+//       sensor.
+//
+//       Build with "make benchmark", or "make CROSS_TOOLCHAIN= benchmark" to
+//       run it on the build host.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "debug.h"
+#include "fps.h"
+#include "fps_register.h"
+#include "fps_control.h"
+#include "fps_calibration.h"
+#include "fps_statistics.h"
+#include "simulator/fps_simulator.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Benchmark Settings
+//
+
+#define BENCH_DEFAULT_CALLS     (200)
+#define BENCH_WARMUP_CALLS      (5)
+#define BENCH_CACHED_FRAMES     (16)
+#define BENCH_FRAMES_TO_AVG     (4)
+#define BENCH_DET_WIDTH         (8)
+#define BENCH_DET_HEIGHT        (8)
+#define BENCH_FRAMES_TO_SUSP    (2)
+#define BENCH_SCAN_HEIGHT       (24)
+
+// Statistics check
+#define BENCH_CHECK_WIDTH       (144)
+#define BENCH_CHECK_HEIGHT      (64)
+#define BENCH_CHECK_MAX_FRAMES  (32)
+#define BENCH_CHECK_SETS        (4)     // frame sets per frame count
+#define BENCH_CHECK_WINDOWS     (16)    // random windows per frame set
+#define BENCH_CHECK_SEED        (0x13579BDF)
+
+// Cached frame sets
+#define BENCH_SET_EMPTY         (0)     // image settings, no finger
+#define BENCH_SET_FINGER        (1)     // image settings, finger
+#define BENCH_SET_DETECT        (2)     // detect settings, as the window search
+#define BENCH_SETS              (3)
+
+typedef struct __bench_result {
+    unsigned int calls;
+    unsigned int frames;
+    unsigned int allocs;
+    double       total_us;
+    double       *latency_us;
+} bench_result_t;
+
+typedef int (*bench_kernel_t) (fps_handle_t *handle);
+
+typedef struct __bench_item {
+    const char     *name;
+    bench_kernel_t kernel;
+    int            live;      // frames from the simulator instead of the cache
+    int            images;    // images per call of a kernel without frames
+} bench_item_t;
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Allocation Counter
+//
+
+static volatile unsigned int bench_allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void*
+__wrap_malloc(size_t size)
+{
+    bench_allocs++;
+    return __real_malloc(size);
+}
+
+void*
+__wrap_calloc(size_t count,
+              size_t size)
+{
+    bench_allocs++;
+    return __real_calloc(count, size);
+}
+
+void*
+__wrap_realloc(void   *ptr,
+               size_t size)
+{
+    bench_allocs++;
+    return __real_realloc(ptr, size);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Frame Cache Backend
+// -----------------------------------------------------------------------------
+// NOTE: The simulator backend with get_raw_image_method replaced. A cached
+//       frame is cut to the requested size from its top left corner, which
+//       costs one copy per row, like reading a frame out of a driver buffer.
+//
+
+static fps_backend_t bench_backend;
+
+static uint8_t      *bench_frames[BENCH_SETS][BENCH_CACHED_FRAMES];
+static int          bench_set     = BENCH_SET_EMPTY;
+static int          bench_live    = FALSE;
+static unsigned int bench_next    = 0;
+static unsigned int bench_fetched = 0;
+
+static int
+bench_get_raw_image(fps_handle_t *handle,
+                    int          img_width,
+                    int          img_height,
+                    uint8_t      *img_buf)
+{
+    uint8_t *frame;
+    int     r;
+
+    bench_fetched++;
+
+    if (bench_live == TRUE) {
+        return fps_sim_backend.get_raw_image_method(handle, img_width, img_height, img_buf);
+    }
+
+    if ((img_width > handle->sensor_width) || (img_height > handle->sensor_height)) {
+        return -1;
+    }
+
+    frame = bench_frames[bench_set][bench_next++ % BENCH_CACHED_FRAMES];
+
+    memcpy(img_buf, frame, handle->latency);
+
+    for (r = 0; r < img_height; r++) {
+        memcpy(&img_buf[handle->latency + r * img_width],
+               &frame[handle->latency + r * handle->sensor_width],
+               img_width);
+    }
+
+    return 0;
+}
+
+static void
+bench_free_frames(void)
+{
+    int f;
+    int i;
+
+    for (f = 0; f < BENCH_SETS; f++) {
+    for (i = 0; i < BENCH_CACHED_FRAMES; i++) {
+        free(bench_frames[f][i]);
+        bench_frames[f][i] = NULL;
+    }}
+}
+
+// Full frames of each set, in image mode
+static int
+bench_fill_frames(fps_handle_t *handle)
+{
+    int     status = 0;
+    uint8_t addr[6];
+    uint8_t data[6];
+    size_t  size;
+    int     f;
+    int     i;
+
+    size = handle->latency + handle->sensor_width * handle->sensor_height;
+
+    addr[0] = FPS_REG_IMG_CDS_CTL_0;
+    addr[1] = FPS_REG_IMG_CDS_CTL_1;
+    addr[2] = FPS_REG_IMG_PGA1_CTL;
+
+    addr[3] = FPS_REG_DET_CDS_CTL_0;
+    addr[4] = FPS_REG_DET_CDS_CTL_1;
+    addr[5] = FPS_REG_DET_PGA1_CTL;
+
+    status = fps_multiple_read(handle, addr, data, 6);
+    if (status < 0) {
+        return status;
+    }
+
+    for (f = 0; f < BENCH_SETS; f++) {
+        status = fps_sim_set_finger(handle, (f == BENCH_SET_FINGER));
+        if (status < 0) {
+            return status;
+        }
+
+        // The image settings of the set
+        status = fps_multiple_write(handle, addr, ((f == BENCH_SET_DETECT) ? &data[3] : &data[0]), 3);
+        if (status < 0) {
+            return status;
+        }
+
+        for (i = 0; i < BENCH_CACHED_FRAMES; i++) {
+            bench_frames[f][i] = (uint8_t *) malloc(size);
+            if (bench_frames[f][i] == NULL) {
+                LOG_ERROR("malloc() failed!\n");
+                return -1;
+            }
+
+            status = fps_get_raw_image(handle, handle->sensor_width, handle->sensor_height,
+                                       bench_frames[f][i]);
+            if (status < 0) {
+                return status;
+            }
+        }
+    }
+
+    status = fps_multiple_write(handle, addr, data, 3);
+    if (status < 0) {
+        return status;
+    }
+
+    return fps_sim_set_finger(handle, FALSE);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Kernels
+//
+
+static uint8_t *bench_img = NULL;
+
+static int
+bench_averaged_image(fps_handle_t *handle)
+{
+    double img_avg;
+    double img_var;
+    double img_noise;
+
+    return fps_get_averaged_image(handle, handle->sensor_width, handle->sensor_height,
+                                  BENCH_FRAMES_TO_AVG, bench_img,
+                                  &img_avg, &img_var, &img_noise);
+}
+
+static int
+bench_finger_image(fps_handle_t *handle)
+{
+    int    status = 0;
+    double img_dr;
+    double img_var;
+    double img_noise;
+
+    bench_set = BENCH_SET_FINGER;
+
+    status = fps_get_finger_image(handle, handle->sensor_width, handle->sensor_height,
+                                  BENCH_FRAMES_TO_AVG, bench_img,
+                                  &img_dr, &img_var, &img_noise);
+
+    bench_set = BENCH_SET_EMPTY;
+
+    return status;
+}
+
+static int
+bench_background_image(fps_handle_t *handle)
+{
+    return fps_set_background_image(handle, handle->sensor_width, handle->sensor_height,
+                                    bench_frames[0][0] + handle->latency);
+}
+
+static int
+bench_detect_window(fps_handle_t *handle)
+{
+    int    status = 0;
+    int    col_begin;
+    int    col_end;
+    int    row_begin;
+    int    row_end;
+    double det_avg;
+    double det_var;
+    double det_noise;
+
+    bench_set = BENCH_SET_DETECT;
+
+    status = fps_search_detect_window(handle,
+                                      handle->sensor_width, handle->sensor_height,
+                                      BENCH_DET_WIDTH, BENCH_DET_HEIGHT,
+                                      BENCH_DET_WIDTH, BENCH_SCAN_HEIGHT,
+                                      BENCH_FRAMES_TO_AVG,
+                                      &col_begin, &col_end, &row_begin, &row_end,
+                                      &det_avg, &det_var, &det_noise);
+
+    bench_set = BENCH_SET_EMPTY;
+
+    return status;
+}
+
+static int
+bench_image_calibration(fps_handle_t *handle)
+{
+    int status = 0;
+
+    status = fps_switch_sensor_mode(handle, FPS_IMAGE_MODE, NULL);
+    if (status < 0) {
+        return status;
+    }
+
+    return fps_image_calibration(handle, handle->sensor_width, handle->sensor_height,
+                                 BENCH_FRAMES_TO_AVG);
+}
+
+static int
+bench_detect_threshold(fps_handle_t *handle)
+{
+    int    detect_th;
+    double sleep_us;
+
+    sleep_us = fps_get_suspend_time(handle, (BENCH_DET_WIDTH * BENCH_DET_HEIGHT),
+                                    BENCH_FRAMES_TO_SUSP, 1.0);
+
+    return fps_search_detect_threshold(handle, FPS_SEARCH_ONE_TRIGGER,
+                                       FPS_MAX_DETECT_TH, 0, sleep_us, 1, &detect_th);
+}
+
+// Without the learnt model, so that every call searches the full range
+static int
+bench_detect_calibration(fps_handle_t *handle)
+{
+    int status = 0;
+
+    (void) fps_clear_detect_model(handle);
+
+    status = fps_switch_sensor_mode(handle, FPS_DETECT_MODE, NULL);
+    if (status < 0) {
+        return status;
+    }
+
+    return fps_detect_calibration(handle, BENCH_DET_WIDTH, BENCH_DET_HEIGHT,
+                                  BENCH_FRAMES_TO_SUSP);
+}
+
+static const bench_item_t bench_items[] = {
+    //   name                        kernel                     live    images
+    // +---------------------------+--------------------------+-------+--------+
+    {    "averaged_image",           bench_averaged_image,      FALSE,  0      },
+    {    "finger_image",             bench_finger_image,        FALSE,  0      },
+    {    "set_background_image",     bench_background_image,    FALSE,  1      },
+    {    "search_detect_window",     bench_detect_window,       FALSE,  0      },
+    {    "image_calibration",        bench_image_calibration,   TRUE,   0      },
+    {    "search_detect_threshold",  bench_detect_threshold,    TRUE,   1      },
+    {    "detect_calibration",       bench_detect_calibration,  TRUE,   0      },
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Measurement
+//
+
+static int
+bench_compare_double(const void *a,
+                     const void *b)
+{
+    double x = *((const double *) a);
+    double y = *((const double *) b);
+
+    return (x > y) - (x < y);
+}
+
+// Nearest rank of the sorted latencies
+static double
+bench_percentile(bench_result_t *result,
+                 double         percent)
+{
+    unsigned int rank;
+
+    rank = (unsigned int) ((percent / 100.0) * result->calls + 0.5);
+    rank = CONSTRAINT(result->calls, rank, 1);
+
+    return result->latency_us[rank - 1];
+}
+
+static int
+bench_run(fps_handle_t       *handle,
+          const bench_item_t *item,
+          unsigned int       calls,
+          bench_result_t     *result)
+{
+    int          status = 0;
+    unsigned int allocs;
+    unsigned int fetched;
+    double       start_us;
+    unsigned int i;
+
+    memset(result, 0x00, sizeof(bench_result_t));
+
+    bench_live = item->live;
+
+    for (i = 0; i < BENCH_WARMUP_CALLS; i++) {
+        status = item->kernel(handle);
+        if (status < 0) {
+            return status;
+        }
+    }
+
+    result->latency_us = (double *) malloc(sizeof(double) * calls);
+    if (result->latency_us == NULL) {
+        LOG_ERROR("malloc() failed!\n");
+        return -1;
+    }
+
+    allocs  = bench_allocs;
+    fetched = bench_fetched;
+
+    for (i = 0; i < calls; i++) {
+        start_us = fps_get_time_us();
+
+        status = item->kernel(handle);
+
+        result->latency_us[i] = fps_get_time_us() - start_us;
+        result->total_us     += result->latency_us[i];
+
+        if (status < 0) {
+            return status;
+        }
+    }
+
+    result->calls  = calls;
+    result->allocs = bench_allocs  - allocs;
+    result->frames = bench_fetched - fetched;
+
+    if (result->frames == 0) {
+        result->frames = item->images * calls;
+    }
+
+    qsort(result->latency_us, calls, sizeof(double), bench_compare_double);
+
+    return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Report
+//
+
+static void
+bench_print_header(int csv)
+{
+    if (csv == TRUE) {
+        printf("kernel,calls,frames_per_call,ns_per_call,ns_per_frame,frames_per_s,"
+               "allocs_per_call,p50_us,p90_us,p99_us,max_us\n");
+    } else {
+        printf("%-24s %6s %8s %12s %12s %10s %8s %9s %9s %9s %9s\n",
+               "Kernel", "Calls", "Frm/Call", "ns/Call", "ns/Frame", "Frames/s",
+               "Alloc/C", "p50 us", "p90 us", "p99 us", "Max us");
+    }
+}
+
+static void
+bench_print_result(int                csv,
+                   const bench_item_t *item,
+                   bench_result_t     *result)
+{
+    double ns_per_call;
+    double ns_per_frame;
+    double frames_per_call;
+    double frames_per_s;
+    double allocs_per_call;
+
+    ns_per_call     = result->total_us * 1000.0 / result->calls;
+    frames_per_call = ((double) result->frames) / result->calls;
+    ns_per_frame    = (result->frames > 0) ? (result->total_us * 1000.0 / result->frames) : 0.0;
+    frames_per_s    = (result->total_us > 0.0) ? (result->frames * 1000000.0 / result->total_us) : 0.0;
+    allocs_per_call = ((double) result->allocs) / result->calls;
+
+    if (csv == TRUE) {
+        printf("%s,%u,%0.3f,%0.1f,%0.1f,%0.1f,%0.3f,%0.3f,%0.3f,%0.3f,%0.3f\n",
+               item->name, result->calls, frames_per_call, ns_per_call, ns_per_frame,
+               frames_per_s, allocs_per_call,
+               bench_percentile(result, 50.0), bench_percentile(result, 90.0),
+               bench_percentile(result, 99.0), result->latency_us[result->calls - 1]);
+    } else {
+        printf("%-24s %6u %8.2f %12.1f %12.1f %10.1f %8.2f %9.3f %9.3f %9.3f %9.3f\n",
+               item->name, result->calls, frames_per_call, ns_per_call, ns_per_frame,
+               frames_per_s, allocs_per_call,
+               bench_percentile(result, 50.0), bench_percentile(result, 90.0),
+               bench_percentile(result, 99.0), result->latency_us[result->calls - 1]);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Statistics Check
+// -----------------------------------------------------------------------------
+// NOTE: Every frame set is accumulated both ways and reduced, mapped and cut
+//       into windows with the double and the fixed-point functions. Each set
+//       has its own kind of pixels, so that flat, noisy, dark and saturated
+//       images are all covered:
+//         0 : random base level per pixel, small noise
+//         1 : random base level per pixel, noise over the full range
+//         2 : one constant level, no noise
+//         3 : pixels stuck at 0 or 255, with noise clipped at both ends
+//       The generator is a local LCG, so that the sets are the same on every
+//       platform.
+//
+
+#define BENCH_CHECK_AVG         (0)
+#define BENCH_CHECK_VAR         (1)
+#define BENCH_CHECK_NOISE       (2)
+#define BENCH_CHECK_PIX_AVG     (3)
+#define BENCH_CHECK_PIX_NOISE   (4)
+#define BENCH_CHECK_WIN_AVG     (5)
+#define BENCH_CHECK_WIN_VAR     (6)
+#define BENCH_CHECK_WIN_NOISE   (7)
+#define BENCH_CHECK_ITEMS       (8)
+
+static const char *bench_check_names[BENCH_CHECK_ITEMS] = {
+    "image average",
+    "image variance",
+    "image noise",
+    "pixel average",
+    "pixel noise",
+    "window average",
+    "window variance",
+    "window noise",
+};
+
+static uint32_t bench_check_seed = BENCH_CHECK_SEED;
+
+static uint32_t
+bench_check_random(uint32_t range)
+{
+    bench_check_seed = bench_check_seed * 1664525 + 1013904223;
+
+    return (bench_check_seed >> 8) % range;
+}
+
+static void
+bench_check_frame(uint8_t *base,
+                  int     amplitude,
+                  uint8_t *frame,
+                  size_t  img_size)
+{
+    int    pix_val;
+    size_t i;
+
+    for (i = 0; i < img_size; i++) {
+        pix_val = base[i];
+
+        if (amplitude > 0) {
+            pix_val += (int) bench_check_random((2 * amplitude) + 1) - amplitude;
+        }
+
+        frame[i] = (uint8_t) CONSTRAINT(255, pix_val, 0);
+    }
+}
+
+static void
+bench_check_base(int     kind,
+                 uint8_t *base,
+                 int     *amplitude,
+                 size_t  img_size)
+{
+    uint8_t level;
+    size_t  i;
+
+    level = (uint8_t) bench_check_random(256);
+
+    for (i = 0; i < img_size; i++) {
+        switch (kind) {
+        case 0  :
+        case 1  : base[i] = (uint8_t) bench_check_random(256);       break;
+        case 2  : base[i] = level;                                   break;
+        default : base[i] = (bench_check_random(2) != 0) ? 255 : 0;  break;
+        }
+    }
+
+    switch (kind) {
+    case 0  : *amplitude = 1 + (int) bench_check_random(8);   break;
+    case 1  : *amplitude = 255;                               break;
+    case 2  : *amplitude = 0;                                 break;
+    default : *amplitude = 1 + (int) bench_check_random(64);  break;
+    }
+}
+
+static void
+bench_check_error(double *max_error,
+                  int    item,
+                  double value,
+                  double fixed)
+{
+    double error;
+
+    error = fabs(FPS_FIXED_TO_DOUBLE(fixed) - value);
+
+    // A NaN of the double path must fail too
+    if (!(error <= max_error[item])) {
+        max_error[item] = (error == error) ? error : HUGE_VAL;
+    }
+}
+
+static int
+bench_check_statistics(void)
+{
+    int          status = 0;
+    size_t       img_size = BENCH_CHECK_WIDTH * BENCH_CHECK_HEIGHT;
+    uint8_t      *base      = NULL;
+    uint8_t      *frame     = NULL;
+    uint8_t      *img_dbl   = NULL;
+    uint8_t      *img_fix   = NULL;
+    double       *pix_dbl   = NULL;
+    double       *sqr_dbl   = NULL;
+    uint32_t     *pix_fix   = NULL;
+    uint64_t     *sqr_fix   = NULL;
+    double       *avg_dbl   = NULL;
+    double       *noise_dbl = NULL;
+    fps_fixed_t  *avg_fix   = NULL;
+    fps_fixed_t  *noise_fix = NULL;
+    double       max_error[BENCH_CHECK_ITEMS];
+    double       dbl[3];
+    fps_fixed_t  fix[3];
+    unsigned int mismatches = 0;
+    unsigned int sets       = 0;
+    int          amplitude;
+    int          frames;
+    int          kind;
+    int          col;
+    int          row;
+    int          win_w;
+    int          win_h;
+    int          f;
+    int          w;
+    size_t       i;
+
+    base      = (uint8_t *)     malloc(img_size);
+    frame     = (uint8_t *)     malloc(img_size);
+    img_dbl   = (uint8_t *)     malloc(img_size);
+    img_fix   = (uint8_t *)     malloc(img_size);
+    pix_dbl   = (double *)      malloc(sizeof(double)      * img_size);
+    sqr_dbl   = (double *)      malloc(sizeof(double)      * img_size);
+    pix_fix   = (uint32_t *)    malloc(sizeof(uint32_t)    * img_size);
+    sqr_fix   = (uint64_t *)    malloc(sizeof(uint64_t)    * img_size);
+    avg_dbl   = (double *)      malloc(sizeof(double)      * img_size);
+    noise_dbl = (double *)      malloc(sizeof(double)      * img_size);
+    avg_fix   = (fps_fixed_t *) malloc(sizeof(fps_fixed_t) * img_size);
+    noise_fix = (fps_fixed_t *) malloc(sizeof(fps_fixed_t) * img_size);
+
+    if ((base    == NULL) || (frame   == NULL) || (img_dbl   == NULL) || (img_fix   == NULL) ||
+        (pix_dbl == NULL) || (sqr_dbl == NULL) || (pix_fix   == NULL) || (sqr_fix   == NULL) ||
+        (avg_dbl == NULL) || (avg_fix == NULL) || (noise_dbl == NULL) || (noise_fix == NULL)) {
+        LOG_ERROR("malloc() failed!\n");
+        status = -1;
+        goto check_end;
+    }
+
+    memset(max_error, 0x00, sizeof(max_error));
+
+    for (frames = 1; frames <= BENCH_CHECK_MAX_FRAMES; frames++) {
+    for (kind = 0; kind < BENCH_CHECK_SETS; kind++) {
+        bench_check_base(kind, base, &amplitude, img_size);
+
+        memset(pix_dbl, 0x00, sizeof(double)   * img_size);
+        memset(sqr_dbl, 0x00, sizeof(double)   * img_size);
+        memset(pix_fix, 0x00, sizeof(uint32_t) * img_size);
+        memset(sqr_fix, 0x00, sizeof(uint64_t) * img_size);
+
+        for (f = 0; f < frames; f++) {
+            bench_check_frame(base, amplitude, frame, img_size);
+
+            fps_accumulate_frame_double(frame, img_size, pix_dbl, sqr_dbl);
+            fps_accumulate_frame_fixed (frame, img_size, pix_fix, sqr_fix);
+        }
+
+        // Averaged image
+        fps_reduce_frames_double(pix_dbl, sqr_dbl, frames, img_size, img_dbl,
+                                 &dbl[0], &dbl[1], &dbl[2]);
+        fps_reduce_frames_fixed (pix_fix, sqr_fix, frames, img_size, img_fix,
+                                 &fix[0], &fix[1], &fix[2]);
+
+        bench_check_error(max_error, BENCH_CHECK_AVG,   dbl[0], fix[0]);
+        bench_check_error(max_error, BENCH_CHECK_VAR,   dbl[1], fix[1]);
+        bench_check_error(max_error, BENCH_CHECK_NOISE, dbl[2], fix[2]);
+
+        if (memcmp(img_dbl, img_fix, img_size) != 0) {
+            mismatches++;
+        }
+
+        // Per-pixel maps
+        fps_pixel_map_double(pix_dbl, sqr_dbl, frames, img_size, avg_dbl, noise_dbl);
+        fps_pixel_map_fixed (pix_fix, sqr_fix, frames, img_size, avg_fix, noise_fix);
+
+        for (i = 0; i < img_size; i++) {
+            bench_check_error(max_error, BENCH_CHECK_PIX_AVG,   avg_dbl[i],   avg_fix[i]);
+            bench_check_error(max_error, BENCH_CHECK_PIX_NOISE, noise_dbl[i], noise_fix[i]);
+        }
+
+        // Windows, the full image first
+        for (w = 0; w < BENCH_CHECK_WINDOWS; w++) {
+            if (w == 0) {
+                win_w = BENCH_CHECK_WIDTH;
+                win_h = BENCH_CHECK_HEIGHT;
+            } else {
+                win_w = 1 + (int) bench_check_random(BENCH_CHECK_WIDTH);
+                win_h = 1 + (int) bench_check_random(BENCH_CHECK_HEIGHT);
+            }
+
+            col = (int) bench_check_random(BENCH_CHECK_WIDTH  - win_w + 1);
+            row = (int) bench_check_random(BENCH_CHECK_HEIGHT - win_h + 1);
+
+            fps_window_stats_double(avg_dbl, noise_dbl, BENCH_CHECK_WIDTH,
+                                    col, row, win_w, win_h,
+                                    &dbl[0], &dbl[1], &dbl[2]);
+            fps_window_stats_fixed (pix_fix, noise_fix, frames, BENCH_CHECK_WIDTH,
+                                    col, row, win_w, win_h,
+                                    &fix[0], &fix[1], &fix[2]);
+
+            bench_check_error(max_error, BENCH_CHECK_WIN_AVG,   dbl[0], fix[0]);
+            bench_check_error(max_error, BENCH_CHECK_WIN_VAR,   dbl[1], fix[1]);
+            bench_check_error(max_error, BENCH_CHECK_WIN_NOISE, dbl[2], fix[2]);
+        }
+
+        sets++;
+    }}
+
+    printf("%u frame sets of %dx%d, 1 to %d frames, tolerance %0.6f\n",
+           sets, BENCH_CHECK_WIDTH, BENCH_CHECK_HEIGHT, BENCH_CHECK_MAX_FRAMES,
+           FPS_FIXED_TOLERANCE);
+    printf("%-16s %12s %8s\n", "Quantity", "Max error", "Result");
+
+    for (i = 0; i < BENCH_CHECK_ITEMS; i++) {
+        printf("%-16s %12.6f %8s\n", bench_check_names[i], max_error[i],
+               ((max_error[i] <= FPS_FIXED_TOLERANCE) ? "ok" : "FAILED"));
+
+        if (!(max_error[i] <= FPS_FIXED_TOLERANCE)) {
+            status = -1;
+        }
+    }
+
+    printf("%-16s %12u %8s\n", "rounded image", mismatches,
+           ((mismatches == 0) ? "ok" : "FAILED"));
+
+    if (mismatches != 0) {
+        status = -1;
+    }
+
+check_end :
+
+    free(base);
+    free(frame);
+    free(img_dbl);
+    free(img_fix);
+    free(pix_dbl);
+    free(sqr_dbl);
+    free(pix_fix);
+    free(sqr_fix);
+    free(avg_dbl);
+    free(noise_dbl);
+    free(avg_fix);
+    free(noise_fix);
+
+    return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Main
+//
+
+static void
+bench_show_usage(char *program)
+{
+    int i;
+
+    printf("Usage: %s [options] [kernel...]\n", program);
+    printf("\n");
+    printf("    -n CALLS   Timed calls per kernel (default: %0d)\n", BENCH_DEFAULT_CALLS);
+    printf("    -c         CSV output\n");
+    printf("    -s         Check the fixed-point statistics against the double path\n");
+    printf("    -h         This help\n");
+    printf("\n");
+    printf("Kernels, all by default:\n");
+
+    for (i = 0; i < ARRAY_SIZE(bench_items); i++) {
+        printf("    %s\n", bench_items[i].name);
+    }
+}
+
+static int
+bench_selected(const bench_item_t *item,
+               int                argc,
+               char               *argv[],
+               int                first)
+{
+    int i;
+
+    if (first >= argc) {
+        return TRUE;
+    }
+
+    for (i = first; i < argc; i++) {
+        if (strcmp(argv[i], item->name) == 0) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int            status = 0;
+    fps_handle_t   *handle = NULL;
+    bench_result_t result;
+    unsigned int   calls = BENCH_DEFAULT_CALLS;
+    int            csv   = FALSE;
+    int            check = FALSE;
+    int            first;
+    int            i;
+
+    for (first = 1; first < argc; first++) {
+        if ((strcmp(argv[first], "-n") == 0) && ((first + 1) < argc)) {
+            calls = (unsigned int) atoi(argv[++first]);
+        } else if (strcmp(argv[first], "-c") == 0) {
+            csv = TRUE;
+        } else if (strcmp(argv[first], "-s") == 0) {
+            check = TRUE;
+        } else if (strcmp(argv[first], "-h") == 0) {
+            bench_show_usage(argv[0]);
+            return 0;
+        } else {
+            break;
+        }
+    }
+
+    if (calls == 0) {
+        bench_show_usage(argv[0]);
+        return 1;
+    }
+
+    (void) set_debug_level(LOG_LEVEL_ERROR);
+
+    if (check == TRUE) {
+        return (bench_check_statistics() < 0) ? 1 : 0;
+    }
+
+    handle = fps_open_simulator(NULL);
+    if (handle == NULL) {
+        LOG_ERROR("Opening the simulated sensor failed!\n");
+        return 1;
+    }
+
+    bench_img = (uint8_t *) malloc(handle->latency + handle->sensor_width * handle->sensor_height);
+    if (bench_img == NULL) {
+        LOG_ERROR("malloc() failed!\n");
+        status = -1;
+        goto main_end;
+    }
+
+    // Calibrated settings and background image first, like in the field
+    status = fps_init_sensor(handle);
+    if (status < 0) {
+        goto main_end;
+    }
+
+    status = bench_image_calibration(handle);
+    if (status < 0) {
+        goto main_end;
+    }
+
+    status = bench_detect_calibration(handle);
+    if (status < 0) {
+        goto main_end;
+    }
+
+    status = fps_switch_sensor_mode(handle, FPS_IMAGE_MODE, NULL);
+    if (status < 0) {
+        goto main_end;
+    }
+
+    status = bench_fill_frames(handle);
+    if (status < 0) {
+        goto main_end;
+    }
+
+    bench_backend                      = fps_sim_backend;
+    bench_backend.name                 = "bench";
+    bench_backend.get_raw_image_method = bench_get_raw_image;
+    handle->backend                    = &bench_backend;
+
+    bench_print_header(csv);
+
+    for (i = 0; i < ARRAY_SIZE(bench_items); i++) {
+        if (bench_selected(&bench_items[i], argc, argv, first) == FALSE) {
+            continue;
+        }
+
+        // Detect kernels run in detect mode, the others in image mode
+        status = fps_switch_sensor_mode(handle,
+                                        ((bench_items[i].kernel == bench_detect_threshold) ?
+                                         FPS_DETECT_MODE : FPS_IMAGE_MODE),
+                                        NULL);
+        if (status < 0) {
+            goto main_end;
+        }
+
+        status = bench_run(handle, &bench_items[i], calls, &result);
+        if (status < 0) {
+            LOG_ERROR("%s failed!\n", bench_items[i].name);
+            free(result.latency_us);
+            goto main_end;
+        }
+
+        bench_print_result(csv, &bench_items[i], &result);
+
+        free(result.latency_us);
+    }
+
+main_end :
+
+    if (handle != NULL) {
+        handle->backend = &fps_sim_backend;
+        (void) fps_close_sensor(&handle);
+    }
+
+    bench_free_frames();
+    free(bench_img);
+
+    return (status < 0) ? 1 : 0;
+}
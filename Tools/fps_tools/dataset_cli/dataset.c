@@ -0,0 +1,203 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Dataset Viewer and Exporter
+// -----------------------------------------------------------------------------
+// NOTE: Works offline on the datasets the image mode test of the analyzer
+//       writes. Without an output folder it prints the header, the register
+//       file and one line per frame; with one it exports the frames, or the
+//       frame with a given sequence number, as BMP or PGM files named after
+//       their sequence number. The dataset is memory-mapped, so only the
+//       pages of the frames exported are read.
+//
+//       Build with "make CROSS_TOOLCHAIN= dataset" to run it on the host.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "debug.h"
+#include "fps.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Dataset Output
+//
+
+static void
+ds_show_usage(char *program)
+{
+    printf("Usage: %s [options] FILE\n", program);
+    printf("\n");
+    printf("    -o FOLDER     Export the frames into FOLDER instead of listing them\n");
+    printf("    -f FORMAT     Export format, \"bmp\" or \"pgm\" (default: bmp)\n");
+    printf("    -s SEQ        Only the frame with sequence number SEQ\n");
+    printf("    -h            This help\n");
+}
+
+static void
+ds_show_header(fps_dataset_map_t *map)
+{
+    fps_dataset_header_t *header = fps_get_dataset_header(map);
+    unsigned int         i;
+
+    printf("Chip ID          = 0x%04X\n", header->chip_id);
+    printf("Power Config     = %0u\n", header->power_config);
+    printf("Sensor Size      = %0ux%0u\n", header->sensor_width, header->sensor_height);
+    printf("Image Window     = (%0u,%0u):(%0u,%0u)\n",
+           header->col_begin, header->row_begin, header->col_end, header->row_end);
+    printf("Image Size       = %0ux%0u\n", header->img_width, header->img_height);
+    printf("Frames Averaged  = %0u\n", header->frms_to_avg);
+    printf("Image Type       = %0u\n", header->img_type);
+    printf("Background Avg.  = %0.3f\n", header->bkgnd_avg);
+    printf("Frames           = %0d%s\n", fps_get_dataset_frames(map),
+           (fps_get_dataset_index(map) == NULL) ? " (not closed, no index)" : "");
+    printf("\n");
+
+    printf("Registers:");
+    for (i = 0; i < header->reg_count; i++) {
+        if ((i % 16) == 0) {
+            printf("\n    0x%02X:", i);
+        }
+        printf(" %02X", header->registers[i]);
+    }
+    printf("\n");
+    printf("\n");
+}
+
+static void
+ds_show_frames(fps_dataset_map_t *map)
+{
+    fps_dataset_record_t *record;
+    int                  frames;
+    int                  i;
+
+    frames = fps_get_dataset_frames(map);
+
+    printf("%8s %14s %10s %10s %10s %10s\n", "Seq", "Time ms", "Avg.", "Var.", "Noise", "DR");
+
+    for (i = 0; i < frames; i++) {
+        record = fps_get_dataset_record(map, i, NULL);
+
+        printf("%8u %14.3f %10.3f %10.3f %10.3f %10.3f\n",
+               record->seq, record->time_us / 1000.0,
+               record->img_avg, record->img_var, record->img_noise, record->img_dr);
+    }
+}
+
+static int
+ds_export_frame(fps_dataset_map_t *map,
+                int               frame,
+                char              *folder,
+                int               format)
+{
+    fps_dataset_record_t *record;
+    char                 path[MAX_FNAME_LENGTH];
+
+    record = fps_get_dataset_record(map, frame, NULL);
+
+    sprintf(path, "%s/%03u.%s", folder, record->seq, (format == FPS_EXPORT_PGM) ? "pgm" : "bmp");
+
+    return fps_export_dataset_frame(map, frame, path, format);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Main
+//
+
+int
+main(int argc, char *argv[])
+{
+    int               status  = 0;
+    fps_dataset_map_t *map    = NULL;
+    char              *path   = NULL;
+    char              *folder = NULL;
+    int               format  = FPS_EXPORT_BMP;
+    int               single  = FALSE;
+    unsigned int      seq     = 0;
+    int               frame   = 0;
+    int               frames;
+    int               i;
+
+    for (i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-o") == 0) && ((i + 1) < argc)) {
+            folder = argv[++i];
+        } else if ((strcmp(argv[i], "-f") == 0) && ((i + 1) < argc)) {
+            i++;
+            if (strcmp(argv[i], "bmp") == 0) {
+                format = FPS_EXPORT_BMP;
+            } else if (strcmp(argv[i], "pgm") == 0) {
+                format = FPS_EXPORT_PGM;
+            } else {
+                ds_show_usage(argv[0]);
+                return 1;
+            }
+        } else if ((strcmp(argv[i], "-s") == 0) && ((i + 1) < argc)) {
+            seq    = (unsigned int) strtoul(argv[++i], NULL, 10);
+            single = TRUE;
+        } else if (strcmp(argv[i], "-h") == 0) {
+            ds_show_usage(argv[0]);
+            return 0;
+        } else if ((argv[i][0] != '-') && (path == NULL)) {
+            path = argv[i];
+        } else {
+            ds_show_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (path == NULL) {
+        ds_show_usage(argv[0]);
+        return 1;
+    }
+
+    (void) set_debug_level(LOG_LEVEL_ERROR);
+
+    map = fps_map_dataset(path);
+    if (map == NULL) {
+        return 1;
+    }
+
+    frames = fps_get_dataset_frames(map);
+
+    if (single == TRUE) {
+        frame = fps_find_dataset_frame(map, seq);
+        if (frame < 0) {
+            LOG_ERROR("No frame with sequence number %0u!\n", seq);
+            status = -1;
+            goto main_end;
+        }
+    }
+
+    if (folder == NULL) {
+        ds_show_header(map);
+
+        if (single == TRUE) {
+            printf("Frame %0u is record %0d\n", seq, frame);
+        } else {
+            ds_show_frames(map);
+        }
+        goto main_end;
+    }
+
+    if (single == TRUE) {
+        status = ds_export_frame(map, frame, folder, format);
+    } else {
+        for (i = 0; (i < frames) && (status == 0); i++) {
+            status = ds_export_frame(map, i, folder, format);
+        }
+    }
+
+    if (status == 0) {
+        printf("%0d frame(s) exported to %s\n", ((single == TRUE) ? 1 : frames), folder);
+    }
+
+main_end :
+
+    (void) fps_unmap_dataset(&map);
+
+    return (status < 0) ? 1 : 0;
+}
@@ -0,0 +1,1089 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// DFS747 Driver Emulator
+// -----------------------------------------------------------------------------
+// NOTE: A CUSE character device, /dev/dfs0 by default, which speaks the ioctl
+//       ABI of driver/dfs747_driver.c on top of the simulated sensor. The
+//       native Linux backend talks to it unchanged, so the whole stack from
+//       ioctl marshalling to the poll() based fps_wait_event() can be run and
+//       timed on any Linux box.
+//
+//       Like the driver it handles one fps_ioc_transfer per ioctl:
+//         REGISTER_MASS_READ/WRITE, GET_ONE_IMG, READ_CHIP_ID, RESET_SENSOR,
+//         SET_CLKRATE, WAKELOCK, SENDKEY, INTR_INIT/READ/CLOSE
+//
+//       Each SPI transfer takes as long as its bytes at the configured clock
+//       rate, plus a fixed setup time. Reset keeps the msleep() delays of the
+//       driver. The interrupt pin is watched by a thread, and a rising edge
+//       wakes poll() and INTR_READ. After each interrupt the IRQ is held off
+//       for 10 ms, with edges in between replayed, as the driver does.
+//       --holdoff=0 takes the hold-off out, to tell its effect on detect
+//       calibration apart from that of the rest of the stack.
+//
+//       --check needs no device: it calibrates through the emulation and
+//       through the plain simulator in-process, and compares the results.
+//
+//       Send SIGUSR1 to put the simulated finger on or take it off.
+//
+//       Build natively with "make CROSS_TOOLCHAIN= emulator", which needs
+//       libfuse. Creating the device needs root, e.g.
+//         sudo ./dfs_emulator -f --name=dfs0
+//
+
+#define FUSE_USE_VERSION 29
+
+#include <cuse_lowlevel.h>
+#include <fuse_opt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include "common.h"
+#include "debug.h"
+#include "fps.h"
+#include "fps_control.h"
+#include "linux/fps_control_linux.h"
+#include "simulator/fps_simulator.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Emulator Settings
+//
+
+#define EMU_DEFAULT_NAME         "dfs0"
+#define EMU_DEFAULT_SPEED_HZ     (1000000)
+#define EMU_TRANSFER_SETUP_US    (20.0)     // spi_sync() overhead per transfer
+#define EMU_RESET_LOW_US         (30000.0)  // msleep(30) in RESET_SENSOR
+#define EMU_RESET_HIGH_US        (20000.0)  // msleep(20) in RESET_SENSOR
+#define EMU_DEFAULT_HOLDOFF_MS   (10)       // fp_delay_work re-enables the IRQ
+#define EMU_TICK_US              (1000.0)   // pin check while detection is off
+#define EMU_INTR_READ_TIMEOUT_US (100000.0) // rechecks for interrupted requests
+#define EMU_IMG_CHUNK            (1024)     // image transfers are padded to this
+#define EMU_INTERRUPT_VALUE      ('0')
+
+// Self check
+#define EMU_CHECK_FRAMES_TO_AVG  (4)
+#define EMU_CHECK_DET_WIDTH      (8)
+#define EMU_CHECK_DET_HEIGHT     (8)
+#define EMU_CHECK_FRAMES_TO_SUSP (4)
+#define EMU_CHECK_PERIOD_ERROR   (0.05)     // of the simulator's period
+
+typedef struct __emu_options {
+    char         *dev_name;
+    unsigned int dev_major;
+    unsigned int dev_minor;
+    unsigned int seed;
+    unsigned int holdoff_ms;
+    int          check;
+    int          show_help;
+} emu_options_t;
+
+typedef struct __emu_device {
+    fps_handle_t           *sim;
+    pthread_mutex_t        lock;
+    pthread_cond_t         irq_cond;
+    pthread_t              ticker;
+    int                    ticker_started;
+    int                    running;
+    int                    speed_hz;
+    int                    finger;
+    int                    irq_line;
+    int                    irq_enabled;
+    int                    irq_pending;
+    double                 irq_holdoff_len_us;
+    double                 irq_holdoff_us;
+    int                    ev_press;
+    struct fuse_pollhandle *poll_handle;
+} emu_device_t;
+
+static emu_device_t emu;
+
+static volatile sig_atomic_t finger_toggle = 0;
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SPI Timing
+//
+
+static void
+emu_spi_transfer(size_t bytes)
+{
+    fps_sleep(EMU_TRANSFER_SETUP_US +
+              ((double) (bytes * 8)) * 1000000.0 / ((double) emu.speed_hz));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Interrupt Pin
+// -----------------------------------------------------------------------------
+// NOTE: Everything below is called with emu.lock held.
+//
+
+static void
+emu_raise_interrupt(double now_us)
+{
+    emu.ev_press    = TRUE;
+    emu.irq_pending = FALSE;
+
+    if (emu.irq_holdoff_len_us > 0.0) {
+        emu.irq_enabled    = FALSE;
+        emu.irq_holdoff_us = now_us + emu.irq_holdoff_len_us;
+    }
+
+    pthread_cond_broadcast(&emu.irq_cond);
+
+    if (emu.poll_handle != NULL) {
+        fuse_lowlevel_notify_poll(emu.poll_handle);
+        fuse_pollhandle_destroy(emu.poll_handle);
+        emu.poll_handle = NULL;
+    }
+}
+
+static void
+emu_enable_interrupt(double now_us)
+{
+    emu.irq_enabled    = TRUE;
+    emu.irq_holdoff_us = 0.0;
+
+    // Edges while the IRQ was disabled are resent on enable
+    if (emu.irq_pending == TRUE) {
+        emu_raise_interrupt(now_us);
+    }
+}
+
+// Run the scans due by now and follow the pin, returns the next scan time
+static double
+emu_update_interrupt(void)
+{
+    double now_us;
+    double next_scan_us;
+    int    line;
+
+    line   = fps_sim_run_scans(emu.sim, &next_scan_us);
+    now_us = fps_get_time_us();
+
+    if ((emu.irq_holdoff_us > 0.0) && (now_us >= emu.irq_holdoff_us)) {
+        emu_enable_interrupt(now_us);
+    }
+
+    // IRQF_TRIGGER_RISING
+    if ((line == TRUE) && (emu.irq_line == FALSE)) {
+        if (emu.irq_enabled == TRUE) {
+            emu_raise_interrupt(now_us);
+        } else {
+            emu.irq_pending = TRUE;
+        }
+    }
+
+    emu.irq_line = line;
+
+    return next_scan_us;
+}
+
+static void*
+emu_ticker(void *arg)
+{
+    double next_scan_us;
+    double wake_us;
+
+    pthread_mutex_lock(&emu.lock);
+
+    while (emu.running == TRUE) {
+        if (finger_toggle != 0) {
+            finger_toggle = 0;
+            emu.finger    = !emu.finger;
+
+            (void) fps_sim_set_finger(emu.sim, emu.finger);
+            LOG_INFO("Finger %s\n", (emu.finger ? "on" : "off"));
+        }
+
+        next_scan_us = emu_update_interrupt();
+
+        wake_us = fps_get_time_us() + EMU_TICK_US;
+
+        if (next_scan_us >= 0.0) {
+            wake_us = MIN(wake_us, next_scan_us);
+        }
+
+        if (emu.irq_holdoff_us > 0.0) {
+            wake_us = MIN(wake_us, emu.irq_holdoff_us);
+        }
+
+        pthread_mutex_unlock(&emu.lock);
+        fps_sleep_until(wake_us);
+        pthread_mutex_lock(&emu.lock);
+    }
+
+    pthread_mutex_unlock(&emu.lock);
+
+    return NULL;
+}
+
+static void
+emu_toggle_finger(int signum)
+{
+    finger_toggle = 1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Transfer Lengths
+// -----------------------------------------------------------------------------
+// NOTE: The user buffers behind tx_buf and rx_buf, as the driver reads and
+//       writes them for each opcode. GET_ONE_IMG needs tx_buf to size rx_buf.
+//
+
+static size_t
+emu_tx_length(struct fps_ioc_transfer *tr)
+{
+    switch (tr->opcode) {
+        case FPS_IOC_REGISTER_MASS_READ  : return tr->len;
+        case FPS_IOC_REGISTER_MASS_WRITE : return tr->len;
+        case FPS_IOC_GET_ONE_IMG         : return 6;
+        default                          : return 0;
+    }
+}
+
+static size_t
+emu_rx_length(struct fps_ioc_transfer *tr,
+              const uint8_t           *tx)
+{
+    switch (tr->opcode) {
+        case FPS_IOC_REGISTER_MASS_READ : return tr->len;
+        case FPS_IOC_GET_ONE_IMG        : return (tx[0] * tx[1]) + tx[2];
+        case FPS_IOC_READ_CHIP_ID       : return 2;
+        case FPS_IOC_INTR_INIT          : return 1;
+        case FPS_IOC_INTR_READ          : return 1;
+        default                         : return 0;
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Driver Operations
+// -----------------------------------------------------------------------------
+// NOTE: Called with emu.lock held, which stands for the driver's buf_lock.
+//       Return the ioctl result, or a negative errno.
+//
+
+static int
+emu_read_chip_id(uint8_t *rx)
+{
+    int chip_id;
+
+    emu_spi_transfer(3);
+
+    if (fps_get_chip_id(emu.sim, &chip_id) < 0) {
+        return -EIO;
+    }
+
+    rx[0] = (uint8_t) ((chip_id >> 8) & 0xFF);
+    rx[1] = (uint8_t) ((chip_id >> 0) & 0xFF);
+
+    return 0;
+}
+
+static int
+emu_reset_sensor(int state)
+{
+    if (fps_reset_sensor(emu.sim, state) < 0) {
+        return -EIO;
+    }
+
+    fps_sleep((state == 0) ? EMU_RESET_LOW_US : EMU_RESET_HIGH_US);
+
+    (void) emu_update_interrupt();
+
+    return 0;
+}
+
+static int
+emu_mass_read(const uint8_t *tx,
+              uint8_t       *rx,
+              size_t        length)
+{
+    // Opcode + (address, dummy) per register
+    emu_spi_transfer(1 + (length * 2));
+
+    if (fps_multiple_read(emu.sim, (uint8_t *) tx, rx, length) < 0) {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static int
+emu_mass_write(const uint8_t *tx,
+               size_t        length)
+{
+    uint8_t addr[128];
+    uint8_t data[128];
+    size_t  count;
+    size_t  i;
+
+    // Opcode + (address, data) per register + dummy
+    emu_spi_transfer(1 + length + 1);
+
+    while (length >= 2) {
+        count = MIN(length / 2, ARRAY_SIZE(addr));
+
+        for (i = 0; i < count; i++) {
+            addr[i] = tx[(i * 2) + 0];
+            data[i] = tx[(i * 2) + 1];
+        }
+
+        if (fps_multiple_write(emu.sim, addr, data, count) < 0) {
+            return -EIO;
+        }
+
+        tx     += count * 2;
+        length -= count * 2;
+    }
+
+    // A write may raise or lower the pin, e.g. INT_CTL or clearing events
+    (void) emu_update_interrupt();
+
+    return 0;
+}
+
+static int
+emu_get_one_image(const uint8_t *tx,
+                  uint8_t       *rx)
+{
+    int     status = 0;
+    int     img_width;
+    int     img_height;
+    int     dummy;
+    int     latency;
+    size_t  read_count;
+    uint8_t *raw;
+
+    img_width  = tx[0];
+    img_height = tx[1];
+    dummy      = tx[2];
+    read_count = (img_width * img_height) + dummy;
+    latency    = emu.sim->latency;
+
+    // Opcode + image, padded like the driver's burst read
+    emu_spi_transfer(((1 + read_count + EMU_IMG_CHUNK - 1) / EMU_IMG_CHUNK) * EMU_IMG_CHUNK);
+
+    raw = (uint8_t *) malloc((img_width * img_height) + latency);
+    if (raw == NULL) {
+        return -ENOMEM;
+    }
+
+    if (fps_get_raw_image(emu.sim, img_width, img_height, raw) < 0) {
+        status = -EIO;
+        goto emu_get_one_image_end;
+    }
+
+    // The simulator gives its own latency, the caller asks for dummy pixels
+    memset(rx, 0x00, dummy);
+    memcpy(&rx[dummy], &raw[latency], img_width * img_height);
+
+emu_get_one_image_end :
+
+    free(raw);
+
+    return status;
+}
+
+// Like fps_interrupt_poll(), reporting an interrupt acknowledges it
+static unsigned int
+emu_take_interrupt(void)
+{
+    if (emu.ev_press == FALSE) {
+        return 0;
+    }
+
+    emu.ev_press = FALSE;
+
+    return POLLIN | POLLRDNORM;
+}
+
+static int
+emu_interrupt_read(fuse_req_t            req,
+                   struct fuse_file_info *fi,
+                   uint8_t               *rx)
+{
+    struct timespec timeout;
+
+    if ((fi->flags & O_NONBLOCK) != 0) {
+        return -EAGAIN;
+    }
+
+    // Blocks until an interrupt, which poll() acknowledges, not this read
+    while ((emu.ev_press == FALSE) && (emu.running == TRUE)) {
+        if (fuse_req_interrupted(req)) {
+            return -EINTR;
+        }
+
+        // pthread_cond_timedwait() is on CLOCK_REALTIME
+        clock_gettime(CLOCK_REALTIME, &timeout);
+
+        timeout.tv_nsec += (long) (EMU_INTR_READ_TIMEOUT_US * 1000.0);
+        timeout.tv_sec  += timeout.tv_nsec / 1000000000L;
+        timeout.tv_nsec  = timeout.tv_nsec % 1000000000L;
+
+        (void) pthread_cond_timedwait(&emu.irq_cond, &emu.lock, &timeout);
+    }
+
+    rx[0] = EMU_INTERRUPT_VALUE;
+
+    return 1;
+}
+
+static int
+emu_transfer(fuse_req_t              req,
+             struct fuse_file_info   *fi,
+             struct fps_ioc_transfer *tr,
+             const uint8_t           *tx,
+             uint8_t                 *rx)
+{
+    switch (tr->opcode) {
+        case FPS_IOC_READ_CHIP_ID :
+            return emu_read_chip_id(rx);
+
+        case FPS_IOC_RESET_SENSOR :
+            return emu_reset_sensor(tr->len != 0);
+
+        case FPS_IOC_SET_CLKRATE :
+            if (tr->len == 0) {
+                return -EINVAL;
+            }
+            emu.speed_hz = (int) tr->len;
+            return 0;
+
+        case FPS_IOC_REGISTER_MASS_READ :
+            return emu_mass_read(tx, rx, tr->len);
+
+        case FPS_IOC_REGISTER_MASS_WRITE :
+            return emu_mass_write(tx, tr->len);
+
+        case FPS_IOC_GET_ONE_IMG :
+            return emu_get_one_image(tx, rx);
+
+        case FPS_IOC_INTR_INIT :
+            if (emu.irq_enabled == FALSE) {
+                emu_enable_interrupt(fps_get_time_us());
+            }
+            return emu_interrupt_read(req, fi, rx);
+
+        case FPS_IOC_INTR_CLOSE :
+            emu.irq_enabled    = FALSE;
+            emu.irq_holdoff_us = 0.0;
+            return 0;
+
+        case FPS_IOC_INTR_READ :
+            return emu_interrupt_read(req, fi, rx);
+
+        default :
+            // WAKELOCK, SENDKEY and unknown opcodes do nothing
+            return 0;
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// CUSE Operations
+// -----------------------------------------------------------------------------
+// NOTE: The ioctl carries pointers into the caller, so it is unrestricted and
+//       fetched in steps: the fps_ioc_transfer, then its tx_buf, then rx_buf
+//       is mapped for the reply. Each step is a retry with all buffers known
+//       so far.
+//
+
+static void
+emu_open(fuse_req_t            req,
+         struct fuse_file_info *fi)
+{
+    fuse_reply_open(req, fi);
+}
+
+static void
+emu_release(fuse_req_t            req,
+            struct fuse_file_info *fi)
+{
+    fuse_reply_err(req, 0);
+}
+
+static void
+emu_ioctl(fuse_req_t            req,
+          int                   cmd,
+          void                  *arg,
+          struct fuse_file_info *fi,
+          unsigned int          flags,
+          const void            *in_buf,
+          size_t                in_bufsz,
+          size_t                out_bufsz)
+{
+    int                     status = 0;
+    struct fps_ioc_transfer tr;
+    struct iovec            in_iov[2];
+    struct iovec            out_iov;
+    size_t                  in_count;
+    size_t                  tx_len;
+    size_t                  rx_len;
+    const uint8_t           *tx;
+    uint8_t                 *rx = NULL;
+
+    if ((flags & FUSE_IOCTL_COMPAT) != 0) {
+        fuse_reply_err(req, ENOSYS);
+        return;
+    }
+
+    if (((unsigned int) cmd) != ((unsigned int) FPS_IOC_MESSAGE(1))) {
+        fuse_reply_err(req, ENOTTY);
+        return;
+    }
+
+    in_iov[0].iov_base = arg;
+    in_iov[0].iov_len  = sizeof(tr);
+    in_count           = 1;
+
+    if (in_bufsz < sizeof(tr)) {
+        fuse_reply_ioctl_retry(req, in_iov, in_count, NULL, 0);
+        return;
+    }
+
+    memcpy(&tr, in_buf, sizeof(tr));
+
+    tx_len = emu_tx_length(&tr);
+    if (tx_len > 0) {
+        in_iov[1].iov_base = (void *) (uintptr_t) tr.tx_buf;
+        in_iov[1].iov_len  = tx_len;
+        in_count           = 2;
+    }
+
+    if (in_bufsz < (sizeof(tr) + tx_len)) {
+        fuse_reply_ioctl_retry(req, in_iov, in_count, NULL, 0);
+        return;
+    }
+
+    tx = ((const uint8_t *) in_buf) + sizeof(tr);
+
+    rx_len = emu_rx_length(&tr, tx);
+    if (out_bufsz < rx_len) {
+        out_iov.iov_base = (void *) (uintptr_t) tr.rx_buf;
+        out_iov.iov_len  = rx_len;
+
+        fuse_reply_ioctl_retry(req, in_iov, in_count, &out_iov, 1);
+        return;
+    }
+
+    if (rx_len > 0) {
+        rx = (uint8_t *) malloc(rx_len);
+        if (rx == NULL) {
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+
+        memset(rx, 0x00, rx_len);
+    }
+
+    pthread_mutex_lock(&emu.lock);
+    status = emu_transfer(req, fi, &tr, tx, rx);
+    pthread_mutex_unlock(&emu.lock);
+
+    if (status < 0) {
+        fuse_reply_err(req, -status);
+    } else {
+        fuse_reply_ioctl(req, status, rx, rx_len);
+    }
+
+    if (rx != NULL) {
+        free(rx);
+    }
+}
+
+static void
+emu_poll(fuse_req_t             req,
+         struct fuse_file_info  *fi,
+         struct fuse_pollhandle *ph)
+{
+    unsigned int revents = 0;
+
+    pthread_mutex_lock(&emu.lock);
+
+    if (ph != NULL) {
+        if (emu.poll_handle != NULL) {
+            fuse_pollhandle_destroy(emu.poll_handle);
+        }
+        emu.poll_handle = ph;
+    }
+
+    revents = emu_take_interrupt();
+
+    pthread_mutex_unlock(&emu.lock);
+
+    fuse_reply_poll(req, revents);
+}
+
+static void
+emu_init_done(void *userdata)
+{
+    emu.running = TRUE;
+
+    if (pthread_create(&emu.ticker, NULL, emu_ticker, NULL) != 0) {
+        LOG_ERROR("Starting the interrupt thread failed!\n");
+        emu.running = FALSE;
+        return;
+    }
+
+    emu.ticker_started = TRUE;
+}
+
+static void
+emu_destroy(void *userdata)
+{
+    pthread_mutex_lock(&emu.lock);
+    emu.running = FALSE;
+    pthread_cond_broadcast(&emu.irq_cond);
+    pthread_mutex_unlock(&emu.lock);
+
+    if (emu.ticker_started == TRUE) {
+        (void) pthread_join(emu.ticker, NULL);
+    }
+}
+
+static const struct cuse_lowlevel_ops emu_ops = {
+    .init_done = emu_init_done,
+    .destroy   = emu_destroy,
+    .open      = emu_open,
+    .release   = emu_release,
+    .ioctl     = emu_ioctl,
+    .poll      = emu_poll,
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Self Check
+// -----------------------------------------------------------------------------
+// NOTE: "--check" runs sensor init, image calibration and detect calibration
+//       twice, without creating a device: once on a simulator handle of its
+//       own, the in-process reference, and once on a handle whose backend
+//       calls the driver operations above directly. The second run goes
+//       through the same SPI timing, interrupt thread, IRQ hold-off and
+//       poll() acknowledge as a client of /dev/dfs0, minus the ioctl
+//       marshalling. The check fails when the detect threshold or CDS offset
+//       differ, or when the detect period is off by more than
+//       EMU_CHECK_PERIOD_ERROR.
+//
+
+typedef struct __emu_check_result {
+    int          status;
+    int          detect_th;
+    int          cds_offset;
+    double       period_us;
+    unsigned int scans;
+    double       time_ms;
+} emu_check_result_t;
+
+static int
+emu_check_reset_sensor(fps_handle_t *handle,
+                       int          state)
+{
+    int status = 0;
+
+    pthread_mutex_lock(&emu.lock);
+    status = emu_reset_sensor(state != 0);
+    pthread_mutex_unlock(&emu.lock);
+
+    return status;
+}
+
+static int
+emu_check_set_sensor_speed(fps_handle_t *handle,
+                           int          speed_hz)
+{
+    pthread_mutex_lock(&emu.lock);
+    emu.speed_hz = speed_hz;
+    pthread_mutex_unlock(&emu.lock);
+
+    return 0;
+}
+
+static int
+emu_check_get_chip_id(fps_handle_t *handle,
+                      int          *chip_id)
+{
+    int     status = 0;
+    uint8_t rx[2];
+
+    memset(rx, 0x00, sizeof(rx));
+
+    pthread_mutex_lock(&emu.lock);
+    status = emu_read_chip_id(rx);
+    pthread_mutex_unlock(&emu.lock);
+
+    *chip_id = (((int) rx[0]) << 8) | ((int) rx[1]);
+
+    return status;
+}
+
+static int
+emu_check_multiple_read(fps_handle_t *handle,
+                        uint8_t      *addr,
+                        uint8_t      *data,
+                        size_t       length)
+{
+    int status = 0;
+
+    pthread_mutex_lock(&emu.lock);
+    status = emu_mass_read(addr, data, length);
+    pthread_mutex_unlock(&emu.lock);
+
+    return status;
+}
+
+static int
+emu_check_multiple_write(fps_handle_t *handle,
+                         uint8_t      *addr,
+                         uint8_t      *data,
+                         size_t       length)
+{
+    int     status = 0;
+    uint8_t tx[256];
+    size_t  count;
+    size_t  i;
+
+    // In (address, data) pairs, like the Linux backend sends them
+    while (length > 0) {
+        count = MIN(length, ARRAY_SIZE(tx) / 2);
+
+        for (i = 0; i < count; i++) {
+            tx[(i * 2) + 0] = addr[i];
+            tx[(i * 2) + 1] = data[i];
+        }
+
+        pthread_mutex_lock(&emu.lock);
+        status = emu_mass_write(tx, count * 2);
+        pthread_mutex_unlock(&emu.lock);
+
+        if (status < 0) {
+            return status;
+        }
+
+        addr   += count;
+        data   += count;
+        length -= count;
+    }
+
+    return 0;
+}
+
+static int
+emu_check_get_raw_image(fps_handle_t *handle,
+                        int          img_width,
+                        int          img_height,
+                        uint8_t      *img_buf)
+{
+    int     status = 0;
+    uint8_t tx[3];
+
+    tx[0] = (uint8_t) img_width;
+    tx[1] = (uint8_t) img_height;
+    tx[2] = (uint8_t) handle->latency;
+
+    pthread_mutex_lock(&emu.lock);
+    status = emu_get_one_image(tx, img_buf);
+    pthread_mutex_unlock(&emu.lock);
+
+    return status;
+}
+
+// Like fps_linux_wait_event() on poll(), returns revents
+static int
+emu_check_wait_event(fps_handle_t *handle,
+                     double       sleep_us)
+{
+    double          deadline_us;
+    double          wait_us;
+    unsigned int    revents;
+    struct timespec timeout;
+
+    deadline_us = fps_get_time_us() + sleep_us;
+
+    pthread_mutex_lock(&emu.lock);
+
+    while ((emu.ev_press == FALSE) && (emu.running == TRUE)) {
+        wait_us = EMU_INTR_READ_TIMEOUT_US;
+
+        if (sleep_us >= 0) {
+            wait_us = MIN(wait_us, deadline_us - fps_get_time_us());
+            if (wait_us <= 0.0) {
+                break;
+            }
+        }
+
+        // pthread_cond_timedwait() is on CLOCK_REALTIME
+        clock_gettime(CLOCK_REALTIME, &timeout);
+
+        timeout.tv_nsec += (long) (wait_us * 1000.0);
+        timeout.tv_sec  += timeout.tv_nsec / 1000000000L;
+        timeout.tv_nsec  = timeout.tv_nsec % 1000000000L;
+
+        (void) pthread_cond_timedwait(&emu.irq_cond, &emu.lock, &timeout);
+    }
+
+    revents = emu_take_interrupt();
+
+    pthread_mutex_unlock(&emu.lock);
+
+    return (int) revents;
+}
+
+static fps_backend_t emu_check_backend = {
+    "emulator",
+    NULL,
+    emu_check_reset_sensor,
+    emu_check_set_sensor_speed,
+    emu_check_get_chip_id,
+    emu_check_multiple_read,
+    emu_check_multiple_write,
+    emu_check_get_raw_image,
+    emu_check_wait_event,
+};
+
+static void
+emu_check_run(fps_handle_t       *handle,
+              emu_check_result_t *result)
+{
+    int          status = 0;
+    unsigned int steps;
+    double       start_us;
+
+    memset(result, 0x00, sizeof(emu_check_result_t));
+
+    status = fps_init_sensor(handle);
+    if (status < 0) {
+        goto emu_check_run_end;
+    }
+
+    status = fps_image_calibration(handle, handle->sensor_width, handle->sensor_height,
+                                   EMU_CHECK_FRAMES_TO_AVG);
+    if (status < 0) {
+        goto emu_check_run_end;
+    }
+
+    (void) fps_clear_scan_counters(handle);
+    start_us = fps_get_clock_time_us(handle);
+
+    status = fps_detect_calibration(handle, EMU_CHECK_DET_WIDTH, EMU_CHECK_DET_HEIGHT,
+                                    EMU_CHECK_FRAMES_TO_SUSP);
+    if (status < 0) {
+        goto emu_check_run_end;
+    }
+
+    result->time_ms = (fps_get_clock_time_us(handle) - start_us) / 1000.0;
+
+    (void) fps_get_scan_counters(handle, &steps, &result->scans, NULL);
+    (void) fps_get_detect_period(handle, &result->period_us);
+
+    status = fps_get_sensor_parameter(handle, (FPS_DETECT_MODE | FPS_PARAM_DETECT_THRESHOLD),
+                                      &result->detect_th);
+    if (status < 0) {
+        goto emu_check_run_end;
+    }
+
+    status = fps_get_sensor_parameter(handle, (FPS_DETECT_MODE | FPS_PARAM_CDS_OFFSET_1),
+                                      &result->cds_offset);
+
+emu_check_run_end :
+
+    result->status = status;
+}
+
+static void
+emu_check_print(const char         *name,
+                emu_check_result_t *result)
+{
+    printf("%-10s status %2d, threshold 0x%02X, CDS offset 0x%03X, period %0.3f us, "
+           "%u scans in %0.1f ms\n",
+           name, result->status, result->detect_th, result->cds_offset,
+           result->period_us, result->scans, result->time_ms);
+}
+
+static int
+emu_check(fps_sim_config_t *config)
+{
+    fps_handle_t       *handle;
+    emu_check_result_t expect;
+    emu_check_result_t actual;
+
+    // Only what goes wrong, the results follow
+    (void) set_debug_level(LOG_LEVEL_WARN);
+
+    handle = fps_open_simulator(config);
+    if (handle == NULL) {
+        LOG_ERROR("Opening the simulated sensor failed!\n");
+        return -1;
+    }
+
+    emu_check_run(handle, &expect);
+    (void) fps_close_sensor(&handle);
+
+    emu_init_done(NULL);
+    if (emu.running == FALSE) {
+        return -1;
+    }
+
+    handle = fps_attach_backend(-1, &emu_check_backend, NULL);
+    if (handle == NULL) {
+        emu_destroy(NULL);
+        return -1;
+    }
+
+    emu_check_run(handle, &actual);
+    (void) fps_close_sensor(&handle);
+
+    emu_destroy(NULL);
+
+    emu_check_print("simulator", &expect);
+    emu_check_print("emulator",  &actual);
+
+    if ((expect.status < 0) || (actual.status < 0) ||
+        (expect.detect_th  != actual.detect_th) ||
+        (expect.cds_offset != actual.cds_offset) ||
+        (fabs(actual.period_us - expect.period_us) >
+         (expect.period_us * EMU_CHECK_PERIOD_ERROR))) {
+        printf("FAILED with a %0.1f ms IRQ hold-off\n", emu.irq_holdoff_len_us / 1000.0);
+        return -1;
+    }
+
+    printf("Passed with a %0.1f ms IRQ hold-off\n", emu.irq_holdoff_len_us / 1000.0);
+
+    return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Main
+//
+
+#define EMU_OPT(_t_, _p_) { _t_, offsetof(emu_options_t, _p_), 1 }
+
+static const struct fuse_opt emu_opts[] = {
+    EMU_OPT("-n %s",         dev_name),
+    EMU_OPT("--name=%s",     dev_name),
+    EMU_OPT("-M %u",         dev_major),
+    EMU_OPT("--maj=%u",      dev_major),
+    EMU_OPT("-m %u",         dev_minor),
+    EMU_OPT("--min=%u",      dev_minor),
+    EMU_OPT("--seed=%u",     seed),
+    EMU_OPT("--holdoff=%u",  holdoff_ms),
+    EMU_OPT("--check",       check),
+    EMU_OPT("-h",            show_help),
+    EMU_OPT("--help",        show_help),
+    FUSE_OPT_END
+};
+
+static void
+emu_show_usage(char *program)
+{
+    printf("Usage: %s [options]\n", program);
+    printf("\n");
+    printf("    -n, --name=NAME   Device name, /dev/NAME (default: %s)\n", EMU_DEFAULT_NAME);
+    printf("    -M, --maj=MAJ     Device major number                \n");
+    printf("    -m, --min=MIN     Device minor number                \n");
+    printf("        --seed=SEED   Seed of the simulated sensor       \n");
+    printf("        --holdoff=MS  IRQ hold-off after an interrupt (default: %0d)\n", EMU_DEFAULT_HOLDOFF_MS);
+    printf("        --check       Calibrate through the emulation and the simulator\n");
+    printf("                      in-process, and compare, without a device\n");
+    printf("    -f                Run in foreground                  \n");
+    printf("    -d                Debug output, implies -f           \n");
+    printf("    -s                Single threaded (INTR_READ blocks all requests)\n");
+    printf("\n");
+    printf("Send SIGUSR1 to put the simulated finger on or take it off.\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    int              status = 0;
+    struct fuse_args args   = FUSE_ARGS_INIT(argc, argv);
+    emu_options_t    opts;
+    fps_sim_config_t config;
+    struct cuse_info ci;
+    char             dev_name[MAX_STRING_LENGTH];
+    const char       *dev_info_argv[1];
+
+    memset(&opts, 0x00, sizeof(opts));
+    fps_sim_default_config(&config);
+    opts.seed       = config.seed;
+    opts.holdoff_ms = EMU_DEFAULT_HOLDOFF_MS;
+
+    if (fuse_opt_parse(&args, &opts, emu_opts, NULL) < 0) {
+        return 1;
+    }
+
+    if (opts.show_help != 0) {
+        emu_show_usage(argv[0]);
+        return 0;
+    }
+
+    snprintf(dev_name, sizeof(dev_name), "DEVNAME=%s",
+             ((opts.dev_name != NULL) ? opts.dev_name : EMU_DEFAULT_NAME));
+    dev_info_argv[0] = dev_name;
+
+    memset(&ci, 0x00, sizeof(ci));
+    ci.dev_major     = opts.dev_major;
+    ci.dev_minor     = opts.dev_minor;
+    ci.dev_info_argc = 1;
+    ci.dev_info_argv = dev_info_argv;
+    ci.flags         = CUSE_UNRESTRICTED_IOCTL;
+
+    memset(&emu, 0x00, sizeof(emu));
+    emu.speed_hz           = EMU_DEFAULT_SPEED_HZ;
+    emu.irq_enabled        = TRUE;  // Interrupt_Init() at probe
+    emu.irq_holdoff_len_us = ((double) opts.holdoff_ms) * 1000.0;
+
+    config.seed = opts.seed;
+
+    emu.sim = fps_open_simulator(&config);
+    if (emu.sim == NULL) {
+        LOG_ERROR("Opening the simulated sensor failed!\n");
+        return 1;
+    }
+
+    // Scans run in real time, for the interrupt thread
+    (void) fps_set_clock(emu.sim, &fps_monotonic_clock);
+
+    pthread_mutex_init(&emu.lock, NULL);
+    pthread_cond_init(&emu.irq_cond, NULL);
+
+    if (opts.check != 0) {
+        status = (emu_check(&config) < 0) ? 1 : 0;
+    } else {
+        signal(SIGUSR1, emu_toggle_finger);
+
+        status = cuse_lowlevel_main(args.argc, args.argv, &ci, &emu_ops, NULL);
+    }
+
+    pthread_cond_destroy(&emu.irq_cond);
+    pthread_mutex_destroy(&emu.lock);
+
+    (void) fps_close_sensor(&emu.sim);
+
+    fuse_opt_free_args(&args);
+    free(opts.dev_name);
+
+    return status;
+}
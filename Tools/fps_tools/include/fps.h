@@ -2,6 +2,9 @@
 #define __fps_h__
 
 
+#include <stddef.h>
+
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -14,23 +17,211 @@ typedef struct __fps_cal_info fps_cal_info_t;
 typedef int (*fps_cal_callback_t) (fps_handle_t   *handle,
                                    fps_cal_info_t *info);
 
+// NOTE: A frame source fills img_buf the same way as fps_get_raw_image(), i.e.
+//       with dummy pixels followed by the image.
+typedef int (*fps_frame_source_t) (fps_handle_t  *handle,
+                                   void          *context,
+                                   int           img_width,
+                                   int           img_height,
+                                   unsigned char *img_buf);
+
+typedef struct __fps_stream fps_stream_t;
+
+typedef struct __fps_pool fps_pool_t;
+
+typedef struct __fps_backend fps_backend_t;
+
+typedef struct __fps_clock fps_clock_t;
+
+typedef struct __fps_event_log fps_event_log_t;
+
+typedef struct __fps_dataset fps_dataset_t;
+
+typedef struct __fps_dataset_map fps_dataset_map_t;
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Sensor Backend
+// -----------------------------------------------------------------------------
+// NOTE: Everything that talks to the sensor goes through the backend of the
+//       handle. fps_attach_sensor() binds the platform's native backend,
+//       fps_attach_backend() any other one, e.g. the simulator. Methods left
+//       NULL fail with -1, except close_method which is optional.
+//
+
+struct __fps_backend {
+    const char *name;
+
+    void (*close_method) (fps_handle_t *handle);
+
+    int (*reset_sensor_method) (fps_handle_t *handle,
+                                int          state);
+
+    int (*set_sensor_speed_method) (fps_handle_t *handle,
+                                    int          speed_hz);
+
+    int (*get_chip_id_method) (fps_handle_t *handle,
+                               int          *chip_id);
+
+    int (*multiple_read_method) (fps_handle_t  *handle,
+                                 unsigned char *addr,
+                                 unsigned char *data,
+                                 size_t        length);
+
+    int (*multiple_write_method) (fps_handle_t  *handle,
+                                  unsigned char *addr,
+                                  unsigned char *data,
+                                  size_t        length);
+
+    int (*get_raw_image_method) (fps_handle_t  *handle,
+                                 int           img_width,
+                                 int           img_height,
+                                 unsigned char *img_buf);
+
+    int (*wait_event_method) (fps_handle_t *handle,
+                              double       sleep_us);
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Sensor Clock
+// -----------------------------------------------------------------------------
+// NOTE: Library timing goes through the clock of the handle: power sequence
+//       and mode switch delays, the SPI alive check, detect period measurement
+//       and mode time accounting. fps_monotonic_clock sleeps for real and is
+//       bound by fps_attach_backend(). fps_virtual_clock advances instantly
+//       by whatever is slept, so its time is the sensor time an algorithm
+//       needs, separate from the CPU time it takes. It only suits backends
+//       that follow it, i.e. the simulator and the replay.
+//
+
+struct __fps_clock {
+    const char *name;
+
+    double (*get_time_method) (fps_handle_t *handle);
+
+    void (*sleep_until_method) (fps_handle_t *handle,
+                                double       deadline_us);
+};
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Sensor Device Handle
 //
 
+// Scans per decided step are counted in buckets 1 .. FPS_SCAN_HISTOGRAM_SIZE,
+// the last bucket also counting longer steps
+#define FPS_SCAN_HISTOGRAM_SIZE (16)
+
+// NOTE: Least-squares sums of straight line fits of the detect threshold [0]
+//       and the detect CDS offset [1] over the detect window average, taken
+//       from past detect calibrations of this sensor.
+typedef struct __fps_detect_model {
+    unsigned int samples;
+    double       sum_x;
+    double       sum_xx;
+    double       sum_y[2];
+    double       sum_xy[2];
+    double       sum_yy[2];
+} fps_detect_model_t;
+
+// Image, detect and power down mode
+#define FPS_SENSOR_MODES (3)
+
+// Delays of the power sequences, one table per power configuration
+#define FPS_POWER_CONFIGS (4)
+#define FPS_POWER_STEPS   (4)
+
+// NOTE: Delays in microseconds. Power step 0 follows turning the LDOs and CP
+//       off, the others follow each step of the power-up sequence. The chip
+//       has no settled status to poll, so each delay must cover the settling
+//       of the board; only the chip ID is read back after the reset, within
+//       alive_timeout_us, to check that the chip answers over SPI.
+typedef struct __fps_power_timing {
+    double reset_pulse_us;
+    double reset_delay_us;
+    double power_step_us[FPS_POWER_STEPS];
+    double enhance_us;
+    double mode_pwrdwn_us;
+    double mode_enter_us;
+    double alive_timeout_us;
+} fps_power_timing_t;
+
+// Public calls timed per handle, see fps_get_stats()
+enum {
+    FPS_API_READ           = 0,     // fps_multiple_read() and the reads on it
+    FPS_API_WRITE          = 1,     // fps_multiple_write() and the writes on it
+    FPS_API_RAW_IMAGE      = 2,     // fps_get_raw_image()
+    FPS_API_AVERAGED_IMAGE = 3,     // averaged images, finger images included
+    FPS_API_MODE_SWITCH    = 4,     // mode transitions, skipped ones excluded
+    FPS_API_SCAN_DETECT    = 5,     // fps_scan_detect_event()
+    FPS_API_WAIT_EVENT     = 6,     // interrupt waits
+    FPS_API_COUNT          = 7,
+};
+
+// Latencies are counted in log2 buckets: [0, 1) us, [1, 2) us, [2, 4) us ...
+// the last bucket also counting longer calls
+#define FPS_STATS_HISTOGRAM_SIZE (24)
+
+typedef struct __fps_api_stats {
+    unsigned int calls;
+    unsigned int errors;
+    double       total_us;
+    double       max_us;
+    double       bytes;     // exact far beyond 32 bits, without a 64-bit type
+    unsigned int histogram[FPS_STATS_HISTOGRAM_SIZE];
+} fps_api_stats_t;
+
+typedef struct __fps_stats {
+    fps_api_stats_t api[FPS_API_COUNT];
+    unsigned int    waits_event;
+    unsigned int    waits_timeout;
+    unsigned int    waits_forever;
+    unsigned int    mode_transitions;
+    unsigned int    mode_matrix[FPS_SENSOR_MODES][FPS_SENSOR_MODES];
+} fps_stats_t;
+
 struct __fps_handle {
-    int           fd;
-    int           chip_id;
-    int           sensor_width;
-    int           sensor_height;
-    int           latency;
-    int           power_config;
-    unsigned char *bkgnd_img;
-    double        bkgnd_avg;
-    double        bkgnd_var;
-    double        bkgnd_noise;
+    int                fd;
+    fps_backend_t      *backend;
+    void               *backend_context;
+    fps_clock_t        *clock;
+    double             virtual_time_us;
+    int                chip_id;
+    int                sensor_width;
+    int                sensor_height;
+    int                latency;
+    int                power_config;
+    int                stats_mode;
+    fps_pool_t         *buffer_pool;
+    int                scan_policy;
+    double             scan_confidence;
+    unsigned int       scan_steps;
+    unsigned int       scan_count;
+    unsigned int       scan_histogram[FPS_SCAN_HISTOGRAM_SIZE];
+    fps_detect_model_t detect_model;
+    double             osc_period_us;
+    fps_power_timing_t power_timing[FPS_POWER_CONFIGS];
+    unsigned int       wait_timeouts;
+    double             wait_overshoot_us;
+    double             wait_overshoot_max_us;
+    double             wait_overshoot_sum_us;
+    int                sensor_mode;
+    double             mode_since_us;
+    unsigned int       mode_transitions;
+    unsigned int       mode_skipped;
+    double             mode_time_us[FPS_SENSOR_MODES];
+    int                stats_enabled;
+    fps_stats_t        stats;
+    fps_event_log_t    *event_log;
+    int                detect_arm;
+    unsigned char      *bkgnd_img;
+    double             bkgnd_avg;
+    double             bkgnd_var;
+    double             bkgnd_noise;
 
     int (*init_sensor_method) (fps_handle_t *handle);
 
@@ -92,15 +283,193 @@ extern int fps_reset_sensor(fps_handle_t *handle,
                                  
 extern fps_handle_t* fps_attach_sensor(int fd);
 
+extern fps_handle_t* fps_attach_backend(int           fd,
+                                        fps_backend_t *backend,
+                                        void          *context);
+
 extern int fps_detach_sensor(fps_handle_t **handle);
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Buffer Pool
+//
+
+enum {
+    FPS_POOL_FRAME = 0,
+    FPS_POOL_MAP   = 1,
+};
+
+extern void* fps_acquire_buffer(fps_handle_t *handle,
+                                int          type);
+
+extern void fps_release_buffer(fps_handle_t *handle,
+                               void         *buffer);
+
+extern int fps_get_buffer_size(fps_handle_t *handle,
+                               int          type);
+
+extern int fps_get_pool_counters(fps_handle_t *handle,
+                                 int          type,
+                                 unsigned int *allocated,
+                                 unsigned int *high_water,
+                                 unsigned int *misses);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Performance Counters
+// -----------------------------------------------------------------------------
+// NOTE: Every handle counts the calls, failures, total and maximum time and a
+//       latency histogram of each FPS_API_* call, the bytes it moved, the waits
+//       ended by an event or by their timeout and how many had no timeout,
+//       and the mode transitions from/to each known mode. Times are on the
+//       handle clock, i.e. sensor time on the virtual clock. Nested calls
+//       count at every level, e.g. an averaged image and each raw image
+//       within it. Counting is on by default and costs two clock reads per
+//       call. fps_get_stats_percentile() gives the upper edge of the bucket
+//       holding a percentile, in us. Frames read by a stream capture thread
+//       are not counted, so the counters only change on the caller's thread.
+//
+
+extern int fps_enable_stats(fps_handle_t *handle,
+                            int          enable);
+
+extern int fps_get_stats(fps_handle_t *handle,
+                         fps_stats_t  *stats);
+
+extern int fps_reset_stats(fps_handle_t *handle);
+
+extern double fps_get_stats_percentile(fps_api_stats_t *api_stats,
+                                       double          percent);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Event Log
+// -----------------------------------------------------------------------------
+// NOTE: A ring of binary records of the detail events of a handle: register
+//       accesses, interrupt waits, SPI alive checks and detect timing. It is cheap
+//       enough to leave on without changing the timing under investigation.
+//       fps_start_event_log() takes the number of records, rounded up to a
+//       power of two. fps_drain_event_log() formats the records since the
+//       last drain and appends them to a text file, or stdout for a NULL
+//       path, and returns how many it wrote. On Linux,
+//       fps_start_event_log_drain() does that from a background thread every
+//       period_ms until fps_stop_event_log(), which drains what is left.
+//
+
+extern int fps_start_event_log(fps_handle_t *handle,
+                               int          records);
+
+extern int fps_stop_event_log(fps_handle_t *handle);
+
+extern int fps_drain_event_log(fps_handle_t *handle,
+                               char         *path);
+
+extern int fps_start_event_log_drain(fps_handle_t *handle,
+                                     char         *path,
+                                     int          period_ms);
+
+extern int fps_get_event_log_counters(fps_handle_t *handle,
+                                      unsigned int *logged,
+                                      unsigned int *lost);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Profiling
+// -----------------------------------------------------------------------------
+// NOTE: Named regions timed on the raw monotonic host clock in nanoseconds,
+//       shared by the library and the tools on top of it. A region opened
+//       inside another one is its child, so the same name under different
+//       parents is a different region. Names must outlive the profile, e.g.
+//       string literals. Profiling is process wide and off by default; only
+//       the thread which switched it on is timed, regions opened by other
+//       threads are ignored. Regions are nested up to FPS_PROFILE_DEPTH deep,
+//       at most FPS_PROFILE_REGIONS distinct ones are kept.
+//
+//       The library times the frames it captures ("capture"), the work on
+//       them ("process") and the detect scans ("scan"), e.g.
+//
+//           fps_reset_profile();
+//           fps_enable_profile(TRUE);
+//           fps_begin_region("calibration");
+//           status = fps_image_calibration(...);
+//           fps_end_region("calibration");
+//           fps_enable_profile(FALSE);
+//
+//       fps_get_profile_percentile() gives the upper edge of the bucket
+//       holding a percentile, in ns, within 1/8 of the value.
+//
+
+#define FPS_PROFILE_REGIONS (32)
+#define FPS_PROFILE_DEPTH   (8)
+
+// Durations are counted in 8 linear sub-buckets per power of two ns
+#define FPS_PROFILE_HISTOGRAM_SIZE (320)
+
+typedef struct __fps_profile_region {
+    const char   *name;
+    int          parent;    // index of the parent region, -1 at the top
+    int          depth;
+    unsigned int count;
+    double       total_ns;
+    double       min_ns;
+    double       max_ns;
+    unsigned int histogram[FPS_PROFILE_HISTOGRAM_SIZE];
+} fps_profile_region_t;
+
+typedef struct __fps_profile {
+    int                  regions;
+    unsigned int         dropped;   // regions beyond the depth or table size
+    fps_profile_region_t region[FPS_PROFILE_REGIONS];
+} fps_profile_t;
+
+extern int fps_enable_profile(int enable);
+
+extern int fps_reset_profile(void);
+
+extern int fps_begin_region(const char *name);
+
+extern int fps_end_region(const char *name);
+
+extern int fps_get_profile(fps_profile_t *profile);
+
+extern double fps_get_profile_percentile(fps_profile_region_t *region,
+                                         double               percent);
+
+extern double fps_get_raw_time_ns(void);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Statistics Arithmetic
+//
+
+enum {
+    FPS_STATS_DOUBLE = 0,
+    FPS_STATS_FIXED  = 1,
+};
+
+extern int fps_set_statistics_mode(fps_handle_t *handle,
+                                   int          mode);
+
+extern int fps_get_statistics_mode(fps_handle_t *handle,
+                                   int          *mode);
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Mode Switch
 //
 
+// NOTE: The handle tracks the sensor mode, so switching to the current mode
+//       costs nothing. fps_reset_sensor() forgets the mode by itself; after
+//       changing GBL_CTL or PWR_CTL_0 or resetting the sensor behind the
+//       library's back, call fps_invalidate_sensor_mode().
 enum {
+    FPS_UNKNOWN_MODE    = -1,
     FPS_IMAGE_MODE      = 0,
     FPS_DETECT_MODE     = 1,
     FPS_POWER_DOWN_MODE = 2,
@@ -116,6 +485,15 @@ extern int fps_switch_sensor_mode(fps_handle_t *handle,
                                   int          mode_new,
                                   int          *mode_old);
 
+extern int fps_invalidate_sensor_mode(fps_handle_t *handle);
+
+extern int fps_get_mode_counters(fps_handle_t *handle,
+                                 unsigned int *transitions,
+                                 unsigned int *skipped,
+                                 double       *time_us);
+
+extern int fps_clear_mode_counters(fps_handle_t *handle);
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -148,6 +526,28 @@ extern int fps_get_finger_image(fps_handle_t  *handle,
                                 double        *img_var,
                                 double        *img_noise);
 
+extern int fps_get_averaged_image_from(fps_handle_t       *handle,
+                                       fps_frame_source_t source,
+                                       void               *context,
+                                       int                img_width,
+                                       int                img_height,
+                                       int                frms_to_avg,
+                                       unsigned char      *img_buf,
+                                       double             *img_avg,
+                                       double             *img_var,
+                                       double             *img_noise);
+
+extern int fps_get_finger_image_from(fps_handle_t       *handle,
+                                     fps_frame_source_t source,
+                                     void               *context,
+                                     int                img_width,
+                                     int                img_height,
+                                     int                frms_to_avg,
+                                     unsigned char      *img_buf,
+                                     double             *img_dr,
+                                     double             *img_var,
+                                     double             *img_noise);
+
 extern int fps_get_background_average(fps_handle_t *handle,
                                       double       *img_avg);
 
@@ -174,6 +574,297 @@ extern int fps_set_detect_calibration_callback(fps_handle_t       *handle,
 extern int fps_scan_detect_event(fps_handle_t *handle,
                                  double       sleep_us);
 
+// NOTE: While armed, fps_scan_detect_event() leaves the detect interrupt
+//       enabled and only waits, reading and acknowledging the interrupt after
+//       a trigger. Changing a sensor parameter, the sensing area, the suspend
+//       interval or the mode re-arms it in full on the next scan.
+extern int fps_arm_detect_event(fps_handle_t *handle);
+
+extern int fps_disarm_detect_event(fps_handle_t *handle);
+
+enum {
+    FPS_SCAN_FIXED = 0,
+    FPS_SCAN_SPRT  = 1,
+};
+
+extern int fps_set_scan_policy(fps_handle_t *handle,
+                               int          policy,
+                               double       confidence);
+
+extern int fps_get_scan_policy(fps_handle_t *handle,
+                               int          *policy,
+                               double       *confidence);
+
+extern int fps_get_scan_counters(fps_handle_t *handle,
+                                 unsigned int *steps,
+                                 unsigned int *scans,
+                                 unsigned int *histogram);
+
+extern int fps_clear_scan_counters(fps_handle_t *handle);
+
+extern int fps_get_wait_counters(fps_handle_t *handle,
+                                 unsigned int *timeouts,
+                                 double       *last_us,
+                                 double       *max_us,
+                                 double       *mean_us);
+
+extern int fps_clear_wait_counters(fps_handle_t *handle);
+
+extern fps_clock_t fps_monotonic_clock;
+extern fps_clock_t fps_virtual_clock;
+
+extern int fps_set_clock(fps_handle_t *handle,
+                         fps_clock_t  *clock);
+
+extern double fps_get_clock_time_us(fps_handle_t *handle);
+
+extern double fps_get_cpu_time_us(void);
+
+extern int fps_set_detect_model(fps_handle_t       *handle,
+                                fps_detect_model_t *model);
+
+extern int fps_get_detect_model(fps_handle_t       *handle,
+                                fps_detect_model_t *model);
+
+extern int fps_clear_detect_model(fps_handle_t *handle);
+
+extern int fps_measure_detect_period(fps_handle_t *handle);
+
+extern int fps_set_detect_period(fps_handle_t *handle,
+                                 double       period_us);
+
+extern int fps_get_detect_period(fps_handle_t *handle,
+                                 double       *period_us);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Calibration Cache
+//
+
+extern int fps_save_calibration(fps_handle_t *handle,
+                                char         *path);
+
+extern int fps_load_calibration(fps_handle_t *handle,
+                                char         *path);
+
+extern int fps_validate_calibration(fps_handle_t *handle,
+                                    int          frms_to_avg,
+                                    int          *valid);
+
+extern int fps_warm_start_calibration(fps_handle_t *handle,
+                                      char         *path,
+                                      int          img_width,
+                                      int          img_height,
+                                      int          frms_to_avg,
+                                      int          det_width,
+                                      int          det_height,
+                                      int          frms_to_susp,
+                                      int          *warm);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Image Stream
+//
+
+enum {
+    FPS_STREAM_BLOCK       = 0,
+    FPS_STREAM_DROP_OLDEST = 1,
+    FPS_STREAM_DROP_NEWEST = 2,
+};
+
+extern fps_stream_t* fps_stream_open(fps_handle_t *handle,
+                                     int          img_width,
+                                     int          img_height,
+                                     int          ring_size,
+                                     int          policy);
+
+extern int fps_stream_close(fps_stream_t **stream);
+
+extern int fps_stream_next(fps_stream_t  *stream,
+                           unsigned char *img_buf);
+
+extern int fps_stream_frame_source(fps_handle_t  *handle,
+                                   void          *context,
+                                   int           img_width,
+                                   int           img_height,
+                                   unsigned char *img_buf);
+
+extern int fps_get_stream_counters(fps_stream_t *stream,
+                                   unsigned int *captured,
+                                   unsigned int *delivered,
+                                   unsigned int *dropped);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Dataset
+// -----------------------------------------------------------------------------
+// NOTE: A dataset keeps the images of a test run in one file instead of one
+//       BMP per image. It starts with a header of the sensor geometry and the
+//       register file at creation, followed by one fixed-size record per
+//       image: its sequence number, the handle clock time it was appended,
+//       its statistics and the pixels, padded to 8 bytes. Closing appends
+//       an index of sequence numbers and times and puts the frame count into
+//       the header; records are never rewritten. A dataset which was not
+//       closed has a frame count of 0 and no index, its frames are counted
+//       from the file size instead.
+//
+//       The file is little-endian and every field is naturally aligned, so
+//       fps_map_dataset() maps it and hands out pointers straight into the
+//       file, on little-endian hosts. fps_find_dataset_frame() looks up a
+//       sequence number in the index, or scans the records without one.
+//       fps_export_dataset_frame() writes one frame as BMP, in the row order
+//       of the analyzer BMPs, or as binary PGM.
+//
+
+#define FPS_DATASET_MAGIC       (0x44535046) // "FPSD"
+#define FPS_DATASET_VERSION     (1)
+#define FPS_DATASET_HEADER_SIZE (256)        // header_size, rest zero
+#define FPS_DATASET_REGISTERS   (64)
+
+enum {
+    FPS_EXPORT_BMP = 0,
+    FPS_EXPORT_PGM = 1,
+};
+
+typedef struct __fps_dataset_header {
+    unsigned int  magic;
+    unsigned int  version;
+    unsigned int  header_size;      // offset of the first record
+    unsigned int  record_size;
+    unsigned int  chip_id;
+    unsigned int  power_config;
+    unsigned int  sensor_width;
+    unsigned int  sensor_height;
+    unsigned int  col_begin;        // image window
+    unsigned int  col_end;
+    unsigned int  row_begin;
+    unsigned int  row_end;
+    unsigned int  img_width;
+    unsigned int  img_height;
+    unsigned int  frms_to_avg;
+    unsigned int  img_type;         // defined by the writer
+    unsigned int  frames;           // 0 until closed
+    unsigned int  reg_count;
+    double        bkgnd_avg;
+    unsigned char registers[FPS_DATASET_REGISTERS];
+} fps_dataset_header_t;
+
+typedef struct __fps_dataset_record {
+    unsigned int seq;
+    unsigned int reserved;
+    double       time_us;
+    double       img_avg;               // of the stored pixels
+    double       img_var;               // of the stored pixels
+    double       img_noise;             // temporal noise of the capture
+    double       img_dr;                // foreground avg. - background avg.
+} fps_dataset_record_t;
+
+// The index follows the last record
+typedef struct __fps_dataset_index {
+    unsigned int seq;
+    unsigned int record;
+    double       time_us;
+} fps_dataset_index_t;
+
+extern fps_dataset_t* fps_create_dataset(fps_handle_t *handle,
+                                         char         *path,
+                                         int          img_width,
+                                         int          img_height,
+                                         int          frms_to_avg,
+                                         int          img_type);
+
+extern int fps_append_dataset(fps_dataset_t *dataset,
+                              unsigned int  seq,
+                              unsigned char *img_buf,
+                              double        img_avg,
+                              double        img_var,
+                              double        img_noise,
+                              double        img_dr);
+
+extern int fps_close_dataset(fps_dataset_t **dataset);
+
+extern fps_dataset_map_t* fps_map_dataset(char *path);
+
+extern int fps_unmap_dataset(fps_dataset_map_t **map);
+
+extern fps_dataset_header_t* fps_get_dataset_header(fps_dataset_map_t *map);
+
+extern int fps_get_dataset_frames(fps_dataset_map_t *map);
+
+extern fps_dataset_index_t* fps_get_dataset_index(fps_dataset_map_t *map);
+
+extern fps_dataset_record_t* fps_get_dataset_record(fps_dataset_map_t *map,
+                                                    int               frame,
+                                                    unsigned char     **pixels);
+
+extern int fps_find_dataset_frame(fps_dataset_map_t *map,
+                                  unsigned int      seq);
+
+extern int fps_export_dataset_frame(fps_dataset_map_t *map,
+                                    int               frame,
+                                    char              *path,
+                                    int               format);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Simulator
+// -----------------------------------------------------------------------------
+// NOTE: A simulated F747B, opened by fps_open_simulator() instead of
+//       fps_open_sensor(). Levels are in mV at the CDS input, periods in us.
+//       A NULL config takes fps_sim_default_config(). It runs on the virtual
+//       clock.
+//
+
+#define FPS_SIM_DEVICE_PATH "sim"
+
+typedef struct __fps_sim_config {
+    unsigned int seed;
+    double       signal_mv;
+    double       fpn_mv;
+    double       noise_mv;
+    double       finger_mv;
+    double       osc_period_us;
+    double       detect_noise_mv;
+} fps_sim_config_t;
+
+extern void fps_sim_default_config(fps_sim_config_t *config);
+
+extern fps_handle_t* fps_open_simulator(fps_sim_config_t *config);
+
+extern int fps_sim_set_finger(fps_handle_t *handle,
+                              int          present);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// I/O Trace Recording and Replay
+// -----------------------------------------------------------------------------
+// NOTE: fps_start_recording() writes every backend call of a handle to a
+//       trace file until fps_stop_recording() or fps_close_sensor(). Start
+//       right after opening, so that the replay begins with the same handle
+//       state. fps_open_replay() opens a handle which answers from the trace.
+//       Each call takes its recorded time on the handle clock, which is the
+//       monotonic one for FPS_REPLAY_REALTIME and the virtual one for
+//       FPS_REPLAY_FAST.
+//
+
+#define FPS_REPLAY_DEVICE_PREFIX "replay:"
+
+#define FPS_REPLAY_REALTIME      (0)
+#define FPS_REPLAY_FAST          (1)
+
+extern int fps_start_recording(fps_handle_t *handle,
+                               char         *path);
+
+extern int fps_stop_recording(fps_handle_t *handle);
+
+extern fps_handle_t* fps_open_replay(char *path,
+                                     int  clock);
+
 
 #if defined(__cplusplus)
 }
@@ -0,0 +1,712 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Driver I/O Benchmark
+// -----------------------------------------------------------------------------
+// NOTE: Times the driver opcodes one call at a time on a real sensor, or on
+//       the CUSE emulator: chip ID, register mass reads, register mass writes
+//       and GET_ONE_IMG, each at a range of sizes, at every SPI clock of the
+//       sweep. Per opcode and clock it reports the latency percentiles and a
+//       log2 latency histogram, the payload bytes per second, how much of the
+//       raw SPI bit rate that payload reaches, and the error rate. A closing
+//       table gives the error rate and frame rate per clock, and the fastest
+//       clock without a single error.
+//
+//       An error is a failed call, or data that does not match: the chip ID
+//       read when the sensor was opened, or the register values read at the
+//       start. Registers that change between two reads at the start (e.g.
+//       INT_EVENT) are not compared. Writes put back the values read at the
+//       start into the image and detect settings, and are checked by an
+//       untimed read back. Frames are only checked for a failed call.
+//
+//       Build with "make iobench". "-d sim" runs on the simulator, which
+//       only checks the tool itself; its latencies mean nothing.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "debug.h"
+#include "fps.h"
+#include "fps_register.h"
+#include "fps_control.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Benchmark Settings
+//
+
+#define IOB_DEFAULT_CALLS       (100)
+#define IOB_DEFAULT_DEVICE      "/dev/dfs0"
+#define IOB_MAX_CLOCKS          (16)
+#define IOB_HIST_BUCKETS        (20)    // [0, 1), [1, 2), ... [2^18, inf) us
+
+// SPI clock fps_init_sensor() sets, put back after the sweep
+#define IOB_INIT_SPEED_HZ       (8 * 1000 * 1000)
+
+// Image and detect settings, written back with their own values
+#define IOB_WRITE_FIRST_REG     (FPS_REG_IMG_CDS_CTL_0)
+#define IOB_WRITE_LAST_REG      (FPS_REG_DET_COL_END)
+#define IOB_WRITE_REGS          (IOB_WRITE_LAST_REG - IOB_WRITE_FIRST_REG + 1)
+
+static const int iob_default_clocks[] = {
+    1 * 1000 * 1000,
+    2 * 1000 * 1000,
+    4 * 1000 * 1000,
+    6 * 1000 * 1000,
+    8 * 1000 * 1000,
+    10 * 1000 * 1000,
+    12 * 1000 * 1000,
+    16 * 1000 * 1000,
+};
+
+// Register counts of the reads and writes, capped to what the sensor has
+static const int iob_reg_counts[] = { 1, 2, 4, 8, 16, 32, FPS_REG_COUNT };
+
+// Image windows, capped to the sensor size
+static const int iob_img_sizes[][2] = {
+    {   8,   8 },
+    {  32,  32 },
+    {  64,  64 },
+    { 256, 256 },
+};
+
+#define IOB_OP_CHIP_ID          (0)
+#define IOB_OP_READ             (1)
+#define IOB_OP_WRITE            (2)
+#define IOB_OP_IMAGE            (3)
+
+typedef struct __iob_op {
+    int  op;
+    int  count;             // registers, or image width
+    int  height;            // image height
+    char name[32];
+} iob_op_t;
+
+typedef struct __iob_result {
+    unsigned int calls;
+    unsigned int errors;
+    size_t       bytes;     // payload bytes per call
+    double       total_us;
+    double       *latency_us;
+    unsigned int hist[IOB_HIST_BUCKETS];
+} iob_result_t;
+
+typedef struct __iob_context {
+    fps_handle_t *handle;
+    uint8_t      addr[FPS_REG_COUNT];
+    uint8_t      ref[FPS_REG_COUNT];        // values read at the start
+    int          stable[FPS_REG_COUNT];     // TRUE if the same in two reads
+    uint8_t      data[FPS_REG_COUNT];
+    uint8_t      *img_buf;
+} iob_context_t;
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Opcodes
+//
+
+static int
+iob_reference(iob_context_t *ctx)
+{
+    int     status = 0;
+    uint8_t data;
+    int     i;
+
+    for (i = 0; i < FPS_REG_COUNT; i++) {
+        ctx->addr[i] = (uint8_t) i;
+
+        status = fps_single_read(ctx->handle, (uint8_t) i, &ctx->ref[i]);
+        if (status < 0) {
+            return status;
+        }
+    }
+
+    for (i = 0; i < FPS_REG_COUNT; i++) {
+        status = fps_single_read(ctx->handle, (uint8_t) i, &data);
+        if (status < 0) {
+            return status;
+        }
+
+        ctx->stable[i] = ((data == ctx->ref[i]) && (i != FPS_REG_INT_EVENT));
+    }
+
+    return 0;
+}
+
+static int
+iob_check(iob_context_t *ctx,
+          int           first,
+          int           count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if ((ctx->stable[first + i] == TRUE) && (ctx->data[i] != ctx->ref[first + i])) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+// Returns < 0 for a failed call, FALSE for wrong data, TRUE otherwise, and
+// the time of the call itself in latency_us
+static int
+iob_call(iob_context_t  *ctx,
+         const iob_op_t *op,
+         double         *latency_us)
+{
+    int    status = 0;
+    int    chip_id;
+    double start_us;
+
+    start_us = fps_get_time_us();
+
+    switch (op->op) {
+    case IOB_OP_CHIP_ID:
+        status = fps_get_chip_id(ctx->handle, &chip_id);
+        break;
+    case IOB_OP_READ:
+        status = fps_multiple_read(ctx->handle, ctx->addr, ctx->data, op->count);
+        break;
+    case IOB_OP_WRITE:
+        status = fps_multiple_write(ctx->handle, &ctx->addr[IOB_WRITE_FIRST_REG],
+                                    &ctx->ref[IOB_WRITE_FIRST_REG], op->count);
+        break;
+    case IOB_OP_IMAGE:
+        status = fps_get_raw_image(ctx->handle, op->count, op->height, ctx->img_buf);
+        break;
+    default:
+        status = -1;
+        break;
+    }
+
+    *latency_us = fps_get_time_us() - start_us;
+
+    if (status < 0) {
+        return status;
+    }
+
+    switch (op->op) {
+    case IOB_OP_CHIP_ID:
+        return (chip_id == ctx->handle->chip_id);
+    case IOB_OP_READ:
+        return iob_check(ctx, 0, op->count);
+    case IOB_OP_WRITE:
+        // Read back, outside the timed call
+        status = fps_multiple_read(ctx->handle, &ctx->addr[IOB_WRITE_FIRST_REG],
+                                   ctx->data, op->count);
+        if (status < 0) {
+            return status;
+        }
+        return iob_check(ctx, IOB_WRITE_FIRST_REG, op->count);
+    default:
+        return TRUE;
+    }
+}
+
+static size_t
+iob_payload_bytes(iob_context_t  *ctx,
+                  const iob_op_t *op)
+{
+    switch (op->op) {
+    case IOB_OP_CHIP_ID:
+        return 2;
+    case IOB_OP_READ:
+    case IOB_OP_WRITE:
+        return op->count;
+    case IOB_OP_IMAGE:
+        return op->count * op->height + ctx->handle->latency;
+    default:
+        return 0;
+    }
+}
+
+static int
+iob_build_ops(fps_handle_t *handle,
+              iob_op_t     *ops,
+              int          max_ops)
+{
+    int n = 0;
+    int width;
+    int height;
+    int i;
+
+    ops[n].op     = IOB_OP_CHIP_ID;
+    ops[n].count  = 0;
+    ops[n].height = 0;
+    sprintf(ops[n].name, "chip_id");
+    n++;
+
+    for (i = 0; (i < ARRAY_SIZE(iob_reg_counts)) && (n < max_ops); i++) {
+        ops[n].op     = IOB_OP_READ;
+        ops[n].count  = iob_reg_counts[i];
+        ops[n].height = 0;
+        sprintf(ops[n].name, "read_%0d", ops[n].count);
+        n++;
+    }
+
+    for (i = 0; (i < ARRAY_SIZE(iob_reg_counts)) && (n < max_ops); i++) {
+        if (iob_reg_counts[i] > IOB_WRITE_REGS) {
+            break;
+        }
+        ops[n].op     = IOB_OP_WRITE;
+        ops[n].count  = iob_reg_counts[i];
+        ops[n].height = 0;
+        sprintf(ops[n].name, "write_%0d", ops[n].count);
+        n++;
+    }
+
+    for (i = 0; (i < ARRAY_SIZE(iob_img_sizes)) && (n < max_ops); i++) {
+        width  = MIN(iob_img_sizes[i][0], handle->sensor_width);
+        height = MIN(iob_img_sizes[i][1], handle->sensor_height);
+
+        // Sizes past the sensor all end up as the full frame, once
+        if ((n > 0) && (ops[n - 1].op == IOB_OP_IMAGE) &&
+            (ops[n - 1].count == width) && (ops[n - 1].height == height)) {
+            continue;
+        }
+
+        ops[n].op     = IOB_OP_IMAGE;
+        ops[n].count  = width;
+        ops[n].height = height;
+        sprintf(ops[n].name, "image_%0dx%0d", width, height);
+        n++;
+    }
+
+    return n;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Measurement
+//
+
+static int
+iob_compare_double(const void *a,
+                   const void *b)
+{
+    double x = *((const double *) a);
+    double y = *((const double *) b);
+
+    return (x > y) - (x < y);
+}
+
+// Nearest rank of the sorted latencies
+static double
+iob_percentile(iob_result_t *result,
+               double       percent)
+{
+    unsigned int rank;
+
+    rank = (unsigned int) ((percent / 100.0) * result->calls + 0.5);
+    rank = CONSTRAINT(result->calls, rank, 1);
+
+    return result->latency_us[rank - 1];
+}
+
+static int
+iob_bucket(double latency_us)
+{
+    int bucket = 0;
+
+    while ((latency_us >= 1.0) && (bucket < (IOB_HIST_BUCKETS - 1))) {
+        latency_us /= 2.0;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+// Lower edge of a bucket, in us
+static unsigned int
+iob_bucket_floor(int bucket)
+{
+    return (bucket == 0) ? 0 : (1u << (bucket - 1));
+}
+
+static int
+iob_run(iob_context_t  *ctx,
+        const iob_op_t *op,
+        int            clock_hz,
+        unsigned int   calls,
+        iob_result_t   *result)
+{
+    int          status = 0;
+    double       latency_us;
+    unsigned int i;
+
+    memset(result, 0x00, sizeof(iob_result_t));
+
+    result->latency_us = (double *) malloc(sizeof(double) * calls);
+    if (result->latency_us == NULL) {
+        LOG_ERROR("malloc() failed!\n");
+        return -1;
+    }
+
+    // Image window of the frame, at the init clock so that it is right
+    if (op->op == IOB_OP_IMAGE) {
+        status = fps_set_sensor_speed(ctx->handle, IOB_INIT_SPEED_HZ);
+        if (status < 0) {
+            return status;
+        }
+
+        status = fps_set_sensing_area(ctx->handle, FPS_IMAGE_MODE,
+                                      (ctx->handle->sensor_width  - op->count)  / 2,
+                                      (ctx->handle->sensor_width  - op->count)  / 2 + op->count  - 1,
+                                      (ctx->handle->sensor_height - op->height) / 2,
+                                      (ctx->handle->sensor_height - op->height) / 2 + op->height - 1);
+        if (status < 0) {
+            return status;
+        }
+
+        status = fps_set_sensor_speed(ctx->handle, clock_hz);
+        if (status < 0) {
+            return status;
+        }
+    }
+
+    result->bytes = iob_payload_bytes(ctx, op);
+
+    for (i = 0; i < calls; i++) {
+        status = iob_call(ctx, op, &latency_us);
+        if (status != TRUE) {
+            result->errors++;
+        }
+
+        result->latency_us[i] = latency_us;
+        result->total_us     += latency_us;
+        result->hist[iob_bucket(latency_us)]++;
+    }
+
+    result->calls = calls;
+
+    qsort(result->latency_us, calls, sizeof(double), iob_compare_double);
+
+    return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Report
+//
+
+static void
+iob_print_header(int csv)
+{
+    int b;
+
+    if (csv == TRUE) {
+        printf("clock_hz,op,bytes_per_call,calls,errors,error_rate,mean_us,"
+               "p50_us,p99_us,max_us,bytes_per_s,spi_efficiency");
+        for (b = 0; b < IOB_HIST_BUCKETS; b++) {
+            printf(",hist_%uus", iob_bucket_floor(b));
+        }
+        printf("\n");
+    } else {
+        printf("%10s %-16s %7s %6s %7s %10s %10s %10s %10s %12s %6s\n",
+               "Clock Hz", "Opcode", "Bytes", "Calls", "Errors",
+               "Mean us", "p50 us", "p99 us", "Max us", "Bytes/s", "SPI %");
+    }
+}
+
+static void
+iob_print_result(int            csv,
+                 int            clock_hz,
+                 const iob_op_t *op,
+                 iob_result_t   *result)
+{
+    double mean_us;
+    double bytes_per_s;
+    double efficiency;
+    int    b;
+
+    mean_us     = result->total_us / result->calls;
+    bytes_per_s = (result->total_us > 0.0) ?
+                  (((double) result->bytes) * result->calls * 1000000.0 / result->total_us) : 0.0;
+    efficiency  = bytes_per_s * 8.0 / clock_hz;
+
+    if (csv == TRUE) {
+        printf("%0d,%s,%u,%u,%u,%0.6f,%0.3f,%0.3f,%0.3f,%0.3f,%0.1f,%0.4f",
+               clock_hz, op->name, (unsigned int) result->bytes, result->calls, result->errors,
+               ((double) result->errors) / result->calls, mean_us,
+               iob_percentile(result, 50.0), iob_percentile(result, 99.0),
+               result->latency_us[result->calls - 1], bytes_per_s, efficiency);
+        for (b = 0; b < IOB_HIST_BUCKETS; b++) {
+            printf(",%u", result->hist[b]);
+        }
+        printf("\n");
+    } else {
+        printf("%10d %-16s %7u %6u %7u %10.1f %10.1f %10.1f %10.1f %12.1f %6.1f\n",
+               clock_hz, op->name, (unsigned int) result->bytes, result->calls, result->errors,
+               mean_us, iob_percentile(result, 50.0), iob_percentile(result, 99.0),
+               result->latency_us[result->calls - 1], bytes_per_s, efficiency * 100.0);
+    }
+}
+
+static void
+iob_print_histogram(const iob_op_t *op,
+                    iob_result_t   *result)
+{
+    unsigned int peak = 0;
+    int          first;
+    int          last;
+    int          b;
+
+    for (first = 0; (first < IOB_HIST_BUCKETS) && (result->hist[first] == 0); first++) {
+        // Skip leading empty buckets
+    }
+
+    for (last = IOB_HIST_BUCKETS - 1; (last > first) && (result->hist[last] == 0); last--) {
+        // Skip trailing empty buckets
+    }
+
+    for (b = first; b <= last; b++) {
+        peak = MAX(peak, result->hist[b]);
+    }
+
+    printf("           %s:\n", op->name);
+
+    for (b = first; b <= last; b++) {
+        if (b == (IOB_HIST_BUCKETS - 1)) {
+            printf("           %8u us -         %6u ", iob_bucket_floor(b), result->hist[b]);
+        } else {
+            printf("           %8u us - %6u us %6u ", iob_bucket_floor(b), iob_bucket_floor(b + 1),
+                   result->hist[b]);
+        }
+        printf("%.*s\n", (int) ((result->hist[b] * 40 + peak - 1) / peak),
+               "########################################");
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Main
+//
+
+static void
+iob_show_usage(char *program)
+{
+    printf("Usage: %s [options]\n", program);
+    printf("\n");
+    printf("    -d PATH       Device path, or \"%s\" for the simulator (default: %s)\n",
+           FPS_SIM_DEVICE_PATH, IOB_DEFAULT_DEVICE);
+    printf("    -n CALLS      Calls per opcode and clock (default: %0d)\n", IOB_DEFAULT_CALLS);
+    printf("    -s HZ,HZ,...  SPI clocks to sweep (default: 1, 2, 4, 6, 8, 10, 12, 16 MHz)\n");
+    printf("    -H            Latency histograms\n");
+    printf("    -c            CSV output, histogram buckets as columns\n");
+    printf("    -h            This help\n");
+}
+
+static int
+iob_parse_clocks(char *list,
+                 int  *clocks)
+{
+    int  n = 0;
+    char *token;
+
+    for (token = strtok(list, ","); (token != NULL) && (n < IOB_MAX_CLOCKS); token = strtok(NULL, ",")) {
+        clocks[n] = atoi(token);
+        if (clocks[n] <= 0) {
+            return -1;
+        }
+        n++;
+    }
+
+    return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int           status = 0;
+    iob_context_t ctx;
+    iob_op_t      ops[32];
+    iob_result_t  result;
+    char          *device    = IOB_DEFAULT_DEVICE;
+    unsigned int  calls      = IOB_DEFAULT_CALLS;
+    int           csv        = FALSE;
+    int           histograms = FALSE;
+    int           clocks[IOB_MAX_CLOCKS];
+    int           n_clocks;
+    int           n_ops;
+    unsigned int  clock_calls;
+    unsigned int  clock_errors;
+    double        frame_us[IOB_MAX_CLOCKS];
+    unsigned int  error_count[IOB_MAX_CLOCKS];
+    unsigned int  call_count[IOB_MAX_CLOCKS];
+    int           best = -1;
+    int           c;
+    int           i;
+
+    memset(&ctx, 0x00, sizeof(iob_context_t));
+
+    n_clocks = ARRAY_SIZE(iob_default_clocks);
+    for (c = 0; c < n_clocks; c++) {
+        clocks[c] = iob_default_clocks[c];
+    }
+
+    for (i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-d") == 0) && ((i + 1) < argc)) {
+            device = argv[++i];
+        } else if ((strcmp(argv[i], "-n") == 0) && ((i + 1) < argc)) {
+            calls = (unsigned int) atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-s") == 0) && ((i + 1) < argc)) {
+            n_clocks = iob_parse_clocks(argv[++i], clocks);
+        } else if (strcmp(argv[i], "-H") == 0) {
+            histograms = TRUE;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            csv = TRUE;
+        } else if (strcmp(argv[i], "-h") == 0) {
+            iob_show_usage(argv[0]);
+            return 0;
+        } else {
+            iob_show_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if ((calls == 0) || (n_clocks <= 0)) {
+        iob_show_usage(argv[0]);
+        return 1;
+    }
+
+    (void) set_debug_level(LOG_LEVEL_ERROR);
+
+    if (strcmp(device, FPS_SIM_DEVICE_PATH) == 0) {
+        ctx.handle = fps_open_simulator(NULL);
+    } else {
+        ctx.handle = fps_open_sensor(device);
+    }
+
+    if (ctx.handle == NULL) {
+        LOG_ERROR("Opening %s failed!\n", device);
+        return 1;
+    }
+
+    ctx.img_buf = (uint8_t *) malloc(ctx.handle->latency + ctx.handle->sensor_width * ctx.handle->sensor_height);
+    if (ctx.img_buf == NULL) {
+        LOG_ERROR("malloc() failed!\n");
+        status = -1;
+        goto main_end;
+    }
+
+    status = fps_init_sensor(ctx.handle);
+    if (status < 0) {
+        goto main_end;
+    }
+
+    status = fps_switch_sensor_mode(ctx.handle, FPS_IMAGE_MODE, NULL);
+    if (status < 0) {
+        goto main_end;
+    }
+
+    // At the init clock, known to work
+    status = iob_reference(&ctx);
+    if (status < 0) {
+        goto main_end;
+    }
+
+    n_ops = iob_build_ops(ctx.handle, ops, ARRAY_SIZE(ops));
+
+    iob_print_header(csv);
+
+    for (c = 0; c < n_clocks; c++) {
+        clock_calls  = 0;
+        clock_errors = 0;
+        frame_us[c]  = 0.0;
+
+        status = fps_set_sensor_speed(ctx.handle, clocks[c]);
+        if (status < 0) {
+            LOG_ERROR("Setting the SPI clock to %0d Hz failed!\n", clocks[c]);
+            call_count[c]  = 0;
+            error_count[c] = 0;
+            continue;
+        }
+
+        for (i = 0; i < n_ops; i++) {
+            status = iob_run(&ctx, &ops[i], clocks[c], calls, &result);
+            if (status < 0) {
+                free(result.latency_us);
+                goto main_end;
+            }
+
+            iob_print_result(csv, clocks[c], &ops[i], &result);
+
+            if ((histograms == TRUE) && (csv == FALSE)) {
+                iob_print_histogram(&ops[i], &result);
+            }
+
+            // The last image op is the largest frame
+            if (ops[i].op == IOB_OP_IMAGE) {
+                frame_us[c] = result.total_us / result.calls;
+            }
+
+            clock_calls  += result.calls;
+            clock_errors += result.errors;
+
+            free(result.latency_us);
+        }
+
+        call_count[c]  = clock_calls;
+        error_count[c] = clock_errors;
+
+        // Undo whatever a bad clock wrote, at the init clock
+        status = fps_set_sensor_speed(ctx.handle, IOB_INIT_SPEED_HZ);
+        if (status < 0) {
+            goto main_end;
+        }
+
+        status = fps_multiple_write(ctx.handle, &ctx.addr[IOB_WRITE_FIRST_REG],
+                                    &ctx.ref[IOB_WRITE_FIRST_REG], IOB_WRITE_REGS);
+        if (status < 0) {
+            goto main_end;
+        }
+
+        if ((clock_errors == 0) && ((best < 0) || (clocks[c] > clocks[best]))) {
+            best = c;
+        }
+    }
+
+    status = 0;
+
+    if (csv == FALSE) {
+        printf("\n");
+        printf("%10s %8s %8s %12s %10s\n", "Clock Hz", "Calls", "Errors", "Error Rate", "Frames/s");
+
+        for (c = 0; c < n_clocks; c++) {
+            if (call_count[c] == 0) {
+                printf("%10d %8s\n", clocks[c], "failed");
+                continue;
+            }
+
+            printf("%10d %8u %8u %12.6f %10.1f\n", clocks[c], call_count[c], error_count[c],
+                   ((double) error_count[c]) / call_count[c],
+                   (frame_us[c] > 0.0) ? (1000000.0 / frame_us[c]) : 0.0);
+        }
+
+        printf("\n");
+        if (best < 0) {
+            printf("No clock ran without errors.\n");
+        } else {
+            printf("Fastest clock without errors: %0d Hz\n", clocks[best]);
+        }
+    }
+
+main_end :
+
+    if (ctx.handle != NULL) {
+        (void) fps_set_sensor_speed(ctx.handle, IOB_INIT_SPEED_HZ);
+        (void) fps_close_sensor(&ctx.handle);
+    }
+
+    free(ctx.img_buf);
+
+    return (status < 0) ? 1 : 0;
+}
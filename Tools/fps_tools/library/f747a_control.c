@@ -42,7 +42,7 @@ f747a_init_sensor(fps_handle_t *handle)
     if (status < 0) {
         return status;
     }
-    fps_sleep(10.0 * 1000);
+    fps_clock_sleep(handle, 10.0 * 1000);
 
     // Specify the power up sequence in different configurations
     switch (handle->power_config) {
@@ -56,7 +56,7 @@ f747a_init_sensor(fps_handle_t *handle)
                 if (status < 0) {
                     return status;
                 }
-                fps_sleep(10.0 * 1000);
+                fps_clock_sleep(handle, 10.0 * 1000);
 			}
             break;
 
@@ -70,7 +70,7 @@ f747a_init_sensor(fps_handle_t *handle)
     if (status < 0) {
         return status;
     }
-    fps_sleep(10.0 * 1000);
+    fps_clock_sleep(handle, 10.0 * 1000);
 
     // Settings for sensing enhancement
     addr[0] = FPS_REG_GBL_CTL;
@@ -126,7 +126,7 @@ f747a_set_sensor_mode(fps_handle_t *handle,
     if (status < 0) {
         return status;
     }
-    fps_sleep(10.0 * 1000);
+    fps_clock_sleep(handle, 10.0 * 1000);
 
     // Image mode
     if (mode == FPS_IMAGE_MODE) {
@@ -137,7 +137,7 @@ f747a_set_sensor_mode(fps_handle_t *handle,
         if (status < 0) {
             return status;
         }
-        fps_sleep(10.0 * 1000);
+        fps_clock_sleep(handle, 10.0 * 1000);
     }
 
     // Detect mode
@@ -148,7 +148,7 @@ f747a_set_sensor_mode(fps_handle_t *handle,
         if (status < 0) {
             return status;
         }
-        fps_sleep(10.0 * 1000);
+        fps_clock_sleep(handle, 10.0 * 1000);
     }
 
     return status;
@@ -160,6 +160,159 @@ f747a_set_sensor_mode(fps_handle_t *handle,
 // Image Calibration
 //
 
+typedef struct __f747a_image_probe_context {
+    int     img_width;
+    int     img_height;
+    int     frms_to_avg;
+    int     col_begin;
+    int     col_end;
+    int     row_begin;
+    int     row_end;
+    int     coarse_area;
+    int     top_row;
+    int     middle_row;
+    int     bottom_row;
+    int     scan_col_begin;
+    int     scan_col_end;
+    int     upper_bound;
+    int     lower_bound;
+    uint8_t addr[3];
+    uint8_t data[3];
+} f747a_image_probe_context_t;
+
+static int
+f747a_image_probe(fps_handle_t      *handle,
+                  void              *context,
+                  int               cds_offset,
+                  int               pga_gain,
+                  int               quality,
+                  fps_image_probe_t *result)
+{
+    f747a_image_probe_context_t *ctx = (f747a_image_probe_context_t *) context;
+
+    int            status = 0;
+    int            img_width;
+    int            coarse_area;
+    int            darker_pixels;
+    fps_cal_info_t info;
+    int            c;
+
+    img_width   = ctx->img_width;
+    coarse_area = (quality == FPS_PROBE_COARSE);
+
+    LOG_DEBUG("CDS Offset = 0x%03X, PGA Gain = 0x%02X%s\n",
+              cds_offset, pga_gain,
+              ((coarse_area == TRUE) ? " (Coarse)" : ""));
+
+    // A coarse probe reads only the scanned columns of the middle row, once
+    if (coarse_area != ctx->coarse_area) {
+        if (coarse_area == TRUE) {
+            status = fps_set_sensing_area(handle, FPS_IMAGE_MODE,
+                                          ctx->scan_col_begin, ctx->scan_col_end,
+                                          ctx->row_begin + ctx->middle_row,
+                                          ctx->row_begin + ctx->middle_row);
+        } else {
+            status = fps_set_sensing_area(handle, FPS_IMAGE_MODE,
+                                          ctx->col_begin, ctx->col_end,
+                                          ctx->row_begin, ctx->row_end);
+        }
+        if (status < 0) {
+            return status;
+        }
+
+        ctx->coarse_area = coarse_area;
+    }
+
+    ctx->data[0] = ((uint8_t) ((cds_offset & 0x100) >> 1)) | (ctx->data[0] & 0x7F);
+    ctx->data[1] = ((uint8_t) ((cds_offset & 0x0FF) >> 0));
+    ctx->data[2] = ((uint8_t) ((pga_gain   & 0x0F ) >> 0)) | (ctx->data[2] & 0xF0);
+
+    status = fps_multiple_write(handle, ctx->addr, ctx->data, 3);
+    if (status < 0) {
+        return status;
+    }
+
+    if (coarse_area == TRUE) {
+        status = fps_get_averaged_image(handle,
+                                        ctx->scan_col_end - ctx->scan_col_begin + 1, 1, 1,
+                                        handle->bkgnd_img,
+                                        &handle->bkgnd_avg,
+                                        &handle->bkgnd_var,
+                                        &handle->bkgnd_noise);
+        if (status < 0) {
+            return status;
+        }
+
+        // Brightness is not judged from the middle row alone
+        darker_pixels = 0;
+
+        for (c = 0; c <= (ctx->scan_col_end - ctx->scan_col_begin); c++) {
+            if (handle->bkgnd_img[c] < ctx->lower_bound) {
+                darker_pixels++;
+            }
+        }
+
+        result->too_bright  = FALSE;
+        result->too_dark    = (darker_pixels > 0);
+        result->dark_excess = (double) darker_pixels - 0.5;
+
+        LOG_DEBUG("%s\n", ((result->too_dark == TRUE) ? "Too Dark" : "OK"));
+
+        return status;
+    }
+
+    // Get an image
+    status = fps_get_averaged_image(handle,
+                                    ctx->img_width,
+                                    ctx->img_height,
+                                    ctx->frms_to_avg,
+                                    handle->bkgnd_img,
+                                    &handle->bkgnd_avg,
+                                    &handle->bkgnd_var,
+                                    &handle->bkgnd_noise);
+    if (status < 0) {
+        return status;
+    }
+
+    if (handle->image_calibration_callback != NULL) {
+        info.img_buf      = handle->bkgnd_img;
+        info.img_avg      = handle->bkgnd_avg;
+        info.img_var      = handle->bkgnd_var;
+        info.img_noise    = handle->bkgnd_noise;
+        info.cds_offset_1 = cds_offset;
+        info.pga_gain_1   = pga_gain;
+
+        status = handle->image_calibration_callback(handle, &info);
+        if (status < 0) {
+            return status;
+        }
+    }
+
+    // Do calibration
+    result->too_bright = FALSE;
+    darker_pixels      = 0;
+
+    for (c = ctx->scan_col_begin; c <= ctx->scan_col_end; c++) {
+        if ((handle->bkgnd_img[ctx->top_row    * img_width + c] > ctx->upper_bound) ||
+            (handle->bkgnd_img[ctx->bottom_row * img_width + c] > ctx->upper_bound)) {
+            result->too_bright = TRUE;
+        }
+
+        if (handle->bkgnd_img[ctx->middle_row * img_width + c] < ctx->lower_bound) {
+            darker_pixels++;
+        }
+    }
+
+    // Any dark pixel in the middle row is too dark
+    result->too_dark    = (darker_pixels > 0);
+    result->dark_excess = (double) darker_pixels - 0.5;
+
+    LOG_DEBUG("%s\n", ((result->too_bright == TRUE) ? "Too Bright" :
+                       (result->too_dark   == TRUE) ? "Too Dark"   : "OK"));
+
+    return status;
+}
+
 int
 f747a_image_calibration(fps_handle_t *handle,
                         int          img_width,
@@ -171,32 +324,20 @@ f747a_image_calibration(fps_handle_t *handle,
     const int lower_bound      = 10;
     const int cds_offset_upper = FPS_MAX_CDS_OFFSET_1 - 0x80;
     const int cds_offset_lower = FPS_MIN_CDS_OFFSET_1 + 0x00;
-    const int cds_offset_step  = 1;
     const int pga_gain_upper   = FPS_MAX_PGA_GAIN_1 - 0x02;
     const int pga_gain_lower   = FPS_MIN_PGA_GAIN_1 + 0x05;
-    const int pga_gain_step    = 1;
 
-    int            status = 0;
-    int            sensor_width;
-    int            sensor_height;
-    int            col_begin;
-    int            col_end;
-    int            row_begin;
-    int            row_end;
-    int            top_row;
-    int            middle_row;
-    int            bottom_row;
-    int            scan_col_begin;
-    int            scan_col_end;
-    int            scan_width;
-    uint8_t        addr[3];
-    uint8_t        data[3];
-    int            cds_offset;
-    int            pga_gain;
-    int            too_bright;
-    int            too_dark;
-    fps_cal_info_t info;
-    int            c;
+    int                         status = 0;
+    int                         sensor_width;
+    int                         sensor_height;
+    int                         col_begin;
+    int                         col_end;
+    int                         row_begin;
+    int                         row_end;
+    int                         scan_width;
+    int                         cds_offset;
+    int                         pga_gain;
+    f747a_image_probe_context_t ctx;
 
     sensor_width  = handle->sensor_width;
     sensor_height = handle->sensor_height;
@@ -205,14 +346,24 @@ f747a_image_calibration(fps_handle_t *handle,
     col_end   = col_begin + img_width - 1;
     row_begin = (sensor_height - img_height) / 2;
     row_end   = row_begin + img_height - 1;
-    
-    top_row    = row_begin  + 4;
-    middle_row = img_height / 2;
-    bottom_row = row_end    - 4;
 
-    scan_col_begin = col_begin + 8;
-    scan_col_end   = col_end   - 8; 
-    scan_width     = scan_col_end - scan_col_begin + 1;
+    ctx.img_width      = img_width;
+    ctx.img_height     = img_height;
+    ctx.frms_to_avg    = frms_to_avg;
+    ctx.col_begin      = col_begin;
+    ctx.col_end        = col_end;
+    ctx.row_begin      = row_begin;
+    ctx.row_end        = row_end;
+    ctx.coarse_area    = FALSE;
+    ctx.top_row        = row_begin  + 4;
+    ctx.middle_row     = img_height / 2;
+    ctx.bottom_row     = row_end    - 4;
+    ctx.scan_col_begin = col_begin + 8;
+    ctx.scan_col_end   = col_end   - 8;
+    ctx.upper_bound    = upper_bound;
+    ctx.lower_bound    = lower_bound;
+
+    scan_width = ctx.scan_col_end - ctx.scan_col_begin + 1;
 
     if (scan_width < 0) {
         return -1;
@@ -230,121 +381,29 @@ f747a_image_calibration(fps_handle_t *handle,
     }
 
     // Initial conditions
-    addr[0] = FPS_REG_IMG_CDS_CTL_0;
-    addr[1] = FPS_REG_IMG_CDS_CTL_1;
-    addr[2] = FPS_REG_IMG_PGA1_CTL;
+    ctx.addr[0] = FPS_REG_IMG_CDS_CTL_0;
+    ctx.addr[1] = FPS_REG_IMG_CDS_CTL_1;
+    ctx.addr[2] = FPS_REG_IMG_PGA1_CTL;
 
-    status = fps_multiple_read(handle, addr, data, 3);
+    status = fps_multiple_read(handle, ctx.addr, ctx.data, 3);
     if (status < 0) {
         return status;
     }
 
-    cds_offset = cds_offset_upper;
-    pga_gain   = pga_gain_upper;
-
-    while (1) {
-        LOG_DEBUG("CDS Offset = 0x%03X, PGA Gain = 0x%02X\n",
-                  cds_offset, pga_gain);
-
-        data[0] = ((uint8_t) ((cds_offset & 0x100) >> 1)) | (data[0] & 0x7F);
-        data[1] = ((uint8_t) ((cds_offset & 0x0FF) >> 0));
-        data[2] = ((uint8_t) ((pga_gain   & 0x0F ) >> 0)) | (data[2] & 0xF0);
-
-        status = fps_multiple_write(handle, addr, data, 3);
-        if (status < 0) {
-            return status;
-        }
-
-        // Get an image
-        status = fps_get_averaged_image(handle,
-                                        img_width,
-                                        img_height,
-                                        frms_to_avg,
-                                        handle->bkgnd_img,
-                                        &handle->bkgnd_avg,
-                                        &handle->bkgnd_var,
-                                        &handle->bkgnd_noise);
-        if (status < 0) {
-            return status;
-        }
-
-        if (handle->image_calibration_callback != NULL) {
-            info.img_buf      = handle->bkgnd_img;
-            info.img_avg      = handle->bkgnd_avg;
-            info.img_var      = handle->bkgnd_var;
-            info.img_noise    = handle->bkgnd_noise; 
-            info.cds_offset_1 = cds_offset;
-            info.pga_gain_1   = pga_gain;
-
-            status = handle->image_calibration_callback(handle, &info);
-            if (status < 0) {
-                return status;
-            }
-        }
-
-        too_bright = FALSE;
-        too_dark   = FALSE;
-
-        for (c = scan_col_begin; c <= scan_col_end; c++) {
-            if (handle->bkgnd_img[top_row    * img_width + c] > upper_bound) {
-                too_bright = TRUE;
-                break;
-            }
-
-            if (handle->bkgnd_img[middle_row * img_width + c] < lower_bound) {
-                too_dark = TRUE;
-                break;
-            }
-
-            if (handle->bkgnd_img[bottom_row * img_width + c] > upper_bound) {
-                too_bright = TRUE;
-                break;
-            }
-        }
-
-        LOG_DEBUG("%s\n", ((too_bright == TRUE) ? "Too Bright" :
-                           (too_dark   == TRUE) ? "Too Dark"   : "OK"));
-
-        if (too_bright == TRUE) {
-            if (cds_offset < cds_offset_upper) {
-                cds_offset += cds_offset_step;
-                continue;
-            }
-
-            if (pga_gain > pga_gain_lower) {
-                pga_gain   -= pga_gain_step;
-                cds_offset  = cds_offset_upper;
-                continue;
-            }
-
-            LOG_ERROR("Too bright but no more settings!\n");
-            break;
-        }
-
-        if (too_dark == TRUE) {
-            if (cds_offset > cds_offset_lower) {
-                cds_offset -= cds_offset_step;
-                continue;
-            }
-
-            if (pga_gain < pga_gain_upper) {
-                pga_gain   += pga_gain_step;
-                cds_offset  = cds_offset_upper;
-                continue;
-            }
-
-            LOG_ERROR("Too dark but no more settings!\n");
-            break;
-        }
+    status = fps_search_image_cds_offset(handle,
+                                         f747a_image_probe, &ctx,
+                                         cds_offset_upper, cds_offset_lower,
+                                         pga_gain_upper,   pga_gain_lower,
+                                         &cds_offset, &pga_gain);
 
-        break;
+    // A failed search may stop on a coarse probe, so restore the image window
+    if (ctx.coarse_area == TRUE) {
+        fps_set_sensing_area(handle, FPS_IMAGE_MODE,
+                             col_begin, col_end,
+                             row_begin, row_end);
     }
 
-    if ((too_bright == FALSE) && (too_dark == FALSE)) {
-        return 0;
-    } else {
-        return -1;
-    }
+    return status;
 }
 
 
@@ -375,6 +434,7 @@ f747a_detect_calibration(fps_handle_t *handle,
     int     cds_offset_init;
     int     cds_offset;
     int     detect_th;
+    int     detect_th_found;
     int     img_col_begin;
     int     img_col_end;
     int     img_row_begin;
@@ -430,10 +490,6 @@ f747a_detect_calibration(fps_handle_t *handle,
         return status;
     }
 
-    // Calculate corresponding sleep time
-    sleep_us  = fps_calculate_suspend_time((det_width * det_height), frms_to_susp);
-    sleep_us *= sleep_mul;
-
 
     // 3. Search the best detect window
     // -------------------------------------------------------------------------
@@ -473,6 +529,17 @@ f747a_detect_calibration(fps_handle_t *handle,
         return status;
     }
 
+    // Measure the detect cycle once per handle
+    if (handle->osc_period_us <= 0.0) {
+        if (fps_measure_detect_period(handle) < 0) {
+            LOG_WARN("Measuring detect period failed, assuming the slowest oscillator\n");
+        }
+    }
+
+    // Calculate corresponding sleep time
+    sleep_us = fps_get_suspend_time(handle, (det_width * det_height), frms_to_susp, sleep_mul);
+    LOG_DEBUG("Sleep Time = %0.3f us\n", sleep_us);
+
     // Calculate the extra CDS Offset should be added
     extra_cds_offset = (int) ((det_avg - 35.0) / 10.0);
     LOG_DEBUG("Extra CDS Offset = %0.3f\n", extra_cds_offset);
@@ -484,10 +551,13 @@ f747a_detect_calibration(fps_handle_t *handle,
     // Search Detect Threshold using binary search
     for (retry_cnt = 0; retry_cnt < retry_limit; retry_cnt++) {
 
-        status = fps_search_detect_threshold(handle,
+        status = fps_search_detect_predicted(handle,
+                                             FPS_MODEL_DETECT_TH,
                                              FPS_SEARCH_ONE_TRIGGER,
                                              detect_th_upper,
                                              detect_th_lower,
+                                             det_avg,
+                                             0,
                                              sleep_us,
                                              1,
                                              &detect_th);
@@ -507,6 +577,8 @@ f747a_detect_calibration(fps_handle_t *handle,
         return -1;
     }
 
+    detect_th_found = detect_th;
+
     // Fine tune Detect Threshold
     for (; retry_cnt < retry_limit; retry_cnt++) {
 
@@ -564,13 +636,16 @@ f747a_detect_calibration(fps_handle_t *handle,
     // Search CDS Offset using binary search
     for (; retry_cnt < retry_limit; retry_cnt++) {
 
-        status = fps_search_detect_cds_offset(handle,
-                                              FPS_SEARCH_ONE_TRIGGER,
-                                              cds_offset_upper,
-                                              cds_offset_lower,
-                                              sleep_us,
-                                              4,
-                                              &cds_offset);
+        status = fps_search_detect_predicted(handle,
+                                             FPS_MODEL_CDS_OFFSET,
+                                             FPS_SEARCH_ONE_TRIGGER,
+                                             cds_offset_upper,
+                                             cds_offset_lower,
+                                             det_avg,
+                                             0,
+                                             sleep_us,
+                                             4,
+                                             &cds_offset);
         if (status == -2) {
             continue;
         }
@@ -587,6 +662,9 @@ f747a_detect_calibration(fps_handle_t *handle,
         return -1;
     }
 
+    // Log the search results, so that later calibrations start narrower
+    (void) fps_update_detect_model(handle, det_avg, detect_th_found, cds_offset);
+
     // Fine tune CDS Offset
     for (; retry_cnt < retry_limit; retry_cnt++) {
 
@@ -4,9 +4,34 @@
 #include "fps.h"
 #include "fps_control.h"
 #include "fps_calibration.h"
+#include "f747b_control.h"
 #include "f747b_register.h"
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Power Sequencing Delays
+// -----------------------------------------------------------------------------
+// NOTE: Delays per power configuration, the characterized 20 ms reset pulse,
+//       50 ms per power step and for the analog settling, and 20 ms per mode
+//       switch step. The registers have no power-good or settled status, so
+//       nothing can be polled instead; a board which settles faster may lower
+//       them with fps_set_power_timing(). After the reset the chip ID is read
+//       back, which only shows that the chip answers over SPI.
+//
+
+const fps_power_timing_t f747b_power_timing[FPS_POWER_CONFIGS] = {
+    // FPS_POWER_CONFIG_1V8_3V3
+    { 20000.0, 0.0, { 50000.0, 50000.0, 50000.0,     0.0 }, 50000.0, 20000.0, 20000.0, 50000.0 },
+    // FPS_POWER_CONFIG_1V8_2V8
+    { 20000.0, 0.0, { 50000.0, 50000.0, 50000.0, 50000.0 }, 50000.0, 20000.0, 20000.0, 50000.0 },
+    // FPS_POWER_CONFIG_1V8_ONLY
+    { 20000.0, 0.0, { 50000.0, 50000.0, 50000.0, 50000.0 }, 50000.0, 20000.0, 20000.0, 50000.0 },
+    // FPS_POWER_CONFIG_EXTERNAL
+    { 20000.0, 0.0, { 50000.0,     0.0,     0.0,     0.0 }, 50000.0, 20000.0, 20000.0, 50000.0 },
+};
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Initialize Sensor
@@ -15,12 +40,17 @@
 int
 f747b_init_sensor(fps_handle_t *handle)
 {
-    const double init_sensor_delay_us = 50.0 * 1000;
+    int                status = 0;
+    fps_power_timing_t *timing;
+    uint8_t            addr[6];
+    uint8_t            data[6];
+	int                i;
 
-    int     status = 0;
-    uint8_t addr[6];
-    uint8_t data[6];
-	int     i;
+    if ((handle->power_config < 0) || (handle->power_config >= FPS_POWER_CONFIGS)) {
+        return -1;
+    }
+
+    timing = &handle->power_timing[handle->power_config];
 
     // Setup appropriate SPI speed
     status = fps_set_sensor_speed(handle, 8 * 1000 * 1000);
@@ -28,8 +58,13 @@ f747b_init_sensor(fps_handle_t *handle)
         return status;
     }
 
-    // Reset sensor
-    FPS_RESET_SENSOR(handle, 20.0 * 1000);
+    // Reset sensor and check that it answers again
+    FPS_RESET_SENSOR(handle, timing->reset_pulse_us);
+
+    status = fps_wait_spi_alive(handle, timing->reset_delay_us, timing->alive_timeout_us);
+    if (status < 0) {
+        return status;
+    }
 
     // Disable and clear interrupts
     FPS_DISABLE_AND_CLEAR_INTERRUPT(handle, FPS_ALL_EVENTS);
@@ -45,7 +80,8 @@ f747b_init_sensor(fps_handle_t *handle)
     if (status < 0) {
         return status;
     }
-    fps_sleep(init_sensor_delay_us);
+
+    fps_clock_sleep(handle, timing->power_step_us[0]);
 
     // Specify the power up sequence in different configurations
     switch (handle->power_config) {
@@ -58,7 +94,7 @@ f747b_init_sensor(fps_handle_t *handle)
                 if (status < 0) {
                     return status;
                 }
-                fps_sleep(init_sensor_delay_us);
+                fps_clock_sleep(handle, timing->power_step_us[(i + 1)]);
 			}
             break;
 
@@ -73,7 +109,7 @@ f747b_init_sensor(fps_handle_t *handle)
                 if (status < 0) {
                     return status;
                 }
-                fps_sleep(init_sensor_delay_us);
+                fps_clock_sleep(handle, timing->power_step_us[(i + 1)]);
 			}
             break;
 
@@ -97,7 +133,7 @@ f747b_init_sensor(fps_handle_t *handle)
         return status;
     }
 
-    fps_sleep(init_sensor_delay_us);
+    fps_clock_sleep(handle, timing->enhance_us);
 
     return status;
 }
@@ -112,11 +148,16 @@ int
 f747b_set_sensor_mode(fps_handle_t *handle,
                       int          mode)
 {
-    const double set_mode_delay_us = 20.0 * 1000;
+    int                status = 0;
+    fps_power_timing_t *timing;
+    uint8_t            addr[9];
+    uint8_t            data[9];
 
-    int     status = 0;
-    uint8_t addr[9];
-    uint8_t data[9];
+    if ((handle->power_config < 0) || (handle->power_config >= FPS_POWER_CONFIGS)) {
+        return -1;
+    }
+
+    timing = &handle->power_timing[handle->power_config];
 
     addr[0] = FPS_REG_CPR_CTL_1; addr[1] = DUMMY_DATA;
     addr[2] = FPS_REG_PWR_CTL_0; addr[3] = DUMMY_DATA;
@@ -141,7 +182,7 @@ f747b_set_sensor_mode(fps_handle_t *handle,
         return status;
     }
 
-    fps_sleep(set_mode_delay_us);
+    fps_clock_sleep(handle, timing->mode_pwrdwn_us);
 
     switch (mode) {
         case FPS_IMAGE_MODE :
@@ -153,7 +194,7 @@ f747b_set_sensor_mode(fps_handle_t *handle,
                 return status;
             }
 
-            fps_sleep(set_mode_delay_us);
+            fps_clock_sleep(handle, timing->mode_enter_us);
             break;
 
         case FPS_DETECT_MODE :
@@ -165,7 +206,7 @@ f747b_set_sensor_mode(fps_handle_t *handle,
                 return status;
             }
 
-            fps_sleep(set_mode_delay_us);
+            fps_clock_sleep(handle, timing->mode_enter_us);
             break;
 
         default : break;
@@ -180,6 +221,155 @@ f747b_set_sensor_mode(fps_handle_t *handle,
 // Image Calibration
 //
 
+typedef struct __f747b_image_probe_context {
+    int     img_width;
+    int     img_height;
+    int     frms_to_avg;
+    int     col_begin;
+    int     col_end;
+    int     row_begin;
+    int     row_end;
+    int     coarse_area;
+    int     scan_col_begin;
+    int     scan_col_end;
+    int     scan_row_begin;
+    int     scan_row_end;
+    int     upper_bound;
+    int     lower_bound;
+    int     ratio_pixels;
+    uint8_t addr[3];
+    uint8_t data[3];
+} f747b_image_probe_context_t;
+
+static int
+f747b_image_probe(fps_handle_t      *handle,
+                  void              *context,
+                  int               cds_offset,
+                  int               pga_gain,
+                  int               quality,
+                  fps_image_probe_t *result)
+{
+    f747b_image_probe_context_t *ctx = (f747b_image_probe_context_t *) context;
+
+    int            status = 0;
+    int            brighter_pixels;
+    int            darker_pixels;
+    int            img_width;
+    int            img_height;
+    int            frms_to_avg;
+    int            scan_col_begin;
+    int            scan_col_end;
+    int            scan_row_begin;
+    int            scan_row_end;
+    int            coarse_area;
+    fps_cal_info_t info;
+    int            r;
+    int            c;
+
+    LOG_DEBUG("CDS Offset = 0x%03X, PGA Gain = 0x%02X%s\n",
+              cds_offset, pga_gain,
+              ((quality == FPS_PROBE_COARSE) ? " (Coarse)" : ""));
+
+    // A coarse probe reads only the scan region, once, and scans all of it
+    if (quality == FPS_PROBE_COARSE) {
+        img_width      = ctx->scan_col_end - ctx->scan_col_begin + 1;
+        img_height     = ctx->scan_row_end - ctx->scan_row_begin + 1;
+        frms_to_avg    = 1;
+        scan_col_begin = 0;
+        scan_col_end   = img_width  - 1;
+        scan_row_begin = 0;
+        scan_row_end   = img_height - 1;
+        coarse_area    = TRUE;
+    } else {
+        img_width      = ctx->img_width;
+        img_height     = ctx->img_height;
+        frms_to_avg    = ctx->frms_to_avg;
+        scan_col_begin = ctx->scan_col_begin;
+        scan_col_end   = ctx->scan_col_end;
+        scan_row_begin = ctx->scan_row_begin;
+        scan_row_end   = ctx->scan_row_end;
+        coarse_area    = FALSE;
+    }
+
+    if (coarse_area != ctx->coarse_area) {
+        if (coarse_area == TRUE) {
+            status = fps_set_sensing_area(handle, FPS_IMAGE_MODE,
+                                          ctx->scan_col_begin, ctx->scan_col_end,
+                                          ctx->scan_row_begin, ctx->scan_row_end);
+        } else {
+            status = fps_set_sensing_area(handle, FPS_IMAGE_MODE,
+                                          ctx->col_begin, ctx->col_end,
+                                          ctx->row_begin, ctx->row_end);
+        }
+        if (status < 0) {
+            return status;
+        }
+
+        ctx->coarse_area = coarse_area;
+    }
+
+    ctx->data[0] = ((uint8_t) ((cds_offset & 0x100) >> 1)) | (ctx->data[0] & 0x7F);
+    ctx->data[1] = ((uint8_t) ((cds_offset & 0x0FF) >> 0));
+    ctx->data[2] = ((uint8_t) ((pga_gain & 0x0F ) >> 0)) | (ctx->data[2] & 0xF0);
+
+    status = fps_multiple_write(handle, ctx->addr, ctx->data, 3);
+    if (status < 0) {
+        return status;
+    }
+
+    // Get an image
+    status = fps_get_averaged_image(handle,
+                                    img_width,
+                                    img_height,
+                                    frms_to_avg,
+                                    handle->bkgnd_img,
+                                    &handle->bkgnd_avg,
+                                    &handle->bkgnd_var,
+                                    &handle->bkgnd_noise);
+    if (status < 0) {
+        return status;
+    }
+
+    if ((handle->image_calibration_callback != NULL) && (quality == FPS_PROBE_FULL)) {
+        info.img_buf      = handle->bkgnd_img;
+        info.img_avg      = handle->bkgnd_avg;
+        info.img_var      = handle->bkgnd_var;
+        info.img_noise    = handle->bkgnd_noise;
+        info.cds_offset_1 = cds_offset;
+        info.pga_gain_1   = pga_gain;
+
+        status = handle->image_calibration_callback(handle, &info);
+        if (status < 0) {
+            return status;
+        }
+    }
+
+    // Do calibration
+    brighter_pixels = 0;
+    darker_pixels   = 0;
+
+    for (r = scan_row_begin; r <= scan_row_end; r++) {
+    for (c = scan_col_begin; c <= scan_col_end; c++) {
+        if (handle->bkgnd_img[r * img_width + c] > ctx->upper_bound) {
+            brighter_pixels++;
+        }
+        if (handle->bkgnd_img[r * img_width + c] < ctx->lower_bound) {
+            darker_pixels++;
+        }
+    }}
+
+    result->too_bright  = (brighter_pixels >= ctx->ratio_pixels);
+    result->too_dark    = (darker_pixels   >= ctx->ratio_pixels);
+    result->dark_excess = (double) darker_pixels - ctx->ratio_pixels + 0.5;
+
+    LOG_DEBUG("Brighter = %0d, Darker = %0d (%s)\n",
+              brighter_pixels, darker_pixels,
+              (result->too_bright ? "Too Bright" :
+               result->too_dark   ? "Too Dark"   : "OK"));
+
+    return status;
+}
+
 int
 f747b_image_calibration(fps_handle_t *handle,
                         int          img_width,
@@ -192,36 +382,22 @@ f747b_image_calibration(fps_handle_t *handle,
     const double ratio            = 0.05;
     const int    cds_offset_upper = FPS_MAX_CDS_OFFSET_1 - 0x80;
     const int    cds_offset_lower = FPS_MIN_CDS_OFFSET_1 + 0x00;
-    const int    cds_offset_step  = 1;
     const int    pga_gain_upper   = FPS_MAX_PGA_GAIN_1 - 0x02;
     const int    pga_gain_lower   = FPS_MIN_PGA_GAIN_1 + 0x05;
-    const int    pga_gain_step    = 1;
 
-    int            status = 0;
-	int            sensor_width;
-	int            sensor_height;
-	int            col_begin;
-	int            col_end;
-	int            row_begin;
-	int            row_end;
-    int            scan_col_begin;
-    int            scan_col_end;
-    int            scan_row_begin;
-    int            scan_row_end;
-    int            scan_width;
-    int            scan_height;
-    size_t         scan_size;
-    uint8_t        addr[3];
-    uint8_t        data[3];
-    int            cds_offset;
-    int            pga_gain;
-    int            brighter_pixels;
-    int            darker_pixels;
-    int            too_bright;
-    int            too_dark;
-    fps_cal_info_t info;
-    int            r;
-    int            c;
+    int                         status = 0;
+	int                         sensor_width;
+	int                         sensor_height;
+	int                         col_begin;
+	int                         col_end;
+	int                         row_begin;
+	int                         row_end;
+    int                         scan_width;
+    int                         scan_height;
+    size_t                      scan_size;
+    int                         cds_offset;
+    int                         pga_gain;
+    f747b_image_probe_context_t ctx;
 
     sensor_width  = handle->sensor_width;
     sensor_height = handle->sensor_height;
@@ -231,19 +407,33 @@ f747b_image_calibration(fps_handle_t *handle,
     row_begin = (sensor_height - img_height) / 2;
     row_end   = row_begin + img_height - 1;
 
-    scan_col_begin = col_begin + (img_width  / 4);
-    scan_col_end   = col_end   - (img_width  / 4);
-    scan_row_begin = row_begin + (img_height / 4);
-    scan_row_end   = row_end   - (img_height / 4);
-
-    scan_width  = scan_col_end - scan_col_begin + 1;
-    scan_height = scan_row_end - scan_row_begin + 1;
+    ctx.img_width      = img_width;
+    ctx.img_height     = img_height;
+    ctx.frms_to_avg    = frms_to_avg;
+    ctx.col_begin      = col_begin;
+    ctx.col_end        = col_end;
+    ctx.row_begin      = row_begin;
+    ctx.row_end        = row_end;
+    ctx.coarse_area    = FALSE;
+    ctx.scan_col_begin = col_begin + (img_width  / 4);
+    ctx.scan_col_end   = col_end   - (img_width  / 4);
+    ctx.scan_row_begin = row_begin + (img_height / 4);
+    ctx.scan_row_end   = row_end   - (img_height / 4);
+    ctx.upper_bound    = upper_bound;
+    ctx.lower_bound    = lower_bound;
+
+    scan_width  = ctx.scan_col_end - ctx.scan_col_begin + 1;
+    scan_height = ctx.scan_row_end - ctx.scan_row_begin + 1;
     scan_size   = scan_width * scan_height;
 
     if ((scan_width < 0) || (scan_height < 0)) {
         return -1;
     }
 
+    // Pixel count limit for too bright or too dark, kept out of the loop so
+    // each iteration only does integer comparisons
+    ctx.ratio_pixels = (int) (((double) scan_size) * ratio);
+
     // Disable and clear all interrupts
     FPS_DISABLE_AND_CLEAR_INTERRUPT(handle, FPS_ALL_EVENTS);
 
@@ -256,120 +446,29 @@ f747b_image_calibration(fps_handle_t *handle,
     }
 
     // Initial conditions
-    addr[0] = FPS_REG_IMG_CDS_CTL_0;
-    addr[1] = FPS_REG_IMG_CDS_CTL_1;
-    addr[2] = FPS_REG_IMG_PGA1_CTL;
+    ctx.addr[0] = FPS_REG_IMG_CDS_CTL_0;
+    ctx.addr[1] = FPS_REG_IMG_CDS_CTL_1;
+    ctx.addr[2] = FPS_REG_IMG_PGA1_CTL;
 
-    status = fps_multiple_read(handle, addr, data, 3);
+    status = fps_multiple_read(handle, ctx.addr, ctx.data, 3);
     if (status < 0) {
         return status;
     }
 
-    cds_offset = cds_offset_upper;
-    pga_gain   = pga_gain_upper;
-
-    while (1) {
-        LOG_DEBUG("CDS Offset = 0x%03X, PGA Gain = 0x%02X\n",
-                  cds_offset, pga_gain);
-
-        data[0] = ((uint8_t) ((cds_offset & 0x100) >> 1)) | (data[0] & 0x7F);
-        data[1] = ((uint8_t) ((cds_offset & 0x0FF) >> 0));
-        data[2] = ((uint8_t) ((pga_gain & 0x0F ) >> 0)) | (data[2] & 0xF0);
-
-        status = fps_multiple_write(handle, addr, data, 3);
-        if (status < 0) {
-            return status;
-        }
-
-        // Get an image
-        status = fps_get_averaged_image(handle,
-                                        img_width,
-                                        img_height,
-                                        frms_to_avg,
-                                        handle->bkgnd_img,
-                                        &handle->bkgnd_avg,
-                                        &handle->bkgnd_var,
-                                        &handle->bkgnd_noise);
-        if (status < 0) {
-            return status;
-        }
-
-        if (handle->image_calibration_callback != NULL) {
-            info.img_buf      = handle->bkgnd_img;
-            info.img_avg      = handle->bkgnd_avg;
-            info.img_var      = handle->bkgnd_var;
-            info.img_noise    = handle->bkgnd_noise;
-            info.cds_offset_1 = cds_offset;
-            info.pga_gain_1   = pga_gain;
-
-            status = handle->image_calibration_callback(handle, &info);
-            if (status < 0) {
-                return status;
-            }
-        }
-
-        // Do calibration
-        brighter_pixels = 0;
-        darker_pixels   = 0;
-
-        for (r = scan_row_begin; r <= scan_row_end; r++) {
-        for (c = scan_col_begin; c <= scan_col_end; c++) {
-            if (handle->bkgnd_img[r * img_width + c] > upper_bound) {
-                brighter_pixels++;
-            }
-            if (handle->bkgnd_img[r * img_width + c] < lower_bound) {
-                darker_pixels++;
-            }
-        }}
-
-        too_bright = (brighter_pixels >= (int) (((double) scan_size) * ratio));
-        too_dark   = (darker_pixels   >= (int) (((double) scan_size) * ratio));
-
-        LOG_DEBUG("Brighter = %0d, Darker = %0d (%s)\n",
-                  brighter_pixels, darker_pixels,
-                  (too_bright ? "Too Bright" :
-                   too_dark   ? "Too Dark"   : "OK"));
-
-        if (((cds_offset == cds_offset_upper) && (pga_gain == pga_gain_lower)) ||
-            ((cds_offset == cds_offset_lower) && (pga_gain == pga_gain_upper))) {
-            LOG_ERROR("No more settings!\n");
-            break;
-        }
-
-        if (too_bright == TRUE) {
-            if (cds_offset < cds_offset_upper) {
-                cds_offset += cds_offset_step;
-                continue;
-            }
-
-            if (pga_gain > pga_gain_lower) {
-                pga_gain   -= pga_gain_step;
-                cds_offset  = cds_offset_upper;
-                continue;
-            }
-        }
-
-        if (too_dark == TRUE) {
-            if (cds_offset > cds_offset_lower) {
-                cds_offset -= cds_offset_step;
-                continue;
-            }
-
-            if (pga_gain < pga_gain_upper) {
-                pga_gain   += pga_gain_step;
-                cds_offset  = cds_offset_upper;
-                continue;
-            }
-        }
-
-        break;
+    status = fps_search_image_cds_offset(handle,
+                                         f747b_image_probe, &ctx,
+                                         cds_offset_upper, cds_offset_lower,
+                                         pga_gain_upper,   pga_gain_lower,
+                                         &cds_offset, &pga_gain);
+
+    // A failed search may stop on a coarse probe, so restore the image window
+    if (ctx.coarse_area == TRUE) {
+        fps_set_sensing_area(handle, FPS_IMAGE_MODE,
+                             col_begin, col_end,
+                             row_begin, row_end);
     }
 
-    if ((too_bright == FALSE) && (too_dark == FALSE)) {
-        return 0;
-    } else {
-        return -1;
-    }
+    return status;
 }
 
 
@@ -432,11 +531,6 @@ f747b_detect_calibration(fps_handle_t *handle,
         return status;
     }
 
-    // Calculate corresponding sleep time
-    sleep_us  = fps_calculate_suspend_time((det_width * det_height), frms_to_susp);
-    sleep_us *= sleep_mul;
-    LOG_DEBUG("Sleep Time = %0.3f us\n", sleep_us);
-
 
     // 2. Set initial CDS and PGA settings
     // ------------------------------------------------------------------------
@@ -497,6 +591,17 @@ f747b_detect_calibration(fps_handle_t *handle,
         return status;
     }
 
+    // Measure the detect cycle once per handle
+    if (handle->osc_period_us <= 0.0) {
+        if (fps_measure_detect_period(handle) < 0) {
+            LOG_WARN("Measuring detect period failed, assuming the slowest oscillator\n");
+        }
+    }
+
+    // Calculate corresponding sleep time
+    sleep_us = fps_get_suspend_time(handle, (det_width * det_height), frms_to_susp, sleep_mul);
+    LOG_DEBUG("Sleep Time = %0.3f us\n", sleep_us);
+
     // Check CDS current setting
     status = fps_single_read(handle, FPS_REG_ANA_I_SET_0, &data[0]);
     if (status < 0) {
@@ -524,10 +629,13 @@ f747b_detect_calibration(fps_handle_t *handle,
     // Search Detect Threshold using binary search
     for (retry_cnt = 0; retry_cnt < retry_limit; retry_cnt++) {
 
-        status = fps_search_detect_threshold(handle,
+        status = fps_search_detect_predicted(handle,
+                                             FPS_MODEL_DETECT_TH,
                                              FPS_SEARCH_ONE_TRIGGER,
                                              detect_th_upper,
                                              detect_th_lower,
+                                             det_avg,
+                                             0,
                                              sleep_us,
                                              1,
                                              &detect_th);
@@ -551,13 +659,16 @@ f747b_detect_calibration(fps_handle_t *handle,
     // Search CDS Offset using binary search
     for (; retry_cnt < retry_limit; retry_cnt++) {
 
-        status = fps_search_detect_cds_offset(handle,
-                                              FPS_SEARCH_ONE_TRIGGER,
-                                              cds_offset_upper,
-                                              cds_offset_lower,
-                                              sleep_us,
-                                              1,
-                                              &cds_offset);
+        status = fps_search_detect_predicted(handle,
+                                             FPS_MODEL_CDS_OFFSET,
+                                             FPS_SEARCH_ONE_TRIGGER,
+                                             cds_offset_upper,
+                                             cds_offset_lower,
+                                             det_avg,
+                                             cds_offset_tol,
+                                             sleep_us,
+                                             1,
+                                             &cds_offset);
         if (status == -2) {
             continue;
         }
@@ -572,6 +683,9 @@ f747b_detect_calibration(fps_handle_t *handle,
         return -1;
     }
 
+    // Log the search results, so that later calibrations start narrower
+    (void) fps_update_detect_model(handle, det_avg, detect_th, cds_offset);
+
     // 6. Final check
     // -------------------------------------------------------------------------
 
@@ -10,6 +10,8 @@ extern "C" {
 #endif
 
     
+extern const fps_power_timing_t f747b_power_timing[FPS_POWER_CONFIGS];
+
 int f747b_init_sensor(fps_handle_t *handle);
 
 int f747b_set_sensor_mode(fps_handle_t *handle,
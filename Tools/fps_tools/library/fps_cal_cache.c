@@ -0,0 +1,653 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "debug.h"
+#include "fps.h"
+#include "fps_control.h"
+#include "fps_calibration.h"
+#include "fps_pool.h"
+#include "fps_cal_cache.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Snapshot Structure
+//
+
+typedef struct __fps_cal_snapshot {
+    int     chip_id;
+    int     power_config;
+    int     sensor_width;
+    int     sensor_height;
+    int     img_col_begin;
+    int     img_col_end;
+    int     img_row_begin;
+    int     img_row_end;
+    int     det_col_begin;
+    int     det_col_end;
+    int     det_row_begin;
+    int     det_row_end;
+    int     params[8];
+    int     detect_th;
+    int     frms_to_susp;
+    double  bkgnd_avg;
+    double  bkgnd_var;
+    double  bkgnd_noise;
+    uint8_t *bkgnd_img;
+} fps_cal_snapshot_t;
+
+// CDS offsets and PGA gains in file order
+static const int fps_cal_snapshot_params[8] = {
+    FPS_IMAGE_MODE  | FPS_PARAM_CDS_OFFSET_0,
+    FPS_IMAGE_MODE  | FPS_PARAM_CDS_OFFSET_1,
+    FPS_IMAGE_MODE  | FPS_PARAM_PGA_GAIN_0,
+    FPS_IMAGE_MODE  | FPS_PARAM_PGA_GAIN_1,
+    FPS_DETECT_MODE | FPS_PARAM_CDS_OFFSET_0,
+    FPS_DETECT_MODE | FPS_PARAM_CDS_OFFSET_1,
+    FPS_DETECT_MODE | FPS_PARAM_PGA_GAIN_0,
+    FPS_DETECT_MODE | FPS_PARAM_PGA_GAIN_1,
+};
+
+// Magic, version, 4 key fields, 8 window edges, 8 parameters, threshold and
+// suspend frames, then 3 doubles and the image size. The image and the
+// checksum follow.
+#define FPS_CAL_CACHE_HEADER_SIZE ((4 * 24) + (8 * 3) + 4)
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Serialization
+//
+
+static void
+fps_put_u32(uint8_t  **ptr,
+            uint32_t value)
+{
+    (*ptr)[0] = (uint8_t) ((value >>  0) & 0xFF);
+    (*ptr)[1] = (uint8_t) ((value >>  8) & 0xFF);
+    (*ptr)[2] = (uint8_t) ((value >> 16) & 0xFF);
+    (*ptr)[3] = (uint8_t) ((value >> 24) & 0xFF);
+    *ptr += 4;
+}
+
+static uint32_t
+fps_get_u32(uint8_t **ptr)
+{
+    uint32_t value;
+
+    value = (((uint32_t) (*ptr)[0]) <<  0) |
+            (((uint32_t) (*ptr)[1]) <<  8) |
+            (((uint32_t) (*ptr)[2]) << 16) |
+            (((uint32_t) (*ptr)[3]) << 24);
+    *ptr += 4;
+
+    return value;
+}
+
+static void
+fps_put_double(uint8_t **ptr,
+               double  value)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    fps_put_u32(ptr, (uint32_t) (bits >>  0));
+    fps_put_u32(ptr, (uint32_t) (bits >> 32));
+}
+
+static double
+fps_get_double(uint8_t **ptr)
+{
+    uint64_t bits;
+    double   value;
+
+    bits  = ((uint64_t) fps_get_u32(ptr)) <<  0;
+    bits |= ((uint64_t) fps_get_u32(ptr)) << 32;
+
+    memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+// FNV-1a
+static uint32_t
+fps_cal_cache_checksum(uint8_t *buf,
+                       size_t  size)
+{
+    uint32_t hash = 0x811C9DC5;
+    size_t   i;
+
+    for (i = 0; i < size; i++) {
+        hash = (hash ^ buf[i]) * 0x01000193;
+    }
+
+    return hash;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Snapshot Read/Write
+//
+
+static int
+fps_capture_snapshot(fps_handle_t       *handle,
+                     fps_cal_snapshot_t *snapshot)
+{
+    int status = 0;
+    int i;
+
+    snapshot->chip_id       = handle->chip_id;
+    snapshot->power_config  = handle->power_config;
+    snapshot->sensor_width  = handle->sensor_width;
+    snapshot->sensor_height = handle->sensor_height;
+
+    status = fps_get_sensing_area(handle, FPS_IMAGE_MODE,
+                                  &snapshot->img_col_begin, &snapshot->img_col_end,
+                                  &snapshot->img_row_begin, &snapshot->img_row_end);
+    if (status < 0) {
+        return status;
+    }
+
+    status = fps_get_sensing_area(handle, FPS_DETECT_MODE,
+                                  &snapshot->det_col_begin, &snapshot->det_col_end,
+                                  &snapshot->det_row_begin, &snapshot->det_row_end);
+    if (status < 0) {
+        return status;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(fps_cal_snapshot_params); i++) {
+        status = fps_get_sensor_parameter(handle,
+                                          fps_cal_snapshot_params[i],
+                                          &snapshot->params[i]);
+        if (status < 0) {
+            return status;
+        }
+    }
+
+    status = fps_get_sensor_parameter(handle,
+                                      FPS_PARAM_DETECT_THRESHOLD,
+                                      &snapshot->detect_th);
+    if (status < 0) {
+        return status;
+    }
+
+    status = fps_get_suspend_frames(handle, &snapshot->frms_to_susp);
+    if (status < 0) {
+        return status;
+    }
+
+    snapshot->bkgnd_avg   = handle->bkgnd_avg;
+    snapshot->bkgnd_var   = handle->bkgnd_var;
+    snapshot->bkgnd_noise = handle->bkgnd_noise;
+    snapshot->bkgnd_img   = handle->bkgnd_img;
+
+    return status;
+}
+
+static int
+fps_apply_snapshot(fps_handle_t       *handle,
+                   fps_cal_snapshot_t *snapshot)
+{
+    int status = 0;
+    int i;
+
+    status = fps_set_sensing_area(handle, FPS_IMAGE_MODE,
+                                  snapshot->img_col_begin, snapshot->img_col_end,
+                                  snapshot->img_row_begin, snapshot->img_row_end);
+    if (status < 0) {
+        return status;
+    }
+
+    status = fps_set_sensing_area(handle, FPS_DETECT_MODE,
+                                  snapshot->det_col_begin, snapshot->det_col_end,
+                                  snapshot->det_row_begin, snapshot->det_row_end);
+    if (status < 0) {
+        return status;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(fps_cal_snapshot_params); i++) {
+        status = fps_set_sensor_parameter(handle,
+                                          fps_cal_snapshot_params[i],
+                                          snapshot->params[i]);
+        if (status < 0) {
+            return status;
+        }
+    }
+
+    status = fps_set_sensor_parameter(handle,
+                                      FPS_PARAM_DETECT_THRESHOLD,
+                                      snapshot->detect_th);
+    if (status < 0) {
+        return status;
+    }
+
+    status = fps_set_suspend_frames(handle, snapshot->frms_to_susp);
+    if (status < 0) {
+        return status;
+    }
+
+    memcpy(handle->bkgnd_img, snapshot->bkgnd_img,
+           (size_t) (handle->sensor_width * handle->sensor_height));
+
+    handle->bkgnd_avg   = snapshot->bkgnd_avg;
+    handle->bkgnd_var   = snapshot->bkgnd_var;
+    handle->bkgnd_noise = snapshot->bkgnd_noise;
+
+    return status;
+}
+
+// Read and check a snapshot file. On success file_buf holds the file and
+// snapshot->bkgnd_img points into it, so the caller must free file_buf.
+static int
+fps_read_snapshot(fps_handle_t       *handle,
+                  char               *path,
+                  fps_cal_snapshot_t *snapshot,
+                  uint8_t            **file_buf)
+{
+    int      status = -1;
+    FILE     *fp    = NULL;
+    uint8_t  *buf   = NULL;
+    uint8_t  *ptr;
+    size_t   sensor_size;
+    size_t   file_size;
+    uint32_t checksum;
+    int      i;
+
+    sensor_size = (size_t) (handle->sensor_width * handle->sensor_height);
+    file_size   = FPS_CAL_CACHE_HEADER_SIZE + sensor_size + 4;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        LOG_DEBUG("No calibration cache at %s\n", path);
+        goto fps_read_snapshot_end;
+    }
+
+    // One extra byte to catch files which are too long
+    buf = (uint8_t *) malloc(file_size + 1);
+    if (buf == NULL) {
+        goto fps_read_snapshot_end;
+    }
+
+    if (fread(buf, 1, file_size + 1, fp) != file_size) {
+        LOG_WARN("Calibration cache has a wrong size!\n");
+        goto fps_read_snapshot_end;
+    }
+
+    ptr      = &buf[file_size - 4];
+    checksum = fps_get_u32(&ptr);
+
+    if (checksum != fps_cal_cache_checksum(buf, file_size - 4)) {
+        LOG_WARN("Calibration cache is corrupted!\n");
+        goto fps_read_snapshot_end;
+    }
+
+    ptr = buf;
+
+    if ((fps_get_u32(&ptr) != FPS_CAL_CACHE_MAGIC) ||
+        (fps_get_u32(&ptr) != FPS_CAL_CACHE_VERSION)) {
+        LOG_WARN("Calibration cache has an unknown format!\n");
+        goto fps_read_snapshot_end;
+    }
+
+    snapshot->chip_id       = (int) fps_get_u32(&ptr);
+    snapshot->power_config  = (int) fps_get_u32(&ptr);
+    snapshot->sensor_width  = (int) fps_get_u32(&ptr);
+    snapshot->sensor_height = (int) fps_get_u32(&ptr);
+
+    if ((snapshot->chip_id       != handle->chip_id      ) ||
+        (snapshot->power_config  != handle->power_config ) ||
+        (snapshot->sensor_width  != handle->sensor_width ) ||
+        (snapshot->sensor_height != handle->sensor_height)) {
+        LOG_DEBUG("Calibration cache belongs to another sensor or power config\n");
+        goto fps_read_snapshot_end;
+    }
+
+    snapshot->img_col_begin = (int) fps_get_u32(&ptr);
+    snapshot->img_col_end   = (int) fps_get_u32(&ptr);
+    snapshot->img_row_begin = (int) fps_get_u32(&ptr);
+    snapshot->img_row_end   = (int) fps_get_u32(&ptr);
+    snapshot->det_col_begin = (int) fps_get_u32(&ptr);
+    snapshot->det_col_end   = (int) fps_get_u32(&ptr);
+    snapshot->det_row_begin = (int) fps_get_u32(&ptr);
+    snapshot->det_row_end   = (int) fps_get_u32(&ptr);
+
+    for (i = 0; i < ARRAY_SIZE(snapshot->params); i++) {
+        snapshot->params[i] = (int) fps_get_u32(&ptr);
+    }
+
+    snapshot->detect_th    = (int) fps_get_u32(&ptr);
+    snapshot->frms_to_susp = (int) fps_get_u32(&ptr);
+    snapshot->bkgnd_avg    = fps_get_double(&ptr);
+    snapshot->bkgnd_var    = fps_get_double(&ptr);
+    snapshot->bkgnd_noise  = fps_get_double(&ptr);
+
+    if (fps_get_u32(&ptr) != (uint32_t) sensor_size) {
+        LOG_WARN("Calibration cache has a wrong image size!\n");
+        goto fps_read_snapshot_end;
+    }
+
+    snapshot->bkgnd_img = ptr;
+
+    *file_buf = buf;
+    buf       = NULL;
+    status    = 0;
+
+fps_read_snapshot_end :
+
+    if (buf != NULL) {
+        free(buf);
+    }
+
+    if (fp != NULL) {
+        fclose(fp);
+    }
+
+    return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Save/Load Calibration
+//
+
+int
+fps_save_calibration(fps_handle_t *handle,
+                     char         *path)
+{
+    int                status = 0;
+    fps_cal_snapshot_t snapshot;
+    FILE               *fp    = NULL;
+    uint8_t            *buf   = NULL;
+    uint8_t            *ptr;
+    size_t             sensor_size;
+    size_t             file_size;
+    int                i;
+
+    status = fps_capture_snapshot(handle, &snapshot);
+    if (status < 0) {
+        return status;
+    }
+
+    sensor_size = (size_t) (handle->sensor_width * handle->sensor_height);
+    file_size   = FPS_CAL_CACHE_HEADER_SIZE + sensor_size + 4;
+
+    buf = (uint8_t *) malloc(file_size);
+    if (buf == NULL) {
+        return -1;
+    }
+
+    ptr = buf;
+
+    fps_put_u32(&ptr, FPS_CAL_CACHE_MAGIC);
+    fps_put_u32(&ptr, FPS_CAL_CACHE_VERSION);
+    fps_put_u32(&ptr, (uint32_t) snapshot.chip_id);
+    fps_put_u32(&ptr, (uint32_t) snapshot.power_config);
+    fps_put_u32(&ptr, (uint32_t) snapshot.sensor_width);
+    fps_put_u32(&ptr, (uint32_t) snapshot.sensor_height);
+    fps_put_u32(&ptr, (uint32_t) snapshot.img_col_begin);
+    fps_put_u32(&ptr, (uint32_t) snapshot.img_col_end);
+    fps_put_u32(&ptr, (uint32_t) snapshot.img_row_begin);
+    fps_put_u32(&ptr, (uint32_t) snapshot.img_row_end);
+    fps_put_u32(&ptr, (uint32_t) snapshot.det_col_begin);
+    fps_put_u32(&ptr, (uint32_t) snapshot.det_col_end);
+    fps_put_u32(&ptr, (uint32_t) snapshot.det_row_begin);
+    fps_put_u32(&ptr, (uint32_t) snapshot.det_row_end);
+
+    for (i = 0; i < ARRAY_SIZE(snapshot.params); i++) {
+        fps_put_u32(&ptr, (uint32_t) snapshot.params[i]);
+    }
+
+    fps_put_u32(&ptr, (uint32_t) snapshot.detect_th);
+    fps_put_u32(&ptr, (uint32_t) snapshot.frms_to_susp);
+    fps_put_double(&ptr, snapshot.bkgnd_avg);
+    fps_put_double(&ptr, snapshot.bkgnd_var);
+    fps_put_double(&ptr, snapshot.bkgnd_noise);
+    fps_put_u32(&ptr, (uint32_t) sensor_size);
+
+    memcpy(ptr, snapshot.bkgnd_img, sensor_size);
+    ptr += sensor_size;
+
+    fps_put_u32(&ptr, fps_cal_cache_checksum(buf, file_size - 4));
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) {
+        LOG_ERROR("Opening %s failed!\n", path);
+        status = -1;
+        goto fps_save_calibration_end;
+    }
+
+    if (fwrite(buf, 1, file_size, fp) != file_size) {
+        LOG_ERROR("Writing %s failed!\n", path);
+        status = -1;
+    }
+
+    if (fclose(fp) != 0) {
+        status = -1;
+    }
+
+fps_save_calibration_end :
+
+    free(buf);
+
+    return status;
+}
+
+int
+fps_load_calibration(fps_handle_t *handle,
+                     char         *path)
+{
+    int                status = 0;
+    fps_cal_snapshot_t snapshot;
+    uint8_t            *file_buf;
+
+    status = fps_read_snapshot(handle, path, &snapshot, &file_buf);
+    if (status < 0) {
+        return status;
+    }
+
+    status = fps_apply_snapshot(handle, &snapshot);
+
+    free(file_buf);
+
+    return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Validate Calibration
+//
+
+int
+fps_validate_calibration(fps_handle_t *handle,
+                         int          frms_to_avg,
+                         int          *valid)
+{
+    int     status = 0;
+    uint8_t *img_buf;
+    int     col_begin;
+    int     col_end;
+    int     row_begin;
+    int     row_end;
+    int     img_size;
+    int     mode_old;
+    double  img_avg;
+    double  img_var;
+    double  img_noise;
+    double  diff_sum;
+    double  diff_avg;
+    int     i;
+
+    *valid = FALSE;
+
+    status = fps_get_sensing_area(handle, FPS_IMAGE_MODE,
+                                  &col_begin, &col_end,
+                                  &row_begin, &row_end);
+    if (status < 0) {
+        return status;
+    }
+
+    img_size = (col_end - col_begin + 1) * (row_end - row_begin + 1);
+
+    if ((img_size <= 0) || (img_size > (handle->sensor_width * handle->sensor_height))) {
+        return 0;
+    }
+
+    img_buf = (uint8_t *) fps_acquire_buffer(handle, FPS_POOL_FRAME);
+    if (img_buf == NULL) {
+        return -1;
+    }
+
+    status = fps_switch_sensor_mode(handle, FPS_IMAGE_MODE, &mode_old);
+    if (status < 0) {
+        goto fps_validate_calibration_end;
+    }
+
+    status = fps_get_averaged_image(handle,
+                                    (col_end - col_begin + 1),
+                                    (row_end - row_begin + 1),
+                                    frms_to_avg,
+                                    img_buf,
+                                    &img_avg,
+                                    &img_var,
+                                    &img_noise);
+
+    // Restore the mode even when the capture failed
+    if (fps_switch_sensor_mode(handle, mode_old, NULL) < 0) {
+        status = -1;
+    }
+
+    if (status < 0) {
+        goto fps_validate_calibration_end;
+    }
+
+    // The calibration leaves the background image packed at the buffer start
+    diff_sum = 0.0;
+
+    for (i = 0; i < img_size; i++) {
+        diff_sum += fabs((double) img_buf[i] - (double) handle->bkgnd_img[i]);
+    }
+
+    diff_avg = diff_sum / img_size;
+
+    LOG_DEBUG("Validation: Average = %0.3f (cached %0.3f), Pixel Difference = %0.3f\n",
+              img_avg, handle->bkgnd_avg, diff_avg);
+
+    if ((fabs(img_avg - handle->bkgnd_avg) <= FPS_CAL_CACHE_AVG_TOLERANCE) &&
+        (diff_avg <= FPS_CAL_CACHE_PIXEL_TOLERANCE)) {
+        *valid = TRUE;
+    }
+
+fps_validate_calibration_end :
+
+    fps_release_buffer(handle, img_buf);
+
+    return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Warm-Start Calibration
+// -----------------------------------------------------------------------------
+// NOTE: The cached snapshot is used when it was taken with the same image and
+//       detect window sizes and suspend frames, and passes validation. Else
+//       full image and detect calibration run and the cache is rewritten. A
+//       cache which cannot be written only costs the next warm start.
+//
+
+int
+fps_warm_start_calibration(fps_handle_t *handle,
+                           char         *path,
+                           int          img_width,
+                           int          img_height,
+                           int          frms_to_avg,
+                           int          det_width,
+                           int          det_height,
+                           int          frms_to_susp,
+                           int          *warm)
+{
+    int                status = 0;
+    fps_cal_snapshot_t snapshot;
+    uint8_t            *file_buf;
+    int                valid;
+    int                mode_old;
+
+    if (warm != NULL) {
+        *warm = FALSE;
+    }
+
+    if (fps_read_snapshot(handle, path, &snapshot, &file_buf) == 0) {
+
+        valid = (((snapshot.img_col_end - snapshot.img_col_begin + 1) == img_width ) &&
+                 ((snapshot.img_row_end - snapshot.img_row_begin + 1) == img_height) &&
+                 ((snapshot.det_col_end - snapshot.det_col_begin + 1) == det_width ) &&
+                 ((snapshot.det_row_end - snapshot.det_row_begin + 1) == det_height) &&
+                 (snapshot.frms_to_susp == frms_to_susp));
+
+        if (valid == TRUE) {
+            status = fps_apply_snapshot(handle, &snapshot);
+        }
+
+        free(file_buf);
+
+        if (status < 0) {
+            return status;
+        }
+
+        if (valid == TRUE) {
+            status = fps_validate_calibration(handle, FPS_CAL_CACHE_VALIDATE_FRAMES, &valid);
+            if (status < 0) {
+                return status;
+            }
+        } else {
+            LOG_DEBUG("Calibration cache has other window sizes\n");
+        }
+
+        if (valid == TRUE) {
+            LOG_DEBUG("Calibration cache is valid\n");
+            if (warm != NULL) {
+                *warm = TRUE;
+            }
+            return 0;
+        }
+    }
+
+    LOG_DEBUG("Running full calibration\n");
+
+    status = fps_switch_sensor_mode(handle, FPS_IMAGE_MODE, &mode_old);
+    if (status < 0) {
+        return status;
+    }
+
+    status = fps_image_calibration(handle, img_width, img_height, frms_to_avg);
+    if (status < 0) {
+        return status;
+    }
+
+    status = fps_switch_sensor_mode(handle, FPS_DETECT_MODE, NULL);
+    if (status < 0) {
+        return status;
+    }
+
+    status = fps_detect_calibration(handle, det_width, det_height, frms_to_susp);
+    if (status < 0) {
+        return status;
+    }
+
+    status = fps_switch_sensor_mode(handle, mode_old, NULL);
+    if (status < 0) {
+        return status;
+    }
+
+    if (fps_save_calibration(handle, path) < 0) {
+        LOG_WARN("Saving calibration cache failed!\n");
+    }
+
+    return 0;
+}
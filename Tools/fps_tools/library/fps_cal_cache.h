@@ -0,0 +1,64 @@
+#ifndef __fps_cal_cache_h__
+#define __fps_cal_cache_h__
+
+
+#include "common.h"
+#include "fps.h"
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Calibration Cache
+// -----------------------------------------------------------------------------
+// NOTE: A snapshot holds everything image and detect calibration leave behind:
+//       CDS offsets and PGA gains of both modes, image and detect windows,
+//       detect threshold, suspend frames, and the background image with its
+//       average/variance/noise. It is keyed by chip ID, power configuration
+//       and sensor dimension, and is only loaded into a matching handle.
+//
+//       The file is little-endian and ends with a checksum over everything
+//       before it, so a truncated or corrupted file is rejected.
+//
+//       A snapshot is validated by one quick averaged capture of the image
+//       window, compared with the cached background image. A finger on the
+//       sensor or a drifted unit fails validation.
+//
+
+#define FPS_CAL_CACHE_MAGIC            (0x43535046) // "FPSC"
+#define FPS_CAL_CACHE_VERSION          (1)
+#define FPS_CAL_CACHE_VALIDATE_FRAMES  (2)
+#define FPS_CAL_CACHE_AVG_TOLERANCE    (8.0)
+#define FPS_CAL_CACHE_PIXEL_TOLERANCE  (12.0)
+
+int fps_save_calibration(fps_handle_t *handle,
+                         char         *path);
+
+int fps_load_calibration(fps_handle_t *handle,
+                         char         *path);
+
+int fps_validate_calibration(fps_handle_t *handle,
+                             int          frms_to_avg,
+                             int          *valid);
+
+int fps_warm_start_calibration(fps_handle_t *handle,
+                               char         *path,
+                               int          img_width,
+                               int          img_height,
+                               int          frms_to_avg,
+                               int          det_width,
+                               int          det_height,
+                               int          frms_to_susp,
+                               int          *warm);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+
+#endif // __fps_cal_cache_h__
@@ -1,10 +1,14 @@
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "common.h"
 #include "debug.h"
 #include "fps_register.h"
 #include "fps_control.h"
 #include "fps_calibration.h"
+#include "fps_statistics.h"
+#include "fps_pool.h"
+#include "fps_event_log.h"
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -48,14 +52,30 @@ fps_detect_calibration(fps_handle_t *handle,
                        int           det_height,
                        int           frms_to_susp)
 {
+    int status = 0;
+    int armed;
+
     if (handle->detect_calibration_method == NULL) {
         return -1;
     }
 
-    return handle->detect_calibration_method(handle,
-                                             det_width,
-                                             det_height,
-                                             frms_to_susp);
+    // The searches scan back to back, so keep the interrupt armed throughout
+    armed = (handle->detect_arm != FPS_DETECT_DISARMED);
+
+    if (armed == FALSE) {
+        (void) fps_arm_detect_event(handle);
+    }
+
+    status = handle->detect_calibration_method(handle,
+                                               det_width,
+                                               det_height,
+                                               frms_to_susp);
+
+    if (armed == FALSE) {
+        (void) fps_disarm_detect_event(handle);
+    }
+
+    return status;
 }
 
 int
@@ -69,70 +89,346 @@ fps_set_detect_calibration_callback(fps_handle_t       *handle,
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Search Detect Window
+// Detect Scan Policy
 //
 
 int
-fps_search_detect_window(fps_handle_t *handle,
-                         int          img_width,
-                         int          img_height,
-                         int          det_width,
-                         int          det_height,
-                         int          scan_width,
-                         int          scan_height,
-                         int          frames,
-                         int          *det_col_begin,
-                         int          *det_col_end,
-                         int          *det_row_begin,
-                         int          *det_row_end,
-                         double       *det_avg,
-                         double       *det_var,
-                         double       *det_noise)
+fps_set_scan_policy(fps_handle_t *handle,
+                    int          policy,
+                    double       confidence)
+{
+    if ((policy != FPS_SCAN_FIXED) &&
+        (policy != FPS_SCAN_SPRT)) {
+        return -1;
+    }
+
+    if ((confidence <= 0.5) || (confidence >= 1.0)) {
+        return -1;
+    }
+
+    handle->scan_policy     = policy;
+    handle->scan_confidence = confidence;
+    return 0;
+}
+
+int
+fps_get_scan_policy(fps_handle_t *handle,
+                    int          *policy,
+                    double       *confidence)
+{
+    *policy     = handle->scan_policy;
+    *confidence = handle->scan_confidence;
+    return 0;
+}
+
+int
+fps_get_scan_counters(fps_handle_t *handle,
+                      unsigned int *steps,
+                      unsigned int *scans,
+                      unsigned int *histogram)
+{
+    if (steps != NULL) {
+        *steps = handle->scan_steps;
+    }
+
+    if (scans != NULL) {
+        *scans = handle->scan_count;
+    }
+
+    if (histogram != NULL) {
+        memcpy(histogram, handle->scan_histogram, sizeof(handle->scan_histogram));
+    }
+
+    return 0;
+}
+
+int
+fps_clear_scan_counters(fps_handle_t *handle)
+{
+    handle->scan_steps = 0;
+    handle->scan_count = 0;
+    memset(handle->scan_histogram, 0x00, sizeof(handle->scan_histogram));
+    return 0;
+}
+
+// Decide one search step. The event is a trigger for FPS_SEARCH_ONE_TRIGGER
+// and a scan without trigger for FPS_SEARCH_NO_TRIGGER. The searches write
+// V_DET_SEL and the CDS offset directly, so after each write they re-arm with
+// fps_invalidate_detect_arm(), which drops the events latched by the chip
+// under the previous setting. FPS_SCAN_FIXED still discards one scan after
+// the write, as it always did: the re-arm cannot reach an interrupt the
+// driver has pending, e.g. one it replays after its IRQ hold-off.
+static int
+fps_scan_detect_step(fps_handle_t *handle,
+                     int          search_mode,
+                     double       sleep_us,
+                     int          scan_limit,
+                     int          *found)
+{
+    int    status = 0;
+    int    scan_cnt;
+    int    event;
+    double llr;
+    double llr_event;
+    double llr_none;
+    double llr_bound;
+
+    llr       = 0.0;
+    llr_event = log(FPS_SPRT_RATE_PRESENT / FPS_SPRT_RATE_ABSENT);
+    llr_none  = log((1.0 - FPS_SPRT_RATE_PRESENT) / (1.0 - FPS_SPRT_RATE_ABSENT));
+    llr_bound = log(handle->scan_confidence / (1.0 - handle->scan_confidence));
+
+    *found = FALSE;
+
+    for (scan_cnt = 0; scan_cnt < scan_limit; ) {
+        status = fps_scan_detect_event(handle, sleep_us);
+        if (status < 0) {
+            return status;
+        }
+
+        scan_cnt++;
+
+        event = (search_mode == FPS_SEARCH_ONE_TRIGGER) ? (status > 0) : (status == 0);
+
+        if (handle->scan_policy == FPS_SCAN_FIXED) {
+            if (event == TRUE) {
+                *found = TRUE;
+                break;
+            }
+            continue;
+        }
+
+        llr += (event == TRUE) ? llr_event : llr_none;
+
+        if ((llr >= llr_bound) || (llr <= -llr_bound)) {
+            break;
+        }
+    }
+
+    if (handle->scan_policy == FPS_SCAN_SPRT) {
+        *found = (llr > 0.0);
+    }
+
+    handle->scan_steps++;
+    handle->scan_count += (unsigned int) scan_cnt;
+    handle->scan_histogram[MIN(MAX(scan_cnt, 1), FPS_SCAN_HISTOGRAM_SIZE) - 1]++;
+
+    LOG_EVENT(handle, FPS_EV_SCAN_STEP, scan_cnt, (*found == TRUE), 0);
+
+    return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Search Detect Window
+// -----------------------------------------------------------------------------
+// NOTE: The frames are captured once and turned into per-pixel maps and
+//       summed-area tables, which every candidate window size then shares.
+//
+
+typedef struct __fps_window_maps {
+    int         img_width;
+    int         frames;
+    int         stats_mode;
+    double      *avg_img;
+    double      *noise_img;
+    uint32_t    *fix_sum;
+    fps_fixed_t *fix_noise;
+    uint64_t    *sum_table;
+    uint64_t    *sqr_table;
+    uint64_t    *fix_noise_table;
+    double      *noise_table;
+    double      *win_noise;
+} fps_window_maps_t;
+
+static int
+fps_search_window_size(fps_window_maps_t   *maps,
+                       int                 img_height,
+                       fps_window_search_t *window)
 {
     // Pre-defined parameters
     const double var_upper   = 5.0;
 	const double noise_upper = 1.0;
 
-    int            status = 0;
-    size_t         img_size;
-    size_t         det_size;
-    int            ver_scan_cnt;
-    int            hor_scan_cnt;
-    int            total_scan_cnt;
-    uint8_t        addr[6];
-    uint8_t        data[6];
-	int            mode_old;
-    uint8_t        **img_array = NULL;
-	uint8_t        *out_img    = NULL;
-    double         *avg_img    = NULL;
-    double         *noise_img  = NULL;
-    double         *win_avg    = NULL;
-    double         *win_var    = NULL;
-    double         *win_noise  = NULL;
-    int            col_start;
-    int            row_start;
-    double         pix_val;
-    double         pix_sum;
-    double         sqr_sum;
-	double         noise_sum;
-    double         avg;
-    double         var;
-	double         noise;
-	fps_cal_info_t info;
-    int            i;
-    int            f;
-    int            w;
-    int            sc;
-    int            sr;
-    int            c;
-    int            r;
+    int         det_width;
+    int         det_height;
+    int         ver_scan_cnt;
+    int         hor_scan_cnt;
+    int         col_start;
+    int         row_start;
+    fps_fixed_t fix_win[3];
+    double      *win_noise;
+    double      win_avg;
+    double      win_var;
+    double      min_noise;
+    double      avg;
+    double      var;
+    double      noise;
+    int         found;
+    int         w;
+    int         sc;
+    int         sr;
+
+    det_width  = window->det_width;
+    det_height = window->det_height;
+    win_noise  = maps->win_noise;
+
+    hor_scan_cnt = window->scan_width  - det_width  + 1;
+    ver_scan_cnt = window->scan_height - det_height + 1;
+
+    col_start = (maps->img_width - window->scan_width ) / 2;
+    row_start = (img_height      - window->scan_height) / 2;
+
+    min_noise = 0.0;
+
+    // Walk through all candidate windows vertically
+    for (sr = row_start; sr < (row_start + ver_scan_cnt); sr++) {
+        // Walk through all candidate windows horizontally
+        for (sc = col_start; sc < (col_start + hor_scan_cnt); sc++) {
+    
+            w = (sr - row_start) * hor_scan_cnt + (sc - col_start);
+
+            // Calculate average and variance of candidate window
+            if (maps->stats_mode == FPS_STATS_FIXED) {
+                fps_window_stats_table_fixed(maps->sum_table, maps->sqr_table, maps->fix_noise_table,
+                                             maps->frames, maps->img_width,
+                                             sc, sr, det_width, det_height,
+                                             &fix_win[0], &fix_win[1], &fix_win[2]);
+
+                avg          = FPS_FIXED_TO_DOUBLE(fix_win[0]);
+                var          = FPS_FIXED_TO_DOUBLE(fix_win[1]);
+                win_noise[w] = FPS_FIXED_TO_DOUBLE(fix_win[2]);
+            } else {
+                fps_window_stats_table_double(maps->sum_table, maps->sqr_table, maps->noise_table,
+                                              maps->frames, maps->img_width,
+                                              sc, sr, det_width, det_height,
+                                              &avg, &var, &win_noise[w]);
+            }
+
+            if ((w == 0) || (win_noise[w] < min_noise)) {
+                min_noise = win_noise[w];
+            }
+    
+            LOG_DEBUG("Window (CB,RB):(CE,RE) = (%0d,%0d):(%0d,%0d) Avg. = %0.3f, Var. = %0.3f, Noise = %0.3f\n",
+                      sc, sr, (sc + det_width - 1), (sr + det_height - 1), avg, var, win_noise[w]);
+        }
+    }
+
+    // Search the window with minimum noise
+    // -------------------------------------------------------------------------
+    // NOTE: Only windows within FPS_TABLE_NOISE_TOLERANCE of the minimum can be
+    //       the one the direct sums would select. Their statistics are summed
+    //       directly, so that the selection and the reported values stay the
+    //       same as without tables. The first window with the smallest noise
+    //       wins, as before.
+
+    found = FALSE;
+    avg   = 0.0;
+    var   = 0.0;
+    noise = 0.0;
+
+    // Walk through all candidate windows vertically
+    for (sr = row_start; sr < (row_start + ver_scan_cnt); sr++) {
+        // Walk through all candidate windows horizontally
+        for (sc = col_start; sc < (col_start + hor_scan_cnt); sc++) {
+       
+            w = (sr - row_start) * hor_scan_cnt + (sc - col_start);
+
+            if (win_noise[w] > (min_noise + FPS_TABLE_NOISE_TOLERANCE)) {
+                continue;
+            }
+
+            if (maps->stats_mode == FPS_STATS_FIXED) {
+                fps_window_stats_fixed(maps->fix_sum, maps->fix_noise, maps->frames, maps->img_width,
+                                       sc, sr, det_width, det_height,
+                                       &fix_win[0], &fix_win[1], &fix_win[2]);
+
+                win_avg      = FPS_FIXED_TO_DOUBLE(fix_win[0]);
+                win_var      = FPS_FIXED_TO_DOUBLE(fix_win[1]);
+                win_noise[w] = FPS_FIXED_TO_DOUBLE(fix_win[2]);
+            } else {
+                fps_window_stats_double(maps->avg_img, maps->noise_img, maps->img_width,
+                                        sc, sr, det_width, det_height,
+                                        &win_avg, &win_var, &win_noise[w]);
+            }
+       
+            // Find a window with minimum noise
+            if ((found == FALSE) || (win_noise[w] < noise)) {
+                window->col_begin = sc;
+                window->col_end   = sc + det_width  - 1;
+                window->row_begin = sr;
+                window->row_end   = sr + det_height - 1;
+       
+                avg   = win_avg;
+                var   = win_var;
+                noise = win_noise[w];
+                found = TRUE;
+            }
+        }
+    }
+
+    window->avg   = avg;
+    window->var   = var;
+    window->noise = noise;
+
+    LOG_DEBUG("Size %0dx%0d: Window (CB,RB):(CE,RE) = (%0d,%0d):(%0d,%0d) Avg. = %0.3f, Var. = %0.3f, Noise = %0.3f\n",
+              det_width, det_height, window->col_begin, window->row_begin, window->col_end, window->row_end,
+              avg, var, noise);
+
+    if ((var >= var_upper) || (noise >= noise_upper)) {
+        LOG_DEBUG("Too bad to search a good detect window!\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+fps_search_detect_windows(fps_handle_t        *handle,
+                          int                 img_width,
+                          int                 img_height,
+                          int                 frames,
+                          fps_window_search_t *windows,
+                          int                 window_cnt,
+                          fps_window_cost_t   cost,
+                          void                *context,
+                          int                 *best)
+{
+    int                 status = 0;
+    size_t              img_size;
+    uint8_t             addr[6];
+    uint8_t             data[6];
+	int                 mode_old;
+    fps_window_maps_t   maps;
+    uint8_t             *data_buf = NULL;
+	uint8_t             *out_img  = NULL;
+    double              *pix_sum  = NULL;
+    double              *sqr_sum  = NULL;
+    uint64_t            *fix_sqr  = NULL;
+    fps_fixed_t         *fix_avg  = NULL;
+	fps_cal_info_t      info;
+    fps_window_search_t *window;
+    int                 best_idx;
+    int                 i;
+    int                 f;
 
     img_size = img_width * img_height;
-    det_size = det_width * det_height;
 
-    hor_scan_cnt   = scan_width  - det_width  + 1;
-    ver_scan_cnt   = scan_height - det_height + 1;
-    total_scan_cnt = hor_scan_cnt * ver_scan_cnt;
+    memset(&maps, 0x00, sizeof(fps_window_maps_t));
+
+    maps.img_width  = img_width;
+    maps.frames     = frames;
+    maps.stats_mode = handle->stats_mode;
+
+    if (best != NULL) {
+        *best = -1;
+    }
+
+    // Pool buffers are sensor-sized
+    if ((int) img_size > fps_get_sensor_size(handle)) {
+        return status = -1;
+    }
 
     addr[0] = FPS_REG_IMG_CDS_CTL_0;
     addr[1] = FPS_REG_IMG_CDS_CTL_1;
@@ -144,88 +440,107 @@ fps_search_detect_window(fps_handle_t *handle,
 
     status = fps_multiple_read(handle, addr, data, 6);
     if (status < 0) {
-        goto fps_search_detect_window_end;
+        goto fps_search_detect_windows_end;
     }
 
     status = fps_multiple_write(handle, addr, &data[3], 3);
     if (status < 0) {
-        goto fps_search_detect_window_end;
+        goto fps_search_detect_windows_end;
     }
 
     status = fps_switch_sensor_mode(handle, FPS_IMAGE_MODE, &mode_old);
     if (status < 0) {
-        goto fps_search_detect_window_end;
+        goto fps_search_detect_windows_end;
     }
 
-    img_array = (uint8_t **) malloc(sizeof(uint8_t *) * frames);
-    if (img_array == NULL) {
+    // Get a frame buffer and per-pixel accumulators from the pool
+    data_buf = (uint8_t *) fps_acquire_buffer(handle, FPS_POOL_FRAME);
+    if (data_buf == NULL) {
         status = -1;
-        goto fps_search_detect_window_end;
+        goto fps_search_detect_windows_end;
     }
 
-	for (f = 0; f < frames; f++) {
-		img_array[f] = NULL;
-        img_array[f] = (uint8_t *) malloc(sizeof(uint8_t) * img_size);
-        if (img_array[f] == NULL) {
+    if (maps.stats_mode == FPS_STATS_FIXED) {
+        maps.fix_sum   = (uint32_t *)    fps_acquire_buffer(handle, FPS_POOL_MAP);
+        fix_sqr        = (uint64_t *)    fps_acquire_buffer(handle, FPS_POOL_MAP);
+        fix_avg        = (fps_fixed_t *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+        maps.fix_noise = (fps_fixed_t *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+        if ((maps.fix_sum == NULL) || (fix_sqr        == NULL) ||
+            (fix_avg      == NULL) || (maps.fix_noise == NULL)) {
             status = -1;
-            goto fps_search_detect_window_end;
+            goto fps_search_detect_windows_end;
         }
-	}
 
+        memset(maps.fix_sum, 0x00, sizeof(uint32_t) * img_size);
+        memset(fix_sqr,      0x00, sizeof(uint64_t) * img_size);
+    } else {
+        pix_sum        = (double *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+        sqr_sum        = (double *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+        maps.avg_img   = (double *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+        maps.noise_img = (double *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+        if ((pix_sum      == NULL) || (sqr_sum        == NULL) ||
+            (maps.avg_img == NULL) || (maps.noise_img == NULL)) {
+            status = -1;
+            goto fps_search_detect_windows_end;
+        }
+
+        memset(pix_sum, 0x00, sizeof(double) * img_size);
+        memset(sqr_sum, 0x00, sizeof(double) * img_size);
+    }
+
+    // Accumulate each frame as it arrives instead of keeping all of them
     for (f = 0; f < frames; f++) {
+        fps_begin_region("capture");
         status = fps_get_raw_image(handle,
                                    img_width,
                                    img_height,
-                                   img_array[f]);
+                                   data_buf);
+        fps_end_region("capture");
         if (status < 0) {
-            goto fps_search_detect_window_end;
+            goto fps_search_detect_windows_end;
         }
+
+        fps_begin_region("process");
+        if (maps.stats_mode == FPS_STATS_FIXED) {
+            fps_accumulate_frame_fixed(data_buf, img_size, maps.fix_sum, fix_sqr);
+        } else {
+            fps_accumulate_frame_double(data_buf, img_size, pix_sum, sqr_sum);
+        }
+        fps_end_region("process");
     }
 
     status = fps_switch_sensor_mode(handle, mode_old, NULL);
     if (status < 0) {
-        goto fps_search_detect_window_end;
+        goto fps_search_detect_windows_end;
     }
 
     status = fps_multiple_write(handle, addr, data, 3);
     if (status < 0) {
-        goto fps_search_detect_window_end;
-    }
-
-    avg_img = (double *) malloc(sizeof(double) * img_size);
-    if (avg_img == NULL) {
-        status = -1;
-        goto fps_search_detect_window_end;
+        goto fps_search_detect_windows_end;
     }
 
-    noise_img = (double *) malloc(sizeof(double) * img_size);
-    if (noise_img == NULL) {
-        status = -1;
-        goto fps_search_detect_window_end;
-    }
-
-    for (i = 0; i < (int) img_size; i++) {
-        pix_sum = 0.0;
-        sqr_sum = 0.0;
-        for (f = 0; f < frames; f++) {
-            pix_val  = (double) img_array[f][i];
-            pix_sum += pix_val;
-            sqr_sum += SQUARE(pix_val);
-        }
-
-        avg_img[i]   = pix_sum / frames;
-        noise_img[i] = sqrt((sqr_sum / frames) - SQUARE(avg_img[i]));
+    // Create per-pixel average and noise maps
+    fps_begin_region("process");
+    if (maps.stats_mode == FPS_STATS_FIXED) {
+        fps_pixel_map_fixed(maps.fix_sum, fix_sqr, frames, img_size, fix_avg, maps.fix_noise);
+    } else {
+        fps_pixel_map_double(pix_sum, sqr_sum, frames, img_size, maps.avg_img, maps.noise_img);
     }
+    fps_end_region("process");
 
 	if (handle->detect_calibration_callback != NULL) {
-		out_img = (uint8_t *) malloc(sizeof(uint8_t) * img_size);
+		out_img = (uint8_t *) fps_acquire_buffer(handle, FPS_POOL_FRAME);
 		if (out_img == NULL) {
 			status = -1;
-			goto fps_search_detect_window_end;
+			goto fps_search_detect_windows_end;
 		}
 
 		for (i = 0; i < (int) img_size; i++) {
-			out_img[i] = (uint8_t) avg_img[i]; 
+            if (maps.stats_mode == FPS_STATS_FIXED) {
+                out_img[i] = (uint8_t) (fix_avg[i] >> FPS_FIXED_SHIFT);
+            } else {
+                out_img[i] = (uint8_t) maps.avg_img[i];
+            }
 		}
 
 		info.img_buf      = out_img;
@@ -235,161 +550,449 @@ fps_search_detect_window(fps_handle_t *handle,
 
 		status = handle->detect_calibration_callback(handle, &info);
 		if (status < 0) {
-			goto fps_search_detect_window_end;
+			goto fps_search_detect_windows_end;
 		}
 
 		info.img_buf = NULL;
 	}
 
-    // Create to record all detect windows' average and variance 
-    win_avg = (double *) malloc(sizeof(double) * total_scan_cnt);
-    if (win_avg == NULL) {
+    // Build summed-area tables so that each window takes four lookups
+    maps.sum_table = (uint64_t *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+    maps.sqr_table = (uint64_t *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+    if ((maps.sum_table == NULL) || (maps.sqr_table == NULL)) {
         status = -1;
-        goto fps_search_detect_window_end;
+        goto fps_search_detect_windows_end;
     }
 
-    win_var = (double *) malloc(sizeof(double) * total_scan_cnt);
-    if (win_var == NULL) {
-        status = -1;
-        goto fps_search_detect_window_end;
+    if (maps.stats_mode == FPS_STATS_FIXED) {
+        maps.fix_noise_table = (uint64_t *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+        if (maps.fix_noise_table == NULL) {
+            status = -1;
+            goto fps_search_detect_windows_end;
+        }
+
+        fps_begin_region("process");
+        fps_build_sum_tables_fixed(maps.fix_sum, img_width, img_height, maps.sum_table, maps.sqr_table);
+        fps_build_noise_table_fixed(maps.fix_noise, img_width, img_height, maps.fix_noise_table);
+        fps_end_region("process");
+    } else {
+        maps.noise_table = (double *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+        if (maps.noise_table == NULL) {
+            status = -1;
+            goto fps_search_detect_windows_end;
+        }
+
+        fps_begin_region("process");
+        fps_build_sum_tables_double(pix_sum, img_width, img_height, maps.sum_table, maps.sqr_table);
+        fps_build_noise_table_double(maps.noise_img, img_width, img_height, maps.noise_table);
+        fps_end_region("process");
     }
 
-    win_noise = (double *) malloc(sizeof(double) * total_scan_cnt);
-    if (win_noise == NULL) {
+    // Create to record all detect windows' noise
+    maps.win_noise = (double *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+    if (maps.win_noise == NULL) {
         status = -1;
-        goto fps_search_detect_window_end;
+        goto fps_search_detect_windows_end;
     }
 
-    for (w = 0; w < total_scan_cnt; w++) {
-        win_avg[w]   = 0.0;
-        win_var[w]   = 0.0;
-        win_noise[w] = 0.0;
-    }
+    // Search every window size and keep the one with the lowest cost
+    best_idx = -1;
 
-    col_start = (img_width  - scan_width ) / 2;
-    row_start = (img_height - scan_height) / 2;
+    fps_begin_region("process");
 
-    // Walk through all candidate windows vertically
-    for (sr = row_start; sr < (row_start + ver_scan_cnt); sr++) {
-        // Walk through all candidate windows horizontally
-        for (sc = col_start; sc < (col_start + hor_scan_cnt); sc++) {
-    
-            // Calculate average and variance of candidate window
-            pix_sum   = 0.0;
-            sqr_sum   = 0.0;
-            noise_sum = 0.0;
-            for (r = sr; r < (sr + det_height); r++) {
-            for (c = sc; c < (sc + det_width ); c++) {
-                pix_val    = avg_img[r * img_width + c];
-                pix_sum   += pix_val;
-                sqr_sum   += SQUARE(pix_val);
-                noise_sum += noise_img[r * img_width + c];
-            }}
-    
-            w = (sr - row_start) * hor_scan_cnt + (sc - col_start);
+    for (i = 0; i < window_cnt; i++) {
+        window = &windows[i];
 
-            win_avg[w]   = pix_sum / det_size;
-            win_var[w]   = (sqr_sum / det_size) - SQUARE(win_avg[w]);
-            win_noise[w] = noise_sum / det_size;
-    
-            LOG_DEBUG("Window (CB,RB):(CE,RE) = (%0d,%0d):(%0d,%0d) Avg. = %0.3f, Var. = %0.3f, Noise = %0.3f\n",
-                      sc, sr, (sc + det_width - 1), (sr + det_height - 1), win_avg[w], win_var[w], win_noise[w]);
+        if ((window->det_width   <= 0                  ) ||
+            (window->det_height  <= 0                  ) ||
+            (window->scan_width  <  window->det_width  ) ||
+            (window->scan_height <  window->det_height ) ||
+            (window->scan_width  >  img_width          ) ||
+            (window->scan_height >  img_height         )) {
+            LOG_ERROR("Invalid window size %0dx%0d in %0dx%0d!\n",
+                      window->det_width, window->det_height, window->scan_width, window->scan_height);
+            window->status = -1;
+            continue;
         }
-    }
 
-    // Search the window with maximum variance
-    *det_col_begin = col_start;
-    *det_col_end   = col_start + det_width  - 1;
-    *det_row_begin = row_start;
-    *det_row_end   = row_start + det_height - 1;
+        window->status = fps_search_window_size(&maps, img_height, window);
+        if (window->status < 0) {
+            continue;
+        }
 
-	avg   = win_avg[0];
-    var   = win_var[0];
-    noise = win_noise[0];
+        window->cost = (cost != NULL) ? cost(window, context) : window->noise;
 
-    // Walk through all candidate windows vertically
-    for (sr = row_start; sr < (row_start + ver_scan_cnt); sr++) {
-        // Walk through all candidate windows horizontally
-        for (sc = col_start; sc < (col_start + hor_scan_cnt); sc++) {
-       
-            w = (sr - row_start) * hor_scan_cnt + (sc - col_start);
-       
-            // Find a window with minimum noise
-            if (win_noise[w] < noise) {
-                *det_col_begin = sc;
-                *det_col_end   = sc + det_width  - 1;
-                *det_row_begin = sr;
-                *det_row_end   = sr + det_height - 1;
-       
-                avg   = win_avg[w];
-                var   = win_var[w];
-                noise = win_noise[w];
-            }
+        if ((best_idx < 0) || (window->cost < windows[best_idx].cost)) {
+            best_idx = i;
         }
     }
 
-    if ((var >= var_upper) || (noise >= noise_upper)) {
-        LOG_DEBUG("Too bad to search a good detect window!\n");
+    fps_end_region("process");
+
+    if (best != NULL) {
+        *best = best_idx;
+    }
+
+    if (best_idx < 0) {
         status = -1;
-        goto fps_search_detect_window_end;
+        goto fps_search_detect_windows_end;
+    }
+
+	LOG_DEBUG("\n");
+	LOG_DEBUG("Result:\n");
+    LOG_DEBUG("Window (CB,RB):(CE,RE) = (%0d,%0d):(%0d,%0d) Avg. = %0.3f, Var. = %0.3f, Noise = %0.3f, Cost = %0.3f\n",
+              windows[best_idx].col_begin, windows[best_idx].row_begin,
+              windows[best_idx].col_end,   windows[best_idx].row_end,
+              windows[best_idx].avg, windows[best_idx].var, windows[best_idx].noise, windows[best_idx].cost);
+	LOG_DEBUG("\n");
+
+fps_search_detect_windows_end:
+
+    fps_release_buffer(handle, data_buf);
+    fps_release_buffer(handle, out_img);
+    fps_release_buffer(handle, pix_sum);
+    fps_release_buffer(handle, sqr_sum);
+    fps_release_buffer(handle, maps.avg_img);
+    fps_release_buffer(handle, maps.noise_img);
+    fps_release_buffer(handle, maps.fix_sum);
+    fps_release_buffer(handle, fix_sqr);
+    fps_release_buffer(handle, fix_avg);
+    fps_release_buffer(handle, maps.fix_noise);
+    fps_release_buffer(handle, maps.sum_table);
+    fps_release_buffer(handle, maps.sqr_table);
+    fps_release_buffer(handle, maps.fix_noise_table);
+    fps_release_buffer(handle, maps.noise_table);
+    fps_release_buffer(handle, maps.win_noise);
+
+    return status;
+}
+
+int
+fps_search_detect_window(fps_handle_t *handle,
+                         int          img_width,
+                         int          img_height,
+                         int          det_width,
+                         int          det_height,
+                         int          scan_width,
+                         int          scan_height,
+                         int          frames,
+                         int          *det_col_begin,
+                         int          *det_col_end,
+                         int          *det_row_begin,
+                         int          *det_row_end,
+                         double       *det_avg,
+                         double       *det_var,
+                         double       *det_noise)
+{
+    int                 status = 0;
+    fps_window_search_t window;
+
+    memset(&window, 0x00, sizeof(fps_window_search_t));
+
+    window.det_width   = det_width;
+    window.det_height  = det_height;
+    window.scan_width  = scan_width;
+    window.scan_height = scan_height;
+
+    status = fps_search_detect_windows(handle,
+                                       img_width, img_height,
+                                       frames,
+                                       &window, 1,
+                                       NULL, NULL,
+                                       NULL);
+
+    *det_col_begin = window.col_begin;
+    *det_col_end   = window.col_end;
+    *det_row_begin = window.row_begin;
+    *det_row_end   = window.row_end;
+
+    if (status < 0) {
+        return status;
     }
 
     if (det_avg != NULL) {
-        *det_avg = avg;
+        *det_avg = window.avg;
     }
 
     if (det_var != NULL) {
-        *det_var = var;
+        *det_var = window.var;
     }
 
     if (det_noise != NULL) {
-        *det_noise = noise;
+        *det_noise = window.noise;
     }
 
-	LOG_DEBUG("\n");
-	LOG_DEBUG("Result:\n");
-    LOG_DEBUG("Window (CB,RB):(CE,RE) = (%0d,%0d):(%0d,%0d) Avg. = %0.3f, Var. = %0.3f, Noise = %0.3f\n",
-              *det_col_begin, *det_row_begin, *det_col_end, *det_row_end, avg, var, noise);
-	LOG_DEBUG("\n");
+    return status;
+}
 
-fps_search_detect_window_end:
 
-    if (img_array != NULL) {
-        for (f = 0; f < frames; f++) {
-            if (img_array[f] != NULL) {
-                free(img_array[f]);
-            }
-        }
-        free(img_array);
-    }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Search Image CDS Offset and PGA Gain
+// -----------------------------------------------------------------------------
+// NOTE: Lowering the CDS offset makes the image brighter, so "too dark" holds
+//       for all offsets above some boundary and for none below it. Instead of
+//       stepping down one offset at a time, the boundary is bracketed and
+//       narrowed with secant steps on the probe's dark_excess, falling back to
+//       bisection whenever a step does not halve the bracket. The result is the
+//       highest offset which is not too dark, i.e. the same setting the linear
+//       walk stops at, after about log2(range) probes instead of range.
+//
+//       While the bracket is wider than FPS_COARSE_BRACKET the probes are
+//       coarse (a small sensing area and a single frame). The bracket ends are
+//       then checked with full probes, widening the bracket if a coarse probe
+//       misjudged, and only the last few steps use the full window.
+//
+//       Starting from the highest gain, a gain is skipped when the image is
+//       too bright at the highest offset, and also when the boundary offset is
+//       too bright (no offset is both not too dark and not too bright).
+//
+//       The last probe is always a full probe at the returned setting, so the
+//       image left in the handle's background buffer belongs to it.
+//
 
-	if (out_img != NULL) {
-		free(out_img);
-	}
+#define FPS_COARSE_BRACKET (8)
+
+typedef struct __fps_cds_bracket {
+    int               lo;
+    int               hi;
+    fps_image_probe_t lo_result;
+    double            hi_excess;
+    int               last;
+    int               probes;
+} fps_cds_bracket_t;
+
+static int
+fps_probe_cds_offset(fps_handle_t           *handle,
+                     fps_image_probe_func_t probe,
+                     void                   *context,
+                     int                    cds_offset,
+                     int                    pga_gain,
+                     int                    quality,
+                     fps_cds_bracket_t      *bracket,
+                     fps_image_probe_t      *result)
+{
+    int status;
 
-    if (avg_img != NULL) {
-        free(avg_img);
+    status = probe(handle, context, cds_offset, pga_gain, quality, result);
+    if (status < 0) {
+        return status;
     }
 
-    if (noise_img != NULL) {
-        free(noise_img);
-    }
+    bracket->probes++;
+    bracket->last = (quality == FPS_PROBE_FULL) ? cds_offset : -1;
 
-    if (win_avg != NULL) {
-        free(win_avg);
-    }
+    return status;
+}
 
-    if (win_var != NULL) {
-        free(win_var);
-    }
+static int
+fps_narrow_cds_offset(fps_handle_t           *handle,
+                      fps_image_probe_func_t probe,
+                      void                   *context,
+                      int                    pga_gain,
+                      int                    quality,
+                      int                    stop_width,
+                      fps_cds_bracket_t      *bracket)
+{
+    int               status = 0;
+    fps_image_probe_t result;
+    int               width;
+    int               mid;
+    int               bisect;
+
+    bisect = FALSE;
 
-    if (win_noise != NULL) {
-        free(win_noise);
+    while ((bracket->hi - bracket->lo) > stop_width) {
+        width = bracket->hi - bracket->lo;
+
+        if ((bisect == TRUE) || (bracket->hi_excess <= bracket->lo_result.dark_excess)) {
+            mid = bracket->lo + (width / 2);
+        } else {
+            mid = bracket->lo + (int) (width * (-bracket->lo_result.dark_excess) /
+                                       (bracket->hi_excess - bracket->lo_result.dark_excess));
+            mid = CONSTRAINT(bracket->hi - 1, mid, bracket->lo + 1);
+        }
+
+        status = fps_probe_cds_offset(handle, probe, context, mid, pga_gain,
+                                      quality, bracket, &result);
+        if (status < 0) {
+            return status;
+        }
+
+        if (result.too_dark == TRUE) {
+            bracket->hi        = mid;
+            bracket->hi_excess = result.dark_excess;
+        } else {
+            bracket->lo        = mid;
+            bracket->lo_result = result;
+        }
+
+        bisect = (((bracket->hi - bracket->lo) * 2) > width);
     }
 
     return status;
 }
 
+int
+fps_search_image_cds_offset(fps_handle_t           *handle,
+                            fps_image_probe_func_t probe,
+                            void                   *context,
+                            int                    cds_offset_upper,
+                            int                    cds_offset_lower,
+                            int                    pga_gain_upper,
+                            int                    pga_gain_lower,
+                            int                    *cds_offset,
+                            int                    *pga_gain)
+{
+    int               status = 0;
+    fps_cds_bracket_t bracket;
+    fps_image_probe_t result;
+    double            upper_excess;
+    int               lo_checked;
+    int               width;
+    int               gain;
+
+    bracket.probes = 0;
+
+    for (gain = pga_gain_upper; gain >= pga_gain_lower; gain--) {
+
+        // Highest offset first, which is the darkest setting of this gain
+        status = fps_probe_cds_offset(handle, probe, context, cds_offset_upper, gain,
+                                      FPS_PROBE_FULL, &bracket, &result);
+        if (status < 0) {
+            return status;
+        }
+
+        if (result.too_bright == TRUE) {
+            continue;
+        }
+
+        if (result.too_dark == FALSE) {
+            *cds_offset = cds_offset_upper;
+            *pga_gain   = gain;
+            LOG_DEBUG("Image calibration done after %0d probes\n", bracket.probes);
+            return 0;
+        }
+
+        upper_excess      = result.dark_excess;
+        bracket.hi        = cds_offset_upper;
+        bracket.hi_excess = upper_excess;
+        bracket.lo        = cds_offset_lower;
+
+        // Then the lowest offset, which must not be too dark to bracket
+        status = fps_probe_cds_offset(handle, probe, context, cds_offset_lower, gain,
+                                      FPS_PROBE_COARSE, &bracket, &bracket.lo_result);
+        if (status < 0) {
+            return status;
+        }
+
+        lo_checked = FALSE;
+
+        if (bracket.lo_result.too_dark == TRUE) {
+            status = fps_probe_cds_offset(handle, probe, context, cds_offset_lower, gain,
+                                          FPS_PROBE_FULL, &bracket, &bracket.lo_result);
+            if (status < 0) {
+                return status;
+            }
+
+            if (bracket.lo_result.too_dark == TRUE) {
+                LOG_ERROR("Too dark but no more settings!\n");
+                return -1;
+            }
+
+            lo_checked = TRUE;
+        }
+
+        // Coarse steps while the boundary is far away
+        status = fps_narrow_cds_offset(handle, probe, context, gain,
+                                       FPS_PROBE_COARSE, FPS_COARSE_BRACKET, &bracket);
+        if (status < 0) {
+            return status;
+        }
+
+        // Check the bracket with full probes, widening it where coarse probes
+        // misjudged the boundary
+        while (bracket.hi < cds_offset_upper) {
+            status = fps_probe_cds_offset(handle, probe, context, bracket.hi, gain,
+                                          FPS_PROBE_FULL, &bracket, &result);
+            if (status < 0) {
+                return status;
+            }
+
+            if (result.too_dark == TRUE) {
+                bracket.hi_excess = result.dark_excess;
+                break;
+            }
+
+            width             = bracket.hi - bracket.lo;
+            bracket.lo        = bracket.hi;
+            bracket.lo_result = result;
+            bracket.hi        = MIN(cds_offset_upper, bracket.hi + (width * 2));
+            bracket.hi_excess = upper_excess;
+            lo_checked        = TRUE;
+        }
+
+        while ((lo_checked == FALSE) || (bracket.last != bracket.lo)) {
+            status = fps_probe_cds_offset(handle, probe, context, bracket.lo, gain,
+                                          FPS_PROBE_FULL, &bracket, &result);
+            if (status < 0) {
+                return status;
+            }
+
+            if (result.too_dark == FALSE) {
+                bracket.lo_result = result;
+                break;
+            }
+
+            if (bracket.lo == cds_offset_lower) {
+                LOG_ERROR("Too dark but no more settings!\n");
+                return -1;
+            }
+
+            width             = bracket.hi - bracket.lo;
+            bracket.hi        = bracket.lo;
+            bracket.hi_excess = result.dark_excess;
+            bracket.lo        = MAX(cds_offset_lower, bracket.lo - (width * 2));
+            lo_checked        = FALSE;
+        }
+
+        // Full steps for the final candidates
+        status = fps_narrow_cds_offset(handle, probe, context, gain,
+                                       FPS_PROBE_FULL, 1, &bracket);
+        if (status < 0) {
+            return status;
+        }
+
+        if (bracket.lo_result.too_bright == TRUE) {
+            LOG_DEBUG("No CDS offset fits PGA gain 0x%02X\n", gain);
+            continue;
+        }
+
+        // Make sure the image left behind belongs to the returned setting
+        if (bracket.last != bracket.lo) {
+            status = fps_probe_cds_offset(handle, probe, context, bracket.lo, gain,
+                                          FPS_PROBE_FULL, &bracket, &result);
+            if (status < 0) {
+                return status;
+            }
+
+            if ((result.too_bright == TRUE) || (result.too_dark == TRUE)) {
+                LOG_DEBUG("Setting is unstable, CDS Offset = 0x%03X\n", bracket.lo);
+                continue;
+            }
+        }
+
+        *cds_offset = bracket.lo;
+        *pga_gain   = gain;
+        LOG_DEBUG("Image calibration done after %0d probes\n", bracket.probes);
+        return 0;
+    }
+
+    LOG_ERROR("No more settings!\n");
+
+    return -1;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -413,7 +1016,7 @@ fps_search_detect_threshold(fps_handle_t *handle,
     int            detect_th_upper;
     int            detect_th_middle;
     int            detect_th_lower;
-    int            scan_cnt;
+    int            found;
     fps_cal_info_t info;
 
     if (handle->detect_calibration_callback != NULL) {
@@ -445,33 +1048,25 @@ fps_search_detect_threshold(fps_handle_t *handle,
             return status;
         }
 
-		(void) fps_scan_detect_event(handle, sleep_us);
+        fps_invalidate_detect_arm(handle);
 
-        for (scan_cnt = 0; scan_cnt < scan_limit; scan_cnt++) {
-            status = fps_scan_detect_event(handle, sleep_us);
-            if (status < 0) {
-                return status;
-            }
+        if (handle->scan_policy != FPS_SCAN_SPRT) {
+            (void) fps_scan_detect_event(handle, sleep_us);
+        }
 
-            if (search_mode == FPS_SEARCH_ONE_TRIGGER) {
-                if (status > 0) {
-                    break;
-                }
-            } else {
-                if (status == 0) {
-                    break;
-                }
-            }
+        status = fps_scan_detect_step(handle, search_mode, sleep_us, scan_limit, &found);
+        if (status < 0) {
+            return status;
         }
 
         if (search_mode == FPS_SEARCH_ONE_TRIGGER) {
-            if ((scan_cnt == scan_limit) && (status == 0)) {
+            if (found == FALSE) {
                 detect_th_upper = detect_th_middle;
             } else {
                 detect_th_lower = detect_th_middle;
             }
         } else {
-            if ((scan_cnt == scan_limit) && (status > 0)) {
+            if (found == FALSE) {
                 detect_th_lower = detect_th_middle;
             } else {
                 detect_th_upper = detect_th_middle;
@@ -518,7 +1113,7 @@ fps_finetune_detect_threshold_downward(fps_handle_t *handle,
     int     cds_offset;
     uint8_t data;
     int     score;
-    int     scan_cnt;
+    int     found;
     int     too_insensitive;
 
     if (handle->detect_calibration_callback != NULL) {
@@ -547,29 +1142,28 @@ fps_finetune_detect_threshold_downward(fps_handle_t *handle,
             return status;
         }
 
-		(void) fps_scan_detect_event(handle, sleep_us);
+        fps_invalidate_detect_arm(handle);
 
-        for (scan_cnt = 0; scan_cnt < scan_limit; scan_cnt++) {
-            status = fps_scan_detect_event(handle, sleep_us);
-            if (status < 0) {
-                return status;
-            }
+        if (handle->scan_policy != FPS_SCAN_SPRT) {
+            (void) fps_scan_detect_event(handle, sleep_us);
+        }
 
-            if (status == 0) {
-                if ((*detect_th) != lower_bound) {
-                    LOG_DEBUG("Detect Threshold adjusted (--)!\n");
-                    (*detect_th)--;
-                } else {
-                    LOG_ERROR("Minimum Detect Threshold reached!\n");
-                    return -2;
-                }
-                break;
-            }
+        status = fps_scan_detect_step(handle, FPS_SEARCH_NO_TRIGGER, sleep_us, scan_limit, &found);
+        if (status < 0) {
+            return status;
         }
 
-        if ((scan_cnt == scan_limit) && (status > 0)) {
+        if (found == FALSE) {
             break;
         }
+
+        if ((*detect_th) != lower_bound) {
+            LOG_DEBUG("Detect Threshold adjusted (--)!\n");
+            (*detect_th)--;
+        } else {
+            LOG_ERROR("Minimum Detect Threshold reached!\n");
+            return -2;
+        }
     }
 
     too_insensitive = (score < scan_limit);
@@ -599,7 +1193,7 @@ fps_finetune_detect_threshold_upward(fps_handle_t *handle,
     int     cds_offset;
     uint8_t data;
     int     score;
-    int     scan_cnt;
+    int     found;
     int     too_sensitive;
 
     if (handle->detect_calibration_callback != NULL) {
@@ -628,29 +1222,28 @@ fps_finetune_detect_threshold_upward(fps_handle_t *handle,
             return status;
         }
 
-		(void) fps_scan_detect_event(handle, sleep_us);
+        fps_invalidate_detect_arm(handle);
 
-        for (scan_cnt = 0; scan_cnt < scan_limit; scan_cnt++) {
-            status = fps_scan_detect_event(handle, sleep_us);
-            if (status < 0) {
-                return status;
-            }
+        if (handle->scan_policy != FPS_SCAN_SPRT) {
+            (void) fps_scan_detect_event(handle, sleep_us);
+        }
 
-            if (status > 0) {
-                if ((*detect_th) != upper_bound) {
-                    LOG_DEBUG("Detect Threshold adjusted (++)!\n");
-                    (*detect_th)++;
-                } else {
-                    LOG_ERROR("Maximum Detect Threshold reached!\n");
-                    return -2;
-                }
-                break;
-            }
+        status = fps_scan_detect_step(handle, FPS_SEARCH_ONE_TRIGGER, sleep_us, scan_limit, &found);
+        if (status < 0) {
+            return status;
         }
 
-        if ((scan_cnt == scan_limit) && (status == 0)) {
+        if (found == FALSE) {
             break;
         }
+
+        if ((*detect_th) != upper_bound) {
+            LOG_DEBUG("Detect Threshold adjusted (++)!\n");
+            (*detect_th)++;
+        } else {
+            LOG_ERROR("Maximum Detect Threshold reached!\n");
+            return -2;
+        }
     }
 
     too_sensitive = (score < scan_limit);
@@ -683,7 +1276,7 @@ fps_search_detect_cds_offset(fps_handle_t *handle,
     int            cds_offset_upper;
     int            cds_offset_middle;
     int            cds_offset_lower;
-    int            scan_cnt;
+    int            found;
     fps_cal_info_t info;
 
     if (handle->detect_calibration_callback != NULL) {
@@ -720,33 +1313,25 @@ fps_search_detect_cds_offset(fps_handle_t *handle,
             return status;
         }
 
-		(void) fps_scan_detect_event(handle, sleep_us);
+        fps_invalidate_detect_arm(handle);
 
-        for (scan_cnt = 0; scan_cnt < scan_limit; scan_cnt++) {
-            status = fps_scan_detect_event(handle, sleep_us);
-            if (status < 0) {
-                return status;
-            }
+        if (handle->scan_policy != FPS_SCAN_SPRT) {
+            (void) fps_scan_detect_event(handle, sleep_us);
+        }
 
-            if (search_mode == FPS_SEARCH_ONE_TRIGGER) {
-                if (status > 0) {
-                    break;
-                }
-            } else {
-                if (status == 0) {
-                    break;
-                }
-            }
+        status = fps_scan_detect_step(handle, search_mode, sleep_us, scan_limit, &found);
+        if (status < 0) {
+            return status;
         }
 
         if (search_mode == FPS_SEARCH_ONE_TRIGGER) {
-            if ((scan_cnt == scan_limit) && (status == 0)) {
+            if (found == FALSE) {
                 cds_offset_upper = cds_offset_middle;
             } else {
                 cds_offset_lower = cds_offset_middle;
             }
         } else {
-            if ((scan_cnt == scan_limit) && (status > 0)) {
+            if (found == FALSE) {
                 cds_offset_lower = cds_offset_middle;
             } else {
                 cds_offset_upper = cds_offset_middle;
@@ -794,7 +1379,7 @@ fps_finetune_detect_cds_offset_downward(fps_handle_t *handle,
     uint8_t addr[2];
     uint8_t data[2];
     int     score;
-    int     scan_cnt;
+    int     found;
     int     too_insensitive;
 
     if (handle->detect_calibration_callback != NULL) {
@@ -828,29 +1413,28 @@ fps_finetune_detect_cds_offset_downward(fps_handle_t *handle,
             return status;
         }
 
-		(void) fps_scan_detect_event(handle, sleep_us);
+        fps_invalidate_detect_arm(handle);
 
-        for (scan_cnt = 0; scan_cnt < scan_limit; scan_cnt++) {
-            status = fps_scan_detect_event(handle, sleep_us);
-            if (status < 0) {
-                return status;
-            }
+        if (handle->scan_policy != FPS_SCAN_SPRT) {
+            (void) fps_scan_detect_event(handle, sleep_us);
+        }
 
-            if (status == 0) {
-                if ((*cds_offset) != lower_bound) {
-                    LOG_DEBUG("CDS Offset adjusted (--)!\n");
-                    (*cds_offset)--;
-                } else {
-                    LOG_ERROR("Minimum CDS Offset reached!\n");
-                    return -2;
-                }
-                break;
-            }
+        status = fps_scan_detect_step(handle, FPS_SEARCH_NO_TRIGGER, sleep_us, scan_limit, &found);
+        if (status < 0) {
+            return status;
         }
 
-        if ((scan_cnt == scan_limit) && (status > 0)) {
+        if (found == FALSE) {
             break;
         }
+
+        if ((*cds_offset) != lower_bound) {
+            LOG_DEBUG("CDS Offset adjusted (--)!\n");
+            (*cds_offset)--;
+        } else {
+            LOG_ERROR("Minimum CDS Offset reached!\n");
+            return -2;
+        }
     }
 
     too_insensitive = (score < scan_limit);
@@ -881,7 +1465,7 @@ fps_finetune_detect_cds_offset_upward(fps_handle_t *handle,
     uint8_t addr[2];
     uint8_t data[2];
     int     score;
-    int     scan_cnt;
+    int     found;
     int     too_sensitive;
 
     if (handle->detect_calibration_callback != NULL) {
@@ -915,29 +1499,28 @@ fps_finetune_detect_cds_offset_upward(fps_handle_t *handle,
             return status;
         }
 
-		(void) fps_scan_detect_event(handle, sleep_us);
+        fps_invalidate_detect_arm(handle);
 
-        for (scan_cnt = 0; scan_cnt < scan_limit; scan_cnt++) {
-            status = fps_scan_detect_event(handle, sleep_us);
-            if (status < 0) {
-                return status;
-            }
+        if (handle->scan_policy != FPS_SCAN_SPRT) {
+            (void) fps_scan_detect_event(handle, sleep_us);
+        }
 
-            if (status > 0) {
-                if ((*cds_offset) != upper_bound) {
-                    LOG_DEBUG("CDS Offset adjusted (++)!\n");
-                    (*cds_offset)++;
-                } else {
-                    LOG_ERROR("Maximum CDS Offset reached!\n");
-                    return -2;
-                }
-                break;
-            }
+        status = fps_scan_detect_step(handle, FPS_SEARCH_ONE_TRIGGER, sleep_us, scan_limit, &found);
+        if (status < 0) {
+            return status;
         }
 
-        if ((scan_cnt == scan_limit) && (status == 0)) {
+        if (found == FALSE) {
             break;
         }
+
+        if ((*cds_offset) != upper_bound) {
+            LOG_DEBUG("CDS Offset adjusted (++)!\n");
+            (*cds_offset)++;
+        } else {
+            LOG_ERROR("Maximum CDS Offset reached!\n");
+            return -2;
+        }
     }
 
     too_sensitive = (score < scan_limit);
@@ -947,3 +1530,187 @@ fps_finetune_detect_cds_offset_upward(fps_handle_t *handle,
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Detect Search Model
+//
+
+int
+fps_set_detect_model(fps_handle_t       *handle,
+                     fps_detect_model_t *model)
+{
+    memcpy(&handle->detect_model, model, sizeof(fps_detect_model_t));
+    return 0;
+}
+
+int
+fps_get_detect_model(fps_handle_t       *handle,
+                     fps_detect_model_t *model)
+{
+    memcpy(model, &handle->detect_model, sizeof(fps_detect_model_t));
+    return 0;
+}
+
+int
+fps_clear_detect_model(fps_handle_t *handle)
+{
+    memset(&handle->detect_model, 0x00, sizeof(fps_detect_model_t));
+    return 0;
+}
+
+int
+fps_update_detect_model(fps_handle_t *handle,
+                        double       det_avg,
+                        int          detect_th,
+                        int          cds_offset)
+{
+    fps_detect_model_t *model = &handle->detect_model;
+    double             y[2];
+    int                t;
+
+    y[FPS_MODEL_DETECT_TH ] = (double) detect_th;
+    y[FPS_MODEL_CDS_OFFSET] = (double) cds_offset;
+
+    model->samples++;
+    model->sum_x  += det_avg;
+    model->sum_xx += det_avg * det_avg;
+
+    for (t = 0; t < 2; t++) {
+        model->sum_y[t]  += y[t];
+        model->sum_xy[t] += det_avg * y[t];
+        model->sum_yy[t] += y[t] * y[t];
+    }
+
+    return 0;
+}
+
+int
+fps_predict_detect_range(fps_handle_t *handle,
+                         int          target,
+                         double       det_avg,
+                         int          extra_margin,
+                         int          upper_bound,
+                         int          lower_bound,
+                         int          *upper,
+                         int          *lower)
+{
+    fps_detect_model_t *model = &handle->detect_model;
+    double             n;
+    double             det;
+    double             slope;
+    double             offset;
+    double             sse;
+    double             sigma;
+    double             predict;
+    double             margin;
+
+    *upper = upper_bound;
+    *lower = lower_bound;
+
+    if ((target != FPS_MODEL_DETECT_TH) && (target != FPS_MODEL_CDS_OFFSET)) {
+        return -1;
+    }
+
+    if (model->samples < FPS_DETECT_MODEL_MIN_SAMPLES) {
+        return 0;
+    }
+
+    n   = (double) model->samples;
+    det = (n * model->sum_xx) - (model->sum_x * model->sum_x);
+
+    // All samples at (nearly) the same average only give a mean
+    if (det <= (n * n * 1.0e-6)) {
+        slope = 0.0;
+    } else {
+        slope = ((n * model->sum_xy[target]) - (model->sum_x * model->sum_y[target])) / det;
+    }
+
+    offset = (model->sum_y[target] - (slope * model->sum_x)) / n;
+
+    sse = model->sum_yy[target]
+        - (offset * model->sum_y[target])
+        - (slope  * model->sum_xy[target]);
+
+    sigma   = sqrt(MAX(sse, 0.0) / (n - 2));
+    predict = offset + (slope * det_avg);
+    margin  = (3.0 * sigma) + FPS_DETECT_MODEL_MARGIN + extra_margin;
+
+    *upper = CONSTRAINT(upper_bound, (int) ceil(predict + margin),  lower_bound);
+    *lower = CONSTRAINT(upper_bound, (int) floor(predict - margin), lower_bound);
+
+    // Keep at least one setting to test between the bounds
+    if ((*upper - *lower) < 2) {
+        *upper = MIN(upper_bound, *lower + 2);
+        *lower = MAX(lower_bound, *upper - 2);
+    }
+
+    LOG_DEBUG("Predicted range = 0x%03X : 0x%03X (%0.1f +/- %0.1f)\n",
+              *upper, *lower, predict, margin);
+
+    return 0;
+}
+
+int
+fps_search_detect_predicted(fps_handle_t *handle,
+                            int          target,
+                            int          search_mode,
+                            int          upper_bound,
+                            int          lower_bound,
+                            double       det_avg,
+                            int          extra_margin,
+                            double       sleep_us,
+                            int          scan_limit,
+                            int          *result)
+{
+    int status = 0;
+    int upper;
+    int lower;
+    int width;
+    int upper_tested;
+    int lower_tested;
+
+    status = fps_predict_detect_range(handle, target, det_avg, extra_margin,
+                                      upper_bound, lower_bound, &upper, &lower);
+    if (status < 0) {
+        return status;
+    }
+
+    // The full range bounds are trusted the same way the plain search does
+    upper_tested = (upper == upper_bound);
+    lower_tested = (lower == lower_bound);
+
+    while (1) {
+        if (target == FPS_MODEL_DETECT_TH) {
+            status = fps_search_detect_threshold(handle, search_mode, upper, lower,
+                                                 sleep_us, scan_limit, result);
+        } else {
+            status = fps_search_detect_cds_offset(handle, search_mode, upper, lower,
+                                                  sleep_us, scan_limit, result);
+        }
+        if (status < 0) {
+            return status;
+        }
+
+        width = upper - lower;
+
+        if ((*result == upper) && (upper_tested == FALSE)) {
+            // Upper bound never moved, the boundary may lie above it
+            lower        = upper - 1;
+            upper        = MIN(upper_bound, upper + (width * 2));
+            lower_tested = TRUE;
+            upper_tested = (upper == upper_bound);
+        } else if ((*result == (lower + 1)) && (lower_tested == FALSE)) {
+            // Lower bound never moved, the boundary may lie below it
+            upper        = lower + 1;
+            lower        = MAX(lower_bound, lower - (width * 2));
+            upper_tested = TRUE;
+            lower_tested = (lower == lower_bound);
+        } else {
+            break;
+        }
+
+        LOG_DEBUG("Prediction missed, widened to 0x%03X : 0x%03X\n", upper, lower);
+    }
+
+    return status;
+}
@@ -38,11 +38,85 @@ int fps_set_detect_calibration_callback(fps_handle_t       *handle,
                                         fps_cal_callback_t callback);
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Detect Scan Policy
+// -----------------------------------------------------------------------------
+// NOTE: Each step of the detect threshold and CDS offset searches decides from
+//       up to scan_limit calls of fps_scan_detect_event() whether the setting
+//       shows the event the step looks for (a trigger, or a scan without one).
+//
+//       FPS_SCAN_FIXED stops at the first such event, so a step without it
+//       always takes scan_limit scans. FPS_SCAN_SPRT runs a sequential
+//       probability ratio test between an event rate of FPS_SPRT_RATE_ABSENT
+//       and FPS_SPRT_RATE_PRESENT per scan, and stops as soon as either is
+//       accepted at the configured confidence (both error rates are
+//       1 - confidence). A step still open after scan_limit scans goes to the
+//       more likely side. SPRT never takes more scans than the fixed policy.
+//
+//       FPS_SCAN_FIXED discards one scan after each setting change, like the
+//       original searches. SPRT does not, and relies on the re-arm and on
+//       fps_scan_detect_event() waiting out wakeups without a DETECT event.
+//
+
+#define FPS_SCAN_DEFAULT_CONFIDENCE (0.95)
+#define FPS_SPRT_RATE_ABSENT        (0.02)
+#define FPS_SPRT_RATE_PRESENT       (0.90)
+
+int fps_set_scan_policy(fps_handle_t *handle,
+                        int          policy,
+                        double       confidence);
+
+int fps_get_scan_policy(fps_handle_t *handle,
+                        int          *policy,
+                        double       *confidence);
+
+int fps_get_scan_counters(fps_handle_t *handle,
+                          unsigned int *steps,
+                          unsigned int *scans,
+                          unsigned int *histogram);
+
+int fps_clear_scan_counters(fps_handle_t *handle);
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Helpers
 //
 
+// NOTE: The caller fills in det_width/det_height and scan_width/scan_height of
+//       each window size, the search fills in the rest. status is negative if
+//       no good window of that size was found. The cost callback ranks the
+//       sizes (lower is better) and defaults to the window noise.
+typedef struct __fps_window_search {
+    int    det_width;
+    int    det_height;
+    int    scan_width;
+    int    scan_height;
+    int    col_begin;
+    int    col_end;
+    int    row_begin;
+    int    row_end;
+    double avg;
+    double var;
+    double noise;
+    double cost;
+    int    status;
+} fps_window_search_t;
+
+typedef double (*fps_window_cost_t) (fps_window_search_t *window,
+                                     void                *context);
+
+int fps_search_detect_windows(fps_handle_t        *handle,
+                              int                 img_width,
+                              int                 img_height,
+                              int                 frames,
+                              fps_window_search_t *windows,
+                              int                 window_cnt,
+                              fps_window_cost_t   cost,
+                              void                *context,
+                              int                 *best);
+
 int fps_search_detect_window(fps_handle_t *handle,
                              int          img_width,
                              int          img_height,
@@ -59,6 +133,43 @@ int fps_search_detect_window(fps_handle_t *handle,
                              double       *det_var,
                              double       *det_noise);
 
+// NOTE: An image probe applies one CDS offset/PGA gain setting, takes an image
+//       into the handle's background buffer and judges it. dark_excess is a
+//       signed measure of how dark the image is, positive exactly when it is
+//       too dark (e.g. dark pixel count minus the allowed count).
+//
+//       A coarse probe may use a smaller sensing area and a single frame, and
+//       must not call the image calibration callback. A full probe uses the
+//       calibration window and averaging, and leaves the sensing area set to
+//       the calibration window.
+enum {
+    FPS_PROBE_FULL   = 0,
+    FPS_PROBE_COARSE = 1,
+};
+
+typedef struct __fps_image_probe {
+    int    too_bright;
+    int    too_dark;
+    double dark_excess;
+} fps_image_probe_t;
+
+typedef int (*fps_image_probe_func_t) (fps_handle_t      *handle,
+                                       void              *context,
+                                       int               cds_offset,
+                                       int               pga_gain,
+                                       int               quality,
+                                       fps_image_probe_t *result);
+
+int fps_search_image_cds_offset(fps_handle_t           *handle,
+                                fps_image_probe_func_t probe,
+                                void                   *context,
+                                int                    cds_offset_upper,
+                                int                    cds_offset_lower,
+                                int                    pga_gain_upper,
+                                int                    pga_gain_lower,
+                                int                    *cds_offset,
+                                int                    *pga_gain);
+
 enum {
     FPS_SEARCH_ONE_TRIGGER = 0,
     FPS_SEARCH_NO_TRIGGER  = 1,
@@ -113,6 +224,64 @@ int fps_finetune_detect_cds_offset_upward(fps_handle_t *handle,
                                           int          *cds_offset);
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Predicted Detect Search
+// -----------------------------------------------------------------------------
+// NOTE: Once FPS_DETECT_MODEL_MIN_SAMPLES calibrations have been recorded, the
+//       detect threshold and CDS offset searches start from the range the
+//       model predicts for the window average, 3 residual deviations plus
+//       FPS_DETECT_MODEL_MARGIN (and a caller margin) around the fitted line.
+//       Before that they search the full range.
+//
+//       A binary search never probes its own bounds, so a result at an
+//       untested bound means the prediction may be wrong. The range is then
+//       widened past that bound and searched again, until the result is
+//       enclosed by tested settings or the full range is reached.
+//
+
+#define FPS_DETECT_MODEL_MIN_SAMPLES (4)
+#define FPS_DETECT_MODEL_MARGIN      (2)
+
+enum {
+    FPS_MODEL_DETECT_TH  = 0,
+    FPS_MODEL_CDS_OFFSET = 1,
+};
+
+int fps_set_detect_model(fps_handle_t       *handle,
+                         fps_detect_model_t *model);
+
+int fps_get_detect_model(fps_handle_t       *handle,
+                         fps_detect_model_t *model);
+
+int fps_clear_detect_model(fps_handle_t *handle);
+
+int fps_update_detect_model(fps_handle_t *handle,
+                            double       det_avg,
+                            int          detect_th,
+                            int          cds_offset);
+
+int fps_predict_detect_range(fps_handle_t *handle,
+                             int          target,
+                             double       det_avg,
+                             int          extra_margin,
+                             int          upper_bound,
+                             int          lower_bound,
+                             int          *upper,
+                             int          *lower);
+
+int fps_search_detect_predicted(fps_handle_t *handle,
+                                int          target,
+                                int          search_mode,
+                                int          upper_bound,
+                                int          lower_bound,
+                                double       det_avg,
+                                int          extra_margin,
+                                double       sleep_us,
+                                int          scan_limit,
+                                int          *result);
+
+
 #if defined(__cplusplus)
 }
 #endif
@@ -1,9 +1,15 @@
 #include <stdlib.h>
+#include <string.h>
 #include "common.h"
 #include "debug.h"
 #include "fps.h"
 #include "fps_register.h"
 #include "fps_control.h"
+#include "fps_statistics.h"
+#include "fps_pool.h"
+#include "fps_perf.h"
+#include "fps_event_log.h"
+#include "fps_calibration.h"
 #include "f747a_control.h"
 #include "f747b_control.h"
 
@@ -15,6 +21,14 @@
 
 fps_handle_t*
 fps_attach_sensor(int fd)
+{
+    return fps_attach_backend(fd, &fps_native_backend, NULL);
+}
+
+fps_handle_t*
+fps_attach_backend(int           fd,
+                   fps_backend_t *backend,
+                   void          *context)
 {
 	int          status = 0;
 	fps_handle_t *handle;
@@ -25,7 +39,42 @@ fps_attach_sensor(int fd)
 		goto fps_attach_sensor_end;
 	}
 
-	handle->fd = fd;
+	handle->fd              = fd;
+    handle->backend         = backend;
+    handle->backend_context = context;
+    handle->clock           = &fps_monotonic_clock;
+    handle->virtual_time_us = 0.0;
+    handle->buffer_pool     = NULL;
+    handle->bkgnd_img       = NULL;
+
+#if defined(__FPS_FIXED_POINT__)
+    handle->stats_mode = FPS_STATS_FIXED;
+#else
+    handle->stats_mode = FPS_STATS_DOUBLE;
+#endif
+
+    handle->scan_policy     = FPS_SCAN_FIXED;
+    handle->scan_confidence = FPS_SCAN_DEFAULT_CONFIDENCE;
+
+    (void) fps_clear_scan_counters(handle);
+    (void) fps_clear_detect_model(handle);
+
+    // Unmeasured until the first detect calibration
+    handle->osc_period_us = 0.0;
+
+    (void) fps_clear_wait_counters(handle);
+
+    // Read from the sensor on first use
+    handle->sensor_mode = FPS_UNKNOWN_MODE;
+
+    (void) fps_clear_mode_counters(handle);
+
+    handle->stats_enabled = TRUE;
+    (void) fps_reset_stats(handle);
+
+    handle->event_log = NULL;
+
+    handle->detect_arm = FPS_DETECT_DISARMED;
 
 #if defined(__F747A__)
     handle->chip_id = F747A_CHIP_ID;
@@ -53,6 +102,8 @@ fps_attach_sensor(int fd)
             handle->detect_calibration_method   = f747a_detect_calibration;
             handle->detect_calibration_callback = NULL;
             handle->scan_detect_method          = NULL;
+
+            memset(handle->power_timing, 0x00, sizeof(handle->power_timing));
             break;
 
         case F747B_CHIP_ID :
@@ -67,6 +118,8 @@ fps_attach_sensor(int fd)
             handle->detect_calibration_method   = f747b_detect_calibration;
             handle->detect_calibration_callback = NULL;
             handle->scan_detect_method          = NULL;
+
+            memcpy(handle->power_timing, f747b_power_timing, sizeof(handle->power_timing));
             break;
 
         default :
@@ -80,6 +133,11 @@ fps_attach_sensor(int fd)
         goto fps_attach_sensor_end;
     }
 
+    status = fps_create_buffer_pool(handle);
+    if (status < 0) {
+        goto fps_attach_sensor_end;
+    }
+
 	handle->bkgnd_avg = 0.0;
 
 	return handle;
@@ -90,15 +148,46 @@ fps_attach_sensor_end :
         if (handle->bkgnd_img != NULL) {
             free(handle->bkgnd_img);
         }
+        fps_destroy_buffer_pool(handle);
         free(handle);
     }
 
     return NULL;
 }
 
+int
+fps_close_sensor(fps_handle_t **handle)
+{
+    if (*handle == NULL) {
+        return 0;
+    }
+
+    if ((*handle)->backend->close_method != NULL) {
+        (*handle)->backend->close_method(*handle);
+    }
+
+    return fps_detach_sensor(handle);
+}
+
+int
+fps_reset_sensor(fps_handle_t *handle,
+                 int          state)
+{
+    if (handle->backend->reset_sensor_method == NULL) {
+        return -1;
+    }
+
+    // The reset leaves the sensor in its default mode, whatever was cached
+    (void) fps_invalidate_sensor_mode(handle);
+
+    return handle->backend->reset_sensor_method(handle, state);
+}
+
 int
 fps_detach_sensor(fps_handle_t **handle)
 {
+	(void) fps_stop_event_log(*handle);
+	fps_destroy_buffer_pool(*handle);
 	free((*handle)->bkgnd_img);
 	free(*handle);
 
@@ -114,10 +203,47 @@ fps_init_sensor(fps_handle_t *handle)
         return -1;
     }
 
+    // The sensor is reset, whatever mode it was in before
+    (void) fps_invalidate_sensor_mode(handle);
+
     return handle->init_sensor_method(handle);
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Set Sensor Speed
+//
+
+int
+fps_set_sensor_speed(fps_handle_t *handle,
+                     int          speed_hz)
+{
+    if (handle->backend->set_sensor_speed_method == NULL) {
+        return -1;
+    }
+
+    return handle->backend->set_sensor_speed_method(handle, speed_hz);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Chip ID
+//
+
+int
+fps_get_chip_id(fps_handle_t *handle,
+                int          *chip_id)
+{
+    if ((chip_id == NULL) || (handle->backend->get_chip_id_method == NULL)) {
+        return -1;
+    }
+
+    return handle->backend->get_chip_id_method(handle, chip_id);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Sensor Dimension
@@ -163,12 +289,145 @@ fps_get_power_config(fps_handle_t *handle,
     return 0;
 }
 
+int
+fps_set_power_timing(fps_handle_t       *handle,
+                     int                config,
+                     fps_power_timing_t *timing)
+{
+    if ((config < 0) || (config >= FPS_POWER_CONFIGS)) {
+        return -1;
+    }
+
+    memcpy(&handle->power_timing[config], timing, sizeof(fps_power_timing_t));
+    return 0;
+}
+
+int
+fps_get_power_timing(fps_handle_t       *handle,
+                     int                config,
+                     fps_power_timing_t *timing)
+{
+    if ((config < 0) || (config >= FPS_POWER_CONFIGS)) {
+        return -1;
+    }
+
+    memcpy(timing, &handle->power_timing[config], sizeof(fps_power_timing_t));
+    return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SPI Alive Check
+//
+
+int
+fps_wait_spi_alive(fps_handle_t *handle,
+                   double       min_us,
+                   double       timeout_us)
+{
+    int    status = 0;
+    int    chip_id;
+    double start_us;
+
+    start_us = fps_get_clock_time_us(handle);
+    fps_clock_sleep_until(handle, start_us + min_us);
+
+    while (1) {
+        status = fps_get_chip_id(handle, &chip_id);
+        if (status < 0) {
+            return status;
+        }
+
+        if (chip_id == handle->chip_id) {
+            LOG_EVENT(handle, FPS_EV_SPI_ALIVE, FPS_EV_NS(fps_get_clock_time_us(handle) - start_us), 0, 0);
+            return 0;
+        }
+
+        if ((fps_get_clock_time_us(handle) - start_us) >= timeout_us) {
+            LOG_ERROR("Chip not answering, chip_id = 0x%04X!\n", chip_id);
+            return -1;
+        }
+
+        fps_clock_sleep(handle, FPS_ALIVE_POLL_US);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Statistics Arithmetic
+//
+
+int
+fps_set_statistics_mode(fps_handle_t *handle,
+                        int          mode)
+{
+    if ((mode != FPS_STATS_DOUBLE) &&
+        (mode != FPS_STATS_FIXED)) {
+        return -1;
+    }
+
+    handle->stats_mode = mode;
+    return 0;
+}
+
+int
+fps_get_statistics_mode(fps_handle_t *handle,
+                        int          *mode)
+{
+    *mode = handle->stats_mode;
+    return 0;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Register Access
 //
 
+int
+fps_multiple_read(fps_handle_t *handle,
+                  uint8_t      *addr,
+                  uint8_t      *data,
+                  size_t       length)
+{
+    int    status = 0;
+    double start_us;
+
+    if (handle->backend->multiple_read_method == NULL) {
+        return -1;
+    }
+
+    start_us = fps_perf_begin(handle);
+
+    status = handle->backend->multiple_read_method(handle, addr, data, length);
+    fps_perf_end(handle, FPS_API_READ, start_us, status, (double) length);
+
+    return status;
+}
+
+int
+fps_multiple_write(fps_handle_t *handle,
+                   uint8_t      *addr,
+                   uint8_t      *data,
+                   size_t       length)
+{
+    int    status = 0;
+    double start_us;
+
+    if (handle->backend->multiple_write_method == NULL) {
+        return -1;
+    }
+
+    start_us = fps_perf_begin(handle);
+
+    status = handle->backend->multiple_write_method(handle, addr, data, length);
+    fps_perf_end(handle, FPS_API_WRITE, start_us, status, (double) length);
+
+    return status;
+}
+
 int
 fps_single_read(fps_handle_t *handle,
                 uint8_t      addr,
@@ -610,6 +869,8 @@ fps_set_sensor_parameter(fps_handle_t *handle,
     int mode;
     int param;
 
+    fps_invalidate_detect_arm(handle);
+
     mode  = flags & (0xFF << 0);
     param = flags & (0xFF << 8);
 
@@ -691,6 +952,8 @@ fps_set_sensing_area(fps_handle_t *handle,
     uint8_t addr[4];
     uint8_t data[4];
 
+    fps_invalidate_detect_arm(handle);
+
     switch (mode) {
         case FPS_IMAGE_MODE :
             addr[0] = FPS_REG_IMG_ROW_BEGIN;
@@ -770,6 +1033,8 @@ fps_set_suspend_frames(fps_handle_t *handle,
     uint8_t addr[2];
     uint8_t data[2];
 
+    fps_invalidate_detect_arm(handle);
+
     addr[0] = FPS_REG_SUSP_WAIT_F_CYC_H;
     addr[1] = FPS_REG_SUSP_WAIT_F_CYC_L;
 
@@ -804,7 +1069,21 @@ fps_calculate_suspend_time(int det_size,
                            int frames)
 {
     // Assume that the slowest oscillator frequency is 250KHz, i.e. 4us
-    return (double) ((det_size * (1 + frames)) * 8) * 4;
+    return (double) ((det_size * (1 + frames)) * 8) * FPS_WORST_OSC_PERIOD_US;
+}
+
+double
+fps_get_suspend_time(fps_handle_t *handle,
+                     int          det_size,
+                     int          frames,
+                     double       worst_case_mul)
+{
+    if (handle->osc_period_us > 0.0) {
+        return (double) ((det_size * (1 + frames)) * 8) *
+               handle->osc_period_us * (1.0 + FPS_SUSPEND_MARGIN);
+    }
+
+    return fps_calculate_suspend_time(det_size, frames) * worst_case_mul;
 }
 
 
@@ -813,15 +1092,58 @@ fps_calculate_suspend_time(int det_size,
 // Sensor Mode
 //
 
+// Accumulate the time spent in the mode being left
+static void
+fps_account_sensor_mode(fps_handle_t *handle,
+                        int          mode)
+{
+    double now_us;
+
+    now_us = fps_get_clock_time_us(handle);
+
+    if ((handle->sensor_mode >= 0) && (handle->sensor_mode < FPS_SENSOR_MODES)) {
+        handle->mode_time_us[handle->sensor_mode] += now_us - handle->mode_since_us;
+    }
+
+    handle->sensor_mode   = mode;
+    handle->mode_since_us = now_us;
+}
+
 int
 fps_set_sensor_mode(fps_handle_t *handle,
                     int          mode)
 {
+    int    status = 0;
+    double start_us;
+
     if (handle->set_sensor_mode_method == NULL) {
         return -1;
     }
 
-    return handle->set_sensor_mode_method(handle, mode);
+    if ((mode == handle->sensor_mode) && (mode != FPS_UNKNOWN_MODE)) {
+        handle->mode_skipped++;
+        return 0;
+    }
+
+    fps_invalidate_detect_arm(handle);
+
+    start_us = fps_perf_begin(handle);
+
+    // The method sees the mode being left in handle->sensor_mode
+    status = handle->set_sensor_mode_method(handle, mode);
+
+    fps_perf_end(handle, FPS_API_MODE_SWITCH, start_us, status, 0.0);
+
+    if (status < 0) {
+        (void) fps_invalidate_sensor_mode(handle);
+        return status;
+    }
+
+    handle->mode_transitions++;
+    fps_perf_count_mode(handle, handle->sensor_mode, mode);
+    fps_account_sensor_mode(handle, mode);
+
+    return status;
 }
 
 int
@@ -832,6 +1154,11 @@ fps_get_sensor_mode(fps_handle_t *handle,
     uint8_t addr[2];
     uint8_t data[2];
 
+    if (handle->sensor_mode != FPS_UNKNOWN_MODE) {
+        *mode = handle->sensor_mode;
+        return 0;
+    }
+
     addr[0] = FPS_REG_GBL_CTL;
     addr[1] = FPS_REG_PWR_CTL_0;
 
@@ -848,6 +1175,8 @@ fps_get_sensor_mode(fps_handle_t *handle,
         *mode = FPS_IMAGE_MODE;
     }
 
+    fps_account_sensor_mode(handle, *mode);
+
     return status;
 }
 
@@ -870,32 +1199,113 @@ fps_switch_sensor_mode(fps_handle_t *handle,
 
     if (mode_new != mode_now) {
         status = fps_set_sensor_mode(handle, mode_new);
+    } else {
+        handle->mode_skipped++;
     }
 
     return status;
 }
 
+int
+fps_invalidate_sensor_mode(fps_handle_t *handle)
+{
+    fps_account_sensor_mode(handle, FPS_UNKNOWN_MODE);
+    return 0;
+}
+
+int
+fps_get_mode_counters(fps_handle_t *handle,
+                      unsigned int *transitions,
+                      unsigned int *skipped,
+                      double       *time_us)
+{
+    int i;
+
+    if (transitions != NULL) {
+        *transitions = handle->mode_transitions;
+    }
+
+    if (skipped != NULL) {
+        *skipped = handle->mode_skipped;
+    }
+
+    // Including the time spent in the current mode so far
+    if (time_us != NULL) {
+        for (i = 0; i < FPS_SENSOR_MODES; i++) {
+            time_us[i] = handle->mode_time_us[i];
+        }
+
+        if ((handle->sensor_mode >= 0) && (handle->sensor_mode < FPS_SENSOR_MODES)) {
+            time_us[handle->sensor_mode] += fps_get_clock_time_us(handle) - handle->mode_since_us;
+        }
+    }
+
+    return 0;
+}
+
+int
+fps_clear_mode_counters(fps_handle_t *handle)
+{
+    handle->mode_transitions = 0;
+    handle->mode_skipped     = 0;
+    handle->mode_since_us    = fps_get_clock_time_us(handle);
+
+    memset(handle->mode_time_us, 0x00, sizeof(handle->mode_time_us));
+    return 0;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Image Mode Operations
 //
 
+int
+fps_get_raw_image(fps_handle_t *handle,
+                  int          img_width,
+                  int          img_height,
+                  uint8_t      *img_buf)
+{
+    int    status = 0;
+    double start_us;
+
+    start_us = fps_perf_begin(handle);
+
+    status = fps_read_raw_image(handle, img_width, img_height, img_buf);
+    fps_perf_end(handle, FPS_API_RAW_IMAGE, start_us, status,
+                 (double) (img_width * img_height + handle->latency));
+
+    return status;
+}
+
+int
+fps_read_raw_image(fps_handle_t *handle,
+                   int          img_width,
+                   int          img_height,
+                   uint8_t      *img_buf)
+{
+    if (handle->backend->get_raw_image_method == NULL) {
+        return -1;
+    }
+
+    return handle->backend->get_raw_image_method(handle, img_width, img_height, img_buf);
+}
+
 int
 fps_set_background_image(fps_handle_t *handle,
                          int          img_width,
                          int          img_height,
                          uint8_t      *img_buf)
 {
-    int    sensor_width;
-    int    sensor_height;
-    int    col_offset;
-    int    row_offset;
-    double pixel_sum;
-    int    dst_index;
-    int    src_index;
-    int    c;
-    int    r;
+    int      sensor_width;
+    int      sensor_height;
+    int      col_offset;
+    int      row_offset;
+    uint32_t pixel_sum;
+    int      dst_index;
+    int      src_index;
+    int      c;
+    int      r;
 
     sensor_width  = handle->sensor_width;
     sensor_height = handle->sensor_height;
@@ -903,7 +1313,7 @@ fps_set_background_image(fps_handle_t *handle,
     col_offset = (sensor_width  - img_width ) / 2;
     row_offset = (sensor_height - img_height) / 2;
 
-    pixel_sum = 0.0;
+    pixel_sum = 0;
 
     for (r = 0; r < img_height; r++) {
     for (c = 0; c < img_width;  c++) {
@@ -913,10 +1323,10 @@ fps_set_background_image(fps_handle_t *handle,
 
         handle->bkgnd_img[dst_index] = img_buf[src_index];
 
-        pixel_sum += (double) img_buf[src_index];
+        pixel_sum += (uint32_t) img_buf[src_index];
     }}
 
-    handle->bkgnd_avg = pixel_sum / (img_width * img_height);
+    handle->bkgnd_avg = ((double) pixel_sum) / (img_width * img_height);
     return 0;
 }
 
@@ -977,188 +1387,256 @@ fps_get_background_noise(fps_handle_t *handle,
     return 0;
 }
 
-int
-fps_get_averaged_image(fps_handle_t  *handle,
-                       int           img_width,
-                       int           img_height,
-                       int           frms_to_avg,
-                       unsigned char *img_buf,
-                       double        *img_avg,
-                       double        *img_var,
-                       double        *img_noise)
+static int
+fps_get_averaged_image_double(fps_handle_t       *handle,
+                              fps_frame_source_t source,
+                              void               *context,
+                              int                img_width,
+                              int                img_height,
+                              int                frms_to_avg,
+                              uint8_t            *img_buf,
+                              double             *img_avg,
+                              double             *img_var,
+                              double             *img_noise)
 {
     int     status = 0;
     size_t  img_size;
-    uint8_t **img_array;
-    uint8_t **data_array;
-    double  pix_val;
-    double  pix_sum;
-    double  sqr_sum;
-    double  noise_sum;
-    double  *avg_img;
-    double  *noise_img;
-    double  pix_avg;
-    double  pix_var;
+    uint8_t *data_buf = NULL;
+    double  *pix_sum  = NULL;
+    double  *sqr_sum  = NULL;
     int     f;
-    size_t  i;
 
     img_size = img_width * img_height;
 
-    // Create image buffers to average
-    img_array = NULL;
-    img_array = (uint8_t **) malloc(sizeof(uint8_t *) * frms_to_avg);
-    if (img_array == NULL) {
+    // Get a frame buffer and per-pixel accumulators from the pool
+    data_buf = (uint8_t *) fps_acquire_buffer(handle, FPS_POOL_FRAME);
+    if (data_buf == NULL) {
         status = -1;
-        goto fps_get_averaged_image_end;
+        goto fps_get_averaged_image_double_end;
     }
 
-    data_array = NULL;
-    data_array = (uint8_t **) malloc(sizeof(uint8_t *) * frms_to_avg);
-    if (data_array == NULL) {
+    pix_sum = (double *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+    if (pix_sum == NULL) {
         status = -1;
-        goto fps_get_averaged_image_end;
-    }
-
-    for (f = 0; f < frms_to_avg; f++) {
-        data_array[f] = NULL;
-        data_array[f] = (uint8_t *) malloc(img_size + FPS_DUMMY_PIXELS);
-        if (data_array[f] == NULL) {
-            status = -1;
-            goto fps_get_averaged_image_end;
-        }
-        img_array[f] = &data_array[f][FPS_DUMMY_PIXELS];
+        goto fps_get_averaged_image_double_end;
     }
 
-    // Create buffers to record each pixel's average and variance
-    avg_img = NULL;
-    avg_img = (double *) malloc(sizeof(double) * img_size);
-    if (avg_img == NULL) {
+    sqr_sum = (double *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+    if (sqr_sum == NULL) {
         status = -1;
-        goto fps_get_averaged_image_end;
+        goto fps_get_averaged_image_double_end;
     }
 
-    noise_img = NULL;
-    noise_img = (double *) malloc(sizeof(double) * img_size);
-    if (noise_img == NULL) {
-        status = -1;
-        goto fps_get_averaged_image_end;
-    }
+    memset(pix_sum, 0x00, sizeof(double) * img_size);
+    memset(sqr_sum, 0x00, sizeof(double) * img_size);
 
-    // Get frames to average
+    // Get frames and accumulate them
     for (f = 0; f < frms_to_avg; f++) {
-        status = fps_get_raw_image(handle,
-                                   img_width,
-                                   img_height,
-                                   data_array[f]);
+        fps_begin_region("capture");
+        status = source(handle, context, img_width, img_height, data_buf);
+        fps_end_region("capture");
         if (status < 0) {
-            goto fps_get_averaged_image_end;
-        }
-    }
-
-    // Average each frames
-    for (i = 0; i < img_size; i++) {
-        pix_sum = 0.0;
-        sqr_sum = 0.0;
-        for (f = 0; f < frms_to_avg; f++) {
-            pix_val  = (double) img_array[f][i];
-
-            pix_sum += pix_val;
-            sqr_sum += SQUARE(pix_val);
+            goto fps_get_averaged_image_double_end;
         }
 
-        avg_img[i]   = pix_avg = pix_sum / frms_to_avg;
-        noise_img[i] = pix_var = (sqr_sum / frms_to_avg) - SQUARE(pix_avg);
+        fps_begin_region("process");
+        fps_accumulate_frame_double(&data_buf[FPS_DUMMY_PIXELS], img_size,
+                                    pix_sum, sqr_sum);
+        fps_end_region("process");
     }
 
-    // Calculate finger image average and variance
-    pix_sum   = 0.0;
-    sqr_sum   = 0.0;
-    noise_sum = 0.0;
-    for (i = 0; i < img_size; i++) {
-        pix_val = avg_img[i];
+    fps_begin_region("process");
+    fps_reduce_frames_double(pix_sum, sqr_sum, frms_to_avg, img_size,
+                             img_buf, img_avg, img_var, img_noise);
+    fps_end_region("process");
 
-        pix_sum   += pix_val;
-        sqr_sum   += SQUARE(pix_val);
-        noise_sum += noise_img[i];
+fps_get_averaged_image_double_end :
 
-        img_buf[i] = (unsigned char) (pix_val + 0.5);
-    }
+    fps_release_buffer(handle, sqr_sum);
+    fps_release_buffer(handle, pix_sum);
+    fps_release_buffer(handle, data_buf);
 
-    pix_avg = pix_sum / img_size;
+    return status;
+}
 
-    if (img_avg != NULL) {
-        *img_avg = pix_avg;
-    }
+static int
+fps_get_averaged_image_fixed(fps_handle_t       *handle,
+                             fps_frame_source_t source,
+                             void               *context,
+                             int                img_width,
+                             int                img_height,
+                             int                frms_to_avg,
+                             uint8_t            *img_buf,
+                             double             *img_avg,
+                             double             *img_var,
+                             double             *img_noise)
+{
+    int         status = 0;
+    size_t      img_size;
+    uint8_t     *data_buf = NULL;
+    uint32_t    *pix_sum  = NULL;
+    uint64_t    *sqr_sum  = NULL;
+    fps_fixed_t fix_avg;
+    fps_fixed_t fix_var;
+    fps_fixed_t fix_noise;
+    int         f;
 
-    if (img_var != NULL) {
-        *img_var = (sqr_sum / img_size) - SQUARE(pix_avg);
-    }
+    img_size = img_width * img_height;
 
-    if (img_noise != NULL) {
-        *img_noise = noise_sum / img_size;
+    // Get a frame buffer and per-pixel accumulators from the pool
+    data_buf = (uint8_t *) fps_acquire_buffer(handle, FPS_POOL_FRAME);
+    if (data_buf == NULL) {
+        status = -1;
+        goto fps_get_averaged_image_fixed_end;
     }
 
-fps_get_averaged_image_end :
-
-    if (avg_img != NULL) {
-        free(avg_img);
+    pix_sum = (uint32_t *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+    if (pix_sum == NULL) {
+        status = -1;
+        goto fps_get_averaged_image_fixed_end;
     }
 
-    if (noise_img != NULL) {
-        free(noise_img);
+    sqr_sum = (uint64_t *) fps_acquire_buffer(handle, FPS_POOL_MAP);
+    if (sqr_sum == NULL) {
+        status = -1;
+        goto fps_get_averaged_image_fixed_end;
     }
 
+    memset(pix_sum, 0x00, sizeof(uint32_t) * img_size);
+    memset(sqr_sum, 0x00, sizeof(uint64_t) * img_size);
+
+    // Get frames and accumulate them
     for (f = 0; f < frms_to_avg; f++) {
-        if (data_array[f] != NULL) {
-            free(data_array[f]);
+        fps_begin_region("capture");
+        status = source(handle, context, img_width, img_height, data_buf);
+        fps_end_region("capture");
+        if (status < 0) {
+            goto fps_get_averaged_image_fixed_end;
         }
+
+        fps_begin_region("process");
+        fps_accumulate_frame_fixed(&data_buf[FPS_DUMMY_PIXELS], img_size,
+                                   pix_sum, sqr_sum);
+        fps_end_region("process");
     }
 
-    if (data_array != NULL) {
-        free(data_array);
+    fps_begin_region("process");
+    fps_reduce_frames_fixed(pix_sum, sqr_sum, frms_to_avg, img_size,
+                            img_buf, &fix_avg, &fix_var, &fix_noise);
+    fps_end_region("process");
+
+    if (img_avg != NULL) {
+        *img_avg = FPS_FIXED_TO_DOUBLE(fix_avg);
     }
 
-    if (img_array != NULL) {
-        free(img_array);
+    if (img_var != NULL) {
+        *img_var = FPS_FIXED_TO_DOUBLE(fix_var);
     }
 
+    if (img_noise != NULL) {
+        *img_noise = FPS_FIXED_TO_DOUBLE(fix_noise);
+    }
+
+fps_get_averaged_image_fixed_end :
+
+    fps_release_buffer(handle, sqr_sum);
+    fps_release_buffer(handle, pix_sum);
+    fps_release_buffer(handle, data_buf);
+
     return status;
 }
 
 int
-fps_get_finger_image(fps_handle_t  *handle,
-                     int           img_width,
-                     int           img_height,
-                     int           frms_to_avg,
-                     unsigned char *img_buf,
-                     double        *img_dr,
-                     double        *img_var,
-                     double        *img_noise)
+fps_get_averaged_image_from(fps_handle_t       *handle,
+                            fps_frame_source_t source,
+                            void               *context,
+                            int                img_width,
+                            int                img_height,
+                            int                frms_to_avg,
+                            uint8_t            *img_buf,
+                            double             *img_avg,
+                            double             *img_var,
+                            double             *img_noise)
 {
-    int     status = 0;
-    uint8_t *finger_img;
-    double  finger_avg;
-    double  finger_var;
-    double  finger_noise;
-    int     img_size;
-    double  sqr_sum;
-    int     i;
+    int    status = 0;
+    double start_us;
+
+    // Pool buffers are sensor-sized
+    if ((img_width * img_height) > fps_get_sensor_size(handle)) {
+        return -1;
+    }
+
+    start_us = fps_perf_begin(handle);
+
+    if (handle->stats_mode == FPS_STATS_FIXED) {
+        status = fps_get_averaged_image_fixed(handle,
+                                              source,
+                                              context,
+                                              img_width,
+                                              img_height,
+                                              frms_to_avg,
+                                              img_buf,
+                                              img_avg,
+                                              img_var,
+                                              img_noise);
+    } else {
+        status = fps_get_averaged_image_double(handle,
+                                               source,
+                                               context,
+                                               img_width,
+                                               img_height,
+                                               frms_to_avg,
+                                               img_buf,
+                                               img_avg,
+                                               img_var,
+                                               img_noise);
+    }
+
+    fps_perf_end(handle, FPS_API_AVERAGED_IMAGE, start_us, status, 0.0);
+
+    return status;
+}
+
+int
+fps_get_finger_image_from(fps_handle_t       *handle,
+                          fps_frame_source_t source,
+                          void               *context,
+                          int                img_width,
+                          int                img_height,
+                          int                frms_to_avg,
+                          uint8_t            *img_buf,
+                          double             *img_dr,
+                          double             *img_var,
+                          double             *img_noise)
+{
+    int      status = 0;
+    uint8_t  *finger_img;
+    double   finger_avg;
+    double   finger_var;
+    double   finger_noise;
+    int      img_size;
+    uint64_t sqr_sum;
+    int      i;
 
     finger_img = (uint8_t *) img_buf;
-    status = fps_get_averaged_image(handle,
-                                    img_width,
-                                    img_height,
-                                    frms_to_avg,
-                                    finger_img,
-                                    &finger_avg,
-                                    &finger_var,
-                                    &finger_noise);
+    status = fps_get_averaged_image_from(handle,
+                                         source,
+                                         context,
+                                         img_width,
+                                         img_height,
+                                         frms_to_avg,
+                                         finger_img,
+                                         &finger_avg,
+                                         &finger_var,
+                                         &finger_noise);
     if (status < 0) {
         return status;
     }
 
     img_size = img_width * img_height;
 
+    fps_begin_region("process");
+
     for (i = 0; i < img_size; i++) {
         if (finger_img[i] > handle->bkgnd_img[i]) {
             finger_img[i] = 0xFF - (finger_img[i] - handle->bkgnd_img[i]);
@@ -1167,12 +1645,15 @@ fps_get_finger_image(fps_handle_t  *handle,
         }
     }
 
-    sqr_sum = 0.0;
+    sqr_sum = 0;
     for (i = 0; i < img_size; i++) {
-        sqr_sum += (double) SQUARE(finger_img[i]);
+        sqr_sum += (uint64_t) SQUARE(finger_img[i]);
     }
 
-    finger_var = sqr_sum / img_size - SQUARE(finger_avg);
+    // VC6 only converts signed __int64 to double, and the sum fits
+    finger_var = ((double) (int64_t) sqr_sum) / img_size - SQUARE(finger_avg);
+
+    fps_end_region("process");
 
     if (img_dr != NULL) {
         *img_dr = finger_avg - handle->bkgnd_avg;
@@ -1189,18 +1670,145 @@ fps_get_finger_image(fps_handle_t  *handle,
     return status;
 }
 
+int
+fps_raw_image_source(fps_handle_t *handle,
+                     void         *context,
+                     int          img_width,
+                     int          img_height,
+                     uint8_t      *img_buf)
+{
+    return fps_get_raw_image(handle, img_width, img_height, img_buf);
+}
+
+int
+fps_get_averaged_image(fps_handle_t  *handle,
+                       int           img_width,
+                       int           img_height,
+                       int           frms_to_avg,
+                       unsigned char *img_buf,
+                       double        *img_avg,
+                       double        *img_var,
+                       double        *img_noise)
+{
+    return fps_get_averaged_image_from(handle,
+                                       fps_raw_image_source,
+                                       NULL,
+                                       img_width,
+                                       img_height,
+                                       frms_to_avg,
+                                       img_buf,
+                                       img_avg,
+                                       img_var,
+                                       img_noise);
+}
+
+int
+fps_get_finger_image(fps_handle_t  *handle,
+                     int           img_width,
+                     int           img_height,
+                     int           frms_to_avg,
+                     unsigned char *img_buf,
+                     double        *img_dr,
+                     double        *img_var,
+                     double        *img_noise)
+{
+    return fps_get_finger_image_from(handle,
+                                     fps_raw_image_source,
+                                     NULL,
+                                     img_width,
+                                     img_height,
+                                     frms_to_avg,
+                                     img_buf,
+                                     img_dr,
+                                     img_var,
+                                     img_noise);
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Detect Mode Operations
 //
 
+int
+fps_wait_event(fps_handle_t *handle,
+               double       sleep_us)
+{
+    int    status = 0;
+    double start_us;
+
+    if (handle->backend->wait_event_method == NULL) {
+        return -1;
+    }
+
+    start_us = fps_perf_begin(handle);
+
+    status = handle->backend->wait_event_method(handle, sleep_us);
+
+    fps_perf_end(handle, FPS_API_WAIT_EVENT, start_us, status, 0.0);
+    fps_perf_count_wait(handle, sleep_us, status);
+
+    return status;
+}
+
+// Wait until the DETECT event or until sleep_us is over. A wakeup without
+// the DETECT bit, e.g. for an edge the driver replays after its 10 ms IRQ
+// hold-off, is not a scan result, so the wait goes on until the original
+// deadline. acknowledge clears the events seen, which leaves an armed
+// interrupt armed for the next scan.
+static int
+fps_wait_detect_event(fps_handle_t *handle,
+                      double       sleep_us,
+                      int          acknowledge)
+{
+    int    status = 0;
+    int    events;
+    double deadline_us;
+    double wait_us;
+
+    deadline_us = fps_get_clock_time_us(handle) + sleep_us;
+    wait_us     = sleep_us;
+
+    while (TRUE) {
+        status = fps_wait_event(handle, wait_us);
+        if (status <= 0) {
+            return status;
+        }
+
+        status = events = fps_check_interrupt(handle, FPS_ALL_EVENTS);
+        if (status < 0) {
+            return status;
+        }
+
+        // Nothing latched means nothing to clear, and clearing would restart
+        // the scan cycle of the F747B
+        if ((acknowledge == TRUE) && (events != 0)) {
+            status = fps_clear_interrupt(handle, FPS_ALL_EVENTS);
+            if (status < 0) {
+                return status;
+            }
+        }
+
+        if ((events & FPS_DETECT_EVENT) != 0) {
+            return 1;
+        }
+
+        LOG_EVENT(handle, FPS_EV_STALE_WAKEUP, events, 0, 0);
+
+        if (sleep_us >= 0) {
+            wait_us = deadline_us - fps_get_clock_time_us(handle);
+            if (wait_us <= 0.0) {
+                return 0;
+            }
+        }
+    }
+}
+
 int
 fps_scan_detect_event_1(fps_handle_t *handle,
                         double       sleep_us)
 {
     int status = 0;
-    int events;
 
     status = fps_disable_interrupt(handle, FPS_ALL_EVENTS);
     if (status < 0) {
@@ -1217,28 +1825,433 @@ fps_scan_detect_event_1(fps_handle_t *handle,
         return status;
     }
     
-    status = fps_wait_event(handle, sleep_us);
-    if (status < 0) {
-        return status;
-    }
+    return fps_wait_detect_event(handle, sleep_us, FALSE);
+}
 
-    if (status > 0) {
-        status = events = fps_check_interrupt(handle, FPS_DETECT_EVENT);
+static int
+fps_scan_detect_event_armed(fps_handle_t *handle,
+                            double       sleep_us)
+{
+    int status = 0;
+
+    if (handle->detect_arm == FPS_DETECT_STALE) {
+        status = fps_disable_interrupt(handle, FPS_ALL_EVENTS);
+        if (status < 0) {
+            return status;
+        }
+
+        status = fps_clear_interrupt(handle, FPS_ALL_EVENTS);
         if (status < 0) {
             return status;
         }
+
+        status = fps_enable_interrupt(handle, FPS_DETECT_EVENT);
+        if (status < 0) {
+            return status;
+        }
+
+        handle->detect_arm = FPS_DETECT_ARMED;
     }
 
-    return ((events & FPS_DETECT_EVENT) != 0);
+    return fps_wait_detect_event(handle, sleep_us, TRUE);
 }
 
 int
 fps_scan_detect_event(fps_handle_t *handle,
                       double       sleep_us)
 {
+    int    status = 0;
+    double start_us;
+
+    start_us = fps_perf_begin(handle);
+    fps_begin_region("scan");
+
     if (handle->scan_detect_method != NULL) {
-        return handle->scan_detect_method(handle, sleep_us);
+        status = handle->scan_detect_method(handle, sleep_us);
+    } else if (handle->detect_arm != FPS_DETECT_DISARMED) {
+        status = fps_scan_detect_event_armed(handle, sleep_us);
     } else {
-        return fps_scan_detect_event_1(handle, sleep_us);
+        status = fps_scan_detect_event_1(handle, sleep_us);
     }
+
+    fps_end_region("scan");
+    fps_perf_end(handle, FPS_API_SCAN_DETECT, start_us, status, 0.0);
+
+    return status;
+}
+
+int
+fps_arm_detect_event(fps_handle_t *handle)
+{
+    // Armed in full by the next scan
+    handle->detect_arm = FPS_DETECT_STALE;
+    return 0;
+}
+
+int
+fps_disarm_detect_event(fps_handle_t *handle)
+{
+    if (handle->detect_arm == FPS_DETECT_DISARMED) {
+        return 0;
+    }
+
+    handle->detect_arm = FPS_DETECT_DISARMED;
+
+    FPS_DISABLE_AND_CLEAR_INTERRUPT(handle, FPS_ALL_EVENTS);
+    return 0;
+}
+
+void
+fps_invalidate_detect_arm(fps_handle_t *handle)
+{
+    if (handle->detect_arm == FPS_DETECT_ARMED) {
+        handle->detect_arm = FPS_DETECT_STALE;
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Detect Cycle Timing
+//
+
+static int
+fps_time_detect_cycle(fps_handle_t *handle,
+                      double       timeout_us,
+                      double       *cycle_us)
+{
+    int    status = 0;
+    double samples[FPS_PERIOD_SAMPLES];
+    double sample;
+    double start_us;
+    int    i;
+    int    j;
+
+    for (i = 0; i < FPS_PERIOD_SAMPLES; i++) {
+        // Stop scanning, so that no edge comes while the IRQ is held off
+        status = fps_clear_bits(handle, FPS_REG_GBL_CTL, FPS_ENABLE_DETECT);
+        if (status < 0) {
+            return status;
+        }
+
+        FPS_DISABLE_AND_CLEAR_INTERRUPT(handle, FPS_ALL_EVENTS);
+
+        // Let the hold-off run out. A replayed edge starts another one, so
+        // wait again until none is left
+        do {
+            fps_clock_sleep(handle, FPS_IRQ_HOLDOFF_US);
+
+            status = fps_wait_event(handle, 0.0);
+            if (status < 0) {
+                return status;
+            }
+        } while (status > 0);
+
+        // Entering detect mode starts the scan cycle, and the scan below arms
+        // afresh
+        status = fps_set_bits(handle, FPS_REG_GBL_CTL, FPS_ENABLE_DETECT);
+        if (status < 0) {
+            return status;
+        }
+
+        fps_invalidate_detect_arm(handle);
+
+        start_us = fps_get_clock_time_us(handle);
+
+        status = fps_scan_detect_event(handle, timeout_us);
+        if (status < 0) {
+            return status;
+        }
+
+        if (status == 0) {
+            LOG_WARN("No detect event within %0.3f us!\n", timeout_us);
+            return -1;
+        }
+
+        sample = fps_get_clock_time_us(handle) - start_us;
+
+        // Median of the samples, which is robust against a late wake-up of
+        // this thread
+        for (j = i; (j > 0) && (samples[j - 1] > sample); j--) {
+            samples[j] = samples[j - 1];
+        }
+
+        samples[j] = sample;
+    }
+
+    *cycle_us = samples[FPS_PERIOD_SAMPLES / 2];
+    LOG_EVENT(handle, FPS_EV_DETECT_CYCLE, FPS_EV_NS(*cycle_us), 0, 0);
+
+    return 0;
+}
+
+int
+fps_measure_detect_period(fps_handle_t *handle)
+{
+    int    status = 0;
+    int    mode_old;
+    int    detect_th_old;
+    int    frames_old;
+    int    col_begin;
+    int    col_end;
+    int    row_begin;
+    int    row_end;
+    int    det_size;
+    double cycle_lo_us;
+    double cycle_hi_us;
+    double period_us;
+
+    status = fps_get_sensing_area(handle, FPS_DETECT_MODE,
+                                  &col_begin, &col_end,
+                                  &row_begin, &row_end);
+    if (status < 0) {
+        return status;
+    }
+
+    det_size = (col_end - col_begin + 1) * (row_end - row_begin + 1);
+
+    status = fps_get_sensor_parameter(handle,
+                                      (FPS_DETECT_MODE | FPS_PARAM_DETECT_THRESHOLD),
+                                      &detect_th_old);
+    if (status < 0) {
+        return status;
+    }
+
+    status = fps_get_suspend_frames(handle, &frames_old);
+    if (status < 0) {
+        return status;
+    }
+
+    status = fps_switch_sensor_mode(handle, FPS_DETECT_MODE, &mode_old);
+    if (status < 0) {
+        return status;
+    }
+
+    // Every scan raises an event at the minimum threshold
+    status = fps_set_sensor_parameter(handle,
+                                      (FPS_DETECT_MODE | FPS_PARAM_DETECT_THRESHOLD),
+                                      FPS_MIN_DETECT_TH);
+    if (status < 0) {
+        goto fps_measure_detect_period_end;
+    }
+
+    status = fps_set_suspend_frames(handle, FPS_PERIOD_FRAMES_LO);
+    if (status < 0) {
+        goto fps_measure_detect_period_end;
+    }
+
+    status = fps_time_detect_cycle(handle,
+                                   (fps_calculate_suspend_time(det_size, FPS_PERIOD_FRAMES_LO) * 2) +
+                                   FPS_IRQ_HOLDOFF_US,
+                                   &cycle_lo_us);
+    if (status < 0) {
+        goto fps_measure_detect_period_end;
+    }
+
+    status = fps_set_suspend_frames(handle, FPS_PERIOD_FRAMES_HI);
+    if (status < 0) {
+        goto fps_measure_detect_period_end;
+    }
+
+    status = fps_time_detect_cycle(handle,
+                                   (fps_calculate_suspend_time(det_size, FPS_PERIOD_FRAMES_HI) * 2) +
+                                   FPS_IRQ_HOLDOFF_US,
+                                   &cycle_hi_us);
+    if (status < 0) {
+        goto fps_measure_detect_period_end;
+    }
+
+    period_us = (cycle_hi_us - cycle_lo_us) /
+                (double) (det_size * 8 * (FPS_PERIOD_FRAMES_HI - FPS_PERIOD_FRAMES_LO));
+
+    status = fps_set_detect_period(handle, period_us);
+    if (status < 0) {
+        LOG_WARN("Measured detect period %0.3f us is out of range!\n", period_us);
+        goto fps_measure_detect_period_end;
+    }
+
+    LOG_DEBUG("Detect Period = %0.3f us\n", period_us);
+
+fps_measure_detect_period_end:
+
+    // Restore the settings even when the measurement failed
+    FPS_DISABLE_AND_CLEAR_INTERRUPT(handle, FPS_ALL_EVENTS);
+
+    if (fps_set_suspend_frames(handle, frames_old) < 0) {
+        status = -1;
+    }
+
+    if (fps_set_sensor_parameter(handle,
+                                 (FPS_DETECT_MODE | FPS_PARAM_DETECT_THRESHOLD),
+                                 detect_th_old) < 0) {
+        status = -1;
+    }
+
+    if (fps_switch_sensor_mode(handle, mode_old, NULL) < 0) {
+        status = -1;
+    }
+
+    return status;
+}
+
+int
+fps_set_detect_period(fps_handle_t *handle,
+                      double       period_us)
+{
+    // 0 forgets the measurement, anything else must be a plausible period
+    if ((period_us != 0.0) &&
+        ((period_us < FPS_MIN_OSC_PERIOD_US) || (period_us > FPS_WORST_OSC_PERIOD_US))) {
+        return -1;
+    }
+
+    handle->osc_period_us = period_us;
+
+    return 0;
+}
+
+int
+fps_get_detect_period(fps_handle_t *handle,
+                      double       *period_us)
+{
+    *period_us = handle->osc_period_us;
+
+    return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Sensor Clock
+//
+
+static double
+fps_monotonic_get_time(fps_handle_t *handle)
+{
+    return fps_get_time_us();
+}
+
+static void
+fps_monotonic_sleep_until(fps_handle_t *handle,
+                          double       deadline_us)
+{
+    fps_sleep_until(deadline_us);
+}
+
+fps_clock_t fps_monotonic_clock = {
+    "monotonic",
+    fps_monotonic_get_time,
+    fps_monotonic_sleep_until,
+};
+
+static double
+fps_virtual_get_time(fps_handle_t *handle)
+{
+    return handle->virtual_time_us;
+}
+
+// Time never goes back, a deadline in the past is a no-op
+static void
+fps_virtual_sleep_until(fps_handle_t *handle,
+                        double       deadline_us)
+{
+    handle->virtual_time_us = MAX(handle->virtual_time_us, deadline_us);
+}
+
+fps_clock_t fps_virtual_clock = {
+    "virtual",
+    fps_virtual_get_time,
+    fps_virtual_sleep_until,
+};
+
+int
+fps_set_clock(fps_handle_t *handle,
+              fps_clock_t  *clock)
+{
+    double since_us;
+
+    if (clock == NULL) {
+        return -1;
+    }
+
+    since_us = fps_get_clock_time_us(handle) - handle->mode_since_us;
+
+    handle->clock         = clock;
+    handle->mode_since_us = fps_get_clock_time_us(handle) - since_us;
+
+    return 0;
+}
+
+double
+fps_get_clock_time_us(fps_handle_t *handle)
+{
+    return handle->clock->get_time_method(handle);
+}
+
+void
+fps_clock_sleep(fps_handle_t *handle,
+                double       sleep_us)
+{
+    fps_clock_sleep_until(handle, fps_get_clock_time_us(handle) + sleep_us);
+}
+
+void
+fps_clock_sleep_until(fps_handle_t *handle,
+                      double       deadline_us)
+{
+    handle->clock->sleep_until_method(handle, deadline_us);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Wait Overshoot
+//
+
+void
+fps_record_wait_overshoot(fps_handle_t *handle,
+                          double       overshoot_us)
+{
+    handle->wait_timeouts++;
+    handle->wait_overshoot_us      = overshoot_us;
+    handle->wait_overshoot_max_us  = MAX(handle->wait_overshoot_max_us, overshoot_us);
+    handle->wait_overshoot_sum_us += overshoot_us;
+
+    LOG_EVENT(handle, FPS_EV_WAIT_OVERSHOOT, FPS_EV_NS(overshoot_us), 0, 0);
+}
+
+int
+fps_get_wait_counters(fps_handle_t *handle,
+                      unsigned int *timeouts,
+                      double       *last_us,
+                      double       *max_us,
+                      double       *mean_us)
+{
+    if (timeouts != NULL) {
+        *timeouts = handle->wait_timeouts;
+    }
+
+    if (last_us != NULL) {
+        *last_us = handle->wait_overshoot_us;
+    }
+
+    if (max_us != NULL) {
+        *max_us = handle->wait_overshoot_max_us;
+    }
+
+    if (mean_us != NULL) {
+        *mean_us = (handle->wait_timeouts > 0) ?
+                   (handle->wait_overshoot_sum_us / handle->wait_timeouts) : 0.0;
+    }
+
+    return 0;
+}
+
+int
+fps_clear_wait_counters(fps_handle_t *handle)
+{
+    handle->wait_timeouts         = 0;
+    handle->wait_overshoot_us     = 0.0;
+    handle->wait_overshoot_max_us = 0.0;
+    handle->wait_overshoot_sum_us = 0.0;
+    return 0;
 }
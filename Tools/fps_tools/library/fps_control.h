@@ -19,25 +19,31 @@ extern "C" {
 // NOTE: Platform specific
 fps_handle_t* fps_open_sensor(char *file);
 
-// NOTE: Platform specific
 int fps_close_sensor(fps_handle_t **handle);
 
 // NOTE: Sensor specific
 int fps_init_sensor(fps_handle_t *handle);
 
-// NOTE: Platform specific
+// NOTE: Backend specific
 int fps_reset_sensor(fps_handle_t *handle,
                      int          state);
 
 #define FPS_RESET_SENSOR(_handle_, _us_) \
     do { \
         (void) fps_reset_sensor((_handle_), 0); \
-        fps_sleep((_us_)); \
+        fps_clock_sleep((_handle_), (_us_)); \
         (void) fps_reset_sensor((_handle_), 1); \
     } while (0)
 
 fps_handle_t* fps_attach_sensor(int fd);
 
+fps_handle_t* fps_attach_backend(int           fd,
+                                 fps_backend_t *backend,
+                                 void          *context);
+
+// NOTE: Platform specific, bound by fps_attach_sensor()
+extern fps_backend_t fps_native_backend;
+
 int fps_detach_sensor(fps_handle_t **handle);
 
 
@@ -46,7 +52,7 @@ int fps_detach_sensor(fps_handle_t **handle);
 // Set Sensor Speed
 //
 
-// NOTE: Platform specific
+// NOTE: Backend specific
 int fps_set_sensor_speed(fps_handle_t *handle,
                          int          speed_hz);
 
@@ -62,7 +68,7 @@ enum {
     F767A_CHIP_ID = 0x0767,
 };
 
-// NOTE: Platform specific
+// NOTE: Backend specific
 int fps_get_chip_id(fps_handle_t *handle,
                     int          *chip_id);
 
@@ -97,19 +103,60 @@ int fps_set_power_config(fps_handle_t *handle,
 int fps_get_power_config(fps_handle_t *handle,
                          int          *config);
 
+int fps_set_power_timing(fps_handle_t       *handle,
+                         int                config,
+                         fps_power_timing_t *timing);
+
+int fps_get_power_timing(fps_handle_t       *handle,
+                         int                config,
+                         fps_power_timing_t *timing);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SPI Alive Check
+// -----------------------------------------------------------------------------
+// NOTE: Sleeps the given delay first, then reads the chip ID every
+//       FPS_ALIVE_POLL_US until it matches or timeout_us has passed since the
+//       wait began. A matching chip ID only shows that the digital core
+//       answers over SPI, not that the LDOs, CP or analog front end settled.
+//
+
+#define FPS_ALIVE_POLL_US (200.0)
+
+int fps_wait_spi_alive(fps_handle_t *handle,
+                       double       min_us,
+                       double       timeout_us);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Statistics Arithmetic
+// -----------------------------------------------------------------------------
+// NOTE: FPS_STATS_FIXED computes image statistics with integer sums and Q24.8
+//       results (see fps_statistics.h). The default is FPS_STATS_FIXED when
+//       the library is built with __FPS_FIXED_POINT__.
+//
+
+int fps_set_statistics_mode(fps_handle_t *handle,
+                            int          mode);
+
+int fps_get_statistics_mode(fps_handle_t *handle,
+                            int          *mode);
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Register Access
 //
 
-// NOTE: Platform specific
+// NOTE: Backend specific
 int fps_multiple_read(fps_handle_t *handle,
                       uint8_t      *addr,
                       uint8_t      *data,
                       size_t       length);
 
-// NOTE: Platform specific
+// NOTE: Backend specific
 int fps_multiple_write(fps_handle_t *handle,
                        uint8_t      *addr,
                        uint8_t      *data,
@@ -204,6 +251,11 @@ int fps_get_suspend_frames(fps_handle_t *handle,
 double fps_calculate_suspend_time(int det_size,
                                   int frames);
 
+double fps_get_suspend_time(fps_handle_t *handle,
+                            int          det_size,
+                            int          frames,
+                            double       worst_case_mul);
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -220,18 +272,34 @@ int fps_switch_sensor_mode(fps_handle_t *handle,
                            int          mode_new,
                            int          *mode_old);
 
+int fps_invalidate_sensor_mode(fps_handle_t *handle);
+
+int fps_get_mode_counters(fps_handle_t *handle,
+                          unsigned int *transitions,
+                          unsigned int *skipped,
+                          double       *time_us);
+
+int fps_clear_mode_counters(fps_handle_t *handle);
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Image Mode Operations
 //
 
-// NOTE: Platform specific
+// NOTE: Backend specific
 int fps_get_raw_image(fps_handle_t *handle,
                       int          img_width,
                       int          img_height,
                       uint8_t      *img_buf);
 
+// NOTE: The same readout without the performance counters, for the stream
+//       capture thread, which must leave handle->stats to the consumer
+int fps_read_raw_image(fps_handle_t *handle,
+                       int          img_width,
+                       int          img_height,
+                       uint8_t      *img_buf);
+
 int fps_set_background_image(fps_handle_t *handle,
                              int          img_width,
                              int          img_height,
@@ -269,6 +337,37 @@ int fps_get_finger_image(fps_handle_t *handle,
                          double       *img_var,
                          double       *img_noise);
 
+// NOTE: The "_from" variants take their frames from a frame source instead of
+//       reading the sensor directly, e.g. from a capture stream (fps_stream.h).
+//       fps_raw_image_source() is the source used by the plain variants.
+int fps_raw_image_source(fps_handle_t *handle,
+                         void         *context,
+                         int          img_width,
+                         int          img_height,
+                         uint8_t      *img_buf);
+
+int fps_get_averaged_image_from(fps_handle_t       *handle,
+                                fps_frame_source_t source,
+                                void               *context,
+                                int                img_width,
+                                int                img_height,
+                                int                frms_to_avg,
+                                uint8_t            *img_buf,
+                                double             *img_avg,
+                                double             *img_var,
+                                double             *img_noise);
+
+int fps_get_finger_image_from(fps_handle_t       *handle,
+                              fps_frame_source_t source,
+                              void               *context,
+                              int                img_width,
+                              int                img_height,
+                              int                frms_to_avg,
+                              uint8_t            *img_buf,
+                              double             *img_dr,
+                              double             *img_var,
+                              double             *img_noise);
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -278,19 +377,113 @@ int fps_get_finger_image(fps_handle_t *handle,
 int fps_scan_detect_event(fps_handle_t *handle,
                           double       sleep_us);
 
+enum {
+    FPS_DETECT_DISARMED = 0,
+    FPS_DETECT_ARMED    = 1,
+    FPS_DETECT_STALE    = 2,
+};
+
+int fps_arm_detect_event(fps_handle_t *handle);
+
+int fps_disarm_detect_event(fps_handle_t *handle);
+
+void fps_invalidate_detect_arm(fps_handle_t *handle);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Detect Cycle Timing
+// -----------------------------------------------------------------------------
+// NOTE: A detect cycle takes det_size * (1 + frames) * 8 oscillator periods.
+//       The oscillator varies a lot between units, so the cycle is measured
+//       instead of assuming the slowest one: with the detect threshold at its
+//       minimum every scan raises an event, and the median time from a fresh
+//       arm, which restarts the scan cycle, to the event is taken at two
+//       suspend intervals. The slope between them is the period, free of any
+//       fixed scan and interrupt latency.
+//
+//       The dfs747 driver holds the IRQ off for FPS_IRQ_HOLDOFF_US after each
+//       interrupt and replays the edges from that time. Each sample therefore
+//       waits the hold-off out before it arms, and its timeout adds the
+//       hold-off to two worst-case cycles.
+//
+//       fps_get_suspend_time() adds FPS_SUSPEND_MARGIN to a measured period,
+//       or multiplies the slowest period by the caller's worst_case_mul when
+//       the handle has not been measured.
+//
+
+#define FPS_WORST_OSC_PERIOD_US (4.0)
+#define FPS_MIN_OSC_PERIOD_US   (0.5)
+#define FPS_SUSPEND_MARGIN      (0.25)
+#define FPS_PERIOD_SAMPLES      (5)
+#define FPS_PERIOD_FRAMES_LO    (1)
+#define FPS_PERIOD_FRAMES_HI    (5)
+#define FPS_IRQ_HOLDOFF_US      (10000.0)
+
+int fps_measure_detect_period(fps_handle_t *handle);
+
+int fps_set_detect_period(fps_handle_t *handle,
+                          double       period_us);
+
+int fps_get_detect_period(fps_handle_t *handle,
+                          double       *period_us);
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Helpers
 //
 
-// NOTE: Platform specific
+// NOTE: Backend specific. A negative sleep_us waits forever, otherwise the
+//       wait ends at an absolute deadline sleep_us from now. How late a wait
+//       without event returns is recorded in the handle.
 int fps_wait_event(fps_handle_t *handle,
                    double       sleep_us);
 
 // NOTE: Platform specific
 void fps_sleep(double sleep_us);
 
+// NOTE: Platform specific, deadline_us is on the fps_get_time_us() clock.
+//       Loops that sleep until start + n * interval do not drift.
+void fps_sleep_until(double deadline_us);
+
+// NOTE: Platform specific, monotonic time in microseconds
+double fps_get_time_us(void);
+
+// NOTE: Platform specific, CPU time of the process in microseconds
+double fps_get_cpu_time_us(void);
+
+// NOTE: Platform specific, raw monotonic time in nanoseconds, not slewed by
+//       NTP, for profiling
+double fps_get_raw_time_ns(void);
+
+extern fps_clock_t fps_monotonic_clock;
+extern fps_clock_t fps_virtual_clock;
+
+// NOTE: Moves the mode time accounting over to the new clock
+int fps_set_clock(fps_handle_t *handle,
+                  fps_clock_t  *clock);
+
+// NOTE: On the clock of the handle, like the deadlines below
+double fps_get_clock_time_us(fps_handle_t *handle);
+
+void fps_clock_sleep(fps_handle_t *handle,
+                     double       sleep_us);
+
+void fps_clock_sleep_until(fps_handle_t *handle,
+                           double       deadline_us);
+
+void fps_record_wait_overshoot(fps_handle_t *handle,
+                               double       overshoot_us);
+
+int fps_get_wait_counters(fps_handle_t *handle,
+                          unsigned int *timeouts,
+                          double       *last_us,
+                          double       *max_us,
+                          double       *mean_us);
+
+int fps_clear_wait_counters(fps_handle_t *handle);
+
 
 #if defined(__cplusplus)
 }
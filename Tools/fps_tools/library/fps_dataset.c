@@ -0,0 +1,710 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "debug.h"
+#include "fps.h"
+#include "fps_register.h"
+#include "fps_control.h"
+#include "fps_dataset.h"
+
+#if defined(__WINDOWS__)
+    #include <windows.h>
+#elif defined(__LINUX__)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+
+#if (FPS_REG_COUNT > FPS_DATASET_REGISTERS)
+    #error "The register file does not fit into the dataset header!"
+#endif
+
+// Grows by doubling from here
+#define FPS_DATASET_INDEX_INITIAL (64)
+
+// Size of the stdio buffer of the writer, so that records go out in bulk
+#define FPS_DATASET_WRITE_BUFFER  (64 * 1024)
+
+#define FPS_DATASET_ALIGN(_size_) (((_size_) + 7) & ~7)
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Dataset Structures
+//
+
+struct __fps_dataset {
+    fps_handle_t        *handle;
+    FILE                *fp;
+    size_t              img_size;
+    size_t              record_size;
+    unsigned int        frames;
+    unsigned int        index_size;
+    fps_dataset_index_t *index;
+    uint8_t             *record_buf;
+};
+
+struct __fps_dataset_map {
+    uint8_t              *base;
+    size_t               size;
+    fps_dataset_header_t *header;
+    fps_dataset_index_t  *index;
+    int                  frames;
+
+#if defined(__WINDOWS__)
+    HANDLE               file;
+    HANDLE               mapping;
+#endif
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Serialization
+//
+
+static void
+fps_put_u32(uint8_t  **ptr,
+            uint32_t value)
+{
+    (*ptr)[0] = (uint8_t) ((value >>  0) & 0xFF);
+    (*ptr)[1] = (uint8_t) ((value >>  8) & 0xFF);
+    (*ptr)[2] = (uint8_t) ((value >> 16) & 0xFF);
+    (*ptr)[3] = (uint8_t) ((value >> 24) & 0xFF);
+    *ptr += 4;
+}
+
+static void
+fps_put_u16(uint8_t  **ptr,
+            uint16_t value)
+{
+    (*ptr)[0] = (uint8_t) ((value >> 0) & 0xFF);
+    (*ptr)[1] = (uint8_t) ((value >> 8) & 0xFF);
+    *ptr += 2;
+}
+
+static void
+fps_put_double(uint8_t **ptr,
+               double  value)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    fps_put_u32(ptr, (uint32_t) (bits >>  0));
+    fps_put_u32(ptr, (uint32_t) (bits >> 32));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Writing
+//
+
+fps_dataset_t*
+fps_create_dataset(fps_handle_t *handle,
+                   char         *path,
+                   int          img_width,
+                   int          img_height,
+                   int          frms_to_avg,
+                   int          img_type)
+{
+    int           status = 0;
+    fps_dataset_t *dataset;
+    uint8_t       header[FPS_DATASET_HEADER_SIZE];
+    uint8_t       *ptr;
+    uint8_t       addr[FPS_REG_COUNT];
+    uint8_t       data[FPS_REG_COUNT];
+    int           col_begin;
+    int           col_end;
+    int           row_begin;
+    int           row_end;
+    int           i;
+
+    if ((img_width <= 0) || (img_height <= 0)) {
+        return NULL;
+    }
+
+    status = fps_get_sensing_area(handle, FPS_IMAGE_MODE,
+                                  &col_begin, &col_end,
+                                  &row_begin, &row_end);
+    if (status < 0) {
+        return NULL;
+    }
+
+    // The register file as it is at the start of the run
+    for (i = 0; i < FPS_REG_COUNT; i++) {
+        addr[i] = (uint8_t) i;
+    }
+
+    status = fps_multiple_read(handle, addr, data, FPS_REG_COUNT);
+    if (status < 0) {
+        return NULL;
+    }
+
+    dataset = (fps_dataset_t *) calloc(1, sizeof(fps_dataset_t));
+    if (dataset == NULL) {
+        LOG_ERROR("calloc() failed!\n");
+        return NULL;
+    }
+
+    dataset->handle      = handle;
+    dataset->img_size    = (size_t) (img_width * img_height);
+    dataset->record_size = FPS_DATASET_ALIGN(FPS_DATASET_RECORD_SIZE + dataset->img_size);
+    dataset->index_size  = FPS_DATASET_INDEX_INITIAL;
+
+    dataset->index      = (fps_dataset_index_t *) malloc(dataset->index_size * sizeof(fps_dataset_index_t));
+    dataset->record_buf = (uint8_t *) calloc(1, dataset->record_size);
+    if ((dataset->index == NULL) || (dataset->record_buf == NULL)) {
+        LOG_ERROR("malloc() failed!\n");
+        goto fps_create_dataset_error;
+    }
+
+    memset(header, 0x00, sizeof(header));
+    ptr = header;
+
+    fps_put_u32(&ptr, FPS_DATASET_MAGIC);
+    fps_put_u32(&ptr, FPS_DATASET_VERSION);
+    fps_put_u32(&ptr, FPS_DATASET_HEADER_SIZE);
+    fps_put_u32(&ptr, (uint32_t) dataset->record_size);
+    fps_put_u32(&ptr, (uint32_t) handle->chip_id);
+    fps_put_u32(&ptr, (uint32_t) handle->power_config);
+    fps_put_u32(&ptr, (uint32_t) handle->sensor_width);
+    fps_put_u32(&ptr, (uint32_t) handle->sensor_height);
+    fps_put_u32(&ptr, (uint32_t) col_begin);
+    fps_put_u32(&ptr, (uint32_t) col_end);
+    fps_put_u32(&ptr, (uint32_t) row_begin);
+    fps_put_u32(&ptr, (uint32_t) row_end);
+    fps_put_u32(&ptr, (uint32_t) img_width);
+    fps_put_u32(&ptr, (uint32_t) img_height);
+    fps_put_u32(&ptr, (uint32_t) frms_to_avg);
+    fps_put_u32(&ptr, (uint32_t) img_type);
+    fps_put_u32(&ptr, 0);                       // frames, set when closed
+    fps_put_u32(&ptr, FPS_REG_COUNT);
+    fps_put_double(&ptr, handle->bkgnd_avg);
+
+    memcpy(ptr, data, FPS_REG_COUNT);
+
+    dataset->fp = fopen(path, "wb");
+    if (dataset->fp == NULL) {
+        LOG_ERROR("Opening %s failed!\n", path);
+        goto fps_create_dataset_error;
+    }
+
+    (void) setvbuf(dataset->fp, NULL, _IOFBF, FPS_DATASET_WRITE_BUFFER);
+
+    if (fwrite(header, 1, sizeof(header), dataset->fp) != sizeof(header)) {
+        LOG_ERROR("Writing %s failed!\n", path);
+        goto fps_create_dataset_error;
+    }
+
+    return dataset;
+
+fps_create_dataset_error :
+
+    if (dataset->fp != NULL) {
+        fclose(dataset->fp);
+    }
+
+    free(dataset->record_buf);
+    free(dataset->index);
+    free(dataset);
+
+    return NULL;
+}
+
+int
+fps_append_dataset(fps_dataset_t *dataset,
+                   unsigned int  seq,
+                   uint8_t       *img_buf,
+                   double        img_avg,
+                   double        img_var,
+                   double        img_noise,
+                   double        img_dr)
+{
+    fps_dataset_index_t *index;
+    uint8_t             *ptr;
+    double              time_us;
+
+    if ((dataset->frames > 0) && (seq <= dataset->index[dataset->frames - 1].seq)) {
+        LOG_ERROR("Sequence number %0u after %0u!\n", seq, dataset->index[dataset->frames - 1].seq);
+        return -1;
+    }
+
+    if (dataset->frames == dataset->index_size) {
+        index = (fps_dataset_index_t *) realloc(dataset->index,
+                                                dataset->index_size * 2 * sizeof(fps_dataset_index_t));
+        if (index == NULL) {
+            LOG_ERROR("realloc() failed!\n");
+            return -1;
+        }
+
+        dataset->index       = index;
+        dataset->index_size *= 2;
+    }
+
+    time_us = fps_get_clock_time_us(dataset->handle);
+
+    ptr = dataset->record_buf;
+
+    fps_put_u32(&ptr, seq);
+    fps_put_u32(&ptr, 0);
+    fps_put_double(&ptr, time_us);
+    fps_put_double(&ptr, img_avg);
+    fps_put_double(&ptr, img_var);
+    fps_put_double(&ptr, img_noise);
+    fps_put_double(&ptr, img_dr);
+
+    // The padding behind the pixels stays zero from calloc()
+    memcpy(ptr, img_buf, dataset->img_size);
+
+    if (fwrite(dataset->record_buf, 1, dataset->record_size, dataset->fp) != dataset->record_size) {
+        LOG_ERROR("Writing a dataset record failed!\n");
+        return -1;
+    }
+
+    index = &dataset->index[dataset->frames];
+
+    index->seq     = seq;
+    index->record  = dataset->frames;
+    index->time_us = time_us;
+
+    dataset->frames++;
+
+    return 0;
+}
+
+int
+fps_close_dataset(fps_dataset_t **dataset)
+{
+    int                 status = 0;
+    fps_dataset_t       *ds;
+    fps_dataset_index_t *index;
+    uint8_t             entry[FPS_DATASET_INDEX_SIZE];
+    uint8_t             *ptr;
+    unsigned int        i;
+
+    if ((dataset == NULL) || (*dataset == NULL)) {
+        return -1;
+    }
+
+    ds = *dataset;
+
+    for (i = 0; i < ds->frames; i++) {
+        index = &ds->index[i];
+        ptr   = entry;
+
+        fps_put_u32(&ptr, index->seq);
+        fps_put_u32(&ptr, index->record);
+        fps_put_double(&ptr, index->time_us);
+
+        if (fwrite(entry, 1, sizeof(entry), ds->fp) != sizeof(entry)) {
+            status = -1;
+            break;
+        }
+    }
+
+    // Only with the whole index on disk does the frame count say it is there
+    if ((status == 0) && (ds->frames > 0)) {
+        ptr = entry;
+        fps_put_u32(&ptr, ds->frames);
+
+        if ((fflush(ds->fp) != 0) ||
+            (fseek(ds->fp, FPS_DATASET_FRAMES_OFFSET, SEEK_SET) != 0) ||
+            (fwrite(entry, 1, 4, ds->fp) != 4)) {
+            status = -1;
+        }
+    }
+
+    if (fclose(ds->fp) != 0) {
+        status = -1;
+    }
+
+    if (status < 0) {
+        LOG_ERROR("Closing the dataset failed!\n");
+    }
+
+    free(ds->record_buf);
+    free(ds->index);
+    free(ds);
+
+    *dataset = NULL;
+
+    return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Reading
+//
+
+static int
+fps_check_dataset(fps_dataset_map_t *map)
+{
+    fps_dataset_header_t *header;
+    size_t               records_end;
+
+    if (map->size < sizeof(fps_dataset_header_t)) {
+        LOG_ERROR("Dataset is too short!\n");
+        return -1;
+    }
+
+    header = (fps_dataset_header_t *) map->base;
+
+    if ((header->magic != FPS_DATASET_MAGIC) || (header->version != FPS_DATASET_VERSION)) {
+        LOG_ERROR("Dataset has an unknown format!\n");
+        return -1;
+    }
+
+    if ((header->header_size < sizeof(fps_dataset_header_t)) ||
+        (header->header_size > map->size) ||
+        ((header->header_size % 8) != 0) ||
+        ((header->record_size % 8) != 0) ||
+        (header->record_size < (sizeof(fps_dataset_record_t) + header->img_width * header->img_height))) {
+        LOG_ERROR("Dataset has a broken header!\n");
+        return -1;
+    }
+
+    map->header = header;
+
+    // Not closed, so take the complete records there are
+    if (header->frames == 0) {
+        map->frames = (int) ((map->size - header->header_size) / header->record_size);
+        map->index  = NULL;
+        return 0;
+    }
+
+    records_end = header->header_size + (size_t) header->frames * header->record_size;
+
+    if ((records_end + header->frames * sizeof(fps_dataset_index_t)) > map->size) {
+        LOG_ERROR("Dataset is truncated!\n");
+        return -1;
+    }
+
+    map->frames = (int) header->frames;
+    map->index  = (fps_dataset_index_t *) &map->base[records_end];
+
+    return 0;
+}
+
+fps_dataset_map_t*
+fps_map_dataset(char *path)
+{
+    fps_dataset_map_t *map;
+#if defined(__LINUX__)
+    int               fd;
+    struct stat       st;
+#endif
+
+    // Checked against the structures the file is read through
+    if ((sizeof(fps_dataset_header_t) != FPS_DATASET_FIELDS_SIZE) ||
+        (sizeof(fps_dataset_record_t) != FPS_DATASET_RECORD_SIZE) ||
+        (sizeof(fps_dataset_index_t)  != FPS_DATASET_INDEX_SIZE )) {
+        LOG_ERROR("Dataset structures are not packed as in the file!\n");
+        return NULL;
+    }
+
+    map = (fps_dataset_map_t *) calloc(1, sizeof(fps_dataset_map_t));
+    if (map == NULL) {
+        LOG_ERROR("calloc() failed!\n");
+        return NULL;
+    }
+
+#if defined(__WINDOWS__)
+    map->file = CreateFile((LPCTSTR) path,
+                           GENERIC_READ,
+                           FILE_SHARE_READ,
+                           NULL,
+                           OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL,
+                           (HANDLE) NULL);
+    if (map->file == INVALID_HANDLE_VALUE) {
+        LOG_ERROR("Opening %s failed!\n", path);
+        free(map);
+        return NULL;
+    }
+
+    map->size = (size_t) GetFileSize(map->file, NULL);
+
+    map->mapping = CreateFileMapping(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map->mapping != NULL) {
+        map->base = (uint8_t *) MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+
+    if (map->base == NULL) {
+        LOG_ERROR("Mapping %s failed!\n", path);
+        (void) fps_unmap_dataset(&map);
+        return NULL;
+    }
+#elif defined(__LINUX__)
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("Opening %s failed!\n", path);
+        free(map);
+        return NULL;
+    }
+
+    if ((fstat(fd, &st) < 0) || (st.st_size == 0)) {
+        LOG_ERROR("Dataset %s is empty!\n", path);
+        close(fd);
+        free(map);
+        return NULL;
+    }
+
+    map->size = (size_t) st.st_size;
+    map->base = (uint8_t *) mmap(NULL, map->size, PROT_READ, MAP_SHARED, fd, 0);
+
+    // The mapping stays valid without the descriptor
+    close(fd);
+
+    if (map->base == (uint8_t *) MAP_FAILED) {
+        LOG_ERROR("Mapping %s failed!\n", path);
+        free(map);
+        return NULL;
+    }
+#endif
+
+    if (fps_check_dataset(map) < 0) {
+        (void) fps_unmap_dataset(&map);
+        return NULL;
+    }
+
+    return map;
+}
+
+int
+fps_unmap_dataset(fps_dataset_map_t **map)
+{
+    if ((map == NULL) || (*map == NULL)) {
+        return -1;
+    }
+
+#if defined(__WINDOWS__)
+    if ((*map)->base != NULL) {
+        UnmapViewOfFile((*map)->base);
+    }
+
+    if ((*map)->mapping != NULL) {
+        CloseHandle((*map)->mapping);
+    }
+
+    CloseHandle((*map)->file);
+#elif defined(__LINUX__)
+    (void) munmap((*map)->base, (*map)->size);
+#endif
+
+    free(*map);
+    *map = NULL;
+
+    return 0;
+}
+
+fps_dataset_header_t*
+fps_get_dataset_header(fps_dataset_map_t *map)
+{
+    return map->header;
+}
+
+int
+fps_get_dataset_frames(fps_dataset_map_t *map)
+{
+    return map->frames;
+}
+
+fps_dataset_index_t*
+fps_get_dataset_index(fps_dataset_map_t *map)
+{
+    return map->index;
+}
+
+fps_dataset_record_t*
+fps_get_dataset_record(fps_dataset_map_t *map,
+                       int               frame,
+                       uint8_t           **pixels)
+{
+    uint8_t *record;
+
+    if ((frame < 0) || (frame >= map->frames)) {
+        return NULL;
+    }
+
+    record = &map->base[map->header->header_size + (size_t) frame * map->header->record_size];
+
+    if (pixels != NULL) {
+        *pixels = &record[sizeof(fps_dataset_record_t)];
+    }
+
+    return (fps_dataset_record_t *) record;
+}
+
+// From the index, or from the record itself without one
+static unsigned int
+fps_get_dataset_seq(fps_dataset_map_t *map,
+                    int               frame)
+{
+    if (map->index != NULL) {
+        return map->index[frame].seq;
+    }
+
+    return fps_get_dataset_record(map, frame, NULL)->seq;
+}
+
+int
+fps_find_dataset_frame(fps_dataset_map_t *map,
+                       unsigned int      seq)
+{
+    int lo;
+    int hi;
+    int mid;
+
+    // Sequence numbers increase from record to record
+    lo = 0;
+    hi = map->frames - 1;
+
+    while (lo <= hi) {
+        mid = lo + (hi - lo) / 2;
+
+        if (fps_get_dataset_seq(map, mid) < seq) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    if ((lo < map->frames) && (fps_get_dataset_seq(map, lo) == seq)) {
+        return lo;
+    }
+
+    return -1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Export
+//
+
+// Rows go out in buffer order, like save_bmp() of the analyzer, each padded
+// to 4 bytes
+static int
+fps_export_bmp(FILE    *fp,
+               uint8_t *pixels,
+               int     width,
+               int     height)
+{
+    uint8_t header[14 + 40 + 256 * 4];
+    uint8_t pad[4] = { 0x00, 0x00, 0x00, 0x00 };
+    uint8_t *ptr;
+    int     stride;
+    int     i;
+
+    stride = (width + 3) & ~3;
+    ptr    = header;
+
+    // File header
+    fps_put_u16(&ptr, 0x4D42);                  // 'B' 'M'
+    fps_put_u32(&ptr, sizeof(header) + stride * height);
+    fps_put_u32(&ptr, 0);
+    fps_put_u32(&ptr, sizeof(header));
+
+    // Info header
+    fps_put_u32(&ptr, 40);
+    fps_put_u32(&ptr, (uint32_t) width);
+    fps_put_u32(&ptr, (uint32_t) height);
+    fps_put_u16(&ptr, 1);                       // Color planes
+    fps_put_u16(&ptr, 8);                       // Bits per pixel
+    fps_put_u32(&ptr, 0);                       // No compression
+    fps_put_u32(&ptr, 0);
+    fps_put_u32(&ptr, 0x4CE5);                  // X resolution
+    fps_put_u32(&ptr, 0x4CE5);                  // Y resolution
+    fps_put_u32(&ptr, 256);
+    fps_put_u32(&ptr, 0);
+
+    // Gray scale color table
+    for (i = 0; i < 256; i++) {
+        *ptr++ = (uint8_t) i;
+        *ptr++ = (uint8_t) i;
+        *ptr++ = (uint8_t) i;
+        *ptr++ = 0x00;
+    }
+
+    if (fwrite(header, 1, sizeof(header), fp) != sizeof(header)) {
+        return -1;
+    }
+
+    for (i = 0; i < height; i++) {
+        if (fwrite(&pixels[i * width], 1, width, fp) != (size_t) width) {
+            return -1;
+        }
+
+        if ((stride > width) && (fwrite(pad, 1, stride - width, fp) != (size_t) (stride - width))) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+fps_export_pgm(FILE    *fp,
+               uint8_t *pixels,
+               int     width,
+               int     height)
+{
+    size_t size = (size_t) (width * height);
+
+    if (fprintf(fp, "P5\n%0d %0d\n255\n", width, height) < 0) {
+        return -1;
+    }
+
+    if (fwrite(pixels, 1, size, fp) != size) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+fps_export_dataset_frame(fps_dataset_map_t *map,
+                         int               frame,
+                         char              *path,
+                         int               format)
+{
+    int     status = 0;
+    FILE    *fp;
+    uint8_t *pixels;
+
+    if (fps_get_dataset_record(map, frame, &pixels) == NULL) {
+        return -1;
+    }
+
+    if ((format != FPS_EXPORT_BMP) && (format != FPS_EXPORT_PGM)) {
+        return -1;
+    }
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) {
+        LOG_ERROR("Opening %s failed!\n", path);
+        return -1;
+    }
+
+    if (format == FPS_EXPORT_BMP) {
+        status = fps_export_bmp(fp, pixels, (int) map->header->img_width, (int) map->header->img_height);
+    } else {
+        status = fps_export_pgm(fp, pixels, (int) map->header->img_width, (int) map->header->img_height);
+    }
+
+    if (fclose(fp) != 0) {
+        status = -1;
+    }
+
+    if (status < 0) {
+        LOG_ERROR("Writing %s failed!\n", path);
+    }
+
+    return status;
+}
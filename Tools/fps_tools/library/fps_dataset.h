@@ -0,0 +1,84 @@
+#ifndef __fps_dataset_h__
+#define __fps_dataset_h__
+
+
+#include "common.h"
+#include "fps.h"
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Dataset
+// -----------------------------------------------------------------------------
+// NOTE: On disk, the header fields come in the order of fps_dataset_header_t,
+//       zero-padded to header_size. Each record is an fps_dataset_record_t,
+//       the img_width x img_height pixels and zeros up to record_size, a
+//       multiple of 8. The index entries follow record frames - 1, one per
+//       record in order. All integers are 32-bit and all doubles 64-bit,
+//       little-endian.
+//
+//       The writer serializes field by field, so it runs on any host. The
+//       reader maps the file and checks the magic through the structure, so
+//       it rejects a dataset on a big-endian host rather than misread it.
+//
+//       Sequence numbers must increase from record to record, which keeps
+//       the index sorted for fps_find_dataset_frame().
+//
+
+// Field offsets and sizes in the file
+#define FPS_DATASET_FRAMES_OFFSET (64)
+#define FPS_DATASET_FIELDS_SIZE   (4 * 18 + 8 + FPS_DATASET_REGISTERS)
+#define FPS_DATASET_RECORD_SIZE   (4 * 2 + 8 * 5)
+#define FPS_DATASET_INDEX_SIZE    (4 * 2 + 8)
+
+fps_dataset_t* fps_create_dataset(fps_handle_t *handle,
+                                  char         *path,
+                                  int          img_width,
+                                  int          img_height,
+                                  int          frms_to_avg,
+                                  int          img_type);
+
+int fps_append_dataset(fps_dataset_t *dataset,
+                       unsigned int  seq,
+                       uint8_t       *img_buf,
+                       double        img_avg,
+                       double        img_var,
+                       double        img_noise,
+                       double        img_dr);
+
+int fps_close_dataset(fps_dataset_t **dataset);
+
+fps_dataset_map_t* fps_map_dataset(char *path);
+
+int fps_unmap_dataset(fps_dataset_map_t **map);
+
+fps_dataset_header_t* fps_get_dataset_header(fps_dataset_map_t *map);
+
+int fps_get_dataset_frames(fps_dataset_map_t *map);
+
+fps_dataset_index_t* fps_get_dataset_index(fps_dataset_map_t *map);
+
+fps_dataset_record_t* fps_get_dataset_record(fps_dataset_map_t *map,
+                                             int               frame,
+                                             uint8_t           **pixels);
+
+int fps_find_dataset_frame(fps_dataset_map_t *map,
+                           unsigned int      seq);
+
+int fps_export_dataset_frame(fps_dataset_map_t *map,
+                             int               frame,
+                             char              *path,
+                             int               format);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+
+#endif // __fps_dataset_h__
@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "debug.h"
+#include "fps.h"
+#include "fps_control.h"
+#include "fps_event_log.h"
+
+#if defined(__WINDOWS__)
+    #include <windows.h>
+#elif defined(__LINUX__)
+    #include <pthread.h>
+#endif
+
+
+#if defined(__WINDOWS__)
+    #define SNPRINTF _snprintf
+    #define FPS_EV_FETCH_AND_INC(_ptr_) ((unsigned int) InterlockedIncrement((LONG *) (_ptr_)) - 1)
+    #if defined(MemoryBarrier)
+        #define FPS_EV_BARRIER()        MemoryBarrier()
+    #else
+        // Older SDKs have no MemoryBarrier(), but an interlocked call is a
+        // full barrier for the CPU and the compiler alike
+        #define FPS_EV_BARRIER() \
+            do { \
+                LONG fence_; \
+                (void) InterlockedExchange(&fence_, 0); \
+            } while (0)
+    #endif
+#else
+    #define SNPRINTF snprintf
+    #define FPS_EV_FETCH_AND_INC(_ptr_) __sync_fetch_and_add((_ptr_), 1)
+    #define FPS_EV_BARRIER()            __sync_synchronize()
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Ring Structure
+// -----------------------------------------------------------------------------
+// NOTE: Record i of the log lives in slot (i & mask). Its writer sets seq to i
+//       while filling it in and to i + 1 when done, so a record is complete
+//       if and only if its seq is its index plus one. The drain reads seq
+//       from the ring, copies the record, and reads seq from the ring again:
+//       the copy is only whole if both reads match. A record found still
+//       being written ends the drain, one already overwritten by a later lap
+//       is counted as lost.
+//
+//       Only one drain runs at a time, under drain_lock on Linux. Writers
+//       never take it.
+//
+
+typedef struct __fps_ev_record {
+    volatile unsigned int seq;
+    unsigned short        event;
+    unsigned short        reserved;
+    double                time_us;
+    int                   args[FPS_EV_ARGS];
+} fps_ev_record_t;
+
+struct __fps_event_log {
+    fps_ev_record_t       *records;
+    unsigned int          mask;
+    volatile unsigned int head;     // next record to write
+    unsigned int          tail;     // next record to drain
+    unsigned int          lost;
+
+#if defined(__LINUX__)
+    pthread_mutex_t       drain_lock;
+    pthread_t             drain_thread;
+    volatile int          draining;
+    FILE                  *drain_file;
+    int                   drain_period_ms;
+#endif
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Formatting
+//
+
+static int
+fps_format_event(int  event,
+                 int  *args,
+                 char *text,
+                 int  size)
+{
+    switch (event) {
+    case FPS_EV_REG_READ :
+    case FPS_EV_REG_WRITE :
+        return SNPRINTF(text, size, "addr = 0x%02X, data = 0x%02X\n", args[0], args[1]);
+    case FPS_EV_WAIT_REVENTS :
+        return SNPRINTF(text, size, "poll_fps.revents = %0d\n", args[0]);
+    case FPS_EV_SPI_ALIVE :
+        return SNPRINTF(text, size, "Chip ID read back after %0.3f us\n", args[0] / 1000.0);
+    case FPS_EV_DETECT_CYCLE :
+        return SNPRINTF(text, size, "Detect cycle = %0.3f us\n", args[0] / 1000.0);
+    case FPS_EV_WAIT_OVERSHOOT :
+        return SNPRINTF(text, size, "Wait overshoot = %0.3f us\n", args[0] / 1000.0);
+    case FPS_EV_SCAN_STEP :
+        return SNPRINTF(text, size, "Step decided after %0d scans (%s)\n",
+                        args[0], ((args[1] == TRUE) ? "Event" : "No Event"));
+    case FPS_EV_STALE_WAKEUP :
+        return SNPRINTF(text, size, "Woken without detect event, events = 0x%02X\n", args[0]);
+    default :
+        return SNPRINTF(text, size, "Event %0d (%0d, %0d, %0d)\n", event, args[0], args[1], args[2]);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Logging
+//
+
+void
+fps_log_event(fps_handle_t *handle,
+              char         *file,
+              int          line,
+              int          event,
+              int          a0,
+              int          a1,
+              int          a2)
+{
+    fps_event_log_t *log = handle->event_log;
+    fps_ev_record_t *record;
+    unsigned int    index;
+    int             args[FPS_EV_ARGS];
+    char            text[MAX_STRING_LENGTH];
+
+    if (log == NULL) {
+        args[0] = a0;
+        args[1] = a1;
+        args[2] = a2;
+
+        if (fps_format_event(event, args, text, sizeof(text)) >= 0) {
+            (void) print_detail(file, line, "%s", text);
+        }
+        return;
+    }
+
+    index  = FPS_EV_FETCH_AND_INC(&log->head);
+    record = &log->records[index & log->mask];
+
+    record->seq = index;
+    FPS_EV_BARRIER();
+
+    record->event   = (unsigned short) event;
+    record->time_us = fps_get_clock_time_us(handle);
+    record->args[0] = a0;
+    record->args[1] = a1;
+    record->args[2] = a2;
+
+    FPS_EV_BARRIER();
+    record->seq = index + 1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Draining
+//
+
+static int
+fps_drain_records(fps_event_log_t *log,
+                  FILE            *file)
+{
+    fps_ev_record_t *slot;
+    fps_ev_record_t record;
+    unsigned int    head;
+    unsigned int    seq;
+    unsigned int    size;
+    unsigned int    lost = 0;
+    int             count = 0;
+    char            text[MAX_STRING_LENGTH];
+
+    head = log->head;
+    size = log->mask + 1;
+
+    // Lapped by the writers since the last drain
+    if ((head - log->tail) > size) {
+        lost      = (head - log->tail) - size;
+        log->tail = head - size;
+    }
+
+    while (log->tail != head) {
+        slot = &log->records[log->tail & log->mask];
+
+        seq = slot->seq;
+        FPS_EV_BARRIER();
+
+        memcpy(&record, slot, sizeof(fps_ev_record_t));
+
+        // A writer of a later lap may have started during the copy
+        FPS_EV_BARRIER();
+
+        if ((seq != (log->tail + 1)) || (slot->seq != seq)) {
+            if ((log->head - log->tail) <= size) {
+                break;      // Still being written, left for the next drain
+            }
+
+            lost++;
+            log->tail++;
+            continue;
+        }
+
+        if (fps_format_event(record.event, record.args, text, sizeof(text)) >= 0) {
+            fprintf(file, "%14.3f us  %s", record.time_us, text);
+            count++;
+        }
+
+        log->tail++;
+    }
+
+    if (lost > 0) {
+        fprintf(file, "%14s     %0u records lost\n", "", lost);
+        log->lost += lost;
+    }
+
+    fflush(file);
+
+    return count;
+}
+
+#if defined(__LINUX__)
+
+static void*
+fps_drain_thread(void *arg)
+{
+    fps_event_log_t *log = (fps_event_log_t *) arg;
+
+    while (log->draining == TRUE) {
+        fps_sleep(log->drain_period_ms * 1000.0);
+
+        pthread_mutex_lock(&log->drain_lock);
+        (void) fps_drain_records(log, log->drain_file);
+        pthread_mutex_unlock(&log->drain_lock);
+    }
+
+    return NULL;
+}
+
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Public Interface
+//
+
+int
+fps_start_event_log(fps_handle_t *handle,
+                    int          records)
+{
+    fps_event_log_t *log;
+    unsigned int    size = 1;
+
+    if ((handle->event_log != NULL) || (records <= 0)) {
+        return -1;
+    }
+
+    while (size < (unsigned int) records) {
+        size <<= 1;
+    }
+
+    log = (fps_event_log_t *) calloc(1, sizeof(fps_event_log_t));
+    if (log == NULL) {
+        LOG_ERROR("calloc() failed!\n");
+        return -1;
+    }
+
+    log->records = (fps_ev_record_t *) calloc(size, sizeof(fps_ev_record_t));
+    if (log->records == NULL) {
+        LOG_ERROR("calloc() failed!\n");
+        free(log);
+        return -1;
+    }
+
+    // Slots start at seq 0, i.e. not complete for the first lap
+    log->mask = size - 1;
+
+#if defined(__LINUX__)
+    pthread_mutex_init(&log->drain_lock, NULL);
+    log->draining = FALSE;
+#endif
+
+    handle->event_log = log;
+
+    return 0;
+}
+
+int
+fps_stop_event_log(fps_handle_t *handle)
+{
+    fps_event_log_t *log = handle->event_log;
+
+    if (log == NULL) {
+        return 0;
+    }
+
+#if defined(__LINUX__)
+    if (log->draining == TRUE) {
+        log->draining = FALSE;
+        pthread_join(log->drain_thread, NULL);
+
+        (void) fps_drain_records(log, log->drain_file);
+
+        if (log->drain_file != stdout) {
+            fclose(log->drain_file);
+        }
+    }
+
+    pthread_mutex_destroy(&log->drain_lock);
+#endif
+
+    handle->event_log = NULL;
+
+    free(log->records);
+    free(log);
+
+    return 0;
+}
+
+int
+fps_drain_event_log(fps_handle_t *handle,
+                    char         *path)
+{
+    fps_event_log_t *log = handle->event_log;
+    FILE            *file;
+    int             count;
+
+    if (log == NULL) {
+        return -1;
+    }
+
+    if (path == NULL) {
+        file = stdout;
+    } else {
+        file = fopen(path, "a");
+        if (file == NULL) {
+            LOG_ERROR("Opening %s failed!\n", path);
+            return -1;
+        }
+    }
+
+#if defined(__LINUX__)
+    pthread_mutex_lock(&log->drain_lock);
+#endif
+
+    count = fps_drain_records(log, file);
+
+#if defined(__LINUX__)
+    pthread_mutex_unlock(&log->drain_lock);
+#endif
+
+    if (file != stdout) {
+        fclose(file);
+    }
+
+    return count;
+}
+
+int
+fps_start_event_log_drain(fps_handle_t *handle,
+                          char         *path,
+                          int          period_ms)
+{
+#if defined(__LINUX__)
+    fps_event_log_t *log = handle->event_log;
+
+    if ((log == NULL) || (log->draining == TRUE) || (period_ms <= 0)) {
+        return -1;
+    }
+
+    if (path == NULL) {
+        log->drain_file = stdout;
+    } else {
+        log->drain_file = fopen(path, "a");
+        if (log->drain_file == NULL) {
+            LOG_ERROR("Opening %s failed!\n", path);
+            return -1;
+        }
+    }
+
+    log->drain_period_ms = period_ms;
+    log->draining        = TRUE;
+
+    if (pthread_create(&log->drain_thread, NULL, fps_drain_thread, log) != 0) {
+        log->draining = FALSE;
+        if (log->drain_file != stdout) {
+            fclose(log->drain_file);
+        }
+        return -1;
+    }
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int
+fps_get_event_log_counters(fps_handle_t *handle,
+                           unsigned int *logged,
+                           unsigned int *lost)
+{
+    if (handle->event_log == NULL) {
+        return -1;
+    }
+
+    if (logged != NULL) {
+        *logged = handle->event_log->head;
+    }
+
+    if (lost != NULL) {
+        *lost = handle->event_log->lost;
+    }
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef __fps_event_log_h__
+#define __fps_event_log_h__
+
+
+#include "common.h"
+#include "debug.h"
+#include "fps.h"
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Event Log
+// -----------------------------------------------------------------------------
+// NOTE: LOG_EVENT() stands in for LOG_DETAIL() on hot paths. With the event
+//       log of the handle started, it only appends a fixed-size record of
+//       the handle clock time, the event and up to three integers to the
+//       ring; the text is made when the ring is drained. Without it, the text
+//       is printed right away as a detail message, as before. Times go into
+//       the integers in ns.
+//
+//       Appending is lock-free: a writer takes its slot with an atomic
+//       increment, so the stream capture thread may log on the same handle.
+//       When the ring is full the oldest records are overwritten, and the
+//       drain counts them as lost.
+//
+
+extern int debug_level;
+
+enum {
+    FPS_EV_REG_READ       = 1,  // addr, data
+    FPS_EV_REG_WRITE      = 2,  // addr, data
+    FPS_EV_WAIT_REVENTS   = 3,  // revents
+    FPS_EV_SPI_ALIVE      = 4,  // ns
+    FPS_EV_DETECT_CYCLE   = 5,  // ns
+    FPS_EV_WAIT_OVERSHOOT = 6,  // ns
+    FPS_EV_SCAN_STEP      = 7,  // scans, found
+    FPS_EV_STALE_WAKEUP   = 8,  // events
+};
+
+#define FPS_EV_ARGS (3)
+
+#define LOG_EVENT(_handle_, _event_, _a0_, _a1_, _a2_) \
+    do { \
+        if (((_handle_)->event_log != NULL) || (debug_level >= LOG_LEVEL_DETAIL)) { \
+            fps_log_event((_handle_), __FILE__, __LINE__, (_event_), (int) (_a0_), (int) (_a1_), (int) (_a2_)); \
+        } \
+    } while (0)
+
+// Microseconds to the integer nanoseconds of an event, saturated
+#define FPS_EV_NS(_us_) \
+    ((int) CONSTRAINT(2147483647.0, (_us_) * 1000.0, -2147483647.0))
+
+void fps_log_event(fps_handle_t *handle,
+                   char         *file,
+                   int          line,
+                   int          event,
+                   int          a0,
+                   int          a1,
+                   int          a2);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+
+#endif // __fps_event_log_h__
@@ -0,0 +1,168 @@
+#include <string.h>
+#include "common.h"
+#include "fps.h"
+#include "fps_control.h"
+#include "fps_perf.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Timed Calls
+//
+
+// Latency histogram bucket, see FPS_STATS_HISTOGRAM_SIZE
+static int
+fps_perf_bucket(double latency_us)
+{
+    unsigned int us;
+    int          bucket = 0;
+
+    if (latency_us >= (double) (1u << (FPS_STATS_HISTOGRAM_SIZE - 2))) {
+        return FPS_STATS_HISTOGRAM_SIZE - 1;
+    }
+
+    us = (latency_us > 0.0) ? ((unsigned int) latency_us) : 0;
+
+    while (us != 0) {
+        us >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+double
+fps_perf_begin(fps_handle_t *handle)
+{
+    if (handle->stats_enabled == FALSE) {
+        return -1.0;
+    }
+
+    return fps_get_clock_time_us(handle);
+}
+
+void
+fps_perf_end(fps_handle_t *handle,
+             int          api,
+             double       start_us,
+             int          status,
+             double       bytes)
+{
+    fps_api_stats_t *api_stats;
+    double          latency_us;
+
+    if ((handle->stats_enabled == FALSE) || (start_us < 0.0)) {
+        return;
+    }
+
+    api_stats  = &handle->stats.api[api];
+    latency_us = fps_get_clock_time_us(handle) - start_us;
+
+    api_stats->calls++;
+    api_stats->total_us += latency_us;
+    api_stats->max_us    = MAX(api_stats->max_us, latency_us);
+    api_stats->histogram[fps_perf_bucket(latency_us)]++;
+
+    if (status < 0) {
+        api_stats->errors++;
+    } else {
+        api_stats->bytes += bytes;
+    }
+}
+
+void
+fps_perf_count_wait(fps_handle_t *handle,
+                    double       sleep_us,
+                    int          status)
+{
+    if (handle->stats_enabled == FALSE) {
+        return;
+    }
+
+    if (sleep_us < 0) {
+        handle->stats.waits_forever++;
+    }
+
+    if (status > 0) {
+        handle->stats.waits_event++;
+    } else if (status == 0) {
+        handle->stats.waits_timeout++;
+    }
+}
+
+void
+fps_perf_count_mode(fps_handle_t *handle,
+                    int          mode_old,
+                    int          mode_new)
+{
+    if (handle->stats_enabled == FALSE) {
+        return;
+    }
+
+    handle->stats.mode_transitions++;
+
+    if ((mode_old >= 0) && (mode_old < FPS_SENSOR_MODES) &&
+        (mode_new >= 0) && (mode_new < FPS_SENSOR_MODES)) {
+        handle->stats.mode_matrix[mode_old][mode_new]++;
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Public Interface
+//
+
+int
+fps_enable_stats(fps_handle_t *handle,
+                 int          enable)
+{
+    handle->stats_enabled = (enable != FALSE);
+    return 0;
+}
+
+int
+fps_get_stats(fps_handle_t *handle,
+              fps_stats_t  *stats)
+{
+    if (stats == NULL) {
+        return -1;
+    }
+
+    memcpy(stats, &handle->stats, sizeof(fps_stats_t));
+    return 0;
+}
+
+int
+fps_reset_stats(fps_handle_t *handle)
+{
+    memset(&handle->stats, 0x00, sizeof(fps_stats_t));
+    return 0;
+}
+
+double
+fps_get_stats_percentile(fps_api_stats_t *api_stats,
+                         double          percent)
+{
+    unsigned int rank;
+    unsigned int count = 0;
+    int          i;
+
+    if ((api_stats == NULL) || (api_stats->calls == 0)) {
+        return 0.0;
+    }
+
+    // Nearest rank
+    rank = (unsigned int) ((percent / 100.0) * api_stats->calls + 0.5);
+    rank = CONSTRAINT(api_stats->calls, rank, 1);
+
+    for (i = 0; i < (FPS_STATS_HISTOGRAM_SIZE - 1); i++) {
+        count += api_stats->histogram[i];
+        if (count >= rank) {
+            return (double) (1u << i);
+        }
+    }
+
+    // Open-ended, so the largest call seen
+    return api_stats->max_us;
+}
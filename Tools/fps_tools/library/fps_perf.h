@@ -0,0 +1,51 @@
+#ifndef __fps_perf_h__
+#define __fps_perf_h__
+
+
+#include "common.h"
+#include "fps.h"
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Performance Counters
+// -----------------------------------------------------------------------------
+// NOTE: A timed call takes its start from fps_perf_begin(), which is -1.0
+//       when counting is off, and hands it to fps_perf_end() with its status:
+//
+//           start_us = fps_perf_begin(handle);
+//           status   = ...;
+//           fps_perf_end(handle, FPS_API_READ, start_us, status, length);
+//
+//       Counting is switched per handle, so fps_perf_end() does nothing for a
+//       call which was started while it was off.
+//
+
+double fps_perf_begin(fps_handle_t *handle);
+
+void fps_perf_end(fps_handle_t *handle,
+                  int          api,
+                  double       start_us,
+                  int          status,
+                  double       bytes);
+
+void fps_perf_count_wait(fps_handle_t *handle,
+                         double       sleep_us,
+                         int          status);
+
+void fps_perf_count_mode(fps_handle_t *handle,
+                         int          mode_old,
+                         int          mode_new);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+
+#endif // __fps_perf_h__
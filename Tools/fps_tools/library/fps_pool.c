@@ -0,0 +1,255 @@
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "debug.h"
+#include "fps.h"
+#include "fps_pool.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Pool Structure
+//
+
+typedef struct __fps_pool_class {
+    size_t       buffer_size;
+    int          capacity;
+    int          allocated;
+    int          available;
+    void         *buffers[MAX(FPS_POOL_FRAME_CAPACITY, FPS_POOL_MAP_CAPACITY)];
+    void         *free_list[MAX(FPS_POOL_FRAME_CAPACITY, FPS_POOL_MAP_CAPACITY)];
+    unsigned int in_use;
+    unsigned int high_water;
+    unsigned int misses;
+} fps_pool_class_t;
+
+struct __fps_pool {
+    fps_pool_class_t classes[2];
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Aligned Allocation
+// -----------------------------------------------------------------------------
+// NOTE: A small header just below the aligned buffer keeps the pointer returned
+//       by malloc() and the buffer type, so that any buffer can be released
+//       without knowing where it came from.
+//
+
+typedef struct __fps_pool_header {
+    void *block;
+    int  type;
+} fps_pool_header_t;
+
+static void*
+fps_aligned_alloc(size_t size,
+                  int    type)
+{
+    uint8_t           *block;
+    uint8_t           *buffer;
+    fps_pool_header_t *header;
+
+    block = (uint8_t *) malloc(size + FPS_POOL_ALIGNMENT + sizeof(fps_pool_header_t));
+    if (block == NULL) {
+        return NULL;
+    }
+
+    buffer = block + sizeof(fps_pool_header_t);
+    buffer = buffer + ((FPS_POOL_ALIGNMENT - ((size_t) buffer % FPS_POOL_ALIGNMENT)) % FPS_POOL_ALIGNMENT);
+
+    header        = ((fps_pool_header_t *) buffer) - 1;
+    header->block = block;
+    header->type  = type;
+
+    return buffer;
+}
+
+static void
+fps_aligned_free(void *buffer)
+{
+    if (buffer != NULL) {
+        free((((fps_pool_header_t *) buffer) - 1)->block);
+    }
+}
+
+static size_t
+fps_align_size(size_t size)
+{
+    return (size + FPS_POOL_ALIGNMENT - 1) / FPS_POOL_ALIGNMENT * FPS_POOL_ALIGNMENT;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Pool Create/Destroy
+//
+
+int
+fps_create_buffer_pool(fps_handle_t *handle)
+{
+    fps_pool_t *pool;
+    size_t     sensor_size;
+
+    pool = (fps_pool_t *) malloc(sizeof(fps_pool_t));
+    if (pool == NULL) {
+        return -1;
+    }
+
+    memset(pool, 0x00, sizeof(fps_pool_t));
+
+    sensor_size = (size_t) (handle->sensor_width * handle->sensor_height);
+
+    pool->classes[FPS_POOL_FRAME].buffer_size = fps_align_size(sensor_size + handle->latency);
+    pool->classes[FPS_POOL_FRAME].capacity    = FPS_POOL_FRAME_CAPACITY;
+
+    pool->classes[FPS_POOL_MAP].buffer_size   = fps_align_size(sensor_size * 8);
+    pool->classes[FPS_POOL_MAP].capacity      = FPS_POOL_MAP_CAPACITY;
+
+    handle->buffer_pool = pool;
+
+    return 0;
+}
+
+void
+fps_destroy_buffer_pool(fps_handle_t *handle)
+{
+    fps_pool_class_t *cls;
+    int              t;
+    int              i;
+
+    if (handle->buffer_pool == NULL) {
+        return;
+    }
+
+    for (t = 0; t < ARRAY_SIZE(handle->buffer_pool->classes); t++) {
+        cls = &handle->buffer_pool->classes[t];
+
+        if (cls->in_use != 0) {
+            LOG_WARN("%0u pool buffers (type %0d) are still in use!\n", cls->in_use, t);
+        }
+
+        for (i = 0; i < cls->allocated; i++) {
+            fps_aligned_free(cls->buffers[i]);
+        }
+    }
+
+    free(handle->buffer_pool);
+    handle->buffer_pool = NULL;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Buffer Acquire/Release
+//
+
+void*
+fps_acquire_buffer(fps_handle_t *handle,
+                   int          type)
+{
+    fps_pool_class_t *cls;
+    void             *buffer;
+
+    if ((handle->buffer_pool == NULL) ||
+        ((type != FPS_POOL_FRAME) && (type != FPS_POOL_MAP))) {
+        return NULL;
+    }
+
+    cls = &handle->buffer_pool->classes[type];
+
+    if (cls->available > 0) {
+        buffer = cls->free_list[--cls->available];
+    } else {
+        buffer = fps_aligned_alloc(cls->buffer_size, type);
+        if (buffer == NULL) {
+            LOG_ERROR("Allocating pool buffer failed!\n");
+            return NULL;
+        }
+
+        if (cls->allocated < cls->capacity) {
+            cls->buffers[cls->allocated++] = buffer;
+        } else {
+            cls->misses++;
+        }
+    }
+
+    cls->in_use++;
+    cls->high_water = MAX(cls->high_water, cls->in_use);
+
+    return buffer;
+}
+
+void
+fps_release_buffer(fps_handle_t *handle,
+                   void         *buffer)
+{
+    fps_pool_class_t *cls;
+    int              i;
+
+    if ((buffer == NULL) || (handle->buffer_pool == NULL)) {
+        return;
+    }
+
+    cls = &handle->buffer_pool->classes[(((fps_pool_header_t *) buffer) - 1)->type];
+    cls->in_use--;
+
+    for (i = 0; i < cls->allocated; i++) {
+        if (cls->buffers[i] == buffer) {
+            cls->free_list[cls->available++] = buffer;
+            return;
+        }
+    }
+
+    // Not kept by the pool, i.e. a miss
+    fps_aligned_free(buffer);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Pool Information
+//
+
+int
+fps_get_buffer_size(fps_handle_t *handle,
+                    int          type)
+{
+    if ((handle->buffer_pool == NULL) ||
+        ((type != FPS_POOL_FRAME) && (type != FPS_POOL_MAP))) {
+        return 0;
+    }
+
+    return (int) handle->buffer_pool->classes[type].buffer_size;
+}
+
+int
+fps_get_pool_counters(fps_handle_t *handle,
+                      int          type,
+                      unsigned int *allocated,
+                      unsigned int *high_water,
+                      unsigned int *misses)
+{
+    fps_pool_class_t *cls;
+
+    if ((handle->buffer_pool == NULL) ||
+        ((type != FPS_POOL_FRAME) && (type != FPS_POOL_MAP))) {
+        return -1;
+    }
+
+    cls = &handle->buffer_pool->classes[type];
+
+    if (allocated != NULL) {
+        *allocated = (unsigned int) cls->allocated;
+    }
+
+    if (high_water != NULL) {
+        *high_water = cls->high_water;
+    }
+
+    if (misses != NULL) {
+        *misses = cls->misses;
+    }
+
+    return 0;
+}
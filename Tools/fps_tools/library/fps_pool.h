@@ -0,0 +1,63 @@
+#ifndef __fps_pool_h__
+#define __fps_pool_h__
+
+
+#include "common.h"
+#include "fps.h"
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Buffer Pool
+// -----------------------------------------------------------------------------
+// NOTE: Every handle owns a pool of sensor-sized buffers aligned to a cache
+//       line. There are two kinds of buffers:
+//         FPS_POOL_FRAME - sensor_size + latency bytes, for raw and 8-bit images
+//         FPS_POOL_MAP   - sensor_size 8-byte elements, for per-pixel sums and
+//                          maps (double, uint64_t or anything narrower)
+//
+//       Buffers are allocated the first time they are needed and kept until
+//       the handle is detached, so repeated captures do not touch the heap.
+//       At most FPS_POOL_FRAME_CAPACITY / FPS_POOL_MAP_CAPACITY buffers are
+//       kept. An acquire beyond that is a miss: it is served by a temporary
+//       allocation which is freed again on release.
+//
+//       The pool is not thread safe. Only the thread which owns the handle
+//       may acquire and release buffers.
+//
+
+#define FPS_POOL_ALIGNMENT      (64)
+#define FPS_POOL_FRAME_CAPACITY (6)
+#define FPS_POOL_MAP_CAPACITY   (8)
+
+int fps_create_buffer_pool(fps_handle_t *handle);
+
+void fps_destroy_buffer_pool(fps_handle_t *handle);
+
+void* fps_acquire_buffer(fps_handle_t *handle,
+                         int          type);
+
+void fps_release_buffer(fps_handle_t *handle,
+                        void         *buffer);
+
+int fps_get_buffer_size(fps_handle_t *handle,
+                        int          type);
+
+int fps_get_pool_counters(fps_handle_t *handle,
+                          int          type,
+                          unsigned int *allocated,
+                          unsigned int *high_water,
+                          unsigned int *misses);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+
+#endif // __fps_pool_h__
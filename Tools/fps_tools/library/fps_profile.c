@@ -0,0 +1,290 @@
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "debug.h"
+#include "fps.h"
+#include "fps_control.h"
+
+#if defined(__WINDOWS__)
+    #include <windows.h>
+#elif defined(__LINUX__)
+    #include <pthread.h>
+#endif
+
+
+#if defined(__WINDOWS__)
+    typedef DWORD fps_thread_id_t;
+    #define FPS_THREAD_SELF()           GetCurrentThreadId()
+    #define FPS_THREAD_EQUAL(_a_, _b_)  ((_a_) == (_b_))
+#else
+    typedef pthread_t fps_thread_id_t;
+    #define FPS_THREAD_SELF()           pthread_self()
+    #define FPS_THREAD_EQUAL(_a_, _b_)  pthread_equal((_a_), (_b_))
+#endif
+
+// Sub-buckets per power of two, see FPS_PROFILE_HISTOGRAM_SIZE
+#define FPS_PROFILE_SUB_BITS    (3)
+#define FPS_PROFILE_SUB_BUCKETS (1 << FPS_PROFILE_SUB_BITS)
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Profile State
+// -----------------------------------------------------------------------------
+// NOTE: The stack holds the open regions of the profiled thread. An entry of
+//       a region which was not kept, i.e. beyond the depth or the table,
+//       has region -1, so that its fps_end_region() still pops it.
+//
+
+typedef struct __fps_profile_frame {
+    int        region;
+    const char *name;
+    double     start_ns;
+} fps_profile_frame_t;
+
+static int                 fps_profile_enabled = FALSE;
+static fps_thread_id_t     fps_profile_thread;
+static fps_profile_t       fps_profile;
+static fps_profile_frame_t fps_profile_stack[FPS_PROFILE_DEPTH];
+static int                 fps_profile_depth = 0;
+static int                 fps_profile_skipped = 0;    // open beyond the stack
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Regions
+//
+
+// Bucket 0 .. 7 count 0 .. 7 ns, then 8 buckets per power of two
+static int
+fps_profile_bucket(double duration_ns)
+{
+    double mantissa;
+    int    exponent;
+    int    bucket;
+
+    if (duration_ns < FPS_PROFILE_SUB_BUCKETS) {
+        return (duration_ns > 0.0) ? ((int) duration_ns) : 0;
+    }
+
+    // duration_ns = mantissa * 2^exponent, mantissa in [0.5, 1)
+    mantissa = frexp(duration_ns, &exponent);
+
+    bucket = (exponent - FPS_PROFILE_SUB_BITS) * FPS_PROFILE_SUB_BUCKETS +
+             (int) ((mantissa * 2.0 - 1.0) * FPS_PROFILE_SUB_BUCKETS);
+
+    return MIN(bucket, FPS_PROFILE_HISTOGRAM_SIZE - 1);
+}
+
+// Upper edge of a bucket in ns
+static double
+fps_profile_bucket_edge(int bucket)
+{
+    int exponent;
+    int sub;
+
+    if (bucket < FPS_PROFILE_SUB_BUCKETS) {
+        return (double) (bucket + 1);
+    }
+
+    exponent = bucket / FPS_PROFILE_SUB_BUCKETS + FPS_PROFILE_SUB_BITS - 1;
+    sub      = bucket % FPS_PROFILE_SUB_BUCKETS;
+
+    return ldexp(1.0 + ((double) (sub + 1)) / FPS_PROFILE_SUB_BUCKETS, exponent);
+}
+
+static int
+fps_profile_find_region(const char *name,
+                        int        parent)
+{
+    fps_profile_region_t *region;
+    int                  i;
+
+    for (i = 0; i < fps_profile.regions; i++) {
+        region = &fps_profile.region[i];
+        if ((region->parent == parent) &&
+            ((region->name == name) || (strcmp(region->name, name) == 0))) {
+            return i;
+        }
+    }
+
+    if (fps_profile.regions >= FPS_PROFILE_REGIONS) {
+        return -1;
+    }
+
+    region = &fps_profile.region[fps_profile.regions];
+
+    region->name   = name;
+    region->parent = parent;
+    region->depth  = fps_profile_depth;
+
+    return fps_profile.regions++;
+}
+
+static int
+fps_profile_is_timed(void)
+{
+    return ((fps_profile_enabled == TRUE) &&
+            FPS_THREAD_EQUAL(fps_profile_thread, FPS_THREAD_SELF()));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Public Interface
+//
+
+int
+fps_enable_profile(int enable)
+{
+    // Regions left open are dropped, whichever thread opened them
+    fps_profile_depth   = 0;
+    fps_profile_skipped = 0;
+
+    fps_profile_thread  = FPS_THREAD_SELF();
+    fps_profile_enabled = (enable != FALSE);
+
+    return 0;
+}
+
+int
+fps_reset_profile(void)
+{
+    if ((fps_profile_enabled == TRUE) && (fps_profile_depth > 0)) {
+        LOG_ERROR("Profile reset with %0d open regions!\n", fps_profile_depth);
+        return -1;
+    }
+
+    memset(&fps_profile, 0x00, sizeof(fps_profile_t));
+    return 0;
+}
+
+int
+fps_begin_region(const char *name)
+{
+    fps_profile_frame_t *frame;
+    int                 parent;
+
+    if (fps_profile_is_timed() == FALSE) {
+        return 0;
+    }
+
+    if (fps_profile_depth >= FPS_PROFILE_DEPTH) {
+        fps_profile_skipped++;
+        fps_profile.dropped++;
+        return 0;
+    }
+
+    frame = &fps_profile_stack[fps_profile_depth];
+
+    frame->name   = name;
+    frame->region = -1;
+
+    // Children of a region which was not kept are not kept either
+    if (fps_profile_depth == 0) {
+        frame->region = fps_profile_find_region(name, -1);
+    } else {
+        parent = fps_profile_stack[fps_profile_depth - 1].region;
+        if (parent >= 0) {
+            frame->region = fps_profile_find_region(name, parent);
+        }
+    }
+
+    fps_profile_depth++;
+
+    if (frame->region < 0) {
+        fps_profile.dropped++;
+    }
+
+    // Last, so that the bookkeeping above is not timed
+    frame->start_ns = fps_get_raw_time_ns();
+
+    return 0;
+}
+
+int
+fps_end_region(const char *name)
+{
+    double               end_ns;
+    double               duration_ns;
+    fps_profile_frame_t  *frame;
+    fps_profile_region_t *region;
+
+    // First, so that the bookkeeping below is not timed
+    end_ns = fps_get_raw_time_ns();
+
+    if (fps_profile_is_timed() == FALSE) {
+        return 0;
+    }
+
+    if (fps_profile_skipped > 0) {
+        fps_profile_skipped--;
+        return 0;
+    }
+
+    if (fps_profile_depth == 0) {
+        return 0;   // opened before profiling was switched on
+    }
+
+    frame = &fps_profile_stack[--fps_profile_depth];
+
+    if ((frame->name != name) && (strcmp(frame->name, name) != 0)) {
+        LOG_ERROR("Region '%s' ended while '%s' is open!\n", name, frame->name);
+        return -1;
+    }
+
+    if (frame->region < 0) {
+        return 0;
+    }
+
+    region      = &fps_profile.region[frame->region];
+    duration_ns = end_ns - frame->start_ns;
+
+    if ((region->count == 0) || (duration_ns < region->min_ns)) {
+        region->min_ns = duration_ns;
+    }
+
+    region->count++;
+    region->total_ns += duration_ns;
+    region->max_ns    = MAX(region->max_ns, duration_ns);
+    region->histogram[fps_profile_bucket(duration_ns)]++;
+
+    return 0;
+}
+
+int
+fps_get_profile(fps_profile_t *profile)
+{
+    if (profile == NULL) {
+        return -1;
+    }
+
+    memcpy(profile, &fps_profile, sizeof(fps_profile_t));
+    return 0;
+}
+
+double
+fps_get_profile_percentile(fps_profile_region_t *region,
+                           double               percent)
+{
+    unsigned int rank;
+    unsigned int count = 0;
+    int          i;
+
+    if ((region == NULL) || (region->count == 0)) {
+        return 0.0;
+    }
+
+    // Nearest rank
+    rank = (unsigned int) ((percent / 100.0) * region->count + 0.5);
+    rank = CONSTRAINT(region->count, rank, 1);
+
+    for (i = 0; i < FPS_PROFILE_HISTOGRAM_SIZE; i++) {
+        count += region->histogram[i];
+        if (count >= rank) {
+            return CONSTRAINT(region->max_ns, fps_profile_bucket_edge(i), region->min_ns);
+        }
+    }
+
+    return region->max_ns;
+}
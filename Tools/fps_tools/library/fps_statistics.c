@@ -0,0 +1,536 @@
+#include <math.h>
+#include "common.h"
+#include "fps_statistics.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Fixed-Point Helpers
+//
+
+static uint64_t
+fps_round_divide(uint64_t numerator,
+                 uint64_t denominator)
+{
+    return (numerator + (denominator / 2)) / denominator;
+}
+
+// Return numerator / denominator in Q24.8, rounded to the nearest 1/256
+fps_fixed_t
+fps_fixed_divide(uint64_t numerator,
+                 uint64_t denominator)
+{
+    uint64_t quotient;
+    uint64_t remainder;
+
+    quotient  = numerator / denominator;
+    remainder = numerator % denominator;
+
+    return (fps_fixed_t) ((quotient << FPS_FIXED_SHIFT) +
+                          fps_round_divide((remainder << FPS_FIXED_SHIFT), denominator));
+}
+
+// Square root of a Q.16 value, returned in Q24.8 (rounded)
+fps_fixed_t
+fps_fixed_sqrt(uint64_t value)
+{
+    uint64_t remainder = value;
+    uint64_t result    = 0;
+    uint64_t bit       = ((uint64_t) 1) << 62;
+
+    while (bit > remainder) {
+        bit >>= 2;
+    }
+
+    while (bit != 0) {
+        if (remainder >= (result + bit)) {
+            remainder -= result + bit;
+            result     = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    // Round up when value is closer to (result + 1)^2 than to result^2
+    if (remainder > result) {
+        result++;
+    }
+
+    return (fps_fixed_t) result;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Frame Accumulation
+//
+
+void
+fps_accumulate_frame_double(uint8_t *frame,
+                            size_t  img_size,
+                            double  *pix_sum,
+                            double  *sqr_sum)
+{
+    double pix_val;
+    size_t i;
+
+    for (i = 0; i < img_size; i++) {
+        pix_val     = (double) frame[i];
+        pix_sum[i] += pix_val;
+        sqr_sum[i] += SQUARE(pix_val);
+    }
+}
+
+void
+fps_accumulate_frame_fixed(uint8_t  *frame,
+                           size_t   img_size,
+                           uint32_t *pix_sum,
+                           uint64_t *sqr_sum)
+{
+    uint32_t pix_val;
+    size_t   i;
+
+    for (i = 0; i < img_size; i++) {
+        pix_val     = (uint32_t) frame[i];
+        pix_sum[i] += pix_val;
+        sqr_sum[i] += (uint64_t) SQUARE(pix_val);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Averaged Image Statistics
+//
+
+void
+fps_reduce_frames_double(double  *pix_sum,
+                         double  *sqr_sum,
+                         int     frames,
+                         size_t  img_size,
+                         uint8_t *img_buf,
+                         double  *img_avg,
+                         double  *img_var,
+                         double  *img_noise)
+{
+    double pix_val;
+    double pix_var;
+    double avg_sum;
+    double avg_sqr;
+    double noise_sum;
+    double pix_avg;
+    size_t i;
+
+    avg_sum   = 0.0;
+    avg_sqr   = 0.0;
+    noise_sum = 0.0;
+
+    for (i = 0; i < img_size; i++) {
+        pix_val = pix_sum[i] / frames;
+        pix_var = (sqr_sum[i] / frames) - SQUARE(pix_val);
+
+        avg_sum   += pix_val;
+        avg_sqr   += SQUARE(pix_val);
+        noise_sum += pix_var;
+
+        img_buf[i] = (uint8_t) (pix_val + 0.5);
+    }
+
+    pix_avg = avg_sum / img_size;
+
+    if (img_avg != NULL) {
+        *img_avg = pix_avg;
+    }
+
+    if (img_var != NULL) {
+        *img_var = (avg_sqr / img_size) - SQUARE(pix_avg);
+    }
+
+    if (img_noise != NULL) {
+        *img_noise = noise_sum / img_size;
+    }
+}
+
+void
+fps_reduce_frames_fixed(uint32_t    *pix_sum,
+                        uint64_t    *sqr_sum,
+                        int         frames,
+                        size_t      img_size,
+                        uint8_t     *img_buf,
+                        fps_fixed_t *img_avg,
+                        fps_fixed_t *img_var,
+                        fps_fixed_t *img_noise)
+{
+    uint64_t frms;
+    uint64_t pixs;
+    uint64_t sum;
+    uint64_t tot_sum;
+    uint64_t tot_sqr;
+    uint64_t tot_var;
+    size_t   i;
+
+    frms = (uint64_t) frames;
+    pixs = (uint64_t) img_size;
+
+    tot_sum = 0;
+    tot_sqr = 0;
+    tot_var = 0;
+
+    // Every quantity below is scaled by frames (or frames^2) to stay exact
+    for (i = 0; i < img_size; i++) {
+        sum = (uint64_t) pix_sum[i];
+
+        tot_sum += sum;
+        tot_sqr += SQUARE(sum);
+        tot_var += (frms * sqr_sum[i]) - SQUARE(sum);
+
+        img_buf[i] = (uint8_t) (((sum * 2) + frms) / (frms * 2));
+    }
+
+    if (img_avg != NULL) {
+        *img_avg = fps_fixed_divide(tot_sum, (pixs * frms));
+    }
+
+    if (img_var != NULL) {
+        *img_var = fps_fixed_divide(((pixs * tot_sqr) - SQUARE(tot_sum)),
+                                    (SQUARE(pixs) * SQUARE(frms)));
+    }
+
+    if (img_noise != NULL) {
+        *img_noise = fps_fixed_divide(tot_var, (pixs * SQUARE(frms)));
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Per-Pixel Maps
+//
+
+void
+fps_pixel_map_double(double *pix_sum,
+                     double *sqr_sum,
+                     int    frames,
+                     size_t img_size,
+                     double *avg_img,
+                     double *noise_img)
+{
+    size_t i;
+
+    for (i = 0; i < img_size; i++) {
+        avg_img[i]   = pix_sum[i] / frames;
+        noise_img[i] = sqrt((sqr_sum[i] / frames) - SQUARE(avg_img[i]));
+    }
+}
+
+void
+fps_pixel_map_fixed(uint32_t    *pix_sum,
+                    uint64_t    *sqr_sum,
+                    int         frames,
+                    size_t      img_size,
+                    fps_fixed_t *avg_img,
+                    fps_fixed_t *noise_img)
+{
+    uint64_t frms;
+    uint64_t sum;
+    uint64_t var;
+    size_t   i;
+
+    frms = (uint64_t) frames;
+
+    for (i = 0; i < img_size; i++) {
+        sum = (uint64_t) pix_sum[i];
+        var = (frms * sqr_sum[i]) - SQUARE(sum);
+
+        avg_img[i]   = fps_fixed_divide(sum, frms);
+        noise_img[i] = fps_fixed_sqrt(fps_round_divide((var << (FPS_FIXED_SHIFT * 2)),
+                                                       SQUARE(frms)));
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Window Statistics
+//
+
+void
+fps_window_stats_double(double *avg_img,
+                        double *noise_img,
+                        int    img_width,
+                        int    col_begin,
+                        int    row_begin,
+                        int    win_width,
+                        int    win_height,
+                        double *win_avg,
+                        double *win_var,
+                        double *win_noise)
+{
+    double win_size;
+    double pix_val;
+    double pix_sum;
+    double sqr_sum;
+    double noise_sum;
+    int    c;
+    int    r;
+
+    win_size = (double) (win_width * win_height);
+
+    pix_sum   = 0.0;
+    sqr_sum   = 0.0;
+    noise_sum = 0.0;
+
+    for (r = row_begin; r < (row_begin + win_height); r++) {
+    for (c = col_begin; c < (col_begin + win_width ); c++) {
+        pix_val    = avg_img[r * img_width + c];
+        pix_sum   += pix_val;
+        sqr_sum   += SQUARE(pix_val);
+        noise_sum += noise_img[r * img_width + c];
+    }}
+
+    *win_avg   = pix_sum / win_size;
+    *win_var   = (sqr_sum / win_size) - SQUARE(*win_avg);
+    *win_noise = noise_sum / win_size;
+}
+
+void
+fps_window_stats_fixed(uint32_t    *pix_sum,
+                       fps_fixed_t *noise_img,
+                       int         frames,
+                       int         img_width,
+                       int         col_begin,
+                       int         row_begin,
+                       int         win_width,
+                       int         win_height,
+                       fps_fixed_t *win_avg,
+                       fps_fixed_t *win_var,
+                       fps_fixed_t *win_noise)
+{
+    uint64_t frms;
+    uint64_t win_size;
+    uint64_t sum;
+    uint64_t tot_sum;
+    uint64_t tot_sqr;
+    uint64_t noise_sum;
+    int      c;
+    int      r;
+
+    frms     = (uint64_t) frames;
+    win_size = (uint64_t) (win_width * win_height);
+
+    tot_sum   = 0;
+    tot_sqr   = 0;
+    noise_sum = 0;
+
+    // Use the exact per-pixel sums so that average and variance only round once
+    for (r = row_begin; r < (row_begin + win_height); r++) {
+    for (c = col_begin; c < (col_begin + win_width ); c++) {
+        sum        = (uint64_t) pix_sum[r * img_width + c];
+        tot_sum   += sum;
+        tot_sqr   += SQUARE(sum);
+        noise_sum += (uint64_t) noise_img[r * img_width + c];
+    }}
+
+    *win_avg   = fps_fixed_divide(tot_sum, (win_size * frms));
+    *win_var   = fps_fixed_divide(((win_size * tot_sqr) - SQUARE(tot_sum)),
+                                  (SQUARE(win_size) * SQUARE(frms)));
+    *win_noise = (fps_fixed_t) fps_round_divide(noise_sum, win_size);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Summed-Area Tables
+//
+
+void
+fps_build_sum_tables_fixed(uint32_t *pix_sum,
+                           int      img_width,
+                           int      img_height,
+                           uint64_t *sum_table,
+                           uint64_t *sqr_table)
+{
+    uint64_t sum;
+    uint64_t row_sum;
+    uint64_t row_sqr;
+    int      c;
+    int      r;
+    int      i;
+
+    for (r = 0; r < img_height; r++) {
+        row_sum = 0;
+        row_sqr = 0;
+
+        for (c = 0; c < img_width; c++) {
+            i   = r * img_width + c;
+            sum = (uint64_t) pix_sum[i];
+
+            row_sum += sum;
+            row_sqr += SQUARE(sum);
+
+            sum_table[i] = row_sum + ((r > 0) ? sum_table[i - img_width] : 0);
+            sqr_table[i] = row_sqr + ((r > 0) ? sqr_table[i - img_width] : 0);
+        }
+    }
+}
+
+void
+fps_build_sum_tables_double(double   *pix_sum,
+                            int      img_width,
+                            int      img_height,
+                            uint64_t *sum_table,
+                            uint64_t *sqr_table)
+{
+    uint64_t sum;
+    uint64_t row_sum;
+    uint64_t row_sqr;
+    int      c;
+    int      r;
+    int      i;
+
+    // Pixel sums are sums of 8-bit values, so they convert to integers exactly
+    for (r = 0; r < img_height; r++) {
+        row_sum = 0;
+        row_sqr = 0;
+
+        for (c = 0; c < img_width; c++) {
+            i   = r * img_width + c;
+            sum = (uint64_t) pix_sum[i];
+
+            row_sum += sum;
+            row_sqr += SQUARE(sum);
+
+            sum_table[i] = row_sum + ((r > 0) ? sum_table[i - img_width] : 0);
+            sqr_table[i] = row_sqr + ((r > 0) ? sqr_table[i - img_width] : 0);
+        }
+    }
+}
+
+void
+fps_build_noise_table_fixed(fps_fixed_t *noise_img,
+                            int         img_width,
+                            int         img_height,
+                            uint64_t    *noise_table)
+{
+    uint64_t row_sum;
+    int      c;
+    int      r;
+    int      i;
+
+    for (r = 0; r < img_height; r++) {
+        row_sum = 0;
+
+        for (c = 0; c < img_width; c++) {
+            i        = r * img_width + c;
+            row_sum += (uint64_t) noise_img[i];
+
+            noise_table[i] = row_sum + ((r > 0) ? noise_table[i - img_width] : 0);
+        }
+    }
+}
+
+void
+fps_build_noise_table_double(double *noise_img,
+                             int    img_width,
+                             int    img_height,
+                             double *noise_table)
+{
+    double row_sum;
+    int    c;
+    int    r;
+    int    i;
+
+    for (r = 0; r < img_height; r++) {
+        row_sum = 0.0;
+
+        for (c = 0; c < img_width; c++) {
+            i        = r * img_width + c;
+            row_sum += noise_img[i];
+
+            noise_table[i] = row_sum + ((r > 0) ? noise_table[i - img_width] : 0.0);
+        }
+    }
+}
+
+// Sum of the window from a table, with four lookups at most
+#define FPS_TABLE_WINDOW_SUM(_t_, _w_, _c_, _r_, _ww_, _wh_, _out_) \
+    do { \
+        int _c1_ = (_c_) + (_ww_) - 1; \
+        int _r1_ = (_r_) + (_wh_) - 1; \
+        (_out_) = (_t_)[_r1_ * (_w_) + _c1_]; \
+        if ((_r_) > 0) { \
+            (_out_) -= (_t_)[((_r_) - 1) * (_w_) + _c1_]; \
+        } \
+        if ((_c_) > 0) { \
+            (_out_) -= (_t_)[_r1_ * (_w_) + ((_c_) - 1)]; \
+        } \
+        if (((_r_) > 0) && ((_c_) > 0)) { \
+            (_out_) += (_t_)[((_r_) - 1) * (_w_) + ((_c_) - 1)]; \
+        } \
+    } while (0)
+
+void
+fps_window_stats_table_fixed(uint64_t    *sum_table,
+                             uint64_t    *sqr_table,
+                             uint64_t    *noise_table,
+                             int         frames,
+                             int         img_width,
+                             int         col_begin,
+                             int         row_begin,
+                             int         win_width,
+                             int         win_height,
+                             fps_fixed_t *win_avg,
+                             fps_fixed_t *win_var,
+                             fps_fixed_t *win_noise)
+{
+    uint64_t frms;
+    uint64_t win_size;
+    uint64_t tot_sum;
+    uint64_t tot_sqr;
+    uint64_t noise_sum;
+
+    frms     = (uint64_t) frames;
+    win_size = (uint64_t) (win_width * win_height);
+
+    // Tables are exact, so results are identical to fps_window_stats_fixed()
+    FPS_TABLE_WINDOW_SUM(sum_table,   img_width, col_begin, row_begin, win_width, win_height, tot_sum);
+    FPS_TABLE_WINDOW_SUM(sqr_table,   img_width, col_begin, row_begin, win_width, win_height, tot_sqr);
+    FPS_TABLE_WINDOW_SUM(noise_table, img_width, col_begin, row_begin, win_width, win_height, noise_sum);
+
+    *win_avg   = fps_fixed_divide(tot_sum, (win_size * frms));
+    *win_var   = fps_fixed_divide(((win_size * tot_sqr) - SQUARE(tot_sum)),
+                                  (SQUARE(win_size) * SQUARE(frms)));
+    *win_noise = (fps_fixed_t) fps_round_divide(noise_sum, win_size);
+}
+
+void
+fps_window_stats_table_double(uint64_t *sum_table,
+                              uint64_t *sqr_table,
+                              double   *noise_table,
+                              int      frames,
+                              int      img_width,
+                              int      col_begin,
+                              int      row_begin,
+                              int      win_width,
+                              int      win_height,
+                              double   *win_avg,
+                              double   *win_var,
+                              double   *win_noise)
+{
+    double   win_size;
+    uint64_t tot_sum;
+    uint64_t tot_sqr;
+    double   noise_sum;
+
+    win_size = (double) (win_width * win_height);
+
+    FPS_TABLE_WINDOW_SUM(sum_table,   img_width, col_begin, row_begin, win_width, win_height, tot_sum);
+    FPS_TABLE_WINDOW_SUM(sqr_table,   img_width, col_begin, row_begin, win_width, win_height, tot_sqr);
+    FPS_TABLE_WINDOW_SUM(noise_table, img_width, col_begin, row_begin, win_width, win_height, noise_sum);
+
+    // VC6 only converts signed __int64 to double, and window sums fit in it
+    *win_avg   = ((double) (int64_t) tot_sum) / frames / win_size;
+    *win_var   = (((double) (int64_t) tot_sqr) / SQUARE((double) frames) / win_size) - SQUARE(*win_avg);
+    *win_noise = noise_sum / win_size;
+}
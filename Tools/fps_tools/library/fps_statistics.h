@@ -0,0 +1,204 @@
+#ifndef __fps_statistics_h__
+#define __fps_statistics_h__
+
+
+#include <stddef.h>
+#include "common.h"
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Fixed-Point Format
+// -----------------------------------------------------------------------------
+// NOTE: Fixed-point results are unsigned Q24.8 numbers. Sums are kept exact in
+//       integers (uint32_t for pixel sums, uint64_t for sums of squares) and
+//       only the final division is rounded, so averages and variances are
+//       within 1/512 of the double path. Noises take a rounded square root
+//       per pixel before averaging and are within 1/256. FPS_FIXED_TOLERANCE
+//       is the bound callers may rely on for all of them.
+//
+
+typedef uint32_t fps_fixed_t;
+
+#define FPS_FIXED_SHIFT     (8)
+#define FPS_FIXED_ONE       (1 << FPS_FIXED_SHIFT)
+#define FPS_FIXED_TOLERANCE (2.0 / FPS_FIXED_ONE)
+
+#define FPS_FIXED_TO_DOUBLE(_x_) (((double) (_x_)) / FPS_FIXED_ONE)
+
+fps_fixed_t fps_fixed_divide(uint64_t numerator,
+                             uint64_t denominator);
+
+fps_fixed_t fps_fixed_sqrt(uint64_t value);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Frame Accumulation
+//
+
+void fps_accumulate_frame_double(uint8_t *frame,
+                                 size_t  img_size,
+                                 double  *pix_sum,
+                                 double  *sqr_sum);
+
+void fps_accumulate_frame_fixed(uint8_t  *frame,
+                                size_t   img_size,
+                                uint32_t *pix_sum,
+                                uint64_t *sqr_sum);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Averaged Image Statistics
+// -----------------------------------------------------------------------------
+// NOTE: Per-pixel noise here is the temporal variance of each pixel, and the
+//       image noise is its mean over the image.
+//
+
+void fps_reduce_frames_double(double  *pix_sum,
+                              double  *sqr_sum,
+                              int     frames,
+                              size_t  img_size,
+                              uint8_t *img_buf,
+                              double  *img_avg,
+                              double  *img_var,
+                              double  *img_noise);
+
+void fps_reduce_frames_fixed(uint32_t    *pix_sum,
+                             uint64_t    *sqr_sum,
+                             int         frames,
+                             size_t      img_size,
+                             uint8_t     *img_buf,
+                             fps_fixed_t *img_avg,
+                             fps_fixed_t *img_var,
+                             fps_fixed_t *img_noise);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Per-Pixel Maps
+// -----------------------------------------------------------------------------
+// NOTE: Per-pixel noise here is the temporal standard deviation of each pixel.
+//
+
+void fps_pixel_map_double(double *pix_sum,
+                          double *sqr_sum,
+                          int    frames,
+                          size_t img_size,
+                          double *avg_img,
+                          double *noise_img);
+
+void fps_pixel_map_fixed(uint32_t    *pix_sum,
+                         uint64_t    *sqr_sum,
+                         int         frames,
+                         size_t      img_size,
+                         fps_fixed_t *avg_img,
+                         fps_fixed_t *noise_img);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Window Statistics
+//
+
+void fps_window_stats_double(double *avg_img,
+                             double *noise_img,
+                             int    img_width,
+                             int    col_begin,
+                             int    row_begin,
+                             int    win_width,
+                             int    win_height,
+                             double *win_avg,
+                             double *win_var,
+                             double *win_noise);
+
+void fps_window_stats_fixed(uint32_t    *pix_sum,
+                            fps_fixed_t *noise_img,
+                            int         frames,
+                            int         img_width,
+                            int         col_begin,
+                            int         row_begin,
+                            int         win_width,
+                            int         win_height,
+                            fps_fixed_t *win_avg,
+                            fps_fixed_t *win_var,
+                            fps_fixed_t *win_noise);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Summed-Area Tables
+// -----------------------------------------------------------------------------
+// NOTE: Each table entry holds the sum over the rectangle from (0,0) to that
+//       pixel, so any window sum takes four lookups. Tables have the same
+//       size as the image (no padding row/column) and fit in a pool map.
+//
+//       Sum tables are built from per-pixel frame sums and are exact in both
+//       modes. The fixed noise table is exact too, so the fixed window stats
+//       are identical to fps_window_stats_fixed(). The double noise table
+//       accumulates rounding errors of a few ulps of the table total.
+//
+
+#define FPS_TABLE_NOISE_TOLERANCE (1.0e-6)
+
+void fps_build_sum_tables_fixed(uint32_t *pix_sum,
+                                int      img_width,
+                                int      img_height,
+                                uint64_t *sum_table,
+                                uint64_t *sqr_table);
+
+void fps_build_sum_tables_double(double   *pix_sum,
+                                 int      img_width,
+                                 int      img_height,
+                                 uint64_t *sum_table,
+                                 uint64_t *sqr_table);
+
+void fps_build_noise_table_fixed(fps_fixed_t *noise_img,
+                                 int         img_width,
+                                 int         img_height,
+                                 uint64_t    *noise_table);
+
+void fps_build_noise_table_double(double *noise_img,
+                                  int    img_width,
+                                  int    img_height,
+                                  double *noise_table);
+
+void fps_window_stats_table_fixed(uint64_t    *sum_table,
+                                  uint64_t    *sqr_table,
+                                  uint64_t    *noise_table,
+                                  int         frames,
+                                  int         img_width,
+                                  int         col_begin,
+                                  int         row_begin,
+                                  int         win_width,
+                                  int         win_height,
+                                  fps_fixed_t *win_avg,
+                                  fps_fixed_t *win_var,
+                                  fps_fixed_t *win_noise);
+
+void fps_window_stats_table_double(uint64_t *sum_table,
+                                   uint64_t *sqr_table,
+                                   double   *noise_table,
+                                   int      frames,
+                                   int      img_width,
+                                   int      col_begin,
+                                   int      row_begin,
+                                   int      win_width,
+                                   int      win_height,
+                                   double   *win_avg,
+                                   double   *win_var,
+                                   double   *win_noise);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+
+#endif // __fps_statistics_h__
@@ -0,0 +1,409 @@
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "debug.h"
+#include "fps.h"
+#include "fps_register.h"
+#include "fps_control.h"
+#include "fps_stream.h"
+
+#if defined(__LINUX__)
+    #include <pthread.h>
+#endif
+
+
+#if defined(__LINUX__)
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Stream Structure
+// -----------------------------------------------------------------------------
+// NOTE: The ring holds ring_size queued frames plus two spare slots, one being
+//       filled by the capture thread and one being copied out by the consumer.
+//       Frames change hands by swapping slot pointers under the lock, so the
+//       SPI readout and the copy to the caller never hold it.
+//
+
+struct __fps_stream {
+    fps_handle_t    *handle;
+    int             img_width;
+    int             img_height;
+    size_t          frame_size;
+    int             ring_size;
+    int             policy;
+
+    uint8_t         *frame_buf;
+    uint8_t         **ring;
+    uint8_t         *capture_slot;
+    uint8_t         *consume_slot;
+    int             head;
+    int             count;
+
+    int             running;
+    int             status;
+    unsigned int    captured;
+    unsigned int    delivered;
+    unsigned int    dropped;
+
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Capture Thread
+//
+
+static void*
+fps_stream_capture(void *arg)
+{
+    fps_stream_t *stream = (fps_stream_t *) arg;
+    int          status;
+    int          tail;
+    uint8_t      *slot;
+
+    pthread_mutex_lock(&stream->lock);
+
+    while (stream->running) {
+
+        // Back-pressure: wait for the consumer to free a slot
+        while ((stream->running) &&
+               (stream->policy == FPS_STREAM_BLOCK) &&
+               (stream->count == stream->ring_size)) {
+            pthread_cond_wait(&stream->not_full, &stream->lock);
+        }
+
+        if (!stream->running) {
+            break;
+        }
+
+        pthread_mutex_unlock(&stream->lock);
+
+        // Not counted in handle->stats, which belongs to the consumer
+        status = fps_read_raw_image(stream->handle,
+                                    stream->img_width,
+                                    stream->img_height,
+                                    stream->capture_slot);
+
+        pthread_mutex_lock(&stream->lock);
+
+        if (status < 0) {
+            LOG_ERROR("Capturing stream frame failed! status = %0d\n", status);
+            stream->status  = status;
+            stream->running = FALSE;
+            break;
+        }
+
+        stream->captured++;
+
+        if (stream->count == stream->ring_size) {
+            if (stream->policy == FPS_STREAM_DROP_NEWEST) {
+                stream->dropped++;
+                continue;
+            }
+
+            // FPS_STREAM_DROP_OLDEST
+            stream->head = (stream->head + 1) % stream->ring_size;
+            stream->count--;
+            stream->dropped++;
+        }
+
+        tail                 = (stream->head + stream->count) % stream->ring_size;
+        slot                 = stream->ring[tail];
+        stream->ring[tail]   = stream->capture_slot;
+        stream->capture_slot = slot;
+        stream->count++;
+
+        pthread_cond_signal(&stream->not_empty);
+    }
+
+    // Wake up a consumer waiting on a stream which will never be filled again
+    pthread_cond_broadcast(&stream->not_empty);
+    pthread_mutex_unlock(&stream->lock);
+
+    return NULL;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Stream Open/Close
+//
+
+fps_stream_t*
+fps_stream_open(fps_handle_t *handle,
+                int          img_width,
+                int          img_height,
+                int          ring_size,
+                int          policy)
+{
+    fps_stream_t *stream = NULL;
+    int          i;
+
+    if ((handle == NULL) || (img_width <= 0) || (img_height <= 0) || (ring_size <= 0)) {
+        return NULL;
+    }
+
+    if ((policy != FPS_STREAM_BLOCK      ) &&
+        (policy != FPS_STREAM_DROP_OLDEST) &&
+        (policy != FPS_STREAM_DROP_NEWEST)) {
+        return NULL;
+    }
+
+    stream = (fps_stream_t *) malloc(sizeof(fps_stream_t));
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    memset(stream, 0x00, sizeof(fps_stream_t));
+
+    stream->handle     = handle;
+    stream->img_width  = img_width;
+    stream->img_height = img_height;
+    stream->frame_size = (size_t) (img_width * img_height) + FPS_DUMMY_PIXELS;
+    stream->ring_size  = ring_size;
+    stream->policy     = policy;
+
+    // Allocate all frames in one block: queued frames plus the two spare slots
+    stream->frame_buf = (uint8_t *) malloc(stream->frame_size * (ring_size + 2));
+    if (stream->frame_buf == NULL) {
+        goto fps_stream_open_error;
+    }
+
+    stream->ring = (uint8_t **) malloc(sizeof(uint8_t *) * ring_size);
+    if (stream->ring == NULL) {
+        goto fps_stream_open_error;
+    }
+
+    for (i = 0; i < ring_size; i++) {
+        stream->ring[i] = &stream->frame_buf[stream->frame_size * i];
+    }
+
+    stream->capture_slot = &stream->frame_buf[stream->frame_size * (ring_size + 0)];
+    stream->consume_slot = &stream->frame_buf[stream->frame_size * (ring_size + 1)];
+
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->not_empty, NULL);
+    pthread_cond_init(&stream->not_full, NULL);
+
+    stream->running = TRUE;
+
+    if (pthread_create(&stream->thread, NULL, fps_stream_capture, stream) != 0) {
+        pthread_cond_destroy(&stream->not_full);
+        pthread_cond_destroy(&stream->not_empty);
+        pthread_mutex_destroy(&stream->lock);
+        goto fps_stream_open_error;
+    }
+
+    return stream;
+
+fps_stream_open_error :
+
+    if (stream->ring != NULL) {
+        free(stream->ring);
+    }
+
+    if (stream->frame_buf != NULL) {
+        free(stream->frame_buf);
+    }
+
+    free(stream);
+
+    return NULL;
+}
+
+int
+fps_stream_close(fps_stream_t **stream)
+{
+    int status;
+
+    if ((stream == NULL) || (*stream == NULL)) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&(*stream)->lock);
+    (*stream)->running = FALSE;
+    pthread_cond_broadcast(&(*stream)->not_full);
+    pthread_mutex_unlock(&(*stream)->lock);
+
+    // The capture thread finishes its current frame before exiting
+    pthread_join((*stream)->thread, NULL);
+
+    status = (*stream)->status;
+
+    pthread_cond_destroy(&(*stream)->not_full);
+    pthread_cond_destroy(&(*stream)->not_empty);
+    pthread_mutex_destroy(&(*stream)->lock);
+
+    free((*stream)->ring);
+    free((*stream)->frame_buf);
+    free(*stream);
+    *stream = NULL;
+
+    return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Stream Frames
+//
+
+int
+fps_stream_next(fps_stream_t *stream,
+                uint8_t      *img_buf)
+{
+    int     status = 0;
+    uint8_t *slot;
+
+    if ((stream == NULL) || (img_buf == NULL)) {
+        return status = -1;
+    }
+
+    pthread_mutex_lock(&stream->lock);
+
+    while ((stream->count == 0) && (stream->running)) {
+        pthread_cond_wait(&stream->not_empty, &stream->lock);
+    }
+
+    // Queued frames are still delivered after the capture thread has stopped
+    if (stream->count == 0) {
+        status = (stream->status < 0) ? stream->status : -1;
+        pthread_mutex_unlock(&stream->lock);
+        return status;
+    }
+
+    slot                          = stream->ring[stream->head];
+    stream->ring[stream->head]    = stream->consume_slot;
+    stream->consume_slot          = slot;
+    stream->head                  = (stream->head + 1) % stream->ring_size;
+    stream->count--;
+    stream->delivered++;
+
+    pthread_cond_signal(&stream->not_full);
+    pthread_mutex_unlock(&stream->lock);
+
+    // Only the consumer touches consume_slot, so copy it outside the lock
+    memcpy(img_buf, slot, stream->frame_size);
+
+    return status;
+}
+
+int
+fps_get_stream_counters(fps_stream_t *stream,
+                        unsigned int *captured,
+                        unsigned int *delivered,
+                        unsigned int *dropped)
+{
+    if (stream == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&stream->lock);
+
+    if (captured != NULL) {
+        *captured = stream->captured;
+    }
+
+    if (delivered != NULL) {
+        *delivered = stream->delivered;
+    }
+
+    if (dropped != NULL) {
+        *dropped = stream->dropped;
+    }
+
+    pthread_mutex_unlock(&stream->lock);
+
+    return 0;
+}
+
+int
+fps_stream_frame_source(fps_handle_t *handle,
+                        void         *context,
+                        int          img_width,
+                        int          img_height,
+                        uint8_t      *img_buf)
+{
+    fps_stream_t *stream = (fps_stream_t *) context;
+
+    if ((stream == NULL) ||
+        (stream->handle     != handle    ) ||
+        (stream->img_width  != img_width ) ||
+        (stream->img_height != img_height)) {
+        return -1;
+    }
+
+    return fps_stream_next(stream, img_buf);
+}
+
+#else // !__LINUX__
+
+fps_stream_t*
+fps_stream_open(fps_handle_t *handle,
+                int          img_width,
+                int          img_height,
+                int          ring_size,
+                int          policy)
+{
+    DUMMY_VAR(handle);
+    DUMMY_VAR(img_width);
+    DUMMY_VAR(img_height);
+    DUMMY_VAR(ring_size);
+    DUMMY_VAR(policy);
+
+    return NULL;
+}
+
+int
+fps_stream_close(fps_stream_t **stream)
+{
+    DUMMY_VAR(stream);
+
+    return -1;
+}
+
+int
+fps_stream_next(fps_stream_t *stream,
+                uint8_t      *img_buf)
+{
+    DUMMY_VAR(stream);
+    DUMMY_VAR(img_buf);
+
+    return -1;
+}
+
+int
+fps_get_stream_counters(fps_stream_t *stream,
+                        unsigned int *captured,
+                        unsigned int *delivered,
+                        unsigned int *dropped)
+{
+    DUMMY_VAR(stream);
+    DUMMY_VAR(captured);
+    DUMMY_VAR(delivered);
+    DUMMY_VAR(dropped);
+
+    return -1;
+}
+
+int
+fps_stream_frame_source(fps_handle_t *handle,
+                        void         *context,
+                        int          img_width,
+                        int          img_height,
+                        uint8_t      *img_buf)
+{
+    DUMMY_VAR(handle);
+    DUMMY_VAR(context);
+    DUMMY_VAR(img_width);
+    DUMMY_VAR(img_height);
+    DUMMY_VAR(img_buf);
+
+    return -1;
+}
+
+#endif // __LINUX__
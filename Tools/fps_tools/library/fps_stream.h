@@ -0,0 +1,75 @@
+#ifndef __fps_stream_h__
+#define __fps_stream_h__
+
+
+#include "common.h"
+#include "fps.h"
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Image Stream
+// -----------------------------------------------------------------------------
+// NOTE: A stream owns a capture thread which keeps reading raw images
+//       into a ring of preallocated frames, so that the caller can process
+//       frame k while frame k+1 is being read out. Frames keep the raw layout
+//       (FPS_DUMMY_PIXELS dummy pixels followed by the image).
+//
+//       When the ring is full the policy decides what happens:
+//         FPS_STREAM_BLOCK       - capture waits until a frame is consumed
+//         FPS_STREAM_DROP_OLDEST - the oldest queued frame is discarded
+//         FPS_STREAM_DROP_NEWEST - the frame just captured is discarded
+//
+//       While the stream is open the capture thread owns the sensor: it
+//       reads frames through the backend with fps_read_raw_image(), which
+//       touches only the backend state and the (lock-free) event log.
+//       Until fps_stream_close() the consumer must not call anything that
+//       reaches the sensor, i.e. register access, mode switches, raw images,
+//       event waits or clock sleeps. It may use the rest of the handle:
+//         - fps_get_averaged_image_from() and fps_get_finger_image_from()
+//           with fps_stream_frame_source(), and the buffer pool they use
+//         - clock reads, the background image and the statistics mode
+//         - the performance counters, fps_get_stats() and fps_reset_stats()
+//       Frames read by the capture thread are not counted as
+//       FPS_API_RAW_IMAGE calls, see fps_get_stream_counters() instead.
+//
+// NOTE: Platform specific. Streams are only available on Linux (pthread), and
+//       fps_stream_open() returns NULL elsewhere.
+//
+
+fps_stream_t* fps_stream_open(fps_handle_t *handle,
+                              int          img_width,
+                              int          img_height,
+                              int          ring_size,
+                              int          policy);
+
+int fps_stream_close(fps_stream_t **stream);
+
+// Copy the oldest queued frame to img_buf, blocking until one is available
+int fps_stream_next(fps_stream_t *stream,
+                    uint8_t      *img_buf);
+
+// Frame source for fps_get_averaged_image_from() with context = stream
+int fps_stream_frame_source(fps_handle_t *handle,
+                            void         *context,
+                            int          img_width,
+                            int          img_height,
+                            uint8_t      *img_buf);
+
+int fps_get_stream_counters(fps_stream_t *stream,
+                            unsigned int *captured,
+                            unsigned int *delivered,
+                            unsigned int *dropped);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+
+#endif // __fps_stream_h__
@@ -83,6 +83,30 @@ LIB32=link.exe -lib
 # Begin Group "library"
 
 # PROP Default_Filter ""
+# Begin Group "recorder"
+
+# PROP Default_Filter ""
+# Begin Source File
+
+SOURCE=.\recorder\fps_recorder.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\recorder\fps_recorder.h
+# End Source File
+# End Group
+# Begin Group "simulator"
+
+# PROP Default_Filter ""
+# Begin Source File
+
+SOURCE=.\simulator\fps_simulator.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\simulator\fps_simulator.h
+# End Source File
+# End Group
 # Begin Group "windows"
 
 # PROP Default_Filter ""
@@ -185,6 +209,14 @@ SOURCE=.\f747b_register.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\fps_cal_cache.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\fps_cal_cache.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\fps_calibration.c
 # End Source File
 # Begin Source File
@@ -201,8 +233,60 @@ SOURCE=.\fps_control.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\fps_dataset.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\fps_dataset.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\fps_event_log.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\fps_event_log.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\fps_perf.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\fps_perf.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\fps_profile.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\fps_pool.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\fps_pool.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\fps_register.h
 # End Source File
+# Begin Source File
+
+SOURCE=.\fps_statistics.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\fps_statistics.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\fps_stream.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\fps_stream.h
+# End Source File
 # End Group
 # Begin Group "include"
 
@@ -1,14 +1,21 @@
+// ppoll() is a GNU extension
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <linux/types.h>
 #include "debug.h"
 #include "fps_control.h"
 #include "fps_control_linux.h"
+#include "fps_event_log.h"
 
 
 // Record how many devices are opened
@@ -33,17 +40,15 @@ fps_open_sensor(char *file)
     return fps_attach_sensor(fd);
 }
 
-int
-fps_close_sensor(fps_handle_t **handle)
+static void
+fps_linux_close(fps_handle_t *handle)
 {
-    close((*handle)->fd);
-
-    return fps_detach_sensor(handle);
+    close(handle->fd);
 }
 
-int
-fps_reset_sensor(fps_handle_t *handle,
-                 int          state)
+static int
+fps_linux_reset_sensor(fps_handle_t *handle,
+                       int          state)
 {
     int status = 0;
 
@@ -66,9 +71,9 @@ fps_reset_sensor(fps_handle_t *handle,
 // Set Sensor Speed
 //
 
-int
-fps_set_sensor_speed(fps_handle_t *handle,
-                     int          speed_hz)
+static int
+fps_linux_set_sensor_speed(fps_handle_t *handle,
+                           int          speed_hz)
 {
     int status = 0;
 
@@ -91,9 +96,9 @@ fps_set_sensor_speed(fps_handle_t *handle,
 // Chip ID
 //
 
-int
-fps_get_chip_id(fps_handle_t *handle,
-                int          *chip_id)
+static int
+fps_linux_get_chip_id(fps_handle_t *handle,
+                      int          *chip_id)
 {
     int     status = 0;
     uint8_t rx[2];
@@ -124,11 +129,11 @@ fps_get_chip_id(fps_handle_t *handle,
 // Register Access
 //
 
-int
-fps_multiple_read(fps_handle_t *handle,
-                  uint8_t      *addr,
-                  uint8_t      *data,
-                  size_t       length)
+static int
+fps_linux_multiple_read(fps_handle_t *handle,
+                        uint8_t      *addr,
+                        uint8_t      *data,
+                        size_t       length)
 {
     int      status = 0;
     uint8_t *tx;
@@ -138,13 +143,13 @@ fps_multiple_read(fps_handle_t *handle,
     tx = (uint8_t *) malloc(length);
     if (tx == NULL) {
         LOG_ERROR("malloc() failed!\n");
-        goto fps_multiple_read_end;
+        goto fps_linux_multiple_read_end;
     }
 
     rx = (uint8_t *) malloc(length);
     if (rx == NULL) {
         LOG_ERROR("malloc() failed!\n");
-        goto fps_multiple_read_end;
+        goto fps_linux_multiple_read_end;
     }
 
     for (i = 0; i < length; i++) {
@@ -162,15 +167,15 @@ fps_multiple_read(fps_handle_t *handle,
     status = ioctl(handle->fd, FPS_IOC_MESSAGE(1), &tr);
     if (status < 0) {
         LOG_ERROR("Calling ioctl() failed! status = %0d\n", status);
-        goto fps_multiple_read_end;
+        goto fps_linux_multiple_read_end;
     }
 
     for (i = 0; i < length; i++) {
         data[i] = rx[i];
-        LOG_DETAIL("addr = 0x%02X, data = 0x%02X\n", addr[i], data[i]);
+        LOG_EVENT(handle, FPS_EV_REG_READ, addr[i], data[i], 0);
     }
 
-fps_multiple_read_end :
+fps_linux_multiple_read_end :
 
     if (tx != NULL) {
         free(tx);
@@ -183,11 +188,11 @@ fps_multiple_read_end :
     return status;
 }
 
-int
-fps_multiple_write(fps_handle_t *handle,
-                   uint8_t      *addr,
-                   uint8_t      *data,
-                   size_t       length)
+static int
+fps_linux_multiple_write(fps_handle_t *handle,
+                         uint8_t      *addr,
+                         uint8_t      *data,
+                         size_t       length)
 {
     int      status = 0;
     uint8_t *tx;
@@ -196,7 +201,7 @@ fps_multiple_write(fps_handle_t *handle,
     tx = (uint8_t *) malloc(length * 2);
     if (tx == NULL) {
         LOG_ERROR("malloc() failed!\n");
-        goto fps_multiple_write_end;
+        goto fps_linux_multiple_write_end;
     }
 
     for (i = 0; i < length; i++) {
@@ -213,14 +218,14 @@ fps_multiple_write(fps_handle_t *handle,
     status = ioctl(handle->fd, FPS_IOC_MESSAGE(1), &tr);
     if (status < 0) {
         LOG_ERROR("Calling ioctl() failed! status = %0d\n", status);
-        goto fps_multiple_write_end;
+        goto fps_linux_multiple_write_end;
     }
 
     for (i = 0; i < length; i++) {
-        LOG_DETAIL("addr = 0x%02X, data = 0x%02X\n", addr[i], data[i]);
+        LOG_EVENT(handle, FPS_EV_REG_WRITE, addr[i], data[i], 0);
     }
 
-fps_multiple_write_end :
+fps_linux_multiple_write_end :
 
     if (tx != NULL) {
         free(tx);
@@ -235,11 +240,11 @@ fps_multiple_write_end :
 // Image Mode Operations
 //
 
-int
-fps_get_raw_image(fps_handle_t *handle,
-                  int          img_width,
-                  int          img_height,
-                  uint8_t      *img_buf)
+static int
+fps_linux_get_raw_image(fps_handle_t *handle,
+                        int          img_width,
+                        int          img_height,
+                        uint8_t      *img_buf)
 {
     int     status = 0;
     size_t  img_size;
@@ -275,26 +280,55 @@ fps_get_raw_image(fps_handle_t *handle,
 // Helpers
 //
 
-int
-fps_wait_event(fps_handle_t *handle,
-               double       sleep_us)
+static void
+fps_us_to_timespec(double          us,
+                   struct timespec *ts)
 {
-    int           status = 0;
-    int           timeout;
-    struct pollfd poll_fps;
+    ts->tv_sec  = (time_t) (us / 1000000.0);
+    ts->tv_nsec = (long) ((us - ((double) ts->tv_sec) * 1000000.0) * 1000.0 + 0.5);
+
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec  += 1;
+        ts->tv_nsec -= 1000000000L;
+    } else if (ts->tv_nsec < 0) {
+        ts->tv_nsec  = 0;
+    }
+}
 
-    timeout = (sleep_us < 0) ? -1 : (int) (sleep_us / 1000);
+static int
+fps_linux_wait_event(fps_handle_t *handle,
+                     double       sleep_us)
+{
+    int             status = 0;
+    double          deadline_us;
+    struct timespec timeout;
+    struct pollfd   poll_fps;
 
     poll_fps.fd      = handle->fd;
     poll_fps.events  = POLLIN;
     poll_fps.revents = 0;
 
-    status = poll(&poll_fps, 1, timeout);
-    if ((status < 0) && (errno != EINTR)) {
-        LOG_ERROR("Calling poll() failed! status = %0d\n", status);
+    deadline_us = fps_get_time_us() + sleep_us;
+
+    // Restart on signals with whatever is left until the deadline
+    do {
+        if (sleep_us < 0) {
+            status = ppoll(&poll_fps, 1, NULL, NULL);
+        } else {
+            fps_us_to_timespec(MAX(deadline_us - fps_get_time_us(), 0.0), &timeout);
+            status = ppoll(&poll_fps, 1, &timeout, NULL);
+        }
+    } while ((status < 0) && (errno == EINTR));
+
+    if (status < 0) {
+        LOG_ERROR("Calling ppoll() failed! status = %0d\n", status);
         return status;
     }
-    LOG_DETAIL("poll_fps.revents = %0d\n", poll_fps.revents);
+    LOG_EVENT(handle, FPS_EV_WAIT_REVENTS, poll_fps.revents, 0, 0);
+
+    if (status == 0) {
+        fps_record_wait_overshoot(handle, fps_get_time_us() - deadline_us);
+    }
 
     return poll_fps.revents;
 }
@@ -302,5 +336,75 @@ fps_wait_event(fps_handle_t *handle,
 void
 fps_sleep(double sleep_us)
 {
-    usleep((int) sleep_us);
+    fps_sleep_until(fps_get_time_us() + sleep_us);
+}
+
+void
+fps_sleep_until(double deadline_us)
+{
+    struct timespec deadline;
+
+    fps_us_to_timespec(deadline_us, &deadline);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+        // Absolute deadline, so simply sleep again
+    }
+}
+
+double
+fps_get_time_us(void)
+{
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
+        return 0.0;
+    }
+
+    return ((double) now.tv_sec) * 1000000.0 + ((double) now.tv_nsec) / 1000.0;
+}
+
+double
+fps_get_raw_time_ns(void)
+{
+    struct timespec now;
+
+#if defined(CLOCK_MONOTONIC_RAW)
+    if (clock_gettime(CLOCK_MONOTONIC_RAW, &now) < 0) {
+#else
+    if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
+#endif
+        return 0.0;
+    }
+
+    return ((double) now.tv_sec) * 1000000000.0 + ((double) now.tv_nsec);
+}
+
+double
+fps_get_cpu_time_us(void)
+{
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now) < 0) {
+        return 0.0;
+    }
+
+    return ((double) now.tv_sec) * 1000000.0 + ((double) now.tv_nsec) / 1000.0;
 }
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Native Backend
+//
+
+fps_backend_t fps_native_backend = {
+    "linux",
+    fps_linux_close,
+    fps_linux_reset_sensor,
+    fps_linux_set_sensor_speed,
+    fps_linux_get_chip_id,
+    fps_linux_multiple_read,
+    fps_linux_multiple_write,
+    fps_linux_get_raw_image,
+    fps_linux_wait_event,
+};
@@ -0,0 +1,799 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "debug.h"
+#include "fps.h"
+#include "fps_control.h"
+#include "fps_recorder.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Recorder/Replay Structures
+//
+
+typedef struct __fps_recorder {
+    fps_backend_t *backend;   // the recorded backend and its context
+    void          *context;
+    FILE          *fp;
+    double        origin_us;
+    int           failed;
+} fps_recorder_t;
+
+typedef struct __fps_replay {
+    FILE          *fp;
+    int           chip_id;
+    unsigned long record;
+    int           diverged;
+    uint8_t       *buf;
+    size_t        buf_size;
+} fps_replay_t;
+
+#define FPS_REC(_handle_)    ((fps_recorder_t *) (_handle_)->backend_context)
+#define FPS_REPLAY(_handle_) ((fps_replay_t *) (_handle_)->backend_context)
+
+static const char *fps_trace_op_names[] = {
+    "none", "reset", "speed", "chip ID", "read", "write", "image", "wait"
+};
+
+#define FPS_TRACE_OP_NAME(_op_) \
+    ((((_op_) > 0) && ((_op_) < ARRAY_SIZE(fps_trace_op_names))) ? fps_trace_op_names[_op_] : "unknown")
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Serialization
+//
+
+static void
+fps_trace_put_u32(uint8_t  *ptr,
+                  uint32_t value)
+{
+    ptr[0] = (uint8_t) ((value >>  0) & 0xFF);
+    ptr[1] = (uint8_t) ((value >>  8) & 0xFF);
+    ptr[2] = (uint8_t) ((value >> 16) & 0xFF);
+    ptr[3] = (uint8_t) ((value >> 24) & 0xFF);
+}
+
+static uint32_t
+fps_trace_get_u32(uint8_t *ptr)
+{
+    return (((uint32_t) ptr[0]) <<  0) |
+           (((uint32_t) ptr[1]) <<  8) |
+           (((uint32_t) ptr[2]) << 16) |
+           (((uint32_t) ptr[3]) << 24);
+}
+
+// Microseconds, saturated to 32 bits
+static uint32_t
+fps_trace_us(double us)
+{
+    if (us <= 0.0) {
+        return 0;
+    }
+
+    if (us >= 4294967295.0) {
+        return 0xFFFFFFFF;
+    }
+
+    return (uint32_t) (us + 0.5);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Recorder
+// -----------------------------------------------------------------------------
+// NOTE: The recorded backend runs with the handle switched back to it, so its
+//       methods find their own context in handle->backend_context.
+//
+
+static fps_recorder_t*
+fps_rec_enter(fps_handle_t *handle)
+{
+    fps_recorder_t *rec = FPS_REC(handle);
+
+    handle->backend         = rec->backend;
+    handle->backend_context = rec->context;
+
+    return rec;
+}
+
+static void
+fps_rec_leave(fps_handle_t   *handle,
+              fps_recorder_t *rec)
+{
+    rec->context            = handle->backend_context;
+    handle->backend         = &fps_record_backend;
+    handle->backend_context = rec;
+}
+
+static void
+fps_rec_write(fps_recorder_t *rec,
+              void           *buf,
+              size_t         size)
+{
+    if ((rec->failed == TRUE) || (size == 0)) {
+        return;
+    }
+
+    if (fwrite(buf, 1, size, rec->fp) != size) {
+        LOG_ERROR("Writing the trace failed, recording stopped!\n");
+        rec->failed = TRUE;
+    }
+}
+
+static void
+fps_rec_write_u32(fps_recorder_t *rec,
+                  uint32_t       value)
+{
+    uint8_t buf[4];
+
+    fps_trace_put_u32(buf, value);
+    fps_rec_write(rec, buf, sizeof(buf));
+}
+
+static void
+fps_rec_write_record(fps_recorder_t *rec,
+                     int            op,
+                     double         start_us,
+                     double         end_us,
+                     int            status)
+{
+    uint8_t buf[FPS_TRACE_RECORD_SIZE];
+
+    buf[0] = (uint8_t) op;
+    fps_trace_put_u32(&buf[1], fps_trace_us(start_us - rec->origin_us));
+    fps_trace_put_u32(&buf[5], fps_trace_us(end_us - start_us));
+    fps_trace_put_u32(&buf[9], (uint32_t) status);
+
+    fps_rec_write(rec, buf, sizeof(buf));
+}
+
+static void
+fps_rec_close(fps_handle_t *handle)
+{
+    fps_recorder_t *rec;
+
+    rec = fps_rec_enter(handle);
+
+    if (handle->backend->close_method != NULL) {
+        handle->backend->close_method(handle);
+    }
+
+    fclose(rec->fp);
+    free(rec);
+}
+
+static int
+fps_rec_reset_sensor(fps_handle_t *handle,
+                     int          state)
+{
+    int            status = -1;
+    fps_recorder_t *rec;
+    double         start_us;
+
+    rec      = fps_rec_enter(handle);
+    start_us = fps_get_clock_time_us(handle);
+
+    if (handle->backend->reset_sensor_method != NULL) {
+        status = handle->backend->reset_sensor_method(handle, state);
+    }
+
+    fps_rec_leave(handle, rec);
+
+    fps_rec_write_record(rec, FPS_TRACE_OP_RESET, start_us, fps_get_clock_time_us(handle), status);
+    fps_rec_write_u32(rec, (uint32_t) state);
+
+    return status;
+}
+
+static int
+fps_rec_set_sensor_speed(fps_handle_t *handle,
+                         int          speed_hz)
+{
+    int            status = -1;
+    fps_recorder_t *rec;
+    double         start_us;
+
+    rec      = fps_rec_enter(handle);
+    start_us = fps_get_clock_time_us(handle);
+
+    if (handle->backend->set_sensor_speed_method != NULL) {
+        status = handle->backend->set_sensor_speed_method(handle, speed_hz);
+    }
+
+    fps_rec_leave(handle, rec);
+
+    fps_rec_write_record(rec, FPS_TRACE_OP_SPEED, start_us, fps_get_clock_time_us(handle), status);
+    fps_rec_write_u32(rec, (uint32_t) speed_hz);
+
+    return status;
+}
+
+static int
+fps_rec_get_chip_id(fps_handle_t *handle,
+                    int          *chip_id)
+{
+    int            status = -1;
+    fps_recorder_t *rec;
+    double         start_us;
+
+    rec      = fps_rec_enter(handle);
+    start_us = fps_get_clock_time_us(handle);
+
+    if (handle->backend->get_chip_id_method != NULL) {
+        status = handle->backend->get_chip_id_method(handle, chip_id);
+    }
+
+    fps_rec_leave(handle, rec);
+
+    fps_rec_write_record(rec, FPS_TRACE_OP_CHIP_ID, start_us, fps_get_clock_time_us(handle), status);
+    fps_rec_write_u32(rec, (uint32_t) *chip_id);
+
+    return status;
+}
+
+static int
+fps_rec_multiple_read(fps_handle_t *handle,
+                      uint8_t      *addr,
+                      uint8_t      *data,
+                      size_t       length)
+{
+    int            status = -1;
+    fps_recorder_t *rec;
+    double         start_us;
+
+    rec      = fps_rec_enter(handle);
+    start_us = fps_get_clock_time_us(handle);
+
+    if (handle->backend->multiple_read_method != NULL) {
+        status = handle->backend->multiple_read_method(handle, addr, data, length);
+    }
+
+    fps_rec_leave(handle, rec);
+
+    fps_rec_write_record(rec, FPS_TRACE_OP_READ, start_us, fps_get_clock_time_us(handle), status);
+    fps_rec_write_u32(rec, (uint32_t) length);
+    fps_rec_write(rec, addr, length);
+    fps_rec_write(rec, data, length);
+
+    return status;
+}
+
+static int
+fps_rec_multiple_write(fps_handle_t *handle,
+                       uint8_t      *addr,
+                       uint8_t      *data,
+                       size_t       length)
+{
+    int            status = -1;
+    fps_recorder_t *rec;
+    double         start_us;
+
+    rec      = fps_rec_enter(handle);
+    start_us = fps_get_clock_time_us(handle);
+
+    if (handle->backend->multiple_write_method != NULL) {
+        status = handle->backend->multiple_write_method(handle, addr, data, length);
+    }
+
+    fps_rec_leave(handle, rec);
+
+    fps_rec_write_record(rec, FPS_TRACE_OP_WRITE, start_us, fps_get_clock_time_us(handle), status);
+    fps_rec_write_u32(rec, (uint32_t) length);
+    fps_rec_write(rec, addr, length);
+    fps_rec_write(rec, data, length);
+
+    return status;
+}
+
+static int
+fps_rec_get_raw_image(fps_handle_t *handle,
+                      int          img_width,
+                      int          img_height,
+                      uint8_t      *img_buf)
+{
+    int            status = -1;
+    fps_recorder_t *rec;
+    double         start_us;
+    size_t         size;
+
+    rec      = fps_rec_enter(handle);
+    start_us = fps_get_clock_time_us(handle);
+
+    if (handle->backend->get_raw_image_method != NULL) {
+        status = handle->backend->get_raw_image_method(handle, img_width, img_height, img_buf);
+    }
+
+    fps_rec_leave(handle, rec);
+
+    // Latency dummy pixels included
+    size = (size_t) (img_width * img_height + handle->latency);
+
+    fps_rec_write_record(rec, FPS_TRACE_OP_IMAGE, start_us, fps_get_clock_time_us(handle), status);
+    fps_rec_write_u32(rec, (uint32_t) img_width);
+    fps_rec_write_u32(rec, (uint32_t) img_height);
+    fps_rec_write_u32(rec, (uint32_t) size);
+    fps_rec_write(rec, img_buf, size);
+
+    return status;
+}
+
+static int
+fps_rec_wait_event(fps_handle_t *handle,
+                   double       sleep_us)
+{
+    int            status = -1;
+    fps_recorder_t *rec;
+    double         start_us;
+
+    rec      = fps_rec_enter(handle);
+    start_us = fps_get_clock_time_us(handle);
+
+    if (handle->backend->wait_event_method != NULL) {
+        status = handle->backend->wait_event_method(handle, sleep_us);
+    }
+
+    fps_rec_leave(handle, rec);
+
+    // The timeout, all ones for forever, is only kept for reading the trace
+    fps_rec_write_record(rec, FPS_TRACE_OP_WAIT, start_us, fps_get_clock_time_us(handle), status);
+    fps_rec_write_u32(rec, ((sleep_us < 0) ? 0xFFFFFFFF : fps_trace_us(sleep_us)));
+
+    return status;
+}
+
+fps_backend_t fps_record_backend = {
+    "recorder",
+    fps_rec_close,
+    fps_rec_reset_sensor,
+    fps_rec_set_sensor_speed,
+    fps_rec_get_chip_id,
+    fps_rec_multiple_read,
+    fps_rec_multiple_write,
+    fps_rec_get_raw_image,
+    fps_rec_wait_event,
+};
+
+int
+fps_start_recording(fps_handle_t *handle,
+                    char         *path)
+{
+    fps_recorder_t *rec;
+    uint8_t        header[12];
+
+    if (handle->backend == &fps_record_backend) {
+        LOG_ERROR("Already recording!\n");
+        return -1;
+    }
+
+    rec = (fps_recorder_t *) malloc(sizeof(fps_recorder_t));
+    if (rec == NULL) {
+        LOG_ERROR("malloc() failed!\n");
+        return -1;
+    }
+
+    memset(rec, 0x00, sizeof(fps_recorder_t));
+
+    rec->fp = fopen(path, "wb");
+    if (rec->fp == NULL) {
+        LOG_ERROR("Opening \"%s\" failed!\n", path);
+        free(rec);
+        return -1;
+    }
+
+    rec->backend   = handle->backend;
+    rec->context   = handle->backend_context;
+    rec->origin_us = fps_get_clock_time_us(handle);
+
+    fps_trace_put_u32(&header[0], FPS_TRACE_MAGIC);
+    fps_trace_put_u32(&header[4], FPS_TRACE_VERSION);
+    fps_trace_put_u32(&header[8], (uint32_t) handle->chip_id);
+
+    fps_rec_write(rec, header, sizeof(header));
+    if (rec->failed == TRUE) {
+        fclose(rec->fp);
+        free(rec);
+        return -1;
+    }
+
+    handle->backend         = &fps_record_backend;
+    handle->backend_context = rec;
+
+    return 0;
+}
+
+int
+fps_stop_recording(fps_handle_t *handle)
+{
+    fps_recorder_t *rec;
+    int            status = 0;
+
+    if (handle->backend != &fps_record_backend) {
+        return 0;
+    }
+
+    rec = fps_rec_enter(handle);
+
+    if ((fclose(rec->fp) != 0) || (rec->failed == TRUE)) {
+        LOG_ERROR("The trace is incomplete!\n");
+        status = -1;
+    }
+
+    free(rec);
+
+    return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Replay
+//
+
+static int
+fps_replay_read(fps_replay_t *replay,
+                void         *buf,
+                size_t       size)
+{
+    if (fread(buf, 1, size, replay->fp) != size) {
+        LOG_ERROR("The trace ended at record %lu!\n", replay->record);
+        replay->diverged = TRUE;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+fps_replay_read_u32(fps_replay_t *replay,
+                    uint32_t     *value)
+{
+    uint8_t buf[4];
+
+    if (fps_replay_read(replay, buf, sizeof(buf)) < 0) {
+        return -1;
+    }
+
+    *value = fps_trace_get_u32(buf);
+
+    return 0;
+}
+
+// Payload into replay->buf, which grows to fit
+static int
+fps_replay_read_payload(fps_replay_t *replay,
+                        size_t       size)
+{
+    uint8_t *buf;
+
+    if (size > replay->buf_size) {
+        buf = (uint8_t *) realloc(replay->buf, size);
+        if (buf == NULL) {
+            LOG_ERROR("realloc() failed!\n");
+            replay->diverged = TRUE;
+            return -1;
+        }
+
+        replay->buf      = buf;
+        replay->buf_size = size;
+    }
+
+    return fps_replay_read(replay, replay->buf, size);
+}
+
+// Header of the next record, which must be of the given op
+static int
+fps_replay_begin(fps_replay_t *replay,
+                 int          op,
+                 double       *duration_us,
+                 int          *status)
+{
+    uint8_t buf[FPS_TRACE_RECORD_SIZE];
+
+    if (replay->diverged == TRUE) {
+        return -1;
+    }
+
+    if (fps_replay_read(replay, buf, sizeof(buf)) < 0) {
+        return -1;
+    }
+
+    replay->record++;
+
+    if (buf[0] != op) {
+        LOG_ERROR("Replay diverged at record %lu: %s called, %s recorded!\n",
+                  replay->record, FPS_TRACE_OP_NAME(op), FPS_TRACE_OP_NAME(buf[0]));
+        replay->diverged = TRUE;
+        return -1;
+    }
+
+    *duration_us = (double) fps_trace_get_u32(&buf[5]);
+    *status      = (int) fps_trace_get_u32(&buf[9]);
+
+    return 0;
+}
+
+static int
+fps_replay_mismatch(fps_replay_t *replay,
+                    char         *what)
+{
+    LOG_ERROR("Replay diverged at record %lu: %s differs!\n", replay->record, what);
+    replay->diverged = TRUE;
+    return -1;
+}
+
+// The recorded call takes as long as it did, on the clock of the handle
+static int
+fps_replay_end(fps_handle_t *handle,
+               double       duration_us,
+               int          status)
+{
+    fps_clock_sleep(handle, duration_us);
+
+    return status;
+}
+
+static void
+fps_replay_close(fps_handle_t *handle)
+{
+    fps_replay_t *replay = FPS_REPLAY(handle);
+
+    fclose(replay->fp);
+    free(replay->buf);
+    free(replay);
+
+    handle->backend_context = NULL;
+}
+
+static int
+fps_replay_reset_sensor(fps_handle_t *handle,
+                        int          state)
+{
+    fps_replay_t *replay = FPS_REPLAY(handle);
+
+    double   duration_us;
+    int      status;
+    uint32_t value;
+
+    if ((fps_replay_begin(replay, FPS_TRACE_OP_RESET, &duration_us, &status) < 0) ||
+        (fps_replay_read_u32(replay, &value) < 0)) {
+        return -1;
+    }
+
+    if ((int) value != state) {
+        return fps_replay_mismatch(replay, "reset state");
+    }
+
+    return fps_replay_end(handle, duration_us, status);
+}
+
+static int
+fps_replay_set_sensor_speed(fps_handle_t *handle,
+                            int          speed_hz)
+{
+    fps_replay_t *replay = FPS_REPLAY(handle);
+
+    double   duration_us;
+    int      status;
+    uint32_t value;
+
+    if ((fps_replay_begin(replay, FPS_TRACE_OP_SPEED, &duration_us, &status) < 0) ||
+        (fps_replay_read_u32(replay, &value) < 0)) {
+        return -1;
+    }
+
+    if ((int) value != speed_hz) {
+        return fps_replay_mismatch(replay, "SPI speed");
+    }
+
+    return fps_replay_end(handle, duration_us, status);
+}
+
+static int
+fps_replay_get_chip_id(fps_handle_t *handle,
+                       int          *chip_id)
+{
+    fps_replay_t *replay = FPS_REPLAY(handle);
+
+    double   duration_us;
+    int      status;
+    uint32_t value;
+    int      c;
+
+    // Traces started on an attached handle have no chip ID read up front
+    c = fgetc(replay->fp);
+    if (c != EOF) {
+        ungetc(c, replay->fp);
+    }
+
+    if (c != FPS_TRACE_OP_CHIP_ID) {
+        *chip_id = replay->chip_id;
+        return 0;
+    }
+
+    if ((fps_replay_begin(replay, FPS_TRACE_OP_CHIP_ID, &duration_us, &status) < 0) ||
+        (fps_replay_read_u32(replay, &value) < 0)) {
+        return -1;
+    }
+
+    *chip_id = (int) value;
+
+    return fps_replay_end(handle, duration_us, status);
+}
+
+static int
+fps_replay_register_access(fps_handle_t *handle,
+                           int          op,
+                           uint8_t      *addr,
+                           uint8_t      *data,
+                           size_t       length)
+{
+    fps_replay_t *replay = FPS_REPLAY(handle);
+
+    double   duration_us;
+    int      status;
+    uint32_t value;
+
+    if ((fps_replay_begin(replay, op, &duration_us, &status) < 0) ||
+        (fps_replay_read_u32(replay, &value) < 0)) {
+        return -1;
+    }
+
+    if ((size_t) value != length) {
+        return fps_replay_mismatch(replay, "transfer length");
+    }
+
+    if (fps_replay_read_payload(replay, 2 * length) < 0) {
+        return -1;
+    }
+
+    if (memcmp(replay->buf, addr, length) != 0) {
+        return fps_replay_mismatch(replay, "register address");
+    }
+
+    if (op == FPS_TRACE_OP_READ) {
+        memcpy(data, &replay->buf[length], length);
+    } else if (memcmp(&replay->buf[length], data, length) != 0) {
+        return fps_replay_mismatch(replay, "register data");
+    }
+
+    return fps_replay_end(handle, duration_us, status);
+}
+
+static int
+fps_replay_multiple_read(fps_handle_t *handle,
+                         uint8_t      *addr,
+                         uint8_t      *data,
+                         size_t       length)
+{
+    return fps_replay_register_access(handle, FPS_TRACE_OP_READ, addr, data, length);
+}
+
+static int
+fps_replay_multiple_write(fps_handle_t *handle,
+                          uint8_t      *addr,
+                          uint8_t      *data,
+                          size_t       length)
+{
+    return fps_replay_register_access(handle, FPS_TRACE_OP_WRITE, addr, data, length);
+}
+
+static int
+fps_replay_get_raw_image(fps_handle_t *handle,
+                         int          img_width,
+                         int          img_height,
+                         uint8_t      *img_buf)
+{
+    fps_replay_t *replay = FPS_REPLAY(handle);
+
+    double   duration_us;
+    int      status;
+    uint32_t width;
+    uint32_t height;
+    uint32_t size;
+
+    if ((fps_replay_begin(replay, FPS_TRACE_OP_IMAGE, &duration_us, &status) < 0) ||
+        (fps_replay_read_u32(replay, &width)  < 0) ||
+        (fps_replay_read_u32(replay, &height) < 0) ||
+        (fps_replay_read_u32(replay, &size)   < 0)) {
+        return -1;
+    }
+
+    if (((int) width != img_width) || ((int) height != img_height) ||
+        ((int) size  != (img_width * img_height + handle->latency))) {
+        return fps_replay_mismatch(replay, "frame size");
+    }
+
+    if (fps_replay_read(replay, img_buf, size) < 0) {
+        return -1;
+    }
+
+    return fps_replay_end(handle, duration_us, status);
+}
+
+static int
+fps_replay_wait_event(fps_handle_t *handle,
+                      double       sleep_us)
+{
+    fps_replay_t *replay = FPS_REPLAY(handle);
+
+    double   duration_us;
+    int      status;
+    uint32_t value;
+
+    if ((fps_replay_begin(replay, FPS_TRACE_OP_WAIT, &duration_us, &status) < 0) ||
+        (fps_replay_read_u32(replay, &value) < 0)) {
+        return -1;
+    }
+
+    return fps_replay_end(handle, duration_us, status);
+}
+
+fps_backend_t fps_replay_backend = {
+    "replay",
+    fps_replay_close,
+    fps_replay_reset_sensor,
+    fps_replay_set_sensor_speed,
+    fps_replay_get_chip_id,
+    fps_replay_multiple_read,
+    fps_replay_multiple_write,
+    fps_replay_get_raw_image,
+    fps_replay_wait_event,
+};
+
+fps_handle_t*
+fps_open_replay(char *path,
+                int  clock)
+{
+    fps_replay_t *replay;
+    fps_handle_t *handle;
+    uint8_t      header[12];
+
+    replay = (fps_replay_t *) malloc(sizeof(fps_replay_t));
+    if (replay == NULL) {
+        LOG_ERROR("malloc() failed!\n");
+        return NULL;
+    }
+
+    memset(replay, 0x00, sizeof(fps_replay_t));
+
+    replay->fp = fopen(path, "rb");
+    if (replay->fp == NULL) {
+        LOG_ERROR("Opening \"%s\" failed!\n", path);
+        goto fps_open_replay_end;
+    }
+
+    if ((fread(header, 1, sizeof(header), replay->fp) != sizeof(header)) ||
+        (fps_trace_get_u32(&header[0]) != FPS_TRACE_MAGIC)) {
+        LOG_ERROR("\"%s\" is not a trace!\n", path);
+        goto fps_open_replay_end;
+    }
+
+    if (fps_trace_get_u32(&header[4]) != FPS_TRACE_VERSION) {
+        LOG_ERROR("Trace version %0u is not supported!\n", fps_trace_get_u32(&header[4]));
+        goto fps_open_replay_end;
+    }
+
+    replay->chip_id = (int) fps_trace_get_u32(&header[8]);
+
+    handle = fps_attach_backend(-1, &fps_replay_backend, replay);
+    if (handle != NULL) {
+        if (clock == FPS_REPLAY_FAST) {
+            (void) fps_set_clock(handle, &fps_virtual_clock);
+        }
+        return handle;
+    }
+
+fps_open_replay_end :
+
+    if (replay->fp != NULL) {
+        fclose(replay->fp);
+    }
+    free(replay->buf);
+    free(replay);
+
+    return NULL;
+}
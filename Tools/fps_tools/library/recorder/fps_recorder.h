@@ -0,0 +1,65 @@
+#ifndef __fps_recorder_h__
+#define __fps_recorder_h__
+
+
+#include "common.h"
+#include "fps.h"
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// I/O Trace Recording and Replay
+// -----------------------------------------------------------------------------
+// NOTE: The recorder wraps the backend of a handle and writes every backend
+//       call to a trace file: reset, speed, chip ID, register reads/writes
+//       with their addresses and values, frames, and waits with their
+//       outcome. Each record carries its start time from the beginning of the
+//       trace and its duration, in us.
+//
+//       The file is little-endian: a header of magic, version and chip ID,
+//       then the records until the end of the file.
+//
+//       The replay backend answers the same calls from a trace, in order.
+//       Reads, frames and waits return what was recorded. The addresses and
+//       data the caller passes in must match the trace; on the first mismatch
+//       the replay stops and every later call fails. The chip ID read by
+//       fps_attach_backend() comes from the header when the trace has none.
+//
+
+#define FPS_TRACE_MAGIC        (0x52535046) // "FPSR"
+#define FPS_TRACE_VERSION      (1)
+
+#define FPS_TRACE_OP_RESET     (1)
+#define FPS_TRACE_OP_SPEED     (2)
+#define FPS_TRACE_OP_CHIP_ID   (3)
+#define FPS_TRACE_OP_READ      (4)
+#define FPS_TRACE_OP_WRITE     (5)
+#define FPS_TRACE_OP_IMAGE     (6)
+#define FPS_TRACE_OP_WAIT      (7)
+
+// Op, start, duration and status
+#define FPS_TRACE_RECORD_SIZE  (1 + 4 + 4 + 4)
+
+extern fps_backend_t fps_record_backend;
+extern fps_backend_t fps_replay_backend;
+
+int fps_start_recording(fps_handle_t *handle,
+                        char         *path);
+
+int fps_stop_recording(fps_handle_t *handle);
+
+fps_handle_t* fps_open_replay(char *path,
+                              int  clock);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+
+#endif // __fps_recorder_h__
@@ -0,0 +1,524 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "debug.h"
+#include "fps.h"
+#include "fps_control.h"
+#include "f747b_register.h"
+#include "fps_simulator.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Simulator Structure
+//
+
+#define FPS_SIM_TWO_PI (6.283185307179586)
+
+typedef struct __fps_sim {
+    fps_sim_config_t config;
+    uint8_t          regs[256];
+    double           fpn[FPS_SENSOR_SIZE];
+    uint32_t         rng_state;
+    int              gauss_valid;
+    double           gauss_spare;
+    int              finger;
+    double           next_scan_us;
+} fps_sim_t;
+
+#define FPS_SIM(_handle_) ((fps_sim_t *) (_handle_)->backend_context)
+
+// Level of the interrupt pin, high while an enabled event is pending
+#define FPS_SIM_INTERRUPT(_sim_) \
+    (((_sim_)->regs[FPS_REG_INT_EVENT] & (_sim_)->regs[FPS_REG_INT_CTL]) != 0)
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Random Numbers
+// -----------------------------------------------------------------------------
+// NOTE: xorshift32 and Box-Muller, so that a seed gives the same frames on
+//       every platform.
+//
+
+static double
+fps_sim_uniform(fps_sim_t *sim)
+{
+    uint32_t x = sim->rng_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    sim->rng_state = x;
+
+    // (0, 1], never 0 so that log() below is defined
+    return (((double) x) + 1.0) / 4294967296.0;
+}
+
+static double
+fps_sim_gauss(fps_sim_t *sim)
+{
+    double r;
+    double t;
+
+    if (sim->gauss_valid == TRUE) {
+        sim->gauss_valid = FALSE;
+        return sim->gauss_spare;
+    }
+
+    r = sqrt(-2.0 * log(fps_sim_uniform(sim)));
+    t = FPS_SIM_TWO_PI * fps_sim_uniform(sim);
+
+    sim->gauss_spare = r * sin(t);
+    sim->gauss_valid = TRUE;
+
+    return r * cos(t);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Register File
+//
+
+static void
+fps_sim_reset_registers(fps_sim_t *sim)
+{
+    memset(sim->regs, 0x00, sizeof(sim->regs));
+
+    sim->regs[FPS_REG_IMG_ROW_END] = FPS_SENSOR_ROWS - 1;
+    sim->regs[FPS_REG_IMG_COL_END] = FPS_SENSOR_COLS - 1;
+    sim->regs[FPS_REG_DET_ROW_END] = FPS_SENSOR_ROWS - 1;
+    sim->regs[FPS_REG_DET_COL_END] = FPS_SENSOR_COLS - 1;
+    sim->regs[FPS_REG_V_DET_SEL]   = FPS_MAX_DETECT_TH;
+
+    sim->next_scan_us = 0.0;
+}
+
+static double
+fps_sim_scan_cycle_us(fps_sim_t *sim)
+{
+    int det_size;
+    int frames;
+
+    det_size = (sim->regs[FPS_REG_DET_ROW_END] - sim->regs[FPS_REG_DET_ROW_BEGIN] + 1) *
+               (sim->regs[FPS_REG_DET_COL_END] - sim->regs[FPS_REG_DET_COL_BEGIN] + 1);
+    frames   = (((int) sim->regs[FPS_REG_SUSP_WAIT_F_CYC_H]) << 8) |
+                ((int) sim->regs[FPS_REG_SUSP_WAIT_F_CYC_L]);
+
+    return (double) (MAX(det_size, 1) * (1 + frames) * 8) * sim->config.osc_period_us;
+}
+
+static void
+fps_sim_write_register(fps_handle_t *handle,
+                       uint8_t      addr,
+                       uint8_t      data)
+{
+    fps_sim_t *sim = FPS_SIM(handle);
+
+    uint8_t gbl_ctl;
+
+    // Dummy transfers between commands
+    if (addr == DUMMY_DATA) {
+        return;
+    }
+
+    gbl_ctl          = sim->regs[FPS_REG_GBL_CTL];
+    sim->regs[addr]  = data;
+
+    // Entering detect mode starts the first scan one cycle from now
+    if ((addr == FPS_REG_GBL_CTL) &&
+        ((gbl_ctl & FPS_ENABLE_DETECT) == 0) &&
+        ((data    & FPS_ENABLE_DETECT) != 0)) {
+        sim->next_scan_us = fps_get_clock_time_us(handle) + fps_sim_scan_cycle_us(sim);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Analog Front End
+//
+
+static double
+fps_sim_to_code(fps_sim_t *sim,
+                int       mode,
+                double    level_mv)
+{
+    int    base;
+    int    cds_offset;
+    double step_mv;
+    double gain;
+    double code;
+
+    base = (mode == FPS_DETECT_MODE) ? FPS_REG_DET_CDS_CTL_0 : FPS_REG_IMG_CDS_CTL_0;
+
+    // CDS_CTL_0, CDS_CTL_1, PGA0_CTL and PGA1_CTL are consecutive in both modes
+    cds_offset = (((int) (sim->regs[base + 0] & 0x80)) << 1) | ((int) sim->regs[base + 1]);
+
+    switch (sim->regs[FPS_REG_ANA_I_SET_0] & 0x03) {
+        case 0x00 : step_mv = 1.5; break;
+        case 0x01 : step_mv = 2.0; break;
+        case 0x02 : step_mv = 2.0; break;
+        default   : step_mv = 2.5; break;
+    }
+
+    gain = FPS_PGA_GAIN_0_SETTING_TO_VALUE(sim->regs[base + 2] & 0x0F) *
+           FPS_PGA_GAIN_1_SETTING_TO_VALUE(sim->regs[base + 3] & 0x0F);
+
+    code = (level_mv - (((double) cds_offset) * step_mv)) * gain * 256.0 / 3300.0;
+
+    return CONSTRAINT(255.0, code, 0.0);
+}
+
+static double
+fps_sim_pixel_mv(fps_sim_t *sim,
+                 int       row,
+                 int       col)
+{
+    double level_mv;
+
+    level_mv = sim->config.signal_mv;
+
+    if ((row >= 0) && (row < FPS_SENSOR_ROWS) &&
+        (col >= 0) && (col < FPS_SENSOR_COLS)) {
+        level_mv += sim->fpn[row * FPS_SENSOR_COLS + col];
+    }
+
+    if (sim->finger == TRUE) {
+        level_mv += sim->config.finger_mv;
+    }
+
+    return level_mv;
+}
+
+// A scan above the threshold latches the detect event
+static void
+fps_sim_detect_scan(fps_sim_t *sim)
+{
+    int    row_begin;
+    int    row_end;
+    int    col_begin;
+    int    col_end;
+    int    pixels;
+    double level_mv;
+    double level;
+    int    r;
+    int    c;
+
+    row_begin = sim->regs[FPS_REG_DET_ROW_BEGIN];
+    row_end   = sim->regs[FPS_REG_DET_ROW_END];
+    col_begin = sim->regs[FPS_REG_DET_COL_BEGIN];
+    col_end   = sim->regs[FPS_REG_DET_COL_END];
+
+    pixels   = 0;
+    level_mv = 0.0;
+
+    for (r = row_begin; r <= row_end; r++) {
+    for (c = col_begin; c <= col_end; c++) {
+        level_mv += fps_sim_pixel_mv(sim, r, c);
+        pixels++;
+    }}
+
+    if (pixels == 0) {
+        return;
+    }
+
+    level_mv = (level_mv / pixels) + (sim->config.detect_noise_mv * fps_sim_gauss(sim));
+    level    = fps_sim_to_code(sim, FPS_DETECT_MODE, level_mv) / 4.0;
+
+    if (level > (double) (sim->regs[FPS_REG_V_DET_SEL] & FPS_MAX_DETECT_TH)) {
+        sim->regs[FPS_REG_INT_EVENT] |= FPS_DETECT_EVENT;
+    }
+}
+
+// Run the scans due by now_us, returns the interrupt pin level
+static int
+fps_sim_catch_up(fps_sim_t *sim,
+                 double    now_us)
+{
+    double cycle_us;
+    int    scans;
+
+    if ((sim->regs[FPS_REG_GBL_CTL] & FPS_ENABLE_DETECT) != 0) {
+        cycle_us = fps_sim_scan_cycle_us(sim);
+
+        for (scans = 0; sim->next_scan_us <= now_us; scans++) {
+            if (scans == FPS_SIM_MAX_CATCHUP) {
+                sim->next_scan_us = now_us + cycle_us;
+                break;
+            }
+
+            fps_sim_detect_scan(sim);
+            sim->next_scan_us += cycle_us;
+        }
+    }
+
+    return FPS_SIM_INTERRUPT(sim) ? TRUE : FALSE;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Backend Methods
+//
+
+static void
+fps_sim_close(fps_handle_t *handle)
+{
+    free(FPS_SIM(handle));
+    handle->backend_context = NULL;
+}
+
+static int
+fps_sim_reset_sensor(fps_handle_t *handle,
+                     int          state)
+{
+    // Registers are held at their defaults while reset is asserted
+    if (state == 0) {
+        fps_sim_reset_registers(FPS_SIM(handle));
+    }
+
+    return 0;
+}
+
+static int
+fps_sim_set_sensor_speed(fps_handle_t *handle,
+                         int          speed_hz)
+{
+    return 0;
+}
+
+static int
+fps_sim_get_chip_id(fps_handle_t *handle,
+                    int          *chip_id)
+{
+    *chip_id = F747B_CHIP_ID;
+
+    return 0;
+}
+
+static int
+fps_sim_multiple_read(fps_handle_t *handle,
+                      uint8_t      *addr,
+                      uint8_t      *data,
+                      size_t       length)
+{
+    fps_sim_t *sim = FPS_SIM(handle);
+
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        data[i] = (addr[i] == DUMMY_DATA) ? DUMMY_DATA : sim->regs[addr[i]];
+    }
+
+    return 0;
+}
+
+static int
+fps_sim_multiple_write(fps_handle_t *handle,
+                       uint8_t      *addr,
+                       uint8_t      *data,
+                       size_t       length)
+{
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        fps_sim_write_register(handle, addr[i], data[i]);
+    }
+
+    return 0;
+}
+
+static int
+fps_sim_get_raw_image(fps_handle_t *handle,
+                      int          img_width,
+                      int          img_height,
+                      uint8_t      *img_buf)
+{
+    fps_sim_t *sim = FPS_SIM(handle);
+
+    int    row_begin;
+    int    col_begin;
+    double level_mv;
+    double code;
+    int    r;
+    int    c;
+
+    row_begin = sim->regs[FPS_REG_IMG_ROW_BEGIN];
+    col_begin = sim->regs[FPS_REG_IMG_COL_BEGIN];
+
+    // Latency dummy pixels first, like the SPI readout
+    memset(img_buf, 0x00, handle->latency);
+    img_buf += handle->latency;
+
+    for (r = 0; r < img_height; r++) {
+    for (c = 0; c < img_width;  c++) {
+        level_mv = fps_sim_pixel_mv(sim, row_begin + r, col_begin + c) +
+                   (sim->config.noise_mv * fps_sim_gauss(sim));
+        code     = fps_sim_to_code(sim, FPS_IMAGE_MODE, level_mv);
+
+        img_buf[r * img_width + c] = (uint8_t) (code + 0.5);
+    }}
+
+    return 0;
+}
+
+static int
+fps_sim_wait_event(fps_handle_t *handle,
+                   double       sleep_us)
+{
+    fps_sim_t *sim = FPS_SIM(handle);
+
+    double now_us;
+    double deadline_us;
+    double cycle_us;
+    int    detect;
+
+    now_us      = fps_get_clock_time_us(handle);
+    deadline_us = now_us + sleep_us;
+    detect      = ((sim->regs[FPS_REG_GBL_CTL] & FPS_ENABLE_DETECT) != 0);
+    cycle_us    = fps_sim_scan_cycle_us(sim);
+
+    // Scans which ran while nobody was waiting
+    if (fps_sim_catch_up(sim, now_us) == TRUE) {
+        return 1;
+    }
+
+    // Then the scans up to the deadline, in real time
+    while ((detect == TRUE) && ((sleep_us < 0) || (sim->next_scan_us <= deadline_us))) {
+        fps_clock_sleep_until(handle, sim->next_scan_us);
+
+        fps_sim_detect_scan(sim);
+        sim->next_scan_us += cycle_us;
+
+        if (FPS_SIM_INTERRUPT(sim)) {
+            return 1;
+        }
+    }
+
+    if (sleep_us < 0) {
+        // Nothing will ever come
+        return -1;
+    }
+
+    fps_clock_sleep_until(handle, deadline_us);
+    fps_record_wait_overshoot(handle, fps_get_clock_time_us(handle) - deadline_us);
+
+    return 0;
+}
+
+fps_backend_t fps_sim_backend = {
+    "simulator",
+    fps_sim_close,
+    fps_sim_reset_sensor,
+    fps_sim_set_sensor_speed,
+    fps_sim_get_chip_id,
+    fps_sim_multiple_read,
+    fps_sim_multiple_write,
+    fps_sim_get_raw_image,
+    fps_sim_wait_event,
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Simulator Open/Control
+//
+
+void
+fps_sim_default_config(fps_sim_config_t *config)
+{
+    config->seed            = FPS_SIM_DEFAULT_SEED;
+    config->signal_mv       = FPS_SIM_DEFAULT_SIGNAL;
+    config->fpn_mv          = FPS_SIM_DEFAULT_FPN;
+    config->noise_mv        = FPS_SIM_DEFAULT_NOISE;
+    config->finger_mv       = FPS_SIM_DEFAULT_FINGER;
+    config->osc_period_us   = FPS_SIM_DEFAULT_OSC;
+    config->detect_noise_mv = FPS_SIM_DEFAULT_DET_NOISE;
+}
+
+fps_handle_t*
+fps_open_simulator(fps_sim_config_t *config)
+{
+    fps_sim_t    *sim;
+    fps_handle_t *handle;
+    int          i;
+
+    sim = (fps_sim_t *) malloc(sizeof(fps_sim_t));
+    if (sim == NULL) {
+        LOG_ERROR("malloc() failed!\n");
+        return NULL;
+    }
+
+    memset(sim, 0x00, sizeof(fps_sim_t));
+
+    if (config != NULL) {
+        sim->config = *config;
+    } else {
+        fps_sim_default_config(&sim->config);
+    }
+
+    if (sim->config.osc_period_us <= 0.0) {
+        sim->config.osc_period_us = FPS_SIM_DEFAULT_OSC;
+    }
+
+    // xorshift32 is stuck at zero
+    sim->rng_state = (sim->config.seed != 0) ? sim->config.seed : FPS_SIM_DEFAULT_SEED;
+
+    for (i = 0; i < FPS_SENSOR_SIZE; i++) {
+        sim->fpn[i] = sim->config.fpn_mv * fps_sim_gauss(sim);
+    }
+
+    fps_sim_reset_registers(sim);
+
+    handle = fps_attach_backend(-1, &fps_sim_backend, sim);
+    if (handle == NULL) {
+        free(sim);
+        return NULL;
+    }
+
+    (void) fps_set_clock(handle, &fps_virtual_clock);
+
+    return handle;
+}
+
+int
+fps_sim_set_finger(fps_handle_t *handle,
+                   int          present)
+{
+    if (handle->backend != &fps_sim_backend) {
+        return -1;
+    }
+
+    FPS_SIM(handle)->finger = (present != FALSE);
+
+    return 0;
+}
+
+int
+fps_sim_run_scans(fps_handle_t *handle,
+                  double       *next_scan_us)
+{
+    fps_sim_t *sim;
+    int       level;
+
+    if (handle->backend != &fps_sim_backend) {
+        return -1;
+    }
+
+    sim   = FPS_SIM(handle);
+    level = fps_sim_catch_up(sim, fps_get_clock_time_us(handle));
+
+    if (next_scan_us != NULL) {
+        if ((sim->regs[FPS_REG_GBL_CTL] & FPS_ENABLE_DETECT) != 0) {
+            *next_scan_us = sim->next_scan_us;
+        } else {
+            *next_scan_us = -1.0;
+        }
+    }
+
+    return level;
+}
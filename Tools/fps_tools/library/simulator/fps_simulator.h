@@ -0,0 +1,66 @@
+#ifndef __fps_simulator_h__
+#define __fps_simulator_h__
+
+
+#include "common.h"
+#include "fps.h"
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Simulated Sensor
+// -----------------------------------------------------------------------------
+// NOTE: An in-process F747B behind the backend vtable, so that calibration can
+//       be run and profiled without hardware. It models:
+//         - the register file, with the chip ID and reset defaults
+//         - image frames of signal + fixed pattern + finger + temporal noise,
+//           less the CDS offset, amplified by PGA0 x PGA1 and quantized to an
+//           8-bit ADC code over 3.3V
+//         - detect scans every det_size x (1 + suspend frames) x 8 oscillator
+//           cycles, each firing when the detect window level (ADC code / 4)
+//           exceeds V_DET_SEL
+//
+//       Scans are scheduled on the clock of the handle, which is the virtual
+//       one, so that detect waits and delays only advance the sensor time.
+//       Bind fps_monotonic_clock for waits as long as on the real sensor.
+//       Register access and frames take no time.
+//
+
+#define FPS_SIM_DEFAULT_SEED      (0x0747B5EDu)
+#define FPS_SIM_DEFAULT_SIGNAL    (500.0)  // mV
+#define FPS_SIM_DEFAULT_FPN       (8.0)    // mV, 1 sigma
+#define FPS_SIM_DEFAULT_NOISE     (1.0)    // mV, 1 sigma
+#define FPS_SIM_DEFAULT_FINGER    (150.0)  // mV
+#define FPS_SIM_DEFAULT_OSC       (2.3)    // us
+#define FPS_SIM_DEFAULT_DET_NOISE (2.0)    // mV, 1 sigma
+
+// Scans a single wait catches up on before skipping ahead
+#define FPS_SIM_MAX_CATCHUP       (256)
+
+extern fps_backend_t fps_sim_backend;
+
+void fps_sim_default_config(fps_sim_config_t *config);
+
+fps_handle_t* fps_open_simulator(fps_sim_config_t *config);
+
+int fps_sim_set_finger(fps_handle_t *handle,
+                       int          present);
+
+// Run the detect scans due by now, for callers that model the interrupt pin
+// themselves instead of waiting with fps_wait_event(). Returns the pin level
+// and the time of the next scan, or -1 while detection is off.
+int fps_sim_run_scans(fps_handle_t *handle,
+                      double       *next_scan_us);
+
+
+#if defined(__cplusplus)
+}
+#endif
+
+
+#endif // __fps_simulator_h__
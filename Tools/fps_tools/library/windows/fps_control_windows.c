@@ -103,22 +103,15 @@ fps_open_sensor(char *file)
     return fps_attach_sensor((int) board);
 }
 
-int
-fps_close_sensor(fps_handle_t **handle)
+static void
+fps_windows_close(fps_handle_t *handle)
 {
-	int status = 0;
-
-	if (*handle != NULL) {
-		board_close((board_t *) &((*handle)->fd));
-		status = fps_detach_sensor(handle);
-	}
-
-	return status;
+    board_close((board_t *) &handle->fd);
 }
 
-int
-fps_reset_sensor(fps_handle_t *handle,
-                 int          state)
+static int
+fps_windows_reset_sensor(fps_handle_t *handle,
+                         int          state)
 {
     int status = 0;
 
@@ -135,9 +128,9 @@ fps_reset_sensor(fps_handle_t *handle,
 // Chip ID
 //
 
-int
-fps_get_chip_id(fps_handle_t *handle,
-				int          *chip_id)
+static int
+fps_windows_get_chip_id(fps_handle_t *handle,
+        				int          *chip_id)
 {
 	if (chip_id == NULL) {
 		return -1;
@@ -152,9 +145,9 @@ fps_get_chip_id(fps_handle_t *handle,
 // Set Sensor Speed
 //
 
-int
-fps_set_sensor_speed(fps_handle_t *handle,
-                     int          speed_hz)
+static int
+fps_windows_set_sensor_speed(fps_handle_t *handle,
+                             int          speed_hz)
 {
     int status = 0;
     int mode;
@@ -186,11 +179,11 @@ fps_set_sensor_speed(fps_handle_t *handle,
 // Register Access
 //
 
-int
-fps_multiple_read(fps_handle_t *handle,
-                  uint8_t      *addr,
-                  uint8_t      *data,
-                  size_t       length)
+static int
+fps_windows_multiple_read(fps_handle_t *handle,
+                          uint8_t      *addr,
+                          uint8_t      *data,
+                          size_t       length)
 {
     int     status = 0;
     uint8_t *cmd_buf;
@@ -203,7 +196,7 @@ fps_multiple_read(fps_handle_t *handle,
 
     cmd_buf = (uint8_t *) malloc(sizeof(uint8_t) * (length + 3));
     if (cmd_buf == NULL) {
-        goto fps_multiple_read_end;
+        goto fps_windows_multiple_read_end;
     }
 
     cmd_buf[0] = CMD_READ_REG;
@@ -216,28 +209,28 @@ fps_multiple_read(fps_handle_t *handle,
 
     status = board_transmit_command(BOARD_HANDLE, (length + 3), cmd_buf);
     if (status < 0) {
-        goto fps_multiple_read_end;
+        goto fps_windows_multiple_read_end;
     }
 
     rsp_buf = (uint8_t *) malloc(sizeof(uint8_t) * (length + 1));
     if (rsp_buf == NULL) {
-        goto fps_multiple_read_end;
+        goto fps_windows_multiple_read_end;
     }
 
     status = board_receive_response(BOARD_HANDLE, (length + 1), rsp_buf);
     if (status < 0) {
-        goto fps_multiple_read_end;
+        goto fps_windows_multiple_read_end;
     }
 
     if (rsp_buf[0] != RSP_SUCCESS) {
-        goto fps_multiple_read_end;
+        goto fps_windows_multiple_read_end;
     }
 
     for (i = 0; i < length; i++) {
         data[i] = (uint8_t) rsp_buf[i + 1];
     }
 
-fps_multiple_read_end :
+fps_windows_multiple_read_end :
 
     if (cmd_buf != NULL) {
         free(cmd_buf);
@@ -250,11 +243,11 @@ fps_multiple_read_end :
     return status;
 }
 
-int
-fps_multiple_write(fps_handle_t *handle,
-                   uint8_t      *addr,
-                   uint8_t      *data,
-                   size_t       length)
+static int
+fps_windows_multiple_write(fps_handle_t *handle,
+                           uint8_t      *addr,
+                           uint8_t      *data,
+                           size_t       length)
 {
     int     status = 0;
     uint8_t *cmd_buf;
@@ -267,7 +260,7 @@ fps_multiple_write(fps_handle_t *handle,
 
     cmd_buf = (uint8_t *) malloc(sizeof(uint8_t) * ((length + 1) * 2 + 3));
     if (cmd_buf == NULL) {
-        goto fps_multiple_write_end;
+        goto fps_windows_multiple_write_end;
     }
 
     cmd_buf[0] = CMD_WRITE_REG;
@@ -283,19 +276,19 @@ fps_multiple_write(fps_handle_t *handle,
 	
     status = board_transmit_command(BOARD_HANDLE, ((length + 1) * 2 + 3), cmd_buf);
     if (status < 0) {
-        goto fps_multiple_write_end;
+        goto fps_windows_multiple_write_end;
     }
 
     status = board_receive_response(BOARD_HANDLE, 1, &rsp);
     if (status < 0) {
-        goto fps_multiple_write_end;
+        goto fps_windows_multiple_write_end;
     }
 
     if (rsp != RSP_SUCCESS) {
-        goto fps_multiple_write_end;
+        goto fps_windows_multiple_write_end;
     }
 
-fps_multiple_write_end :
+fps_windows_multiple_write_end :
 
     if (cmd_buf != NULL) {
         free(cmd_buf);
@@ -310,11 +303,11 @@ fps_multiple_write_end :
 // Image Mode Operations
 //
 
-int
-fps_get_raw_image(fps_handle_t *handle,
-                  int          img_width,
-                  int          img_height,
-                  uint8_t      *img_buf)
+static int
+fps_windows_get_raw_image(fps_handle_t *handle,
+                          int          img_width,
+                          int          img_height,
+                          uint8_t      *img_buf)
 {
     int     status = 0;
 	size_t  img_size;
@@ -346,18 +339,18 @@ fps_get_raw_image(fps_handle_t *handle,
 
     status = board_receive_response(BOARD_HANDLE, (length + 1), rsp_buf);
     if (status < 0) {
-        goto fps_get_raw_image_end;
+        goto fps_windows_get_raw_image_end;
     }
 
     if (rsp_buf[0] != RSP_SUCCESS) {
-        goto fps_get_raw_image_end;
+        goto fps_windows_get_raw_image_end;
     }
 
     for (i = 0; i < img_size; i++) {
         img_buf[i] = rsp_buf[i + 1];
     }
 
-fps_get_raw_image_end:
+fps_windows_get_raw_image_end:
 
     if (rsp_buf != NULL) {
         free(rsp_buf);
@@ -372,14 +365,22 @@ fps_get_raw_image_end:
 // Helpers
 //
 
-int
-fps_wait_event(fps_handle_t *handle,
-               double       sleep_us)
+static int
+fps_windows_wait_event(fps_handle_t *handle,
+                       double       sleep_us)
 {
-    int status = 0;
-    int events = 0;
+    int    status = 0;
+    int    events = 0;
+    double deadline_us;
 
-    fps_sleep(sleep_us);
+    // Nothing to wait on here, so always wait until the deadline
+    deadline_us = fps_get_time_us() + sleep_us;
+
+    fps_sleep_until(deadline_us);
+
+    if (sleep_us >= 0) {
+        fps_record_wait_overshoot(handle, fps_get_time_us() - deadline_us);
+    }
 
     status = fps_check_interrupt(handle, FPS_ALL_EVENTS);
     if (status < 0) {
@@ -409,3 +410,76 @@ fps_sleep(double sleep_us)
         QueryPerformanceCounter((LARGE_INTEGER *) &elapsed_time);
     }
 }
+
+void
+fps_sleep_until(double deadline_us)
+{
+    while (fps_get_time_us() < deadline_us) {
+        // Busy wait like fps_sleep()
+    }
+}
+
+double
+fps_get_time_us(void)
+{
+    __int64 now;
+    __int64 freq;
+
+    QueryPerformanceFrequency((LARGE_INTEGER *) &freq);
+    QueryPerformanceCounter((LARGE_INTEGER *) &now);
+
+    return ((double) now) * ((double) 1000000.0f) / ((double) freq);
+}
+
+// NOTE: The performance counter is not slewed, unlike the system time
+double
+fps_get_raw_time_ns(void)
+{
+    __int64 now;
+    __int64 freq;
+
+    QueryPerformanceFrequency((LARGE_INTEGER *) &freq);
+    QueryPerformanceCounter((LARGE_INTEGER *) &now);
+
+    return ((double) now) * 1000000000.0 / ((double) freq);
+}
+
+// NOTE: fps_sleep() busy waits, so its delays count as CPU time here
+double
+fps_get_cpu_time_us(void)
+{
+    FILETIME creation_time;
+    FILETIME exit_time;
+    FILETIME kernel_time;
+    FILETIME user_time;
+    __int64  ticks;
+
+    if (GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time,
+                        &kernel_time, &user_time) == 0) {
+        return 0.0;
+    }
+
+    // 100 ns ticks
+    ticks = (((__int64) kernel_time.dwHighDateTime) << 32) + kernel_time.dwLowDateTime +
+            (((__int64) user_time.dwHighDateTime)   << 32) + user_time.dwLowDateTime;
+
+    return ((double) ticks) / 10.0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Native Backend
+//
+
+fps_backend_t fps_native_backend = {
+    "windows",
+    fps_windows_close,
+    fps_windows_reset_sensor,
+    fps_windows_set_sensor_speed,
+    fps_windows_get_chip_id,
+    fps_windows_multiple_read,
+    fps_windows_multiple_write,
+    fps_windows_get_raw_image,
+    fps_windows_wait_event,
+};